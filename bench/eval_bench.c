@@ -0,0 +1,361 @@
+/* Measures every stage of evaluating an expression, from splitting a command
+ * into words to the CLI's batch mode, on short, long, deeply nested and
+ * function-heavy expressions.
+ *
+ * Every benchmark is warmed up while finding how many operations take at least
+ * `MIN_RUN_SECONDS`, and then timed `NUM_RUNS` times. The results are written
+ * as JSON to the file given as the first argument (or to standard output), so
+ * runs of different versions can be compared. */
+#define _POSIX_C_SOURCE 200809L
+#include "../libs/arachne-strlib/arachne_strlib.h"
+#include "../src/cli/cli.h"
+#include "../src/mcalc4/mcalc4.h"
+#include "../src/mcalc4/mcalc4_jit.h"
+#include "../src/mcalc4/mcalc4_vm.h"
+#include "../src/mcalc4/mcalc4_types.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_RUNS 7
+#define MIN_RUN_SECONDS 0.02
+#define LONG_SIZE (1 << 12)
+#define NESTED_DEPTH 256
+#define NUM_BATCH_LINES 10000
+#define MAX_RESULTS 32
+
+/* Written to so the compiler can't drop the work being measured. */
+static volatile double sink;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+struct Input {
+    const char* name;
+    char* equ;
+    size_t len;
+};
+
+struct BenchResult {
+    const char* name;
+    const char* input;
+    size_t bytes;
+    size_t ops_per_run;
+    double best_ns;
+    double median_ns;
+};
+
+struct Bench {
+    const struct Input* input;
+    struct MC4_VariableSet* vars;
+    struct MC4_Settings* settings;
+    struct TokensList tokens;
+    struct MC4_Compiled* compiled;
+    struct MC4_Bytecode* bytecode;
+    struct MC4_Jit* jit;
+    const char* batch_path;
+};
+
+/* Runs `num_calls` calls of a benchmark. */
+typedef void (*BenchFn)(struct Bench* bench, size_t num_calls);
+
+static char* new_string(size_t len) {
+    char* str = malloc(len + 1);
+    if (str == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return str;
+}
+
+static char* copy_string(const char* str) {
+    return strcpy(new_string(strlen(str)), str);
+}
+
+static struct Input make_input(const char* name, char* equ) {
+    return (struct Input){.name = name, .equ = equ, .len = strlen(equ)};
+}
+
+/**
+ * Returns `chunk` repeated until the expression is about `size` characters
+ * long, followed by `last`.
+ */
+static char* build_long(const char* chunk, const char* last, size_t size) {
+    const size_t chunk_len = strlen(chunk);
+    const size_t num_chunks = (size / chunk_len) + 1;
+    char* equ = new_string((num_chunks * chunk_len) + strlen(last));
+    size_t len = 0;
+    for (size_t i = 0; i < num_chunks; i++) {
+        memcpy(&equ[len], chunk, chunk_len);
+        len += chunk_len;
+    }
+    strcpy(&equ[len], last);
+    return equ;
+}
+
+/**
+ * Returns `(1+(1+(...(1+x)...)))` with `depth` parentheses.
+ */
+static char* build_nested(unsigned int depth) {
+    char* equ = new_string((depth * 4) + 1);
+    size_t len = 0;
+    for (unsigned int i = 0; i < depth; i++) {
+        memcpy(&equ[len], "(1+", 3);
+        len += 3;
+    }
+    equ[len++] = 'x';
+    memset(&equ[len], ')', depth);
+    equ[len + depth] = '\0';
+    return equ;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    const double lhs = *(const double*)a, rhs = *(const double*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/**
+ * Times `fn`, where every call does `ops_per_call` operations.
+ */
+static struct BenchResult measure(const char* name, BenchFn fn,
+                                  struct Bench* bench, size_t ops_per_call) {
+    /* Doubling the number of calls until a run is long enough doubles as the
+    warmup. */
+    size_t num_calls = 1;
+    while (true) {
+        const double start = now_seconds();
+        fn(bench, num_calls);
+        if ((now_seconds() - start) >= MIN_RUN_SECONDS) break;
+        num_calls *= 2;
+    }
+
+    double ns_per_op[NUM_RUNS];
+    const size_t num_ops = num_calls * ops_per_call;
+    for (int run = 0; run < NUM_RUNS; run++) {
+        const double start = now_seconds();
+        fn(bench, num_calls);
+        ns_per_op[run] = ((now_seconds() - start) * 1e9) / num_ops;
+    }
+    qsort(ns_per_op, NUM_RUNS, sizeof(double), compare_doubles);
+    return (struct BenchResult){
+        .name = name,
+        .input = bench->input->name,
+        .bytes = bench->input->len,
+        .ops_per_run = num_ops,
+        .best_ns = ns_per_op[0],
+        .median_ns = ns_per_op[NUM_RUNS / 2],
+    };
+}
+
+static void bench_tokenize(struct Bench* bench, size_t num_calls) {
+    for (size_t i = 0; i < num_calls; i++) {
+        MC4_ErrorCode err = MC4_ERR_NONE;
+        struct TokensList tokens =
+            tokenize_n(bench->input->equ, bench->input->len, &err);
+        sink = tokens.len;
+    }
+}
+
+static void bench_parse_tokens(struct Bench* bench, size_t num_calls) {
+    for (size_t i = 0; i < num_calls; i++) {
+        MC4_ErrorCode err = MC4_ERR_NONE;
+        unsigned int err_pos;
+        sink = parse_tokens(&bench->tokens, bench->input->equ, bench->vars,
+                            &err, &err_pos, bench->settings->angle_mode);
+    }
+}
+
+static void bench_evaluate(struct Bench* bench, size_t num_calls) {
+    for (size_t i = 0; i < num_calls; i++) {
+        sink = MC4_evaluate_n(bench->input->equ, bench->input->len,
+                              bench->vars, bench->settings)
+                   .value;
+    }
+}
+
+static void bench_eval_compiled(struct Bench* bench, size_t num_calls) {
+    for (size_t i = 0; i < num_calls; i++) {
+        MC4_ErrorCode err;
+        sink = MC4_eval_compiled(bench->compiled, bench->vars, &err);
+    }
+}
+
+static void bench_bytecode(struct Bench* bench, size_t num_calls) {
+    for (size_t i = 0; i < num_calls; i++) {
+        MC4_ErrorCode err;
+        sink = MC4_bytecode_eval(bench->bytecode, bench->vars, &err);
+    }
+}
+
+static void bench_jit(struct Bench* bench, size_t num_calls) {
+    for (size_t i = 0; i < num_calls; i++) {
+        MC4_ErrorCode err;
+        sink = MC4_jit_eval(bench->jit, bench->vars, &err);
+    }
+}
+
+static void bench_read_words(struct Bench* bench, size_t num_calls) {
+    for (size_t i = 0; i < num_calls; i++) {
+        struct ArachneString astr = arachne_new_str(bench->input->equ);
+        size_t num_words = 0;
+        while (arachne_read_word(&astr) != NULL) num_words++;
+        arachne_free(&astr);
+        sink = num_words;
+    }
+}
+
+static void bench_batch(struct Bench* bench, size_t num_calls) {
+    /* Batch mode writes its results to standard output. */
+    fflush(stdout);
+    const int saved_stdout = dup(STDOUT_FILENO);
+    const int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    close(null_fd);
+    for (size_t i = 0; i < num_calls; i++) {
+        sink = start_batch(bench->batch_path);
+    }
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+}
+
+/**
+ * Writes `NUM_BATCH_LINES` lines cycling through `inputs` (and a `let` which
+ * changes `x`) to a temporary file, returning its path.
+ */
+static char* write_batch_file(const struct Input inputs[], size_t num_inputs) {
+    char* path = copy_string("/tmp/mcalc4-bench-XXXXXX");
+    const int fd = mkstemp(path);
+    FILE* file = (fd >= 0) ? fdopen(fd, "w") : NULL;
+    if (file == NULL) {
+        fprintf(stderr, "can't create %s\n", path);
+        exit(1);
+    }
+    fprintf(file, "let x = 0.5\nlet y = 2\n");
+    for (size_t i = 2; i < NUM_BATCH_LINES; i++) {
+        if ((i % 16) == 0) {
+            fprintf(file, "let x = %zu\n", i);
+        } else {
+            fprintf(file, "%s\n", inputs[i % num_inputs].equ);
+        }
+    }
+    fclose(file);
+    return path;
+}
+
+static void write_json(FILE* out, const struct BenchResult results[],
+                       size_t num_results) {
+    fprintf(out, "{\n  \"runs\": %d,\n  \"results\": [\n", NUM_RUNS);
+    for (size_t i = 0; i < num_results; i++) {
+        const struct BenchResult* result = &results[i];
+        fprintf(out,
+                "    {\"name\": \"%s\", \"input\": \"%s\", \"bytes\": %zu, "
+                "\"ops_per_run\": %zu, \"ns_per_op\": %.2f, "
+                "\"median_ns_per_op\": %.2f, \"ops_per_sec\": %.0f}%s\n",
+                result->name, result->input, result->bytes,
+                result->ops_per_run, result->best_ns, result->median_ns,
+                1e9 / result->best_ns, (i + 1 < num_results) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static void print_table(const struct BenchResult results[],
+                        size_t num_results) {
+    printf("%-14s %-10s %12s %12s %14s\n", "benchmark", "input", "ns/op",
+           "median", "ops/s");
+    for (size_t i = 0; i < num_results; i++) {
+        printf("%-14s %-10s %12.1f %12.1f %14.0f\n", results[i].name,
+               results[i].input, results[i].best_ns, results[i].median_ns,
+               1e9 / results[i].best_ns);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const struct Input inputs[] = {
+        make_input("short", copy_string("2*x + 1")),
+        make_input("long", build_long("x*1.5 + y/2 - 3.25 + ", "1", LONG_SIZE)),
+        make_input("nested", build_nested(NESTED_DEPTH)),
+        make_input("functions",
+                   build_long("sin(cos(tan(x))) + sqrt(ln(y) + log(10*y)) - "
+                              "arcsin(x)*arccos(x) + arctan(y)^2 + ",
+                              "1", 512)),
+    };
+    const size_t num_inputs = sizeof(inputs) / sizeof(inputs[0]);
+
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "x", 0.5);
+    set_var(&vars, "y", 2);
+    struct MC4_Settings settings = settings_default();
+    struct Bench bench = {.vars = &vars, .settings = &settings};
+    struct BenchResult results[MAX_RESULTS];
+    size_t num_results = 0;
+
+    for (size_t i = 0; i < num_inputs; i++) {
+        bench.input = &inputs[i];
+        MC4_ErrorCode err = MC4_ERR_NONE;
+        struct MC4_Result check =
+            MC4_evaluate_n(inputs[i].equ, inputs[i].len, &vars, &settings);
+        if (check.err_code != MC4_ERR_NONE) {
+            fprintf(stderr, "%s input doesn't evaluate\n", inputs[i].name);
+            return 1;
+        }
+        results[num_results++] = measure("tokenize", bench_tokenize, &bench, 1);
+        bench.tokens = tokenize_n(inputs[i].equ, inputs[i].len, &err);
+        results[num_results++] =
+            measure("parse_tokens", bench_parse_tokens, &bench, 1);
+        results[num_results++] =
+            measure("evaluate", bench_evaluate, &bench, 1);
+        bench.compiled = MC4_compile(inputs[i].equ, &vars, &settings, &err);
+        bench.bytecode = MC4_bytecode_compile(bench.compiled);
+        bench.jit = MC4_jit_compile(bench.compiled);
+        results[num_results++] =
+            measure("eval_compiled", bench_eval_compiled, &bench, 1);
+        results[num_results++] =
+            measure("bytecode", bench_bytecode, &bench, 1);
+        results[num_results++] = measure("jit", bench_jit, &bench, 1);
+        MC4_jit_free(bench.jit);
+        MC4_bytecode_free(bench.bytecode);
+        MC4_free_compiled(bench.compiled);
+    }
+
+    const struct Input command = make_input(
+        "command", copy_string("let inlet_temp_2 := 2 * x + sqrt(y) - 1"));
+    bench.input = &command;
+    results[num_results++] =
+        measure("read_word", bench_read_words, &bench, 1);
+
+    char* batch_path = write_batch_file(inputs, num_inputs);
+    FILE* batch_file = fopen(batch_path, "rb");
+    fseek(batch_file, 0, SEEK_END);
+    const struct Input batch = {.name = "batch", .len = ftell(batch_file)};
+    fclose(batch_file);
+    bench.input = &batch;
+    bench.batch_path = batch_path;
+    results[num_results++] =
+        measure("cli_batch", bench_batch, &bench, NUM_BATCH_LINES);
+    remove(batch_path);
+
+    if (argc > 1) {
+        FILE* out = fopen(argv[1], "w");
+        if (out == NULL) {
+            fprintf(stderr, "can't write %s\n", argv[1]);
+            return 1;
+        }
+        write_json(out, results, num_results);
+        fclose(out);
+        print_table(results, num_results);
+    } else {
+        write_json(stdout, results, num_results);
+    }
+
+    free(batch_path);
+    free(command.equ);
+    for (size_t i = 0; i < num_inputs; i++) free(inputs[i].equ);
+    free_varset(&vars);
+}
@@ -0,0 +1,81 @@
+/* Compares `MC4_format()` with `snprintf("%.17g")` on a mix of doubles. */
+#define _POSIX_C_SOURCE 200809L
+#include "../src/mcalc4/mcalc4_format.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_VALUES 1000000
+#define NUM_RUNS 5
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15u;
+
+static uint64_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/**
+ * Returns a random result: small integers, short decimals, full precision
+ * fractions and large magnitudes, in equal parts.
+ */
+static double random_value(void) {
+    const double value = (next_random() >> 11) * 0x1p-53;
+    switch (next_random() % 4) {
+    case 0: return (double)(next_random() % 100000);
+    case 1: return (double)(next_random() % 100000) / 1000;
+    case 2: return value;
+    default: return (value * 1e30) / (1 + (next_random() % 1000));
+    }
+}
+
+int main(void) {
+    double* values = malloc(NUM_VALUES * sizeof(double));
+    if (values == NULL) return 1;
+    for (int i = 0; i < NUM_VALUES; i++) values[i] = random_value();
+
+    static const char* const MODE_NAMES[] = {"normal", "scientific",
+                                             "engineering"};
+    double best[3] = {1e300, 1e300, 1e300};
+    double best_printf = 1e300;
+    size_t total_len = 0;
+    char buffer[MC4_FORMAT_BUFFER_SIZE];
+    for (int run = 0; run < NUM_RUNS; run++) {
+        for (int mode = 0; mode < 3; mode++) {
+            const double start = now_seconds();
+            total_len = 0;
+            for (int i = 0; i < NUM_VALUES; i++) {
+                total_len += MC4_format(values[i], mode, buffer);
+            }
+            const double elapsed = now_seconds() - start;
+            if (elapsed < best[mode]) best[mode] = elapsed;
+        }
+
+        const double start = now_seconds();
+        for (int i = 0; i < NUM_VALUES; i++) {
+            total_len += snprintf(buffer, sizeof(buffer), "%.17g", values[i]);
+        }
+        const double elapsed = now_seconds() - start;
+        if (elapsed < best_printf) best_printf = elapsed;
+    }
+    if (total_len == 0) return 1;
+
+    printf("%-20s %10s\n", "formatter", "ns/number");
+    for (int mode = 0; mode < 3; mode++) {
+        printf("MC4_format %-9s %10.1f\n", MODE_NAMES[mode],
+               (best[mode] * 1e9) / NUM_VALUES);
+    }
+    printf("%-20s %10.1f\n", "snprintf %.17g",
+           (best_printf * 1e9) / NUM_VALUES);
+    free(values);
+}
@@ -0,0 +1,65 @@
+/* Measures how tokenizing time grows with expression length. A linear lexer
+ * shows a flat ns/byte column from 1 KB up to 1 MB. */
+#define _POSIX_C_SOURCE 200809L
+#include "../src/mcalc4/mcalc4.h"
+#include "../src/mcalc4/mcalc4_types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MIN_SIZE (1 << 10)
+#define MAX_SIZE (1 << 20)
+#define NUM_RUNS 5
+
+/* Mixes every kind of token, including keywords, near misses of keywords
+(`arcs` + `x`) and constants. */
+static const char CHUNK[] =
+    "sin(x)*2.5 + arctan(y)^2 - pi/ln(3) + arcsx*sqrt(e) - log(10.125) + ";
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+/**
+ * Fills `equ` with `size` characters of repeated `CHUNK`s, ending in a number
+ * so the expression stays valid.
+ */
+static void build_expression(char* equ, size_t size) {
+    const size_t chunk_len = strlen(CHUNK);
+    size_t len = 0;
+    while ((len + chunk_len + 1) <= size) {
+        memcpy(&equ[len], CHUNK, chunk_len);
+        len += chunk_len;
+    }
+    memset(&equ[len], '1', size - len);
+}
+
+int main(void) {
+    char* equ = malloc(MAX_SIZE);
+    if (equ == NULL) return 1;
+
+    printf("%10s %12s %10s %10s\n", "bytes", "tokens", "ns/byte", "MB/s");
+    for (size_t size = MIN_SIZE; size <= MAX_SIZE; size *= 4) {
+        build_expression(equ, size);
+        double best = 1e300;
+        unsigned int num_tokens = 0;
+        for (int run = 0; run < NUM_RUNS; run++) {
+            MC4_ErrorCode err = MC4_ERR_NONE;
+            const double start = now_seconds();
+            struct TokensList tokens = tokenize_n(equ, size, &err);
+            const double elapsed = now_seconds() - start;
+            if (err != MC4_ERR_NONE) {
+                fprintf(stderr, "tokenizing failed\n");
+                return 1;
+            }
+            num_tokens = tokens.len;
+            if (elapsed < best) best = elapsed;
+        }
+        printf("%10zu %12u %10.2f %10.1f\n", size, num_tokens,
+               (best * 1e9) / size, (size / best) / 1e6);
+    }
+    free(equ);
+}
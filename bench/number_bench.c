@@ -0,0 +1,91 @@
+/* Compares `parse_number()` with `strtod()` on a mix of number literals. */
+#define _POSIX_C_SOURCE 200809L
+#include "../src/mcalc4/mcalc4_number.h"
+#include "../src/mcalc4/mcalc4_types.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_LITERALS 1000000
+#define NUM_RUNS 5
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15u;
+
+static uint64_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/**
+ * Writes a random literal to `out`: short integers, short decimals, full
+ * precision decimals and exponent notation, in equal parts.
+ */
+static int write_literal(char* out) {
+    const double value = (next_random() >> 11) * 0x1p-53;
+    switch (next_random() % 4) {
+    case 0: return sprintf(out, "%u", (unsigned int)(next_random() % 100000));
+    case 1: return sprintf(out, "%.3f", value * 1000);
+    case 2: return sprintf(out, "%.17g", value);
+    default:
+        return sprintf(out, "%.6e",
+                       (value * 1e30) / (1 + (next_random() % 1000)));
+    }
+}
+
+int main(void) {
+    char* text = malloc((size_t)NUM_LITERALS * 32);
+    size_t* starts = malloc(NUM_LITERALS * sizeof(size_t));
+    if ((text == NULL) || (starts == NULL)) return 1;
+    size_t len = 0;
+    for (int i = 0; i < NUM_LITERALS; i++) {
+        starts[i] = len;
+        len += write_literal(&text[len]);
+        text[len++] = ' ';
+    }
+    text[len] = '\0';
+
+    double best_fast = 1e300, best_strtod = 1e300;
+    double sum_fast = 0, sum_strtod = 0;
+    for (int run = 0; run < NUM_RUNS; run++) {
+        double start = now_seconds();
+        sum_fast = 0;
+        for (int i = 0; i < NUM_LITERALS; i++) {
+            double value;
+            MC4_ErrorCode err = MC4_ERR_NONE;
+            parse_number(&text[starts[i]], len - starts[i], &value, &err);
+            sum_fast += value;
+        }
+        double elapsed = now_seconds() - start;
+        if (elapsed < best_fast) best_fast = elapsed;
+
+        start = now_seconds();
+        sum_strtod = 0;
+        for (int i = 0; i < NUM_LITERALS; i++) {
+            sum_strtod += strtod(&text[starts[i]], NULL);
+        }
+        elapsed = now_seconds() - start;
+        if (elapsed < best_strtod) best_strtod = elapsed;
+    }
+    if (sum_fast != sum_strtod) {
+        fprintf(stderr, "parse_number() and strtod() disagree\n");
+        return 1;
+    }
+
+    printf("%-14s %10s %10s\n", "parser", "ns/number", "MB/s");
+    printf("%-14s %10.1f %10.1f\n", "parse_number",
+           (best_fast * 1e9) / NUM_LITERALS, (len / best_fast) / 1e6);
+    printf("%-14s %10.1f %10.1f\n", "strtod",
+           (best_strtod * 1e9) / NUM_LITERALS, (len / best_strtod) / 1e6);
+    free(starts);
+    free(text);
+}
@@ -1,5 +1,6 @@
 #include "arachne_strlib.h"
 #include <ctype.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -63,9 +64,14 @@ static size_t get_true_pos(struct ArachneString* astr) {
     return (astr->start + astr->len);
 }
 
+/* Number of buffers allocated by every Arachne String so far. Strings may be
+used on several threads, so it is a relaxed atomic. */
+static _Atomic size_t num_allocations = 0;
+
 extern const char* arachne_get_range(struct ArachneString* astr) {
     if (astr->buf != NULL) free(astr->buf);
     astr->buf = calloc(astr->len + 1, sizeof(char));
+    atomic_fetch_add_explicit(&num_allocations, 1, memory_order_relaxed);
     memcpy(astr->buf, &astr->src[astr->start], astr->len);
     return astr->buf;
 }
@@ -125,3 +131,7 @@ extern const char* arachne_read_rest(struct ArachneString* astr) {
     astr->start += astr->len;
     return ret;
 }
+
+extern size_t arachne_num_allocations(void) {
+    return atomic_load_explicit(&num_allocations, memory_order_relaxed);
+}
@@ -75,4 +75,10 @@ extern const char* arachne_read_word_wd(struct ArachneString* astr, char delimit
  */
 extern const char* arachne_read_rest(struct ArachneString* astr);
 
+/**
+ * Returns how many times Arachne Strings have allocated memory for their contents since the
+ * program started.
+ */
+extern size_t arachne_num_allocations(void);
+
 #endif
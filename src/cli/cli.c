@@ -1,27 +1,64 @@
+#define _POSIX_C_SOURCE 200809L
 #include "cli.h"
 #include "../../libs/arachne-strlib/arachne_strlib.h"
 #include "../mcalc4/mcalc4.h"
+#include "../mcalc4/mcalc4_cache.h"
+#include "../mcalc4/mcalc4_diff.h"
+#include "../mcalc4/mcalc4_formulas.h"
+#include "../mcalc4/mcalc4_format.h"
+#include "../mcalc4/mcalc4_integrate.h"
+#include "../mcalc4/mcalc4_precise.h"
+#include "../mcalc4/mcalc4_solve.h"
+#include "../mcalc4/mcalc4_stats.h"
+#include "../mcalc4/mcalc4_table.h"
 #include "cli_types.h"
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Results the REPL remembers, so re-entering an expression with the same
+variables doesn't parse it again. */
+#define CLI_CACHE_CAPACITY 256
+/* Most variables `diff` differentiates with respect to at once. */
+#define CLI_DIFF_MAX_VARS 16
 
 static void print_syntax_error(const char* info) {
     printf("Syntax Error: %s.\n", info);
 }
 
-void evaluate_all(const char* equations[], int num_equs) {
-    struct MC4_Result result;
-    struct MC4_Settings settings;
+static void print_evaluation_error(MC4_Result* result) {
+    printf("Syntax Error: %s at character %u.\n", MC4_get_error_str(result),
+           result->err_pos + 1);
+}
 
-    for (int i = 1; i < num_equs; i++) {
-        result = MC4_evaluate(equations[i], NULL, &settings);
-        if (MC4_error_occured(&result)) {
+static void print_result(const char* equation, double value,
+                         const struct MC4_Settings* settings) {
+    char buffer[MC4_FORMAT_BUFFER_SIZE];
+    MC4_format(value, settings->output_mode, buffer);
+    printf("%s = %s\n", equation, buffer);
+}
+
+void evaluate_all(const char* equations[], int num_equs,
+                  unsigned int num_threads) {
+    struct MC4_Settings settings = settings_default();
+    MC4_Result* results = malloc(num_equs * sizeof(MC4_Result));
+    if (results == NULL) MLOG.panic("Out of memory.");
+
+    MC4_evaluate_many(equations, num_equs, NULL, &settings, results,
+                      num_threads);
+    for (int i = 0; i < num_equs; i++) {
+        if (MC4_error_occured(&results[i])) {
             printf("%s = ERROR\n", equations[i]);
-            print_syntax_error(MC4_get_error_str(&result));
+            print_evaluation_error(&results[i]);
         } else {
-            printf("%s = %lf\n", equations[i], result.value);
+            print_result(equations[i], results[i].value, &settings);
         }
     }
+    free(results);
 }
 
 static bool str_is_empty(const char* s) {
@@ -32,6 +69,18 @@ static bool str_is_empty(const char* s) {
     return true;
 }
 
+/**
+ * Checks if `s` is a letter or underscore followed by letters, digits and
+ * underscores.
+ */
+static bool is_var_name(const char* s) {
+    if (!isalpha(s[0]) && (s[0] != '_')) return false;
+    for (size_t i = 1; s[i] != '\0'; i++) {
+        if (!isalnum(s[i]) && (s[i] != '_')) return false;
+    }
+    return true;
+}
+
 static void trim_str_end(char* s) {
     const size_t STRING_LENGTH = strlen(s);
     for (int i = STRING_LENGTH - 1; (i >= 0) && isspace(s[i]); i--) {
@@ -42,6 +91,12 @@ static void trim_str_end(char* s) {
 static enum SetttingName str_to_setting_name(const char* s) {
     if (strcasecmp("angle", s) == 0) {
         return SETNAME_ANGLE_MODE;
+    } else if (strcasecmp("output", s) == 0) {
+        return SETNAME_OUTPUT_MODE;
+    } else if (strcasecmp("stats", s) == 0) {
+        return SETNAME_STATS;
+    } else if (strcasecmp("precision", s) == 0) {
+        return SETNAME_PRECISION;
     } else {
         return SETNAME_UNKOWN;
     }
@@ -53,15 +108,41 @@ static const char* const HELP_STR =
     "functions(such sin and arctan), logarithms(log and ln), and\n"
     "constants(e and pi)\n\n"
     "Variables - Syntax: `let{variable} = {value}`. Set a variable with\n"
-    "name {variable} to {value} {Value can be} any valid expression.\n\n"
+    "name {variable} to {value} {Value can be} any valid expression.\n"
+    "`let{variable} := {value}` keeps {variable} up to date whenever the\n"
+    "variables in {value} change.\n\n"
     "Settings - Syntax: `set{setting_name} { value }`. There are a\n"
-    "few settings in M-Calculator 4 which can be adjusted: ANGLE_MODE,\n"
-    "{TBD}...\n";
+    "few settings in M-Calculator 4 which can be adjusted: ANGLE_MODE\n"
+    "(`set angle rad|deg`), OUTPUT_MODE (`set output normal|sci|eng`),\n"
+    "STATS (`set stats on|off`) and PRECISION (`set precision {digits}|off`),\n"
+    "which evaluates expressions with {digits} significant digits instead\n"
+    "of a double's 17.\n\n"
+    "Stats - Syntax: `stats` or `stats reset`. Shows how often each phase\n"
+    "of evaluating ran and how long it took, while stats are on.\n\n"
+    "Tables - Syntax: `table {expression} for {variable} from {start} to\n"
+    "{end} step {step}`. Writes `{variable},{value}` lines for every step,\n"
+    "or to a file with `> {path}` at the end.\n\n"
+    "Integrals - Syntax: `integrate {expression} d{variable} from {start}\n"
+    "to {end}`, optionally followed by `tol {absolute tolerance}` and\n"
+    "`rtol {relative tolerance}`. Prints the integral, its estimated error\n"
+    "and how often {expression} was evaluated.\n\n"
+    "Equations - Syntax: `solve {expression} = {expression} for {variable}`,\n"
+    "optionally followed by `in {start}..{end}` and `step {step}`. Prints a\n"
+    "root near the value of {variable}, or every root between {start} and\n"
+    "{end}, scanned in steps of {step}.\n\n"
+    "Derivatives - Syntax: `diff {expression} wrt {variable},...`,\n"
+    "optionally followed by `at {value},...`. Prints the exact derivative\n"
+    "with respect to each variable, at their values or the given point.\n";
 
 enum Command {
     CMD_LET,
     CMD_SET,
     CMD_HELP,
+    CMD_STATS,
+    CMD_TABLE,
+    CMD_INTEGRATE,
+    CMD_SOLVE,
+    CMD_DIFF,
     CMD_QUIT,
     CMD_NONE,
 };
@@ -71,6 +152,11 @@ static const char* command_to_str(enum Command command) {
     case CMD_LET: return "CMD_LET";
     case CMD_SET: return "CMD_SET";
     case CMD_HELP: return "CMD_HELP";
+    case CMD_STATS: return "CMD_STATS";
+    case CMD_TABLE: return "CMD_TABLE";
+    case CMD_INTEGRATE: return "CMD_INTEGRATE";
+    case CMD_SOLVE: return "CMD_SOLVE";
+    case CMD_DIFF: return "CMD_DIFF";
     case CMD_QUIT: return "CMD_QUIT";
     case CMD_NONE: return "CMD_NONE";
     default: return NULL;
@@ -84,6 +170,16 @@ static enum Command str_to_command(const char* s) {
         return CMD_SET;
     } else if (strcasecmp(s, "help") == 0) {
         return CMD_HELP;
+    } else if (strcasecmp(s, "stats") == 0) {
+        return CMD_STATS;
+    } else if (strcasecmp(s, "table") == 0) {
+        return CMD_TABLE;
+    } else if (strcasecmp(s, "integrate") == 0) {
+        return CMD_INTEGRATE;
+    } else if (strcasecmp(s, "solve") == 0) {
+        return CMD_SOLVE;
+    } else if (strcasecmp(s, "diff") == 0) {
+        return CMD_DIFF;
     } else if ((strcasecmp(s, "quit") == 0) || (strcasecmp(s, "exit") == 0)) {
         return CMD_QUIT;
     } else {
@@ -95,45 +191,144 @@ enum CommandParseError {
     CPE_NO_ERROR,
     /* Let Command */
     CPE_NO_VAR_NAME,
-    CPE_VAR_NAME_TOO_LONG,
-    CPE_VAR_NAME_NOT_ALPHA,
+    CPE_VAR_NAME_INVALID,
+    CPE_VAR_NAME_IS_KEYWORD,
     CPE_EQUAL_SIGN_NOT_FOUND,
     CPE_EXPECTED_EQUAL_SIGN,
     CPE_EXPECTED_EXPRESSION,
+    /* The expression has an error, which has already been printed. */
+    CPE_INVALID_EXPRESSION,
     /* Set Command */
     CPE_UNKOWN_SETTING,
     CPE_EXPECTED_SET_VALUE,
     CPE_INVALID_SET_VALUE,
+    /* Stats Command */
+    CPE_INVALID_STATS_ARG,
+    /* Table Command */
+    CPE_EXPECTED_RANGE,
+    CPE_EMPTY_RANGE,
+    CPE_CANT_OPEN_FILE,
+    /* Integrate Command */
+    CPE_EXPECTED_DIFFERENTIAL,
+    CPE_INFINITE_BOUNDS,
+    CPE_INVALID_TOL,
+    /* Solve Command */
+    CPE_EXPECTED_UNKNOWN,
+    CPE_TOO_MANY_EQUAL_SIGNS,
+    CPE_INVALID_STEP,
+    /* Diff Command */
+    CPE_EXPECTED_WRT,
+    CPE_TOO_MANY_VARS,
+    CPE_DUPLICATE_VAR,
+    CPE_POINT_MISMATCH,
 };
 
+/**
+ * Returns a copy of `s`, for words of an `ArachneString` which must survive
+ * the next read, since it reuses their memory. Free with `free()`.
+ */
+static char* copy_str(const char* s) {
+    char* copy = malloc(strlen(s) + 1);
+    if (copy == NULL) MLOG.panic("Out of memory.");
+    strcpy(copy, s);
+    return copy;
+}
+
+/**
+ * Reads a variable name into `*var_name`, which is a copy to be freed with
+ * `free()` if `CPE_NO_ERROR` is returned. Returns `missing` if there is no
+ * word left.
+ */
+static enum CommandParseError read_var_name(ArachneString* astr,
+                                            enum CommandParseError missing,
+                                            char** var_name) {
+    const char* word = arachne_read_word(astr);
+    if (word == NULL) return missing;
+    if (!is_var_name(word)) return CPE_VAR_NAME_INVALID;
+    if (is_keyword(word, strlen(word))) return CPE_VAR_NAME_IS_KEYWORD;
+    *var_name = copy_str(word);
+    return CPE_NO_ERROR;
+}
+
+/**
+ * Handles the rest of a `let` command after the variable name: `= expr`, which
+ * sets the variable once, or `:= expr`, which binds it to `expr` so it follows
+ * the variables `expr` reads.
+ */
 static enum CommandParseError
-handle_let_command(ArachneString* astr, struct MC4_VariableSet* varset,
-                   struct MC4_Settings* settings) {
-    const char* var_name_str = arachne_read_word(astr);
-    if (var_name_str == NULL) return CPE_NO_VAR_NAME;
-    if (strlen(var_name_str) != 1) return CPE_VAR_NAME_TOO_LONG;
-    if (!isalpha(var_name_str[0])) return CPE_VAR_NAME_NOT_ALPHA;
-    const char var_name = var_name_str[0];
+handle_let_value(ArachneString* astr, struct MC4_VariableSet* varset,
+                 struct MC4_Formulas* formulas, struct MC4_Settings* settings,
+                 const char* var_name, bool verbose) {
     const char* equal_sign = arachne_read_word(astr);
     if (equal_sign == NULL) return CPE_EQUAL_SIGN_NOT_FOUND;
-    if (strcmp(equal_sign, "=") != 0) return CPE_EXPECTED_EQUAL_SIGN;
+    const bool bind = (strcmp(equal_sign, ":=") == 0);
+    if (!bind && (strcmp(equal_sign, "=") != 0)) {
+        return CPE_EXPECTED_EQUAL_SIGN;
+    }
     const char* expression = arachne_read_rest(astr);
     if (str_is_empty(expression)) return CPE_EXPECTED_EXPRESSION;
-    MC4_Result result = MC4_evaluate(expression, varset, settings);
-    set_var(varset, var_name, result.value);
-    printf("Set variable '%c' to %lf\n", var_name, result.value);
+    if (bind) {
+        const MC4_ErrorCode err = MC4_formulas_bind(
+            formulas, varset, var_name, expression, settings);
+        if (err != MC4_ERR_NONE) {
+            print_syntax_error(_MC4_ErrorCode_to_str(err));
+            return CPE_INVALID_EXPRESSION;
+        }
+        if (verbose) {
+            double bound_value = 0;
+            get_var(varset, var_name, &bound_value);
+            char value[MC4_FORMAT_BUFFER_SIZE];
+            MC4_format(bound_value, settings->output_mode, value);
+            size_t len = strlen(expression);
+            while ((len > 0) && isspace(expression[len - 1])) len--;
+            while ((len > 0) && isspace(expression[0])) {
+                expression++;
+                len--;
+            }
+            printf("Bound variable '%s' to %.*s = %s\n", var_name, (int)len,
+                   expression, value);
+        }
+    } else {
+        MC4_Result result = MC4_evaluate(expression, varset, settings);
+        /* The variable keeps its value if the expression has an error. */
+        if (MC4_error_occured(&result)) {
+            print_syntax_error(MC4_get_error_str(&result));
+            return CPE_INVALID_EXPRESSION;
+        }
+        MC4_formulas_assign(formulas, varset, var_name, result.value);
+        if (verbose) {
+            char value[MC4_FORMAT_BUFFER_SIZE];
+            MC4_format(result.value, settings->output_mode, value);
+            printf("Set variable '%s' to %s\n", var_name, value);
+        }
+    }
     arachne_free(astr);
     return CPE_NO_ERROR;
 }
 
+static enum CommandParseError
+handle_let_command(ArachneString* astr, struct MC4_VariableSet* varset,
+                   struct MC4_Formulas* formulas,
+                   struct MC4_Settings* settings, bool verbose) {
+    char* var_name;
+    enum CommandParseError error =
+        read_var_name(astr, CPE_NO_VAR_NAME, &var_name);
+    if (error != CPE_NO_ERROR) return error;
+    error = handle_let_value(astr, varset, formulas, settings, var_name,
+                             verbose);
+    free(var_name);
+    return error;
+}
+
 static void handle_let_command_error(enum CommandParseError error) {
     switch (error) {
     case CPE_NO_VAR_NAME: print_syntax_error("Expected variable name"); break;
-    case CPE_VAR_NAME_TOO_LONG:
-        print_syntax_error("Variable name must be one character");
+    case CPE_VAR_NAME_INVALID:
+        print_syntax_error("Variable names are letters, digits and "
+                           "underscores, and can't start with a digit");
         break;
-    case CPE_VAR_NAME_NOT_ALPHA:
-        print_syntax_error("Variable name must be a letter");
+    case CPE_VAR_NAME_IS_KEYWORD:
+        print_syntax_error("Variable name can't be a function or constant");
         break;
     case CPE_EQUAL_SIGN_NOT_FOUND:
         print_syntax_error("Expected an equal sign");
@@ -146,8 +341,14 @@ static void handle_let_command_error(enum CommandParseError error) {
     }
 }
 
+/**
+ * Handles `set name value`. Changing the angle mode recomputes every variable
+ * bound with `let x := expr`.
+ */
 static enum CommandParseError
-handle_set_command(ArachneString* astr, struct MC4_Settings* settings) {
+handle_set_command(ArachneString* astr, struct MC4_VariableSet* varset,
+                   struct MC4_Formulas* formulas,
+                   struct MC4_Settings* settings, bool verbose) {
     const char* SETTING_NAME = arachne_read_word(astr);
     enum SetttingName setting_name = str_to_setting_name(SETTING_NAME);
     if (setting_name == SETNAME_UNKOWN) return CPE_UNKOWN_SETTING;
@@ -158,22 +359,643 @@ handle_set_command(ArachneString* astr, struct MC4_Settings* settings) {
             if (VALUE == NULL) return CPE_EXPECTED_SET_VALUE;
             if (strcasecmp("rad", VALUE) == 0) {
                 settings->angle_mode = ANGLE_MODE_RAD;
-                puts("Setting angle mode to radians");
+                if (verbose) puts("Setting angle mode to radians");
             } else if (strcasecmp("deg", VALUE) == 0) {
                 settings->angle_mode = ANGLE_MODE_DEG;
-                puts("Setting angle mode to degrees");
+                if (verbose) puts("Setting angle mode to degrees");
+            } else {
+                return CPE_INVALID_SET_VALUE;
+            }
+            MC4_formulas_recompute_all(formulas, varset, settings);
+            break;
+        };
+    case SETNAME_OUTPUT_MODE:
+        {
+            const char* VALUE = arachne_read_word(astr);
+            if (VALUE == NULL) return CPE_EXPECTED_SET_VALUE;
+            if (strcasecmp("normal", VALUE) == 0) {
+                settings->output_mode = OUTPUT_MODE_NORMAL;
+                if (verbose) puts("Setting output mode to normal");
+            } else if ((strcasecmp("sci", VALUE) == 0) ||
+                       (strcasecmp("scientific", VALUE) == 0)) {
+                settings->output_mode = OUTPUT_MODE_SCIENTIFIC;
+                if (verbose) puts("Setting output mode to scientific");
+            } else if ((strcasecmp("eng", VALUE) == 0) ||
+                       (strcasecmp("engineering", VALUE) == 0)) {
+                settings->output_mode = OUTPUT_MODE_ENGINEERING;
+                if (verbose) puts("Setting output mode to engineering");
             } else {
                 return CPE_INVALID_SET_VALUE;
             }
+            break;
+        };
+    case SETNAME_STATS:
+        {
+            const char* VALUE = arachne_read_word(astr);
+            if (VALUE == NULL) return CPE_EXPECTED_SET_VALUE;
+            if (strcasecmp("on", VALUE) == 0) {
+                MC4_stats_enable(true);
+                if (verbose) puts("Turning stats on");
+            } else if (strcasecmp("off", VALUE) == 0) {
+                MC4_stats_enable(false);
+                if (verbose) puts("Turning stats off");
+            } else {
+                return CPE_INVALID_SET_VALUE;
+            }
+            break;
+        };
+    case SETNAME_PRECISION:
+        {
+            const char* VALUE = arachne_read_word(astr);
+            if (VALUE == NULL) return CPE_EXPECTED_SET_VALUE;
+            if (strcasecmp("off", VALUE) == 0) {
+                settings->precision = 0;
+                if (verbose) puts("Turning arbitrary precision off");
+                break;
+            }
+            char* end;
+            const unsigned long digits = strtoul(VALUE, &end, 10);
+            if (!isdigit(VALUE[0]) || (*end != '\0') ||
+                (digits > MC4_MAX_PRECISION)) {
+                return CPE_INVALID_SET_VALUE;
+            }
+            settings->precision = (unsigned int)digits;
+            if (verbose && (digits == 0)) {
+                puts("Turning arbitrary precision off");
+            } else if (verbose) {
+                printf("Setting precision to %lu digits\n", digits);
+            }
+            break;
         };
     default: break;
     }
     return CPE_NO_ERROR;
 }
 
+/**
+ * Prints the counters of every phase, the libm functions which were called and
+ * how often the command parser allocated. `one_line` keeps batch mode's one
+ * line of output per line of input.
+ */
+static void print_stats(bool one_line) {
+    const struct MC4_Stats stats = MC4_stats_get();
+    if (one_line) {
+        for (int i = 0; i < NUM_STATS_PHASES; i++) {
+            printf("%s %llu calls %llu ns, ", MC4_stats_phase_name(i),
+                   (unsigned long long)stats.num_calls[i],
+                   (unsigned long long)stats.ns[i]);
+        }
+        printf("allocations %zu\n", arachne_num_allocations());
+        return;
+    }
+
+    if (!MC4_stats_enabled()) puts("Stats are off (`set stats on`).");
+    printf("%-12s %12s %14s %10s\n", "phase", "calls", "total ns", "ns/call");
+    for (int i = 0; i < NUM_STATS_PHASES; i++) {
+        const uint64_t num_calls = stats.num_calls[i];
+        printf("%-12s %12llu %14llu %10.1f\n", MC4_stats_phase_name(i),
+               (unsigned long long)num_calls, (unsigned long long)stats.ns[i],
+               (num_calls == 0) ? 0.0 : ((double)stats.ns[i] / num_calls));
+    }
+    printf("function calls:");
+    for (int i = 0; i < NUM_FUNC_TYPES; i++) {
+        if (stats.num_func_calls[i] == 0) continue;
+        printf(" %s %llu", func_type_to_str(i),
+               (unsigned long long)stats.num_func_calls[i]);
+    }
+    printf("\ncommand parser allocations: %zu\n", arachne_num_allocations());
+}
+
+/**
+ * Runs `stats`, or `stats reset`.
+ */
+static enum CommandParseError handle_stats_command(ArachneString* astr,
+                                                   bool verbose) {
+    const char* word = arachne_read_word(astr);
+    if (word == NULL) {
+        print_stats(!verbose);
+    } else if (strcasecmp("reset", word) == 0) {
+        MC4_stats_reset();
+        puts(verbose ? "Stats reset" : "ok");
+    } else {
+        return CPE_INVALID_STATS_ARG;
+    }
+    return CPE_NO_ERROR;
+}
+
+/**
+ * Returns the whitespace before the last ` word ` in `s`, which ends the
+ * expression of a `table`, `integrate`, `solve` or `diff` command, or NULL if
+ * there is none.
+ */
+static char* find_last_word(char* s, const char* word) {
+    const size_t len = strlen(word);
+    char* found = NULL;
+    for (size_t i = 1; s[i] != '\0'; i++) {
+        if (isspace(s[i - 1]) && (strncasecmp(&s[i], word, len) == 0) &&
+            isspace(s[i + len])) {
+            found = &s[i - 1];
+        }
+    }
+    return found;
+}
+
+/**
+ * Copies the rest of `astr` and splits the copy at the last ` word `, so the
+ * expression before it can be kept while `astr` reads what follows it.
+ * Returns the expression, to be freed with `free()`, or NULL if there is no
+ * ` word `.
+ */
+static char* split_rest_at_word(ArachneString* astr, const char* word) {
+    char* line = copy_str(arachne_read_rest(astr));
+    char* found = find_last_word(line, word);
+    if (found == NULL) {
+        free(line);
+        return NULL;
+    }
+    *found = '\0';
+    arachne_set_str(astr, &found[strlen(word) + 1]);
+    return line;
+}
+
+static bool evaluate_bound(const char* word, struct MC4_VariableSet* varset,
+                           struct MC4_Settings* settings, double* value) {
+    MC4_Result result = MC4_evaluate(word, varset, settings);
+    *value = result.value;
+    return !MC4_error_occured(&result);
+}
+
+/**
+ * Reads `keyword value`, where `value` is an expression without spaces.
+ */
+static bool read_range_bound(ArachneString* astr, const char* keyword,
+                             struct MC4_VariableSet* varset,
+                             struct MC4_Settings* settings, double* value) {
+    const char* word = arachne_read_word(astr);
+    if ((word == NULL) || (strcasecmp(word, keyword) != 0)) return false;
+    word = arachne_read_word(astr);
+    return (word != NULL) && evaluate_bound(word, varset, settings, value);
+}
+
+/**
+ * Handles the rest of a `table` command after the variable name: `from start
+ * to end step step`, and optionally `> path`.
+ */
+static enum CommandParseError
+handle_table_bounds(ArachneString* astr, struct MC4_VariableSet* varset,
+                    struct MC4_Settings* settings, const char* equ,
+                    const char* var_name, bool verbose) {
+    struct MC4_Range range = {.name = var_name};
+    if (!read_range_bound(astr, "from", varset, settings, &range.from) ||
+        !read_range_bound(astr, "to", varset, settings, &range.to) ||
+        !read_range_bound(astr, "step", varset, settings, &range.step)) {
+        return CPE_EXPECTED_RANGE;
+    }
+    if (MC4_range_len(&range) == 0) return CPE_EMPTY_RANGE;
+
+    FILE* out = stdout;
+    const char* path = NULL;
+    const char* word = arachne_read_word(astr);
+    if (word != NULL) {
+        if (strcmp(word, ">") != 0) return CPE_EXPECTED_RANGE;
+        path = arachne_read_word(astr);
+        if (path == NULL) return CPE_EXPECTED_RANGE;
+        out = fopen(path, "w");
+        if (out == NULL) return CPE_CANT_OPEN_FILE;
+    }
+    const MC4_ErrorCode err =
+        MC4_tabulate(equ, &range, varset, settings, out, 0);
+    if (out != stdout) fclose(out);
+    if (err != MC4_ERR_NONE) {
+        print_syntax_error(_MC4_ErrorCode_to_str(err));
+    } else if (path != NULL) {
+        if (verbose) {
+            printf("Wrote %zu rows to %s\n", MC4_range_len(&range), path);
+        } else {
+            puts("ok");
+        }
+    }
+    return CPE_NO_ERROR;
+}
+
+static enum CommandParseError
+handle_table_range(ArachneString* astr, struct MC4_VariableSet* varset,
+                   struct MC4_Settings* settings, const char* equ,
+                   bool verbose) {
+    char* var_name;
+    enum CommandParseError error =
+        read_var_name(astr, CPE_EXPECTED_RANGE, &var_name);
+    if (error != CPE_NO_ERROR) return error;
+    error = handle_table_bounds(astr, varset, settings, equ, var_name,
+                                verbose);
+    free(var_name);
+    return error;
+}
+
+/**
+ * Runs `table expr for x from start to end step step [> path]`. `expr` is
+ * compiled once, and the rows are evaluated and formatted on every CPU.
+ */
+static enum CommandParseError
+handle_table_command(ArachneString* astr, struct MC4_VariableSet* varset,
+                     struct MC4_Settings* settings, bool verbose) {
+    char* line = split_rest_at_word(astr, "for");
+    if (line == NULL) return CPE_EXPECTED_RANGE;
+    const enum CommandParseError error =
+        str_is_empty(line)
+            ? CPE_EXPECTED_EXPRESSION
+            : handle_table_range(astr, varset, settings, line, verbose);
+    free(line);
+    return error;
+}
+
+static void handle_table_command_error(enum CommandParseError error) {
+    switch (error) {
+    case CPE_EXPECTED_RANGE:
+        print_syntax_error("Expected `for {variable} from {start} to {end} "
+                           "step {step}`");
+        break;
+    case CPE_EMPTY_RANGE: print_syntax_error("Range is empty"); break;
+    case CPE_CANT_OPEN_FILE: print_syntax_error("Can't open file"); break;
+    default: handle_let_command_error(error); break;
+    }
+}
+
+/**
+ * Handles the rest of an `integrate` command after `from`: `start to end`,
+ * and optionally `tol tolerance` and `rtol tolerance`.
+ */
+static enum CommandParseError
+handle_integrate_bounds(ArachneString* astr, struct MC4_VariableSet* varset,
+                        struct MC4_Settings* settings, const char* equ,
+                        const char* var_name) {
+    double from, to;
+    double abs_tol = MC4_INTEGRATE_DEFAULT_ABS_TOL;
+    double rel_tol = MC4_INTEGRATE_DEFAULT_REL_TOL;
+    const char* word = arachne_read_word(astr);
+    if ((word == NULL) || !evaluate_bound(word, varset, settings, &from) ||
+        !read_range_bound(astr, "to", varset, settings, &to)) {
+        return CPE_EXPECTED_DIFFERENTIAL;
+    }
+    if (!isfinite(from) || !isfinite(to)) return CPE_INFINITE_BOUNDS;
+    while ((word = arachne_read_word(astr)) != NULL) {
+        double* tol;
+        if (strcasecmp(word, "tol") == 0) {
+            tol = &abs_tol;
+        } else if (strcasecmp(word, "rtol") == 0) {
+            tol = &rel_tol;
+        } else {
+            return CPE_EXPECTED_DIFFERENTIAL;
+        }
+        word = arachne_read_word(astr);
+        if ((word == NULL) || !evaluate_bound(word, varset, settings, tol) ||
+            !(*tol >= 0)) {
+            return CPE_INVALID_TOL;
+        }
+    }
+    if ((abs_tol == 0) && (rel_tol == 0)) return CPE_INVALID_TOL;
+
+    struct MC4_Integral integral;
+    const MC4_ErrorCode err =
+        MC4_integrate(equ, var_name, from, to, abs_tol, rel_tol, varset,
+                      settings, 0, &integral);
+    if (err != MC4_ERR_NONE) {
+        print_syntax_error(_MC4_ErrorCode_to_str(err));
+        return CPE_NO_ERROR;
+    }
+    char value[MC4_FORMAT_BUFFER_SIZE];
+    char error[MC4_FORMAT_BUFFER_SIZE];
+    MC4_format(integral.value, settings->output_mode, value);
+    MC4_format(integral.error, settings->output_mode, error);
+    printf("%s +/- %s (%zu evaluations%s)\n", value, error, integral.num_evals,
+           integral.converged ? "" : ", tolerance not reached");
+    return CPE_NO_ERROR;
+}
+
+/**
+ * Runs `integrate expr dx from start to end [tol tolerance] [rtol tolerance]`.
+ */
+static enum CommandParseError
+handle_integrate_command(ArachneString* astr, struct MC4_VariableSet* varset,
+                         struct MC4_Settings* settings) {
+    char* line = split_rest_at_word(astr, "from");
+    if (line == NULL) return CPE_EXPECTED_DIFFERENTIAL;
+    trim_str_end(line);
+    /* The last word before `from` is `d{variable}`. */
+    size_t start = strlen(line);
+    while ((start > 0) && !isspace(line[start - 1])) start--;
+    char* var_name = &line[start + 1];
+    enum CommandParseError error;
+    if ((line[start] != 'd') || !is_var_name(var_name)) {
+        error = CPE_EXPECTED_DIFFERENTIAL;
+    } else if (is_keyword(var_name, strlen(var_name))) {
+        error = CPE_VAR_NAME_IS_KEYWORD;
+    } else {
+        line[start] = '\0';
+        error = str_is_empty(line)
+                    ? CPE_EXPECTED_EXPRESSION
+                    : handle_integrate_bounds(astr, varset, settings, line,
+                                              var_name);
+    }
+    free(line);
+    return error;
+}
+
+static void handle_integrate_command_error(enum CommandParseError error) {
+    switch (error) {
+    case CPE_EXPECTED_DIFFERENTIAL:
+        print_syntax_error("Expected `d{variable} from {start} to {end}`");
+        break;
+    case CPE_INFINITE_BOUNDS:
+        print_syntax_error("Bounds must be finite");
+        break;
+    case CPE_INVALID_TOL:
+        print_syntax_error("Tolerances must be numbers which aren't "
+                           "negative, and not both 0");
+        break;
+    default: handle_let_command_error(error); break;
+    }
+}
+
+static void print_roots(const char* var_name,
+                        const struct MC4_Solution* solution,
+                        const struct MC4_Settings* settings) {
+    if (solution->num_roots == 0) {
+        printf("No roots found");
+    } else {
+        printf("%s = ", var_name);
+    }
+    for (size_t i = 0; i < solution->num_roots; i++) {
+        char root[MC4_FORMAT_BUFFER_SIZE];
+        MC4_format(solution->roots[i], settings->output_mode, root);
+        printf((i == 0) ? "%s" : ", %s", root);
+    }
+    /* The note stays on the same line, for batch mode. */
+    printf(" (%zu evaluations%s)\n", solution->num_evals,
+           solution->complete
+               ? ""
+               : "; roots may be missing, try a smaller `step`");
+}
+
+/**
+ * Reads the `step` of `solve ... in start..end step step` into the number of
+ * intervals to scan, which must not be more than `MC4_SOLVE_MAX_INTERVALS`.
+ */
+static enum CommandParseError
+read_solve_step(ArachneString* astr, struct MC4_VariableSet* varset,
+                struct MC4_Settings* settings, double from, double to,
+                size_t* num_intervals) {
+    *num_intervals = 0;
+    const char* word = arachne_read_word(astr);
+    if (word == NULL) return CPE_NO_ERROR;
+    if (strcasecmp(word, "step") != 0) return CPE_EXPECTED_UNKNOWN;
+    word = arachne_read_word(astr);
+    double step;
+    if ((word == NULL) || !evaluate_bound(word, varset, settings, &step) ||
+        (arachne_read_word(astr) != NULL)) {
+        return CPE_EXPECTED_UNKNOWN;
+    }
+    const double count = ceil(fabs(to - from) / step);
+    if (!(step > 0) || !(count <= MC4_SOLVE_MAX_INTERVALS)) {
+        return CPE_INVALID_STEP;
+    }
+    *num_intervals = (count < 1) ? 1 : (size_t)count;
+    return CPE_NO_ERROR;
+}
+
+/**
+ * Handles the rest of a `solve` command after the variable name: nothing,
+ * which finds a root near the variable's value (or 0), or `in start..end`
+ * and optionally `step step`, which finds every root in the range.
+ */
+static enum CommandParseError
+handle_solve_range(ArachneString* astr, struct MC4_VariableSet* varset,
+                   struct MC4_Settings* settings, const char* equ,
+                   const char* var_name) {
+    struct MC4_Solution solution;
+    MC4_ErrorCode err;
+    const char* word = arachne_read_word(astr);
+    if (word == NULL) {
+        double guess = 0;
+        get_var(varset, var_name, &guess);
+        err = MC4_solve(equ, var_name, guess, varset, settings, &solution);
+    } else {
+        if (strcasecmp(word, "in") != 0) return CPE_EXPECTED_UNKNOWN;
+        word = arachne_read_word(astr);
+        char* dots = (word != NULL) ? strstr(word, "..") : NULL;
+        if (dots == NULL) return CPE_EXPECTED_UNKNOWN;
+        *dots = '\0';
+        double from, to;
+        if (!evaluate_bound(word, varset, settings, &from) ||
+            !evaluate_bound(&dots[2], varset, settings, &to)) {
+            return CPE_EXPECTED_UNKNOWN;
+        }
+        if (!isfinite(from) || !isfinite(to)) return CPE_INFINITE_BOUNDS;
+        size_t num_intervals;
+        const enum CommandParseError error = read_solve_step(
+            astr, varset, settings, from, to, &num_intervals);
+        if (error != CPE_NO_ERROR) return error;
+        err = MC4_solve_range(equ, var_name, from, to, num_intervals, varset,
+                              settings, 0, &solution);
+    }
+    if (err != MC4_ERR_NONE) {
+        print_syntax_error(_MC4_ErrorCode_to_str(err));
+        return CPE_NO_ERROR;
+    }
+    print_roots(var_name, &solution, settings);
+    MC4_free_solution(&solution);
+    return CPE_NO_ERROR;
+}
+
+static enum CommandParseError
+handle_solve_unknown(ArachneString* astr, struct MC4_VariableSet* varset,
+                     struct MC4_Settings* settings, const char* equ) {
+    char* var_name;
+    enum CommandParseError error =
+        read_var_name(astr, CPE_EXPECTED_UNKNOWN, &var_name);
+    if (error != CPE_NO_ERROR) return error;
+    error = handle_solve_range(astr, varset, settings, equ, var_name);
+    free(var_name);
+    return error;
+}
+
+/**
+ * Runs `solve lhs = rhs for x [in start..end]`, or `solve expr for x`, which
+ * solves `expr = 0`. `lhs - rhs` is compiled once and solved as native code.
+ */
+static enum CommandParseError
+handle_solve_command(ArachneString* astr, struct MC4_VariableSet* varset,
+                     struct MC4_Settings* settings) {
+    char* line = split_rest_at_word(astr, "for");
+    if (line == NULL) return CPE_EXPECTED_UNKNOWN;
+    char* equal_sign = strchr(line, '=');
+    const char* rhs = "0";
+    if (equal_sign != NULL) {
+        *equal_sign = '\0';
+        rhs = &equal_sign[1];
+    }
+    enum CommandParseError error;
+    if (strchr(rhs, '=') != NULL) {
+        error = CPE_TOO_MANY_EQUAL_SIGNS;
+    } else if (str_is_empty(line) || str_is_empty(rhs)) {
+        error = CPE_EXPECTED_EXPRESSION;
+    } else {
+        /* "(" + lhs + ")-(" + rhs + ")" */
+        char* equ = malloc(strlen(line) + strlen(rhs) + 6);
+        if (equ == NULL) MLOG.panic("Out of memory.");
+        sprintf(equ, "(%s)-(%s)", line, rhs);
+        error = handle_solve_unknown(astr, varset, settings, equ);
+        free(equ);
+    }
+    free(line);
+    return error;
+}
+
+static void handle_solve_command_error(enum CommandParseError error) {
+    switch (error) {
+    case CPE_EXPECTED_UNKNOWN:
+        print_syntax_error("Expected `for {variable}`, optionally followed by "
+                           "`in {start}..{end}` and `step {step}`");
+        break;
+    case CPE_INVALID_STEP:
+        print_syntax_error("Step must be a positive number, and split the "
+                           "range into at most 16777216 intervals");
+        break;
+    case CPE_TOO_MANY_EQUAL_SIGNS:
+        print_syntax_error("Expected at most one `=`");
+        break;
+    default: handle_integrate_command_error(error); break;
+    }
+}
+
+/**
+ * Splits `s` at every comma into `parts`. Returns the number of parts, or
+ * `max_parts + 1` if there are more than `max_parts`.
+ */
+static size_t split_commas(char* s, char** parts, size_t max_parts) {
+    size_t num_parts = 0;
+    while (num_parts < max_parts) {
+        parts[num_parts++] = s;
+        s = strchr(s, ',');
+        if (s == NULL) return num_parts;
+        *s++ = '\0';
+    }
+    return max_parts + 1;
+}
+
+/**
+ * Handles the rest of a `diff` command after the variables: nothing, which
+ * differentiates at the variables' values, or `at value,...`.
+ */
+static enum CommandParseError
+handle_diff_point(ArachneString* astr, struct MC4_VariableSet* varset,
+                  struct MC4_Settings* settings, const char* equ,
+                  const char* const* names, size_t num_names) {
+    double point[CLI_DIFF_MAX_VARS];
+    const double* at = NULL;
+    const char* word = arachne_read_word(astr);
+    if (word != NULL) {
+        if (strcasecmp(word, "at") != 0) return CPE_EXPECTED_WRT;
+        word = arachne_read_word(astr);
+        if (word == NULL) return CPE_POINT_MISMATCH;
+        char* values = copy_str(word);
+        char* parts[CLI_DIFF_MAX_VARS];
+        const size_t num_parts =
+            split_commas(values, parts, CLI_DIFF_MAX_VARS);
+        bool valid = (num_parts == num_names) &&
+                     (arachne_read_word(astr) == NULL);
+        for (size_t i = 0; valid && (i < num_parts); i++) {
+            valid = evaluate_bound(parts[i], varset, settings, &point[i]);
+        }
+        free(values);
+        if (!valid) return CPE_POINT_MISMATCH;
+        at = point;
+    }
+
+    double value;
+    double gradient[CLI_DIFF_MAX_VARS];
+    const MC4_ErrorCode err = MC4_gradient(equ, names, at, num_names, varset,
+                                           settings, &value, gradient);
+    if (err != MC4_ERR_NONE) {
+        print_syntax_error(_MC4_ErrorCode_to_str(err));
+        return CPE_NO_ERROR;
+    }
+    for (size_t i = 0; i < num_names; i++) {
+        char derivative[MC4_FORMAT_BUFFER_SIZE];
+        MC4_format(gradient[i], settings->output_mode, derivative);
+        printf("%sd/d%s = %s", (i == 0) ? "" : ", ", names[i], derivative);
+    }
+    putchar('\n');
+    return CPE_NO_ERROR;
+}
+
+static enum CommandParseError
+handle_diff_vars(ArachneString* astr, struct MC4_VariableSet* varset,
+                 struct MC4_Settings* settings, const char* equ) {
+    const char* word = arachne_read_word(astr);
+    if (word == NULL) return CPE_EXPECTED_WRT;
+    char* vars = copy_str(word);
+    char* names[CLI_DIFF_MAX_VARS];
+    const size_t num_names = split_commas(vars, names, CLI_DIFF_MAX_VARS);
+    enum CommandParseError error = CPE_NO_ERROR;
+    if (num_names > CLI_DIFF_MAX_VARS) error = CPE_TOO_MANY_VARS;
+    for (size_t i = 0; (error == CPE_NO_ERROR) && (i < num_names); i++) {
+        if (!is_var_name(names[i])) {
+            error = CPE_VAR_NAME_INVALID;
+        } else if (is_keyword(names[i], strlen(names[i]))) {
+            error = CPE_VAR_NAME_IS_KEYWORD;
+        }
+        for (size_t j = 0; (error == CPE_NO_ERROR) && (j < i); j++) {
+            if (strcmp(names[i], names[j]) == 0) error = CPE_DUPLICATE_VAR;
+        }
+    }
+    if (error == CPE_NO_ERROR) {
+        error = handle_diff_point(astr, varset, settings, equ,
+                                  (const char* const*)names, num_names);
+    }
+    free(vars);
+    return error;
+}
+
+/**
+ * Runs `diff expr wrt x,... [at value,...]`, which evaluates the derivatives
+ * of `expr` with respect to every variable in one pass of forward mode
+ * automatic differentiation.
+ */
+static enum CommandParseError
+handle_diff_command(ArachneString* astr, struct MC4_VariableSet* varset,
+                    struct MC4_Settings* settings) {
+    char* line = split_rest_at_word(astr, "wrt");
+    if (line == NULL) return CPE_EXPECTED_WRT;
+    const enum CommandParseError error =
+        str_is_empty(line) ? CPE_EXPECTED_EXPRESSION
+                           : handle_diff_vars(astr, varset, settings, line);
+    free(line);
+    return error;
+}
+
+static void handle_diff_command_error(enum CommandParseError error) {
+    switch (error) {
+    case CPE_EXPECTED_WRT:
+        print_syntax_error("Expected `wrt {variable},...`, optionally "
+                           "followed by `at {value},...`");
+        break;
+    case CPE_TOO_MANY_VARS:
+        print_syntax_error("Too many variables");
+        break;
+    case CPE_DUPLICATE_VAR:
+        print_syntax_error("Each variable may only be given once");
+        break;
+    case CPE_POINT_MISMATCH:
+        print_syntax_error("Expected one value per variable");
+        break;
+    default: handle_let_command_error(error); break;
+    }
+}
+
 static void handle_set_command_error(enum CommandParseError error) {
     switch (error) {
-    case CPE_UNKOWN_SETTING: print_syntax_error("Unkown setting.");
+    case CPE_UNKOWN_SETTING: print_syntax_error("Unkown setting"); break;
     case CPE_EXPECTED_SET_VALUE: print_syntax_error("Expected value"); break;
     case CPE_INVALID_SET_VALUE:
         print_syntax_error("Invalid value for setting");
@@ -184,15 +1006,38 @@ static void handle_set_command_error(enum CommandParseError error) {
 
 static void handle_command(enum Command command, ArachneString* astr,
                            struct MC4_VariableSet* varset,
+                           struct MC4_Formulas* formulas,
                            struct MC4_Settings* settings) {
     switch (command) {
     case CMD_LET:
-        handle_let_command_error(handle_let_command(astr, varset, settings));
+        handle_let_command_error(
+            handle_let_command(astr, varset, formulas, settings, true));
         break;
     case CMD_SET:
-        handle_set_command_error(handle_set_command(astr, settings));
+        handle_set_command_error(
+            handle_set_command(astr, varset, formulas, settings, true));
         break;
     case CMD_HELP: puts(HELP_STR); break;
+    case CMD_STATS:
+        if (handle_stats_command(astr, true) != CPE_NO_ERROR) {
+            print_syntax_error("Expected nothing or `reset`");
+        }
+        break;
+    case CMD_TABLE:
+        handle_table_command_error(
+            handle_table_command(astr, varset, settings, true));
+        break;
+    case CMD_INTEGRATE:
+        handle_integrate_command_error(
+            handle_integrate_command(astr, varset, settings));
+        break;
+    case CMD_SOLVE:
+        handle_solve_command_error(
+            handle_solve_command(astr, varset, settings));
+        break;
+    case CMD_DIFF:
+        handle_diff_command_error(handle_diff_command(astr, varset, settings));
+        break;
     case CMD_QUIT: /* handled elsewere */ break;
     default: /* expressions. handled elsewhere. */ break;
     }
@@ -202,6 +1047,8 @@ void start_cli() {
     char buffer[512] = {0};
     struct MC4_VariableSet varset = new_varset();
     struct MC4_Settings settings = settings_default();
+    struct MC4_Cache* cache = MC4_cache_new(CLI_CACHE_CAPACITY);
+    struct MC4_Formulas* formulas = MC4_formulas_new();
     ArachneString astr = arachne_new_str(buffer);
     while (true) {
         printf("(mcalc4) ");
@@ -214,16 +1061,285 @@ void start_cli() {
         if (command == CMD_NONE) {
             /* Interperet input as expression. */
             trim_str_end(buffer);
-            MC4_Result result = MC4_evaluate(buffer, &varset, &settings);
+            if (settings.precision > 0) {
+                char* text;
+                MC4_Result result =
+                    MC4_evaluate_precise(buffer, &varset, &settings, &text);
+                if (MC4_error_occured(&result)) {
+                    print_evaluation_error(&result);
+                } else {
+                    printf("%s = %s\n", buffer, text);
+                }
+                free(text);
+                continue;
+            }
+            MC4_Result result =
+                MC4_evaluate_cached(cache, buffer, &varset, &settings);
             if (MC4_error_occured(&result)) {
-                print_syntax_error(MC4_get_error_str(&result));
+                print_evaluation_error(&result);
             } else {
-                printf("%s = %lf\n", buffer, result.value);
+                print_result(buffer, result.value, &settings);
             }
         } else if (command == CMD_QUIT) {
             break;
         } else {
-            handle_command(command, &astr, &varset, &settings);
+            handle_command(command, &astr, &varset, formulas, &settings);
+        }
+    }
+    MC4_formulas_free(formulas);
+    MC4_cache_free(cache);
+    free_varset(&varset);
+    arachne_free(&astr);
+}
+
+/* Size of the blocks read from batch input which can't be memory mapped.
+Lines longer than this grow the buffer. */
+#define BATCH_READ_SIZE (1 << 20)
+
+struct BatchState {
+    ArachneString astr;
+    struct MC4_VariableSet varset;
+    struct MC4_Formulas* formulas;
+    struct MC4_Settings settings;
+};
+
+/**
+ * Reads the first word of `line` (up to 15 characters, more than any command)
+ * into `word`.
+ */
+static void read_first_word(const char* line, size_t len, char word[16]) {
+    size_t i = 0;
+    while ((i < len) && isspace(line[i])) i++;
+    int word_len = 0;
+    while ((word_len < 15) && (i < len) && !isspace(line[i])) {
+        word[word_len++] = line[i++];
+    }
+    word[word_len] = '\0';
+}
+
+/**
+ * Runs a `let`, `set`, `stats`, `table`, `integrate`, `solve` or `diff`
+ * command. The command parser needs a null-terminated string, so the line is
+ * copied; commands are rare compared to expressions.
+ */
+static enum CommandParseError handle_batch_command(enum Command command,
+                                                   const char* line,
+                                                   size_t len,
+                                                   struct BatchState* state) {
+    char* copy = malloc(len + 1);
+    if (copy == NULL) MLOG.panic("Out of memory.");
+    memcpy(copy, line, len);
+    copy[len] = '\0';
+    arachne_set_str(&state->astr, copy);
+    arachne_read_word(&state->astr);
+
+    enum CommandParseError error = CPE_NO_ERROR;
+    if (command == CMD_LET) {
+        error = handle_let_command(&state->astr, &state->varset,
+                                   state->formulas, &state->settings, false);
+        if (error != CPE_NO_ERROR) handle_let_command_error(error);
+    } else if (command == CMD_SET) {
+        error = handle_set_command(&state->astr, &state->varset,
+                                   state->formulas, &state->settings, false);
+        if (error != CPE_NO_ERROR) handle_set_command_error(error);
+    } else if (command == CMD_TABLE) {
+        error = handle_table_command(&state->astr, &state->varset,
+                                     &state->settings, false);
+        if (error != CPE_NO_ERROR) handle_table_command_error(error);
+    } else if (command == CMD_INTEGRATE) {
+        error = handle_integrate_command(&state->astr, &state->varset,
+                                         &state->settings);
+        if (error != CPE_NO_ERROR) handle_integrate_command_error(error);
+    } else if (command == CMD_SOLVE) {
+        error = handle_solve_command(&state->astr, &state->varset,
+                                     &state->settings);
+        if (error != CPE_NO_ERROR) handle_solve_command_error(error);
+    } else if (command == CMD_DIFF) {
+        error = handle_diff_command(&state->astr, &state->varset,
+                                    &state->settings);
+        if (error != CPE_NO_ERROR) handle_diff_command_error(error);
+    } else {
+        error = handle_stats_command(&state->astr, false);
+        if (error != CPE_NO_ERROR) {
+            print_syntax_error("Expected nothing or `reset`");
         }
     }
+    free(copy);
+    return error;
+}
+
+/**
+ * Handles the `len` characters of `line` (which isn't null-terminated),
+ * writing exactly one line of output. Returns false once the input asks to
+ * quit.
+ */
+static bool handle_batch_line(const char* line, size_t len,
+                              struct BatchState* state) {
+    while ((len > 0) && isspace(line[len - 1])) len--;
+    while ((len > 0) && isspace(*line)) {
+        line++;
+        len--;
+    }
+    if (len == 0) {
+        putchar('\n');
+        return true;
+    }
+    char word[16];
+    read_first_word(line, len, word);
+    enum Command command = str_to_command(word);
+    switch (command) {
+    case CMD_NONE:
+        if (state->settings.precision > 0) {
+            char* text;
+            MC4_Result result = MC4_evaluate_precise_n(
+                line, len, &state->varset, &state->settings, &text);
+            if (MC4_error_occured(&result)) {
+                print_evaluation_error(&result);
+            } else {
+                puts(text);
+            }
+            free(text);
+            return true;
+        } else {
+            MC4_Result result =
+                MC4_evaluate_n(line, len, &state->varset, &state->settings);
+            if (MC4_error_occured(&result)) {
+                print_evaluation_error(&result);
+            } else {
+                char buffer[MC4_FORMAT_BUFFER_SIZE + 1];
+                const enum OutputMode mode = state->settings.output_mode;
+                size_t buffer_len = MC4_format(result.value, mode, buffer);
+                buffer[buffer_len++] = '\n';
+                fwrite(buffer, 1, buffer_len, stdout);
+            }
+            return true;
+        }
+    case CMD_QUIT: return false;
+    case CMD_HELP: putchar('\n'); return true;
+    case CMD_STATS:
+    case CMD_TABLE:
+    case CMD_INTEGRATE:
+    case CMD_SOLVE:
+    case CMD_DIFF:
+        handle_batch_command(command, line, len, state);
+        return true;
+    case CMD_LET:
+    case CMD_SET:
+        if (handle_batch_command(command, line, len, state) == CPE_NO_ERROR) {
+            puts("ok");
+        }
+        return true;
+    }
+    return true;
+}
+
+/**
+ * Handles every line in `data` straight from the mapped pages.
+ */
+static void run_batch_mapped(const char* data, size_t size,
+                             struct BatchState* state) {
+    const char* line = data;
+    const char* const end = data + size;
+    while (line < end) {
+        const char* newline = memchr(line, '\n', end - line);
+        const char* line_end = (newline != NULL) ? newline : end;
+        if (!handle_batch_line(line, line_end - line, state)) return;
+        line = line_end + 1;
+    }
+}
+
+/**
+ * Handles every line of `file` by reading it in blocks. Used for pipes and
+ * terminals, which can't be memory mapped. Returns false if a line didn't fit
+ * in memory.
+ */
+static bool run_batch_stream(FILE* file, struct BatchState* state) {
+    size_t capacity = BATCH_READ_SIZE;
+    char* buffer = malloc(capacity);
+    size_t len = 0;
+    bool running = true;
+    bool out_of_memory = (buffer == NULL);
+    while (running && !out_of_memory) {
+        if (len == capacity) {
+            capacity *= 2;
+            char* grown = realloc(buffer, capacity);
+            out_of_memory = (grown == NULL);
+            if (out_of_memory) break;
+            buffer = grown;
+        }
+        const size_t num_read = fread(&buffer[len], 1, capacity - len, file);
+        if (num_read == 0) {
+            /* The last line might not end with a newline. */
+            if (len > 0) handle_batch_line(buffer, len, state);
+            break;
+        }
+        len += num_read;
+
+        const char* line = buffer;
+        const char* newline;
+        while (running && ((newline = memchr(line, '\n',
+                                             &buffer[len] - line)) != NULL)) {
+            running = handle_batch_line(line, newline - line, state);
+            line = newline + 1;
+        }
+        len = &buffer[len] - line;
+        memmove(buffer, line, len);
+    }
+    free(buffer);
+    return !out_of_memory;
+}
+
+/**
+ * Maps `file` into memory if it is a non-empty regular file. Returns NULL if
+ * it isn't, or if it can't be mapped.
+ */
+static const char* map_batch_file(FILE* file, size_t* size) {
+    struct stat st;
+    const int fd = fileno(file);
+    if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) || (st.st_size <= 0)) {
+        return NULL;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return NULL;
+    posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+    *size = st.st_size;
+    return data;
+}
+
+int start_batch(const char* path) {
+    FILE* file = stdin;
+    if (strcmp(path, "-") != 0) {
+        file = fopen(path, "rb");
+        if (file == NULL) {
+            fprintf(stderr, "mcalc4: cannot open '%s'\n", path);
+            return 1;
+        }
+    }
+
+    struct BatchState state = {
+        .astr = arachne_new_str(""),
+        .varset = new_varset(),
+        .formulas = MC4_formulas_new(),
+        .settings = settings_default(),
+    };
+    bool out_of_memory = false;
+    size_t size;
+    const char* data = map_batch_file(file, &size);
+    if (data != NULL) {
+        run_batch_mapped(data, size, &state);
+        munmap((void*)data, size);
+    } else {
+        out_of_memory = !run_batch_stream(file, &state);
+    }
+
+    MC4_formulas_free(state.formulas);
+    free_varset(&state.varset);
+    arachne_free(&state.astr);
+    if (file != stdin) fclose(file);
+    fflush(stdout);
+    if (out_of_memory) {
+        fprintf(stderr, "mcalc4: out of memory\n");
+        return 1;
+    }
+    return 0;
 }
@@ -1,7 +1,20 @@
 #ifndef MCALC4_CLI_H_
 #define MCALC4_CLI_H_
 
-void evaluate_all(const char* equations[], int num_equs);
+/**
+ * Evaluates every equation on `num_threads` threads (0 uses one per CPU) and
+ * prints the results in the order the equations were given.
+ */
+void evaluate_all(const char* equations[], int num_equs,
+                  unsigned int num_threads);
 void start_cli(void);
 
+/**
+ * Evaluates every line of `path` (or stdin if `path` is "-") without
+ * prompting, writing exactly one line of output per line of input. Returns the
+ * process exit status. Output is written a line at a time, so it is fastest if
+ * stdout is fully buffered.
+ */
+int start_batch(const char* path);
+
 #endif
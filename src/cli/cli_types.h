@@ -15,17 +15,24 @@ enum OutputMode {
 struct MC4_Settings {
     enum AngleMode angle_mode;
     enum OutputMode output_mode;
+    /* Significant digits of arbitrary precision evaluation, or 0 to evaluate
+    with doubles. */
+    unsigned int precision;
 };
 
 enum SetttingName {
     SETNAME_UNKOWN,
     SETNAME_ANGLE_MODE,
+    SETNAME_OUTPUT_MODE,
+    SETNAME_STATS,
+    SETNAME_PRECISION,
 };
 
 static struct MC4_Settings settings_default() {
     return (struct MC4_Settings){
         .angle_mode = ANGLE_MODE_RAD,
         .output_mode = OUTPUT_MODE_NORMAL,
+        .precision = 0,
     };
 }
 
@@ -1,9 +1,53 @@
 #include "cli/cli.h"
+#include "mcalc4/mcalc4_pool.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Size of the stdout buffer in batch mode. */
+#define BATCH_WRITE_SIZE (1 << 16)
+
+/**
+ * Reads the thread count of `-j`, which must be a whole number, clamped to
+ * `MC4_MAX_THREADS`.
+ */
+static bool read_num_threads(const char* arg, unsigned int* num_threads) {
+    /* `strtoul()` skips spaces and accepts a sign, which aren't counts. */
+    if (!isdigit((unsigned char)arg[0])) return false;
+    char* end;
+    errno = 0;
+    const unsigned long value = strtoul(arg, &end, 10);
+    if (*end != '\0') return false;
+    if ((errno == ERANGE) || (value > MC4_MAX_THREADS)) {
+        *num_threads = MC4_MAX_THREADS;
+    } else {
+        *num_threads = value;
+    }
+    return true;
+}
 
 int main(const int argc, const char* argv[]) {
+    if ((argc > 1) && (strcmp(argv[1], "--batch") == 0)) {
+        /* Nothing has been written yet, so the buffer can still change. */
+        setvbuf(stdout, NULL, _IOFBF, BATCH_WRITE_SIZE);
+        return start_batch((argc > 2) ? argv[2] : "-");
+    }
+    int first_equ = 1;
+    unsigned int num_threads = 1;
+    if ((argc > 2) && (strcmp(argv[1], "-j") == 0)) {
+        if (!read_num_threads(argv[2], &num_threads)) {
+            fprintf(stderr, "mcalc4: invalid number of threads '%s'\n",
+                    argv[2]);
+            return 1;
+        }
+        first_equ = 3;
+    }
     /* if `mcacl4` has command_line arguments */
-    if (argc > 1) {
-        evaluate_all(argv, argc);
+    if (argc > first_equ) {
+        evaluate_all(&argv[first_equ], argc - first_equ, num_threads);
     } else {
         start_cli();
     }
@@ -1,31 +1,30 @@
 #include "mcalc4.h"
 #include "../../libs/mlogging.h"
 #include "../cli/cli_types.h"
+#include "mcalc4_arena.h"
+#include "mcalc4_number.h"
+#include "mcalc4_stats.h"
 #include "mcalc4_types.h"
-#include <assert.h>
 #include <ctype.h>
 #include <float.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define ARR_SIZE(arr) ((sizeof(arr)) / (sizeof(arr[0])))
 
+/* `str` doesn't have to be null-terminated (it may point into a memory mapped
+file), so the reader never looks at or past `str[len]`. */
 struct StringReader {
     const char* str;
-    unsigned int pos;
+    size_t len;
+    size_t pos;
 };
 
-static struct StringReader new_string_reader(const char* s) {
-    return (struct StringReader){.str = s, .pos = 0};
-}
-
-/**
- * @brief Get next character.
- */
-static char reader_get_current(struct StringReader* reader) {
-    return reader->str[reader->pos];
+static struct StringReader new_string_reader(const char* s, size_t len) {
+    return (struct StringReader){.str = s, .len = len, .pos = 0};
 }
 
 /**
@@ -43,288 +42,408 @@ static void reader_move_back(struct StringReader* reader) {
 }
 
 /**
- * @brief Checks if `s1` is in `s2` at index `i`
+ * @brief Returns an empty `TokensList` with room for `capacity` tokens, taken
+ * from `arena`.
  */
-bool string_at(const char* s1, const char* s2, int i) {
-    return (strstr(&s2[i], s1) == &s2[i]);
+static struct TokensList new_list(struct MC4_Arena* arena, size_t capacity) {
+    struct TokensList list = {
+        .types = arena_alloc(arena, capacity + 1),
+        .values = arena_alloc(arena, capacity * sizeof(union TokenValue)),
+        .starts = arena_alloc(arena, (capacity + 1) * sizeof(unsigned int)),
+        .len = 0,
+    };
+    list.types[0] = TYPE_EMPTY;
+    list.starts[0] = 0;
+    return list;
 }
 
 /**
- * @brief Returns a new `TokensList` with position set to 0 and every token set
- * to empty.
- *
- * @return struct TokensList
+ * Appends `token`, which starts at `start`. `tokenize_n()` allocates one slot
+ * per input character, and every token consumes at least one character, so the
+ * list never fills up.
  */
-struct TokensList new_list() {
-    struct TokensList list;
-    list.tkns_pos = 0;
-    for (int i = 0; i < MAX_TOKENS; i++) {
-        list.tokens[i].type = TYPE_EMPTY;
-    }
-    return list;
+static void add_token(struct TokensList* list, struct Token token,
+                      size_t start) {
+    list->types[list->len] = token.type;
+    memcpy(&list->values[list->len], &token.value, sizeof(union TokenValue));
+    list->starts[list->len] = start;
+    list->types[++list->len] = TYPE_EMPTY;
 }
 
-void add_token(struct TokensList* list, struct Token token,
-               MC4_ErrorCode* err) {
-    if (list->tkns_pos >= MAX_TOKENS) {
-        *err = MC4_ERR_MAX_TOKENS;
-        return;
-    } else {
-        list->tokens[list->tkns_pos] = token;
-        list->tkns_pos++;
-    }
+/**
+ * Records where tokenizing stopped as the start of the terminator.
+ */
+static struct TokensList end_list(struct TokensList list, size_t pos) {
+    list.starts[list.len] = pos;
+    return list;
 }
 
-double read_num(struct StringReader* reader, MC4_ErrorCode* err) {
-    double whole_part = 0.0;
-    double decimal_part = 0.0;
-
-    while (isdigit(reader_get_current(reader))) {
-        whole_part = (whole_part * 10) + (reader_get_current(reader) - '0');
-        reader_advance(reader);
-    }
+/* Character classes used by the lexer. */
+enum CharClass {
+    CC_OTHER,
+    CC_SPACE,
+    CC_DIGIT,
+    CC_OPERATOR,
+    CC_PAR_LEFT,
+    CC_PAR_RIGHT,
+    CC_LETTER,
+};
 
-    double divisor = 10.0;
-    if (reader_get_current(reader) == '.') {
-        reader_advance(reader);
+/* Class of every byte, matching `isspace()`, `isdigit()` and `isalpha()` in
+the "C" locale, except that '_' is a letter too. */
+static const unsigned char CHAR_CLASSES[256] = {
+    [' '] = CC_SPACE,     ['\t'] = CC_SPACE,    ['\n'] = CC_SPACE,
+    ['\v'] = CC_SPACE,    ['\f'] = CC_SPACE,    ['\r'] = CC_SPACE,
+    ['0'] = CC_DIGIT,     ['1'] = CC_DIGIT,     ['2'] = CC_DIGIT,
+    ['3'] = CC_DIGIT,     ['4'] = CC_DIGIT,     ['5'] = CC_DIGIT,
+    ['6'] = CC_DIGIT,     ['7'] = CC_DIGIT,     ['8'] = CC_DIGIT,
+    ['9'] = CC_DIGIT,     ['+'] = CC_OPERATOR,  ['-'] = CC_OPERATOR,
+    ['*'] = CC_OPERATOR,  ['/'] = CC_OPERATOR,  ['^'] = CC_OPERATOR,
+    ['('] = CC_PAR_LEFT,  [')'] = CC_PAR_RIGHT, ['A'] = CC_LETTER,
+    ['B'] = CC_LETTER,    ['C'] = CC_LETTER,    ['D'] = CC_LETTER,
+    ['E'] = CC_LETTER,    ['F'] = CC_LETTER,    ['G'] = CC_LETTER,
+    ['H'] = CC_LETTER,    ['I'] = CC_LETTER,    ['J'] = CC_LETTER,
+    ['K'] = CC_LETTER,    ['L'] = CC_LETTER,    ['M'] = CC_LETTER,
+    ['N'] = CC_LETTER,    ['O'] = CC_LETTER,    ['P'] = CC_LETTER,
+    ['Q'] = CC_LETTER,    ['R'] = CC_LETTER,    ['S'] = CC_LETTER,
+    ['T'] = CC_LETTER,    ['U'] = CC_LETTER,    ['V'] = CC_LETTER,
+    ['W'] = CC_LETTER,    ['X'] = CC_LETTER,    ['Y'] = CC_LETTER,
+    ['Z'] = CC_LETTER,    ['a'] = CC_LETTER,    ['b'] = CC_LETTER,
+    ['c'] = CC_LETTER,    ['d'] = CC_LETTER,    ['e'] = CC_LETTER,
+    ['f'] = CC_LETTER,    ['g'] = CC_LETTER,    ['h'] = CC_LETTER,
+    ['i'] = CC_LETTER,    ['j'] = CC_LETTER,    ['k'] = CC_LETTER,
+    ['l'] = CC_LETTER,    ['m'] = CC_LETTER,    ['n'] = CC_LETTER,
+    ['o'] = CC_LETTER,    ['p'] = CC_LETTER,    ['q'] = CC_LETTER,
+    ['r'] = CC_LETTER,    ['s'] = CC_LETTER,    ['t'] = CC_LETTER,
+    ['u'] = CC_LETTER,    ['v'] = CC_LETTER,    ['w'] = CC_LETTER,
+    ['x'] = CC_LETTER,    ['y'] = CC_LETTER,    ['z'] = CC_LETTER,
+    ['_'] = CC_LETTER,
+};
 
-        while (isdigit(reader_get_current(reader)) ||
-               (reader_get_current(reader) == '.')) {
-            if (reader_get_current(reader) == '.') {
-                *err = MC4_ERR_NUM_FMT_ERR;
-                return 0;
-            } else {
-                decimal_part += (reader_get_current(reader) - '0') / divisor;
-                divisor *= 10;
-                reader_advance(reader);
-            }
-        }
-    }
-    return whole_part + decimal_part;
+static enum CharClass char_class(char ch) {
+    return CHAR_CLASSES[(unsigned char)ch];
 }
 
-bool is_func_str(const struct StringReader* reader) {
-    const char* FUNC_STRS[] = {"sin",    "cos", "tan", "arcsin", "arccos",
-                               "arctan", "log", "ln",  "sqrt"};
-    const int size = sizeof(FUNC_STRS) / sizeof(FUNC_STRS[0]);
-
-    for (int i = 0; i < size; i++) {
-        if (string_at(FUNC_STRS[i], reader->str, reader->pos)) {
-            return true;
-        }
-    }
-
-    return false;
+/**
+ * Reads the number literal at the reader's position.
+ */
+double read_num(struct StringReader* reader, MC4_ErrorCode* err) {
+    double value = 0;
+    reader->pos += parse_number(&reader->str[reader->pos],
+                                reader->len - reader->pos, &value, err);
+    return value;
 }
 
-enum FuncType funcstr_to_type(struct StringReader* reader) {
-    const char* FUNC_STRS[] = {"sin",    "cos", "tan", "arcsin", "arccos",
-                               "arctan", "log", "ln",  "sqrt"};
-
-    const enum FuncType FUNC_TYPES[] = {FN_SIN,    FN_COS,   FN_TAN,
-                                        FN_ASIN,   FN_ACOS,  FN_ATAN,
-                                        FN_LOG_10, FN_LOG_E, FN_SQRT};
+/* Functions and constants, which are matched with `KEYWORD_TRIE`. */
+static const struct {
+    const char* str;
+    struct Token token;
+    enum ConstType const_type;
+} KEYWORDS[] = {
+    {"sin", {.type = TYPE_FUNCTION, .func_type = FN_SIN}, CONST_NONE},
+    {"cos", {.type = TYPE_FUNCTION, .func_type = FN_COS}, CONST_NONE},
+    {"tan", {.type = TYPE_FUNCTION, .func_type = FN_TAN}, CONST_NONE},
+    {"arcsin", {.type = TYPE_FUNCTION, .func_type = FN_ASIN}, CONST_NONE},
+    {"arccos", {.type = TYPE_FUNCTION, .func_type = FN_ACOS}, CONST_NONE},
+    {"arctan", {.type = TYPE_FUNCTION, .func_type = FN_ATAN}, CONST_NONE},
+    {"log", {.type = TYPE_FUNCTION, .func_type = FN_LOG_10}, CONST_NONE},
+    {"ln", {.type = TYPE_FUNCTION, .func_type = FN_LOG_E}, CONST_NONE},
+    {"sqrt", {.type = TYPE_FUNCTION, .func_type = FN_SQRT}, CONST_NONE},
+    {"pi", {.type = TYPE_NUMBER, .value = M_PI}, CONST_PI},
+    {"e", {.type = TYPE_NUMBER, .value = M_E}, CONST_E},
+};
 
-    const int FN_STRS_SIZE = sizeof(FUNC_STRS) / sizeof(FUNC_STRS[0]);
-    const int FN_TYPES_SIZE = sizeof(FUNC_TYPES) / sizeof(FUNC_TYPES[0]);
+struct TrieNode {
+    char ch;
+    /* Index of the first child, or 0 if there are none. */
+    unsigned char child;
+    /* Index of the next child of the same parent, or 0 if there are none. */
+    unsigned char sibling;
+    /* 1 + index in `KEYWORDS` of the keyword ending here, or 0. */
+    unsigned char keyword;
+};
 
-    assert(FN_STRS_SIZE == FN_TYPES_SIZE);
+/* Trie of `KEYWORDS`, in breadth-first order with siblings sorted. Node 0 is
+the root. Must be updated along with `KEYWORDS`. */
+static const struct TrieNode KEYWORD_TRIE[] = {
+    {'\0', 1, 0, 0},  /* 0: "" */
+    {'a', 8, 2, 0},   /* 1: "a" */
+    {'c', 9, 3, 0},   /* 2: "c" */
+    {'e', 0, 4, 11},  /* 3: "e" */
+    {'l', 10, 5, 0},  /* 4: "l" */
+    {'p', 12, 6, 0},  /* 5: "p" */
+    {'s', 13, 7, 0},  /* 6: "s" */
+    {'t', 15, 0, 0},  /* 7: "t" */
+    {'r', 16, 0, 0},  /* 8: "ar" */
+    {'o', 17, 0, 0},  /* 9: "co" */
+    {'n', 0, 11, 8},  /* 10: "ln" */
+    {'o', 18, 0, 0},  /* 11: "lo" */
+    {'i', 0, 0, 10},  /* 12: "pi" */
+    {'i', 19, 14, 0}, /* 13: "si" */
+    {'q', 20, 0, 0},  /* 14: "sq" */
+    {'a', 21, 0, 0},  /* 15: "ta" */
+    {'c', 22, 0, 0},  /* 16: "arc" */
+    {'s', 0, 0, 2},   /* 17: "cos" */
+    {'g', 0, 0, 7},   /* 18: "log" */
+    {'n', 0, 0, 1},   /* 19: "sin" */
+    {'r', 25, 0, 0},  /* 20: "sqr" */
+    {'n', 0, 0, 3},   /* 21: "tan" */
+    {'c', 26, 23, 0}, /* 22: "arcc" */
+    {'s', 27, 24, 0}, /* 23: "arcs" */
+    {'t', 28, 0, 0},  /* 24: "arct" */
+    {'t', 0, 0, 9},   /* 25: "sqrt" */
+    {'o', 29, 0, 0},  /* 26: "arcco" */
+    {'i', 30, 0, 0},  /* 27: "arcsi" */
+    {'a', 31, 0, 0},  /* 28: "arcta" */
+    {'s', 0, 0, 5},   /* 29: "arccos" */
+    {'n', 0, 0, 4},   /* 30: "arcsin" */
+    {'n', 0, 0, 6},   /* 31: "arctan" */
+};
 
-    for (int i = 0; i < FN_STRS_SIZE; i++) {
-        if (string_at(FUNC_STRS[i], reader->str, reader->pos)) {
-            reader->pos += strlen(FUNC_STRS[i]);
-            return FUNC_TYPES[i];
+/**
+ * Returns the index in `KEYWORDS` of the `len` characters at `name`, or -1 if
+ * they aren't a keyword. The walk stops at the first character which leaves
+ * the trie, so names which don't start like a keyword cost one step.
+ */
+static int match_keyword(const char* name, size_t len) {
+    unsigned int node = 0;
+    for (size_t i = 0; i < len; i++) {
+        node = KEYWORD_TRIE[node].child;
+        while ((node != 0) && (KEYWORD_TRIE[node].ch != name[i])) {
+            node = KEYWORD_TRIE[node].sibling;
         }
+        if (node == 0) return -1;
     }
-
-    return -1;
+    return (int)KEYWORD_TRIE[node].keyword - 1;
 }
 
-const char* find_const_str(struct StringReader* reader) {
-    const char* const CONSTANTS[] = {"pi", "e"};
-    const int SIZE = sizeof(CONSTANTS) / sizeof(CONSTANTS[0]);
+bool is_keyword(const char* name, size_t len) {
+    return match_keyword(name, len) >= 0;
+}
 
-    for (int i = 0; i < SIZE; i++) {
-        if (string_at(CONSTANTS[i], reader->str, reader->pos)) {
-            return CONSTANTS[i];
+const char* func_type_to_str(enum FuncType func_type) {
+    for (size_t i = 0; i < ARR_SIZE(KEYWORDS); i++) {
+        if ((KEYWORDS[i].token.type == TYPE_FUNCTION) &&
+            (KEYWORDS[i].token.func_type == func_type)) {
+            return KEYWORDS[i].str;
         }
     }
-    return NULL;
-}
-
-double const_str_to_value(const char* s) {
-    if (strcmp(s, "pi") == 0) {
-        return M_PI;
-    } else if (strcmp(s, "e") == 0) {
-        return M_E;
-    }
-
-    return 0;
+    return "unknown";
 }
 
 /**
- * Advances reader until there is no more whitespace to read.
+ * Returns the position after the name (a letter followed by letters and
+ * digits) at `pos`.
  */
-static void reader_handle_whitespace(struct StringReader* reader) {
-    while (isspace(reader_get_current(reader))) {
-        reader_advance(reader);
+static size_t skip_name(const char* str, size_t len, size_t pos) {
+    while ((pos < len) && ((char_class(str[pos]) == CC_LETTER) ||
+                           (char_class(str[pos]) == CC_DIGIT))) {
+        pos++;
     }
+    return pos;
 }
 
-/**
- * Tokenizes all sequential operator characters such as '+' and '^'.
- */
-static void reader_handle_op(struct StringReader* reader,
-                             struct TokensList* list, MC4_ErrorCode* err) {
-    char current_ch = reader_get_current(reader);
-    while ((strchr("+-*/^", current_ch) != NULL) && (current_ch != '\0')) {
-        add_token(list, (struct Token){.type = TYPE_OPERATOR, .op = current_ch},
-                  err);
-        reader_advance(reader);
-        current_ch = reader_get_current(reader);
+bool match_constant(const char* name, size_t len, enum ConstType* const_type) {
+    const int keyword = match_keyword(name, skip_name(name, len, 0));
+    if ((keyword < 0) || (KEYWORDS[keyword].const_type == CONST_NONE)) {
+        return false;
     }
+    *const_type = KEYWORDS[keyword].const_type;
+    return true;
 }
 
 /**
- * When a digit is found, the value wil be read and added to tokens.
+ * Tokenizes the first `len` characters of `equ`, which doesn't need to be
+ * null-terminated. An error is written to `err`. The tokens are stored in the
+ * calling thread's arena and are valid until the thread tokenizes again.
+ *
+ * Every character is classified once through `CHAR_CLASSES`, and functions
+ * and constants are found by walking `KEYWORD_TRIE`, so tokenizing is linear in
+ * `len`. A name which isn't a keyword is a variable, and its token records
+ * where the name is in `equ`.
  */
-static void reader_handle_digit(struct StringReader* reader,
-                                struct TokensList* list, MC4_ErrorCode* err) {
-    if (isdigit(reader_get_current(reader))) {
-        double value = read_num(reader, err);
-        add_token(list, (struct Token){.type = TYPE_NUMBER, .value = value},
-                  err);
-    }
-}
+struct TokensList tokenize_n(const char* equ, size_t len, MC4_ErrorCode* err) {
+    /* `err` is optional. */
+    MC4_ErrorCode ignored_err = MC4_ERR_NONE;
+    if (err == NULL) err = &ignored_err;
+    struct MC4_Arena* arena = arena_for_thread();
+    arena_reset(arena);
+    struct TokensList tokens_list = new_list(arena, len);
+    struct StringReader reader = new_string_reader(equ, len);
 
-/**
- * Tokenizes all sequential parenthesis.
- */
-static void reader_handle_par(struct StringReader* reader,
-                              struct TokensList* list, MC4_ErrorCode* err) {
-    char current_ch = reader_get_current(reader);
-    while (current_ch == '(' || current_ch == ')') {
-        if (current_ch == '(') {
-            add_token(list, (struct Token){.type = TYPE_PAR_LEFT}, err);
-        } else {
-            add_token(list, (struct Token){.type = TYPE_PAR_RIGHT}, err);
+    while (reader.pos < len) {
+        const char ch = reader.str[reader.pos];
+        switch (char_class(ch)) {
+        case CC_SPACE: reader_advance(&reader); break;
+        case CC_OPERATOR:
+            add_token(&tokens_list,
+                      (struct Token){.type = TYPE_OPERATOR, .op = ch},
+                      reader.pos);
+            reader_advance(&reader);
+            break;
+        case CC_PAR_LEFT:
+            add_token(&tokens_list, (struct Token){.type = TYPE_PAR_LEFT},
+                      reader.pos);
+            reader_advance(&reader);
+            break;
+        case CC_PAR_RIGHT:
+            add_token(&tokens_list, (struct Token){.type = TYPE_PAR_RIGHT},
+                      reader.pos);
+            reader_advance(&reader);
+            break;
+        case CC_DIGIT:
+            {
+                const size_t start = reader.pos;
+                double value = read_num(&reader, err);
+                if ((*err) != MC4_ERR_NONE) {
+                    return end_list(tokens_list, reader.pos);
+                }
+                add_token(&tokens_list,
+                          (struct Token){.type = TYPE_NUMBER, .value = value},
+                          start);
+                break;
+            }
+        case CC_LETTER:
+            {
+                const size_t end = skip_name(equ, len, reader.pos);
+                const int keyword =
+                    match_keyword(&equ[reader.pos], end - reader.pos);
+                if (keyword >= 0) {
+                    add_token(&tokens_list, KEYWORDS[keyword].token,
+                              reader.pos);
+                } else {
+                    const struct MC4_Name name = {
+                        .start = reader.pos,
+                        .len = end - reader.pos,
+                    };
+                    add_token(&tokens_list,
+                              (struct Token){.type = TYPE_VARIABLE,
+                                             .name = name},
+                              reader.pos);
+                }
+                reader.pos = end;
+                break;
+            }
+        case CC_OTHER:
+            *err = MC4_ERR_UNEXPECTED_TOKEN;
+            return end_list(tokens_list, reader.pos);
         }
-        reader_advance(reader);
-        current_ch = reader_get_current(reader);
     }
-}
 
-/**
- * When the reader encounters a function, it will tokenize the function and add
- * it to `list.tokens`.
- */
-static bool reader_handle_func(struct StringReader* reader,
-                               struct TokensList* list, MC4_ErrorCode* err) {
-    if (is_func_str(reader)) {
-        enum FuncType func_type = funcstr_to_type(reader);
-        add_token(list,
-                  (struct Token){.type = TYPE_FUNCTION, .func_type = func_type},
-                  err);
-        return true;
-    }
-    return false;
+    return end_list(tokens_list, len);
 }
 
 /**
- * When the reader encounters a constant, it will tokenize the constant and add
- * it to `list.tokens`.
+ * Takes in string and tokenized it, writing to `list`. An error is
+ * written to `err`.
  */
-static bool reader_handle_const(struct StringReader* reader,
-                                struct TokensList* list, MC4_ErrorCode* err) {
-    const char* const_str = find_const_str(reader);
-    if (const_str != NULL) {
-        double value = const_str_to_value(const_str);
-        add_token(list, (struct Token){.type = TYPE_NUMBER, .value = value},
-                  err);
-        reader->pos += strlen(const_str);
-        return true;
-    }
-    return false;
+struct TokensList tokenize(const char* equ, MC4_ErrorCode* err) {
+    return tokenize_n(equ, strlen(equ), err);
 }
 
-/**
- * When the reader encounters a single letter which isn't part of a function or
- * constant.
- */
-static void reader_handle_var(struct StringReader* reader,
-                              struct TokensList* list, MC4_ErrorCode* err) {
-    if (isalpha(reader_get_current(reader))) {
-        add_token(list,
-                  (struct Token){.type = TYPE_VARIABLE,
-                                 .symbol = reader_get_current(reader)},
-                  err);
-        reader_advance(reader);
-    }
+static size_t skip_digits(const char* str, size_t len, size_t pos) {
+    while ((pos < len) && (char_class(str[pos]) == CC_DIGIT)) pos++;
+    return pos;
 }
 
 /**
- * Takes in string and tokenized it, writing to `list`. An error is
- * written to `err`.
+ * Returns the position after the number literal at `pos`, read the way
+ * `parse_number()` reads it, without converting it.
  */
-struct TokensList tokenize(const char* equ, MC4_ErrorCode* err) {
-    struct TokensList tokens_list = new_list();
-    const unsigned int EQU_LEN = strlen(equ);
-    struct StringReader reader = new_string_reader(equ);
-
-    while (reader.pos < EQU_LEN) {
-        reader_handle_whitespace(&reader);
-        reader_handle_op(&reader, &tokens_list, err);
-        reader_handle_digit(&reader, &tokens_list, err);
-        reader_handle_par(&reader, &tokens_list, err);
-        if (reader_handle_func(&reader, &tokens_list, err)) continue;
-        if (reader_handle_const(&reader, &tokens_list, err)) continue;
-        /* It is necessary to continue loop to avoid reading functions or
-        constants as variables. */
-        reader_handle_var(&reader, &tokens_list, err);
+static size_t skip_number(const char* str, size_t len, size_t pos) {
+    while ((pos < len) &&
+           ((char_class(str[pos]) == CC_DIGIT) || (str[pos] == '.'))) {
+        pos++;
     }
-
-    return tokens_list;
-}
-
-static struct MC4_VariableSet new_var_set() {
-    return (struct MC4_VariableSet){.exists_hashmap = {false},
-                                    .values_hashmap = {0}};
+    if ((pos >= len) || ((str[pos] != 'e') && (str[pos] != 'E'))) return pos;
+    size_t exp_pos = pos + 1;
+    if ((exp_pos < len) && ((str[exp_pos] == '+') || (str[exp_pos] == '-'))) {
+        exp_pos++;
+    }
+    const size_t exp_end = skip_digits(str, len, exp_pos);
+    return (exp_end > exp_pos) ? exp_end : pos;
 }
 
-static void load_vars(struct MC4_Result* result, struct MC4_VariableSet* vars) {
-    for (int i = 0; i < MC4_VARSET_SIZE; i++) {
-        if (vars->exists_hashmap[i]) {
-            set_var(&result->vars, key_to_letter(i), vars->values_hashmap[i]);
+unsigned int find_variables(const char* equ, size_t len,
+                            struct MC4_Name* names, unsigned int max_names) {
+    unsigned int num_names = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        const enum CharClass class = char_class(equ[pos]);
+        if (class == CC_DIGIT) {
+            pos = skip_number(equ, len, pos);
+        } else if (class == CC_LETTER) {
+            const size_t end = skip_name(equ, len, pos);
+            const struct MC4_Name name = {.start = pos, .len = end - pos};
+            pos = end;
+            if (match_keyword(&equ[name.start], name.len) >= 0) continue;
+            bool seen = false;
+            for (unsigned int i = 0; (i < num_names) && !seen; i++) {
+                seen = (names[i].len == name.len) &&
+                       (memcmp(&equ[names[i].start], &equ[name.start],
+                               name.len) == 0);
+            }
+            if (seen) continue;
+            if (num_names == max_names) return max_names + 1;
+            names[num_names++] = name;
+        } else {
+            pos++;
         }
     }
+    return num_names;
 }
 
 struct Parser {
-    struct Token* tokens;
+    const struct TokensList* tokens;
     unsigned int pos;
-    struct MC4_VariableSet* vars;
+    /* The text which was tokenized, which variable names point into. */
+    const char* equ;
+    /* Evaluating only reads `vars`. Compiling interns names into `symbols`
+    instead, and leaves `vars` NULL. */
+    const struct MC4_VariableSet* vars;
+    struct MC4_VariableSet* symbols;
+    /* Whether compiling folds constants, see `compiled_add_folded()`. */
+    bool fold;
+    /* Where the token which caused the first error starts. */
+    unsigned int err_pos;
 };
 
-struct Parser new_parser(struct TokensList* list,
-                         struct MC4_VariableSet* vars) {
+struct Parser new_parser(struct TokensList* list, const char* equ,
+                         const struct MC4_VariableSet* vars) {
     return (struct Parser){
-        .tokens = list->tokens,
+        .tokens = list,
         .pos = 0,
+        .equ = equ,
         .vars = vars,
+        .symbols = NULL,
+        .fold = true,
+        .err_pos = 0,
     };
 }
 
-struct Token* parser_get_current(struct Parser* parser) {
-    return &parser->tokens[parser->pos];
+/**
+ * Writes `code` to `err`, remembering where the current token starts if this is
+ * the first error.
+ */
+static void parser_error(struct Parser* parser, MC4_ErrorCode* err,
+                         MC4_ErrorCode code) {
+    if ((*err) == MC4_ERR_NONE) {
+        parser->err_pos = parser->tokens->starts[parser->pos];
+    }
+    *err = code;
+}
+
+struct Token parser_get_current(struct Parser* parser) {
+    return tokens_get(parser->tokens, parser->pos);
 }
 
 void parser_consume(struct Parser* parser, enum TokenType type,
                     MC4_ErrorCode* err) {
-    struct Token* current = parser_get_current(parser);
-    if (current->type == type) {
+    struct Token current = parser_get_current(parser);
+    if (current.type == type) {
         parser->pos++;
     } else {
-        *err = MC4_ERR_UNEXPECTED_TOKEN;
+        parser_error(parser, err, MC4_ERR_UNEXPECTED_TOKEN);
     }
 }
 
@@ -353,34 +472,58 @@ double convert_angle_units(double angle, enum AngleMode angle_mode) {
     }
 }
 
+/**
+ * Applies the function `func_type` to `value`.
+ */
+static double apply_func(enum FuncType func_type, double value,
+                         enum AngleMode angle_mode) {
+    stats_count_func(func_type);
+    switch (func_type) {
+    case FN_SIN: return sin(convert_angle_units(value, angle_mode));
+    case FN_COS: return cos(convert_angle_units(value, angle_mode));
+    case FN_TAN: return tan(convert_angle_units(value, angle_mode));
+    case FN_ASIN: return asin(value);
+    case FN_ACOS: return acos(value);
+    case FN_ATAN: return atan(value);
+    case FN_LOG_10: return log10(value);
+    case FN_LOG_E: return log(value);
+    case FN_SQRT: return sqrt(value);
+    }
+    return 0;
+}
+
+/**
+ * Applies the binary operator `op` to `lhs` and `rhs`.
+ */
+static double apply_op(char op, double lhs, double rhs) {
+    switch (op) {
+    case '+': return lhs + rhs;
+    case '-': return lhs - rhs;
+    case '*': return lhs * rhs;
+    case '/': return lhs / rhs;
+    case '^': return pow(lhs, rhs);
+    }
+    return 0;
+}
+
 double parse_func(struct Parser* parser, MC4_ErrorCode* err,
                   enum AngleMode angle_mode) {
-    struct Token* current = parser_get_current(parser);
-    if (current->type == TYPE_FUNCTION) {
+    struct Token current = parser_get_current(parser);
+    if (current.type == TYPE_FUNCTION) {
         parser_consume(parser, TYPE_FUNCTION, err);
         double value = parse_func(parser, err, angle_mode);
         if ((*err) != MC4_ERR_NONE) return 0;
-        switch (current->func_type) {
-        case FN_SIN: return sin(convert_angle_units(value, angle_mode));
-        case FN_COS: return cos(convert_angle_units(value, angle_mode));
-        case FN_TAN: return tan(convert_angle_units(value, angle_mode));
-        case FN_ASIN: return asin(value);
-        case FN_ACOS: return acos(value);
-        case FN_ATAN: return atan(value);
-        case FN_LOG_10: return log10(value);
-        case FN_LOG_E: return log(value);
-        case FN_SQRT: return sqrt(value);
-        }
-    } else if ((current->type == TYPE_PAR_LEFT) ||
-               (current->type == TYPE_NUMBER) ||
-               (current->type == TYPE_VARIABLE)) {
+        return apply_func(current.func_type, value, angle_mode);
+    } else if ((current.type == TYPE_PAR_LEFT) ||
+               (current.type == TYPE_NUMBER) ||
+               (current.type == TYPE_VARIABLE)) {
         double value = parse_numpar(parser, err, angle_mode);
         if ((*err) != MC4_ERR_NONE)
             return 0;
         else
             return value;
     } else {
-        *err = MC4_ERR_UNEXPECTED_TOKEN;
+        parser_error(parser, err, MC4_ERR_UNEXPECTED_TOKEN);
     }
     return 0;
 }
@@ -388,8 +531,8 @@ double parse_func(struct Parser* parser, MC4_ErrorCode* err,
 double parse_exp(struct Parser* parser, MC4_ErrorCode* err,
                  enum AngleMode angle_mode) {
     double value = parse_func(parser, err, angle_mode);
-    struct Token* current = parser_get_current(parser);
-    while (current->type == TYPE_OPERATOR && current->op == '^') {
+    struct Token current = parser_get_current(parser);
+    while (current.type == TYPE_OPERATOR && current.op == '^') {
         parser_consume(parser, TYPE_OPERATOR, err);
         value = pow(value, parse_func(parser, err, angle_mode));
         if ((*err) != MC4_ERR_NONE) return 0;
@@ -401,10 +544,10 @@ double parse_exp(struct Parser* parser, MC4_ErrorCode* err,
 double parse_multdiv(struct Parser* parser, MC4_ErrorCode* err,
                      enum AngleMode angle_mode) {
     double value = parse_exp(parser, err, angle_mode);
-    struct Token* current = parser_get_current(parser);
-    while (current->type == TYPE_OPERATOR &&
-           ((current->op == '*') || (current->op == '/'))) {
-        if (current->op == '*') {
+    struct Token current = parser_get_current(parser);
+    while (current.type == TYPE_OPERATOR &&
+           ((current.op == '*') || (current.op == '/'))) {
+        if (current.op == '*') {
             parser_consume(parser, TYPE_OPERATOR, err);
             value *= parse_exp(parser, err, angle_mode);
         } else {
@@ -420,10 +563,10 @@ double parse_multdiv(struct Parser* parser, MC4_ErrorCode* err,
 double parse_addsub(struct Parser* parser, MC4_ErrorCode* err,
                     enum AngleMode angle_mode) {
     double value = parse_multdiv(parser, err, angle_mode);
-    struct Token* current = parser_get_current(parser);
-    while (current->type == TYPE_OPERATOR &&
-           ((current->op == '+') || (current->op == '-'))) {
-        if (current->op == '+') {
+    struct Token current = parser_get_current(parser);
+    while (current.type == TYPE_OPERATOR &&
+           ((current.op == '+') || (current.op == '-'))) {
+        if (current.op == '+') {
             parser_consume(parser, TYPE_OPERATOR, err);
             value += parse_multdiv(parser, err, angle_mode);
         } else {
@@ -438,40 +581,44 @@ double parse_addsub(struct Parser* parser, MC4_ErrorCode* err,
 
 double parse_numpar(struct Parser* parser, MC4_ErrorCode* err,
                     enum AngleMode angle_mode) {
-    struct Token* current = parser_get_current(parser);
-    if (current->type == TYPE_NUMBER) {
+    struct Token current = parser_get_current(parser);
+    if (current.type == TYPE_NUMBER) {
         parser_consume(parser, TYPE_NUMBER, err);
-        return current->value;
-    } else if (current->type == TYPE_VARIABLE) {
-        int key = letter_to_key(current->symbol);
-        if (parser->vars->exists_hashmap[key]) {
+        return current.value;
+    } else if (current.type == TYPE_VARIABLE) {
+        const int slot = varset_find(
+            parser->vars, &parser->equ[current.name.start], current.name.len);
+        if ((slot >= 0) && parser->vars->exists[slot]) {
             parser_consume(parser, TYPE_VARIABLE, err);
-            return parser->vars->values_hashmap[key];
+            return parser->vars->values[slot];
         } else {
-            *err = MC4_ERR_VAR_NOT_FOUND;
+            parser_error(parser, err, MC4_ERR_VAR_NOT_FOUND);
             return 0;
         }
-    } else if (current->type == TYPE_PAR_LEFT) {
+    } else if (current.type == TYPE_PAR_LEFT) {
         parser_consume(parser, TYPE_PAR_LEFT, err);
         double value = parse_addsub(parser, err, angle_mode);
         parser_consume(parser, TYPE_PAR_RIGHT, err);
         return value;
     } else {
-        *err = MC4_ERR_UNEXPECTED_TOKEN;
+        parser_error(parser, err, MC4_ERR_UNEXPECTED_TOKEN);
         return 0;
     }
 }
 
 /**
  * Takes in a list of tokens, and parses the results, returning the result of
- * the expression as a double.
+ * the expression as a double. If there is an error, where it was found is
+ * written to `err_pos`.
  */
-double parse_tokens(struct TokensList* list, struct MC4_VariableSet* vars,
-                    MC4_ErrorCode* err, enum AngleMode angle_mode) {
-    struct Parser parser = new_parser(list, vars);
+double parse_tokens(struct TokensList* list, const char* equ,
+                    const struct MC4_VariableSet* vars, MC4_ErrorCode* err,
+                    unsigned int* err_pos, enum AngleMode angle_mode) {
+    struct Parser parser = new_parser(list, equ, vars);
     /* Recursive descent parser starts in terms of lowest order of operations.
      */
     double result = parse_addsub(&parser, err, angle_mode);
+    *err_pos = parser.err_pos;
     return result;
 }
 
@@ -483,14 +630,443 @@ double parse_tokens(struct TokensList* list, struct MC4_VariableSet* vars,
  * writtent to err.
  * @return result
  */
-struct MC4_Result MC4_evaluate(const char* equ, struct MC4_VariableSet* vars,
+struct MC4_Result MC4_evaluate(const char* equ,
+                               const struct MC4_VariableSet* vars,
                                struct MC4_Settings* settings) {
+    return MC4_evaluate_n(equ, strlen(equ), vars, settings);
+}
+
+struct MC4_Result MC4_evaluate_n(const char* equ, size_t len,
+                                 const struct MC4_VariableSet* vars,
+                                 struct MC4_Settings* settings) {
     struct MC4_Result result = new_result();
-    if (vars != NULL) load_vars(&result, vars);
     MC4_ErrorCode* err = &result.err_code;
-    struct TokensList tokens_list = tokenize(equ, err);
-    if ((*err) != MC4_ERR_NONE) return result;
-    result.value =
-        parse_tokens(&tokens_list, &result.vars, err, settings->angle_mode);
+    uint64_t start = stats_start();
+    struct TokensList tokens_list = tokenize_n(equ, len, err);
+    stats_end(STATS_TOKENIZE, start);
+    if ((*err) != MC4_ERR_NONE) {
+        result.err_pos = tokens_list.starts[tokens_list.len];
+        return result;
+    }
+    start = stats_start();
+    result.value = parse_tokens(&tokens_list, equ, vars, err, &result.err_pos,
+                                settings->angle_mode);
+    stats_end(STATS_PARSE, start);
     return result;
 }
+
+/* Compiling
+ *
+ * The compiler walks the same grammar as the `parse_*` functions above, but
+ * instead of computing values it emits nodes into a `MC4_Compiled`. Operands
+ * are always emitted before the node that uses them, so the nodes can be
+ * evaluated with a single forward loop.
+ *
+ * Constants are folded while emitting: a subexpression without variables
+ * always ends up as a single `NUMBER` node, emitted last. So when an operator
+ * or function finds that its operands are the last nodes and are numbers, it
+ * replaces them with its result instead of emitting a node. Folding uses the
+ * same `apply_op()` and `apply_func()` as evaluation, so results don't change
+ * by a single bit. Arbitrary precision evaluation compiles without folding,
+ * and reads every literal again from where its node says it is. */
+
+/**
+ * Appends `node` to `expr`, returning the index of the new node.
+ */
+static unsigned int compiled_add_node(struct MC4_Compiled* expr,
+                                      struct MC4_Node node) {
+    if (expr->num_nodes >= expr->capacity) {
+        expr->capacity = (expr->capacity == 0) ? 16 : (expr->capacity * 2);
+        expr->nodes =
+            realloc(expr->nodes, expr->capacity * sizeof(struct MC4_Node));
+        if (expr->nodes == NULL) MLOG.panic("Out of memory.");
+    }
+    expr->nodes[expr->num_nodes] = node;
+    return expr->num_nodes++;
+}
+
+/**
+ * Appends an `OPERATOR` or `FUNCTION` node to `expr`, or evaluates it right
+ * away if all of its operands are numbers and the parser folds constants.
+ * Returns the index of the node with the result.
+ */
+static unsigned int compiled_add_folded(const struct Parser* parser,
+                                        struct MC4_Compiled* expr,
+                                        struct MC4_Node node) {
+    if (!parser->fold) return compiled_add_node(expr, node);
+    struct MC4_Node* nodes = expr->nodes;
+    const unsigned int last = expr->num_nodes - 1;
+    if ((node.type == NODE_FUNCTION) && (node.lhs == last) &&
+        (nodes[last].type == NODE_NUMBER)) {
+        nodes[last].value =
+            apply_func(node.func_type, nodes[last].value, expr->angle_mode);
+        return last;
+    }
+    if ((node.type == NODE_OPERATOR) && (node.rhs == last) &&
+        (node.lhs == (last - 1)) && (nodes[last].type == NODE_NUMBER) &&
+        (nodes[last - 1].type == NODE_NUMBER)) {
+        nodes[last - 1].value =
+            apply_op(node.op, nodes[last - 1].value, nodes[last].value);
+        expr->num_nodes--;
+        return last - 1;
+    }
+    return compiled_add_node(expr, node);
+}
+
+static unsigned int compile_func(struct Parser* parser,
+                                 struct MC4_Compiled* expr,
+                                 MC4_ErrorCode* err);
+static unsigned int compile_exp(struct Parser* parser,
+                                struct MC4_Compiled* expr, MC4_ErrorCode* err);
+static unsigned int compile_multdiv(struct Parser* parser,
+                                    struct MC4_Compiled* expr,
+                                    MC4_ErrorCode* err);
+static unsigned int compile_addsub(struct Parser* parser,
+                                   struct MC4_Compiled* expr,
+                                   MC4_ErrorCode* err);
+static unsigned int compile_numpar(struct Parser* parser,
+                                   struct MC4_Compiled* expr,
+                                   MC4_ErrorCode* err);
+
+static unsigned int compile_func(struct Parser* parser,
+                                 struct MC4_Compiled* expr,
+                                 MC4_ErrorCode* err) {
+    struct Token current = parser_get_current(parser);
+    if (current.type == TYPE_FUNCTION) {
+        parser_consume(parser, TYPE_FUNCTION, err);
+        unsigned int arg = compile_func(parser, expr, err);
+        if ((*err) != MC4_ERR_NONE) return 0;
+        return compiled_add_folded(parser, expr,
+                                   (struct MC4_Node){.type = NODE_FUNCTION,
+                                                     .func_type =
+                                                         current.func_type,
+                                                     .lhs = arg});
+    } else if ((current.type == TYPE_PAR_LEFT) ||
+               (current.type == TYPE_NUMBER) ||
+               (current.type == TYPE_VARIABLE)) {
+        return compile_numpar(parser, expr, err);
+    } else {
+        parser_error(parser, err, MC4_ERR_UNEXPECTED_TOKEN);
+    }
+    return 0;
+}
+
+static unsigned int compile_exp(struct Parser* parser,
+                                struct MC4_Compiled* expr,
+                                MC4_ErrorCode* err) {
+    unsigned int lhs = compile_func(parser, expr, err);
+    if ((*err) != MC4_ERR_NONE) return 0;
+    struct Token current = parser_get_current(parser);
+    while (current.type == TYPE_OPERATOR && current.op == '^') {
+        parser_consume(parser, TYPE_OPERATOR, err);
+        unsigned int rhs = compile_func(parser, expr, err);
+        if ((*err) != MC4_ERR_NONE) return 0;
+        lhs = compiled_add_folded(parser, expr,
+                                  (struct MC4_Node){.type = NODE_OPERATOR,
+                                                    .op = '^',
+                                                    .lhs = lhs,
+                                                    .rhs = rhs});
+        current = parser_get_current(parser);
+    }
+    return lhs;
+}
+
+static unsigned int compile_multdiv(struct Parser* parser,
+                                    struct MC4_Compiled* expr,
+                                    MC4_ErrorCode* err) {
+    unsigned int lhs = compile_exp(parser, expr, err);
+    if ((*err) != MC4_ERR_NONE) return 0;
+    struct Token current = parser_get_current(parser);
+    while (current.type == TYPE_OPERATOR &&
+           ((current.op == '*') || (current.op == '/'))) {
+        const char op = current.op;
+        parser_consume(parser, TYPE_OPERATOR, err);
+        unsigned int rhs = compile_exp(parser, expr, err);
+        if ((*err) != MC4_ERR_NONE) return 0;
+        lhs = compiled_add_folded(parser, expr,
+                                  (struct MC4_Node){.type = NODE_OPERATOR,
+                                                    .op = op,
+                                                    .lhs = lhs,
+                                                    .rhs = rhs});
+        current = parser_get_current(parser);
+    }
+    return lhs;
+}
+
+static unsigned int compile_addsub(struct Parser* parser,
+                                   struct MC4_Compiled* expr,
+                                   MC4_ErrorCode* err) {
+    unsigned int lhs = compile_multdiv(parser, expr, err);
+    if ((*err) != MC4_ERR_NONE) return 0;
+    struct Token current = parser_get_current(parser);
+    while (current.type == TYPE_OPERATOR &&
+           ((current.op == '+') || (current.op == '-'))) {
+        const char op = current.op;
+        parser_consume(parser, TYPE_OPERATOR, err);
+        unsigned int rhs = compile_multdiv(parser, expr, err);
+        if ((*err) != MC4_ERR_NONE) return 0;
+        lhs = compiled_add_folded(parser, expr,
+                                  (struct MC4_Node){.type = NODE_OPERATOR,
+                                                    .op = op,
+                                                    .lhs = lhs,
+                                                    .rhs = rhs});
+        current = parser_get_current(parser);
+    }
+    return lhs;
+}
+
+static unsigned int compile_numpar(struct Parser* parser,
+                                   struct MC4_Compiled* expr,
+                                   MC4_ErrorCode* err) {
+    struct Token current = parser_get_current(parser);
+    if (current.type == TYPE_NUMBER) {
+        const unsigned int pos = parser->tokens->starts[parser->pos];
+        parser_consume(parser, TYPE_NUMBER, err);
+        return compiled_add_node(expr, (struct MC4_Node){.type = NODE_NUMBER,
+                                                         .value =
+                                                             current.value,
+                                                         .pos = pos});
+    } else if (current.type == TYPE_VARIABLE) {
+        const char* name = &parser->equ[current.name.start];
+        int slot;
+        if (parser->symbols != NULL) {
+            /* Whether the variable exists is checked when evaluating. */
+            slot = varset_intern(parser->symbols, name, current.name.len);
+        } else {
+            /* Without a set to intern into, the variable must exist now. */
+            slot = varset_find(parser->vars, name, current.name.len);
+            if ((slot < 0) || !parser->vars->exists[slot]) {
+                parser_error(parser, err, MC4_ERR_VAR_NOT_FOUND);
+                return 0;
+            }
+        }
+        parser_consume(parser, TYPE_VARIABLE, err);
+        return compiled_add_node(
+            expr, (struct MC4_Node){.type = NODE_VARIABLE, .slot = slot});
+    } else if (current.type == TYPE_PAR_LEFT) {
+        parser_consume(parser, TYPE_PAR_LEFT, err);
+        unsigned int value = compile_addsub(parser, expr, err);
+        parser_consume(parser, TYPE_PAR_RIGHT, err);
+        return value;
+    } else {
+        parser_error(parser, err, MC4_ERR_UNEXPECTED_TOKEN);
+        return 0;
+    }
+}
+
+/* Common subexpression elimination
+ *
+ * After compiling, nodes are renumbered in order, and a node which is
+ * structurally identical to an earlier one (same type, payload and renumbered
+ * operands) is dropped in favour of the earlier one. Operands are renumbered
+ * before the nodes that use them, so identical subtrees of any depth collapse
+ * into one in a single pass. `+` and `*` are commutative in floating point,
+ * so `x*y` and `y*x` are treated as the same node. */
+
+/**
+ * Returns the operands of `node` in a canonical order.
+ */
+static void node_operands(const struct MC4_Node* node, unsigned int* lhs,
+                          unsigned int* rhs) {
+    *lhs = node->lhs;
+    *rhs = (node->type == NODE_FUNCTION) ? 0 : node->rhs;
+    if ((node->type == NODE_OPERATOR) &&
+        ((node->op == '+') || (node->op == '*')) && (*lhs > *rhs)) {
+        *lhs = node->rhs;
+        *rhs = node->lhs;
+    }
+}
+
+/**
+ * Returns the payload of `node` as an integer, comparing numbers by their bits.
+ */
+static uint64_t node_payload(const struct MC4_Node* node) {
+    uint64_t bits = 0;
+    switch (node->type) {
+    case NODE_NUMBER: memcpy(&bits, &node->value, sizeof(bits)); break;
+    case NODE_VARIABLE: bits = node->slot; break;
+    case NODE_OPERATOR: bits = (unsigned char)node->op; break;
+    case NODE_FUNCTION: bits = node->func_type; break;
+    }
+    return bits;
+}
+
+static bool nodes_identical(const struct MC4_Node* a,
+                            const struct MC4_Node* b) {
+    unsigned int a_lhs, a_rhs, b_lhs, b_rhs;
+    node_operands(a, &a_lhs, &a_rhs);
+    node_operands(b, &b_lhs, &b_rhs);
+    return (a->type == b->type) && (node_payload(a) == node_payload(b)) &&
+           (a_lhs == b_lhs) && (a_rhs == b_rhs);
+}
+
+static uint64_t node_hash(const struct MC4_Node* node) {
+    unsigned int lhs, rhs;
+    node_operands(node, &lhs, &rhs);
+    uint64_t hash = node_payload(node) ^ ((uint64_t)node->type << 60);
+    hash = (hash ^ lhs) * UINT64_C(0x9E3779B97F4A7C15);
+    hash = (hash ^ rhs) * UINT64_C(0x9E3779B97F4A7C15);
+    return hash ^ (hash >> 32);
+}
+
+/**
+ * Removes every node of `expr` which repeats an earlier node, and records how
+ * many were removed in `expr->num_eliminated`.
+ */
+static void eliminate_common_subexpressions(struct MC4_Compiled* expr) {
+    const unsigned int num_nodes = expr->num_nodes;
+    unsigned int table_size = 16;
+    while (table_size < (num_nodes * 2)) table_size *= 2;
+    /* Open addressing table of new node indices + 1, 0 is an empty slot. */
+    unsigned int* table = calloc(table_size, sizeof(unsigned int));
+    /* New index of every old node. */
+    unsigned int* renumbered = malloc(num_nodes * sizeof(unsigned int));
+    if ((table == NULL) || (renumbered == NULL)) MLOG.panic("Out of memory.");
+
+    unsigned int num_kept = 0;
+    for (unsigned int i = 0; i < num_nodes; i++) {
+        struct MC4_Node node = expr->nodes[i];
+        if ((node.type == NODE_OPERATOR) || (node.type == NODE_FUNCTION)) {
+            node.lhs = renumbered[node.lhs];
+        }
+        if (node.type == NODE_OPERATOR) node.rhs = renumbered[node.rhs];
+
+        unsigned int slot = node_hash(&node) & (table_size - 1);
+        while ((table[slot] != 0) &&
+               !nodes_identical(&expr->nodes[table[slot] - 1], &node)) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (table[slot] == 0) {
+            /* Kept nodes only move towards the front, so node `i` is never
+            overwritten before it is read. */
+            expr->nodes[num_kept] = node;
+            table[slot] = ++num_kept;
+        }
+        renumbered[i] = table[slot] - 1;
+    }
+
+    expr->num_eliminated = num_nodes - num_kept;
+    expr->num_nodes = num_kept;
+    free(renumbered);
+    free(table);
+}
+
+/**
+ * Records the slot of every `VARIABLE` node in `expr->vars_read`. After
+ * `eliminate_common_subexpressions()`, every variable has exactly one node.
+ */
+static void collect_vars_read(struct MC4_Compiled* expr) {
+    unsigned int num_vars_read = 0;
+    for (unsigned int i = 0; i < expr->num_nodes; i++) {
+        if (expr->nodes[i].type == NODE_VARIABLE) num_vars_read++;
+    }
+    if (num_vars_read == 0) return;
+    expr->vars_read = malloc(num_vars_read * sizeof(int));
+    if (expr->vars_read == NULL) MLOG.panic("Out of memory.");
+    for (unsigned int i = 0; i < expr->num_nodes; i++) {
+        if (expr->nodes[i].type == NODE_VARIABLE) {
+            expr->vars_read[expr->num_vars_read++] = expr->nodes[i].slot;
+        }
+    }
+}
+
+struct MC4_Compiled* MC4_compile(const char* equ,
+                                 struct MC4_VariableSet* vars,
+                                 const struct MC4_Settings* settings,
+                                 MC4_ErrorCode* err) {
+    *err = MC4_ERR_NONE;
+    struct TokensList tokens_list = tokenize(equ, err);
+    if ((*err) != MC4_ERR_NONE) return NULL;
+    struct MC4_Compiled* expr = calloc(1, sizeof(struct MC4_Compiled));
+    if (expr == NULL) MLOG.panic("Out of memory.");
+    expr->angle_mode = (settings != NULL) ? settings->angle_mode
+                                          : settings_default().angle_mode;
+    struct Parser parser = new_parser(&tokens_list, equ, NULL);
+    parser.symbols = vars;
+    compile_addsub(&parser, expr, err);
+    if ((*err) != MC4_ERR_NONE) {
+        MC4_free_compiled(expr);
+        return NULL;
+    }
+    eliminate_common_subexpressions(expr);
+    collect_vars_read(expr);
+    return expr;
+}
+
+struct MC4_Compiled* compile_tokens_unfolded(
+    struct TokensList* list, const char* equ,
+    const struct MC4_VariableSet* vars, enum AngleMode angle_mode,
+    MC4_ErrorCode* err, unsigned int* err_pos) {
+    *err = MC4_ERR_NONE;
+    struct MC4_Compiled* expr = calloc(1, sizeof(struct MC4_Compiled));
+    if (expr == NULL) MLOG.panic("Out of memory.");
+    expr->angle_mode = angle_mode;
+    struct Parser parser = new_parser(list, equ, vars);
+    parser.fold = false;
+    compile_addsub(&parser, expr, err);
+    *err_pos = parser.err_pos;
+    if ((*err) != MC4_ERR_NONE) {
+        MC4_free_compiled(expr);
+        return NULL;
+    }
+    collect_vars_read(expr);
+    return expr;
+}
+
+/* Expressions with at most this many nodes are evaluated without allocating. */
+#define EVAL_STACK_REGS 64
+
+bool compiled_vars_defined(const struct MC4_Compiled* expr,
+                           const struct MC4_VariableSet* vars) {
+    for (unsigned int i = 0; i < expr->num_vars_read; i++) {
+        const int slot = expr->vars_read[i];
+        if ((vars == NULL) || ((unsigned int)slot >= vars->num_slots) ||
+            !vars->exists[slot]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+double MC4_eval_compiled(const struct MC4_Compiled* expr,
+                         const struct MC4_VariableSet* vars,
+                         MC4_ErrorCode* err) {
+    *err = MC4_ERR_NONE;
+    if (!compiled_vars_defined(expr, vars)) {
+        *err = MC4_ERR_VAR_NOT_FOUND;
+        return 0;
+    }
+
+    double stack_regs[EVAL_STACK_REGS];
+    double* regs = stack_regs;
+    if (expr->num_nodes > EVAL_STACK_REGS) {
+        regs = malloc(expr->num_nodes * sizeof(double));
+        if (regs == NULL) MLOG.panic("Out of memory.");
+    }
+
+    for (unsigned int i = 0; i < expr->num_nodes; i++) {
+        const struct MC4_Node* node = &expr->nodes[i];
+        switch (node->type) {
+        case NODE_NUMBER: regs[i] = node->value; break;
+        case NODE_VARIABLE: regs[i] = vars->values[node->slot]; break;
+        case NODE_OPERATOR:
+            regs[i] = apply_op(node->op, regs[node->lhs], regs[node->rhs]);
+            break;
+        case NODE_FUNCTION:
+            regs[i] = apply_func(node->func_type, regs[node->lhs],
+                                 expr->angle_mode);
+            break;
+        }
+    }
+
+    double value = regs[expr->num_nodes - 1];
+    if (regs != stack_regs) free(regs);
+    return value;
+}
+
+void MC4_free_compiled(struct MC4_Compiled* expr) {
+    if (expr == NULL) return;
+    free(expr->vars_read);
+    free(expr->nodes);
+    free(expr);
+}
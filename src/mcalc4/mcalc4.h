@@ -12,67 +12,43 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
 #include "../../libs/mlogging.h"
 #include "mcalc4_types.h"
+#include "mcalc4_varset.h"
 #include "../cli/cli_types.h"
 
-static struct MC4_VariableSet new_varset() {
-    return (struct MC4_VariableSet){
-        .values_hashmap = {0},
-        .exists_hashmap = {false},
-    };
-}
-
-static int letter_to_key(char ch) {
-    if (isupper(ch))
-        return ch - 'A';
-    else if (islower(ch)) {
-        return (ch - 'a') + MC4_VARSET_HALF_SIZE;
-    } else {
-        // MLOG.errorf("letter_to_key() - invalid letter: %c", ch);
-        return 0;
-    }
-}
-
-static char key_to_letter(int key) {
-    if ((key >= 0) && (key < MC4_VARSET_HALF_SIZE)) {
-        return key + 'A';
-    } else if ((key >= MC4_VARSET_HALF_SIZE) && (key < MC4_VARSET_SIZE)) {
-        return key - MC4_VARSET_HALF_SIZE + 'a';
-    } else {
-        // MLOG.errorf("key_to_letter() - invalid key: %d", key);
-        return 0;
-    }
-}
-
-static void set_var(struct MC4_VariableSet* vars, char var, double value) {
-    int key = letter_to_key(var);
-    vars->exists_hashmap[key] = true;
-    vars->values_hashmap[key] = value;
+static struct Token tokens_get(const struct TokensList* list,
+                               unsigned int i) {
+    struct Token token = {.type = list->types[i]};
+    memcpy(&token.value, &list->values[i], sizeof(union TokenValue));
+    return token;
 }
 
 typedef struct MC4_Result {
     double value;
     MC4_ErrorCode err_code;
-    struct MC4_VariableSet vars;
+    /* Where in the equation the error was found, if there was one. */
+    unsigned int err_pos;
 } MC4_Result;
 
 static MC4_Result new_result() {
     return (MC4_Result){
         .value = 0,
         .err_code = MC4_ERR_NONE,
-        .vars = new_varset(),
+        .err_pos = 0,
     };
 }
 
 static const char* _MC4_ErrorCode_to_str(MC4_ErrorCode code) {
     switch (code) {
     case MC4_ERR_NONE: return "No error";
-    case MC4_ERR_MAX_TOKENS: return "Max tokens";
     case MC4_ERR_NUM_FMT_ERR: return "Number formatting error";
     case MC4_ERR_VAR_NOT_FOUND: return "Variable not found";
+    case MC4_ERR_CYCLE: return "Circular variable reference";
     case MC4_ERR_UNEXPECTED_TOKEN: return "Unexpected token";
     }
+    return "Unknown error";
 }
 
 static const char* MC4_get_error_str(MC4_Result* result) {
@@ -83,6 +59,89 @@ static bool MC4_error_occured(MC4_Result* result) {
     return (result->err_code != MC4_ERR_NONE);
 }
 
-struct MC4_Result MC4_evaluate(const char* equ, struct MC4_VariableSet* vars, struct MC4_Settings* settings);
+/**
+ * Parses and evaluates tokens which `tokenize_n()` made from `equ`. Doesn't
+ * reset the tokenizer's arena, so the same tokens can be parsed many times.
+ */
+double parse_tokens(struct TokensList* list, const char* equ,
+                    const struct MC4_VariableSet* vars, MC4_ErrorCode* err,
+                    unsigned int* err_pos, enum AngleMode angle_mode);
+
+/**
+ * Evaluates `equ`, reading variables from `vars` (which may be NULL if there
+ * are none). `vars` is only borrowed: nothing is copied out of it, and the
+ * result is just the value or the error and where it was found.
+ */
+struct MC4_Result MC4_evaluate(const char* equ,
+                               const struct MC4_VariableSet* vars,
+                               struct MC4_Settings* settings);
+
+/**
+ * Same as `MC4_evaluate()`, but only reads the first `len` characters of
+ * `equ`, which doesn't need to be null-terminated.
+ */
+struct MC4_Result MC4_evaluate_n(const char* equ, size_t len,
+                                 const struct MC4_VariableSet* vars,
+                                 struct MC4_Settings* settings);
+
+/**
+ * Evaluates `num_equs` independent equations on `num_threads` threads (0 uses
+ * one thread per CPU), writing the result of `equs[i]` to `results[i]`. Every
+ * equation reads `vars`, exactly as with `MC4_evaluate()`.
+ */
+void MC4_evaluate_many(const char* equs[], size_t num_equs,
+                       const struct MC4_VariableSet* vars,
+                       struct MC4_Settings* settings, MC4_Result* results,
+                       unsigned int num_threads);
+
+/**
+ * Tokenizes and parses `equ` once, returning a reusable compiled expression
+ * with variable names resolved to slots of `vars`. Names which aren't in
+ * `vars` yet are added as undefined variables; if `vars` is NULL, reading a
+ * variable is an error. Every subexpression without variables is evaluated
+ * here, so the angle mode of `settings` (NULL uses the defaults) is fixed for
+ * the compiled expression. Repeated subexpressions are only kept once, see
+ * `MC4_Compiled.num_eliminated`. Returns NULL and writes to `err` if the
+ * expression is invalid. Free with `MC4_free_compiled()`.
+ */
+struct MC4_Compiled* MC4_compile(const char* equ,
+                                 struct MC4_VariableSet* vars,
+                                 const struct MC4_Settings* settings,
+                                 MC4_ErrorCode* err);
+
+/**
+ * Evaluates a compiled expression against `vars` (which may be NULL if it
+ * reads no variables, and must otherwise be the set it was compiled with)
+ * without tokenizing, parsing, or looking up names. `expr` is never modified,
+ * so it may be shared between threads.
+ */
+double MC4_eval_compiled(const struct MC4_Compiled* expr,
+                         const struct MC4_VariableSet* vars,
+                         MC4_ErrorCode* err);
+
+void MC4_free_compiled(struct MC4_Compiled* expr);
+
+/**
+ * Evaluates `equ` once per row, where row `i` binds every column's variable to
+ * `column.values[i]`. Variables without a column are read from `vars` (which
+ * may be NULL, and gets the names of the columns if they are new). Writes
+ * `num_rows` values to `results`.
+ */
+MC4_ErrorCode MC4_evaluate_batch(const char* equ,
+                                 const struct MC4_Column* columns,
+                                 size_t num_columns, size_t num_rows,
+                                 struct MC4_VariableSet* vars,
+                                 const struct MC4_Settings* settings,
+                                 double* results);
+
+/**
+ * Same as `MC4_evaluate_batch()`, but for an already compiled expression.
+ * `vars` must be the set it was compiled with.
+ */
+MC4_ErrorCode MC4_eval_compiled_batch(const struct MC4_Compiled* expr,
+                                      const struct MC4_Column* columns,
+                                      size_t num_columns, size_t num_rows,
+                                      const struct MC4_VariableSet* vars,
+                                      double* results);
 
 #endif
@@ -0,0 +1,94 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mcalc4_arena.h"
+#include "../../libs/mlogging.h"
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define ARENA_MIN_BLOCK_SIZE 4096
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+};
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static struct ArenaBlock* new_block(size_t size, struct ArenaBlock* next) {
+    struct ArenaBlock* block = malloc(sizeof(struct ArenaBlock) + size);
+    if (block == NULL) MLOG.panic("Out of memory.");
+    block->next = next;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void* arena_alloc(struct MC4_Arena* arena, size_t size) {
+    size = align_up(size);
+    struct ArenaBlock* head = arena->head;
+    if ((head == NULL) || ((head->size - head->used) < size)) {
+        size_t block_size = (head == NULL) ? ARENA_MIN_BLOCK_SIZE
+                                           : (head->size * 2);
+        if (block_size < size) block_size = size;
+        head = arena->head = new_block(block_size, head);
+    }
+    void* ptr = &head->data[head->used];
+    head->used += size;
+    return ptr;
+}
+
+void arena_reset(struct MC4_Arena* arena) {
+    struct ArenaBlock* head = arena->head;
+    if (head == NULL) return;
+    if (head->next == NULL) {
+        head->used = 0;
+        return;
+    }
+    size_t total = 0;
+    while (head != NULL) {
+        struct ArenaBlock* next = head->next;
+        total += head->size;
+        free(head);
+        head = next;
+    }
+    arena->head = new_block(total, NULL);
+}
+
+void arena_free(struct MC4_Arena* arena) {
+    struct ArenaBlock* head = arena->head;
+    while (head != NULL) {
+        struct ArenaBlock* next = head->next;
+        free(head);
+        head = next;
+    }
+    arena->head = NULL;
+}
+
+static _Thread_local struct MC4_Arena thread_arena;
+static _Thread_local bool thread_arena_registered;
+static pthread_key_t thread_arena_key;
+static pthread_once_t thread_arena_key_once = PTHREAD_ONCE_INIT;
+
+static void free_thread_arena(void* arena) {
+    arena_free(arena);
+}
+
+static void create_thread_arena_key(void) {
+    pthread_key_create(&thread_arena_key, free_thread_arena);
+}
+
+struct MC4_Arena* arena_for_thread(void) {
+    if (!thread_arena_registered) {
+        /* The key is only used so the arena gets freed at thread exit. */
+        pthread_once(&thread_arena_key_once, create_thread_arena_key);
+        pthread_setspecific(thread_arena_key, &thread_arena);
+        thread_arena_registered = true;
+    }
+    return &thread_arena;
+}
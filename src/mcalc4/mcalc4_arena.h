@@ -0,0 +1,35 @@
+#ifndef MCALCULATOR_VERSION_4_ARENA_H_
+#define MCALCULATOR_VERSION_4_ARENA_H_
+
+#include <stddef.h>
+
+struct ArenaBlock;
+
+/**
+ * A bump allocator for scratch memory which lives until the next reset.
+ * A zeroed `MC4_Arena` is a valid empty arena.
+ */
+struct MC4_Arena {
+    struct ArenaBlock* head;
+};
+
+/**
+ * Returns `size` bytes aligned for any type. Never returns NULL.
+ */
+void* arena_alloc(struct MC4_Arena* arena, size_t size);
+
+/**
+ * Makes all memory returned by `arena_alloc()` available again. If the last
+ * round needed more than one block, they are merged into one block big enough
+ * for the whole round, so steady-state use doesn't call `malloc()`.
+ */
+void arena_reset(struct MC4_Arena* arena);
+
+void arena_free(struct MC4_Arena* arena);
+
+/**
+ * Returns the calling thread's arena. It is freed when the thread exits.
+ */
+struct MC4_Arena* arena_for_thread(void);
+
+#endif
@@ -0,0 +1,166 @@
+#include "../../libs/mlogging.h"
+#include "../cli/cli_types.h"
+#include "mcalc4.h"
+#include "mcalc4_pool.h"
+#include "mcalc4_simd.h"
+#include "mcalc4_stats.h"
+#include "mcalc4_types.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Rows are evaluated in blocks of this size so that every node's values for
+the block stay in cache while the next node reads them. */
+#define BATCH_BLOCK_SIZE 256
+
+static void fill_block(double* block, double value) {
+    for (size_t i = 0; i < BATCH_BLOCK_SIZE; i++) block[i] = value;
+}
+
+MC4_ErrorCode MC4_eval_compiled_batch(const struct MC4_Compiled* expr,
+                                      const struct MC4_Column* columns,
+                                      size_t num_columns, size_t num_rows,
+                                      const struct MC4_VariableSet* vars,
+                                      double* results) {
+    const unsigned int num_nodes = expr->num_nodes;
+    const unsigned int num_slots = (vars != NULL) ? vars->num_slots : 0;
+    /* Column bound to every slot and to every node, or NULL. */
+    const struct MC4_Column** column_of_slot =
+        calloc(num_slots + 1, sizeof(struct MC4_Column*));
+    const struct MC4_Column** column_of_node =
+        calloc(num_nodes, sizeof(struct MC4_Column*));
+    if ((column_of_slot == NULL) || (column_of_node == NULL)) {
+        MLOG.panic("Out of memory.");
+    }
+    for (size_t i = 0; i < num_columns; i++) {
+        const int slot =
+            varset_find(vars, columns[i].name, strlen(columns[i].name));
+        if (slot >= 0) column_of_slot[slot] = &columns[i];
+    }
+    MC4_ErrorCode err = MC4_ERR_NONE;
+    for (unsigned int i = 0; i < num_nodes; i++) {
+        const int slot = expr->nodes[i].slot;
+        if (expr->nodes[i].type != NODE_VARIABLE) continue;
+        if ((unsigned int)slot >= num_slots) {
+            err = MC4_ERR_VAR_NOT_FOUND;
+        } else if (column_of_slot[slot] != NULL) {
+            column_of_node[i] = column_of_slot[slot];
+        } else if (!vars->exists[slot]) {
+            err = MC4_ERR_VAR_NOT_FOUND;
+        }
+    }
+    free(column_of_slot);
+    if (err != MC4_ERR_NONE) {
+        free(column_of_node);
+        return err;
+    }
+
+    const double to_rad =
+        (expr->angle_mode == ANGLE_MODE_DEG) ? (M_PI / 180) : 1;
+    double* regs = malloc(num_nodes * BATCH_BLOCK_SIZE * sizeof(double));
+    const double** inputs = malloc(num_nodes * sizeof(double*));
+    if ((regs == NULL) || (inputs == NULL)) MLOG.panic("Out of memory.");
+
+    /* Values which are the same for every row only need to be written once. */
+    for (unsigned int i = 0; i < num_nodes; i++) {
+        const struct MC4_Node* node = &expr->nodes[i];
+        double* block = &regs[i * BATCH_BLOCK_SIZE];
+        inputs[i] = block;
+        if (node->type == NODE_NUMBER) {
+            fill_block(block, node->value);
+        } else if ((node->type == NODE_VARIABLE) &&
+                   (column_of_node[i] == NULL)) {
+            fill_block(block, vars->values[node->slot]);
+        }
+    }
+
+    for (size_t start = 0; start < num_rows; start += BATCH_BLOCK_SIZE) {
+        const size_t len = ((num_rows - start) < BATCH_BLOCK_SIZE)
+                               ? (num_rows - start)
+                               : BATCH_BLOCK_SIZE;
+        for (unsigned int i = 0; i < num_nodes; i++) {
+            const struct MC4_Node* node = &expr->nodes[i];
+            /* The last node is written straight into `results`. */
+            double* out = (i == (num_nodes - 1))
+                              ? &results[start]
+                              : &regs[i * BATCH_BLOCK_SIZE];
+            switch (node->type) {
+            case NODE_NUMBER:
+            case NODE_VARIABLE:
+                if (column_of_node[i] != NULL) {
+                    inputs[i] = &column_of_node[i]->values[start];
+                }
+                if (i == (num_nodes - 1)) {
+                    memcpy(out, inputs[i], len * sizeof(double));
+                }
+                break;
+            case NODE_OPERATOR:
+                simd_apply_op(node->op, inputs[node->lhs], inputs[node->rhs],
+                              out, len);
+                inputs[i] = out;
+                break;
+            case NODE_FUNCTION:
+                simd_apply_func(node->func_type, inputs[node->lhs], out, len,
+                                to_rad);
+                stats_count_funcs(node->func_type, len);
+                inputs[i] = out;
+                break;
+            }
+        }
+    }
+
+    free(column_of_node);
+    free(inputs);
+    free(regs);
+    return MC4_ERR_NONE;
+}
+
+MC4_ErrorCode MC4_evaluate_batch(const char* equ,
+                                 const struct MC4_Column* columns,
+                                 size_t num_columns, size_t num_rows,
+                                 struct MC4_VariableSet* vars,
+                                 const struct MC4_Settings* settings,
+                                 double* results) {
+    /* Columns need slots even if the caller has no variable set. */
+    struct MC4_VariableSet local_vars = new_varset();
+    if (vars == NULL) vars = &local_vars;
+    MC4_ErrorCode err;
+    struct MC4_Compiled* expr = MC4_compile(equ, vars, settings, &err);
+    if (err == MC4_ERR_NONE) {
+        err = MC4_eval_compiled_batch(expr, columns, num_columns, num_rows,
+                                      vars, results);
+    }
+    MC4_free_compiled(expr);
+    free_varset(&local_vars);
+    return err;
+}
+
+struct EvaluateManyJob {
+    const char** equs;
+    const struct MC4_VariableSet* vars;
+    struct MC4_Settings* settings;
+    MC4_Result* results;
+};
+
+static void evaluate_many_task(void* ctx, size_t index) {
+    struct EvaluateManyJob* job = ctx;
+    job->results[index] =
+        MC4_evaluate(job->equs[index], job->vars, job->settings);
+}
+
+void MC4_evaluate_many(const char* equs[], size_t num_equs,
+                       const struct MC4_VariableSet* vars,
+                       struct MC4_Settings* settings, MC4_Result* results,
+                       unsigned int num_threads) {
+    if (num_equs == 0) return;
+    if (num_threads > num_equs) num_threads = num_equs;
+    struct MC4_ThreadPool* pool = pool_new(num_threads);
+    struct EvaluateManyJob job = {
+        .equs = equs,
+        .vars = vars,
+        .settings = settings,
+        .results = results,
+    };
+    pool_run(pool, num_equs, evaluate_many_task, &job);
+    pool_free(pool);
+}
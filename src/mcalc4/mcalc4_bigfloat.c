@@ -0,0 +1,1537 @@
+/* Arbitrary precision floating point.
+ *
+ * Mantissas are arrays of 32-bit limbs, so a product of two limbs and a carry
+ * fits 64 bits. Every operation works on the mantissas as integers, with at
+ * least a limb more than its result keeps, and rounds once at the end in
+ * `round_limbs()`.
+ *
+ * Multiplication is the only operation whose cost grows faster than the
+ * precision, so everything else is built on it: division and square roots
+ * with Newton's iteration, which costs a few multiplications at full
+ * precision because every step only needs half the precision of the next, and
+ * the elementary functions with Taylor series after argument reduction, whose
+ * terms mostly divide by small integers. */
+#include "mcalc4_bigfloat.h"
+#include "../../libs/mlogging.h"
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Mantissas at least this long are multiplied with Karatsuba's method. */
+#define BF_KARATSUBA_THRESHOLD 32
+
+/* Products of this many limbs or fewer are computed on the stack. */
+#define BF_STACK_LIMBS 64
+
+/* Binary exponents beyond this overflow to infinity or underflow to 0, which
+keeps exponent arithmetic far away from overflowing `int64_t`. */
+#define BF_MAX_EXPONENT (INT64_C(1) << 50)
+
+/* Arguments of trigonometric functions with more binary digits before the
+point than this would need too much precision to reduce, and give NaN. */
+#define BF_MAX_TRIG_EXPONENT 65536
+
+/* The angle is halved this many times before the series of `atan()`. */
+#define BF_ATAN_HALVINGS 4
+
+/* More steps than Newton's iteration can take for any length. */
+#define BF_MAX_NEWTON_STEPS 64
+
+/* Normal output switches to scientific notation outside of [1e-6, 1e21), as
+with `MC4_format()`, or further up for more digits. */
+#define BF_FIXED_MIN_DECIMAL_POINT -5
+#define BF_FIXED_MAX_DECIMAL_POINT 21
+
+/* sqrt(1/2) as a limb, below which a mantissa is doubled for `bf_log()`. */
+#define BF_SQRT_HALF_LIMB UINT32_C(0xB504F334)
+
+static int clz32(uint32_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clz(x);
+#else
+    int count = 0;
+    while ((x & (UINT32_C(1) << 31)) == 0) {
+        x <<= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+static uint32_t* alloc_limbs(size_t n) {
+    uint32_t* limbs = calloc((n > 0) ? n : 1, sizeof(uint32_t));
+    if (limbs == NULL) MLOG.panic("Out of memory.");
+    return limbs;
+}
+
+/**
+ * `r = a + b` for an `n`-limb `a` and an `m`-limb `b`, `m <= n`. Returns the
+ * carry out of `r[n - 1]`. `r` may be `a`.
+ */
+static uint32_t limbs_add(uint32_t* r, const uint32_t* a, size_t n,
+                          const uint32_t* b, size_t m) {
+    uint64_t carry = 0;
+    for (size_t i = 0; i < n; i++) {
+        carry += a[i];
+        if (i < m) carry += b[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    return (uint32_t)carry;
+}
+
+/**
+ * `r = a - b` for an `n`-limb `a` and an `m`-limb `b`, `m <= n`. Returns the
+ * borrow out of `r[n - 1]`. `r` may be `a`.
+ */
+static uint32_t limbs_sub(uint32_t* r, const uint32_t* a, size_t n,
+                          const uint32_t* b, size_t m) {
+    uint32_t borrow = 0;
+    for (size_t i = 0; i < n; i++) {
+        const uint64_t diff =
+            (uint64_t)a[i] - ((i < m) ? b[i] : 0) - borrow;
+        r[i] = (uint32_t)diff;
+        borrow = (uint32_t)(diff >> 63);
+    }
+    return borrow;
+}
+
+static void limbs_negate(uint32_t* r, size_t n) {
+    uint64_t carry = 1;
+    for (size_t i = 0; i < n; i++) {
+        carry += (uint32_t)~r[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+static void mul_schoolbook(uint32_t* r, const uint32_t* a, size_t na,
+                           const uint32_t* b, size_t nb) {
+    memset(r, 0, (na + nb) * sizeof(uint32_t));
+    for (size_t i = 0; i < na; i++) {
+        const uint64_t ai = a[i];
+        if (ai == 0) continue;
+        uint64_t carry = 0;
+        for (size_t j = 0; j < nb; j++) {
+            carry += (ai * b[j]) + r[i + j];
+            r[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        r[i + nb] = (uint32_t)carry;
+    }
+}
+
+/**
+ * Writes the `na + nb` limbs of `a * b` to `r`, which mustn't overlap either.
+ *
+ * Karatsuba's method splits both operands in half at `B^half`, and gets the
+ * middle of the product from `(a0 + a1)(b0 + b1) - a0 b0 - a1 b1`, so it
+ * takes three half length products instead of four.
+ */
+static void mul_limbs(uint32_t* r, const uint32_t* a, size_t na,
+                      const uint32_t* b, size_t nb) {
+    if (na < nb) {
+        const uint32_t* swap = a;
+        a = b, b = swap;
+        const size_t swap_len = na;
+        na = nb, nb = swap_len;
+    }
+    if (nb < BF_KARATSUBA_THRESHOLD) {
+        mul_schoolbook(r, a, na, b, nb);
+        return;
+    }
+    const size_t half = (na + 1) / 2;
+    if (nb <= half) {
+        /* Too unbalanced to split both, so `b` is multiplied by pieces of `a`
+        as long as itself. */
+        memset(r, 0, (na + nb) * sizeof(uint32_t));
+        uint32_t* piece = alloc_limbs(2 * nb);
+        for (size_t i = 0; i < na; i += nb) {
+            const size_t len = ((na - i) < nb) ? (na - i) : nb;
+            mul_limbs(piece, b, nb, &a[i], len);
+            limbs_add(&r[i], &r[i], na + nb - i, piece, nb + len);
+        }
+        free(piece);
+        return;
+    }
+
+    const size_t na1 = na - half, nb1 = nb - half;
+    /* `a0 b0` and `a1 b1` go straight into their places in `r`. */
+    mul_limbs(r, a, half, b, half);
+    mul_limbs(&r[2 * half], &a[half], na1, &b[half], nb1);
+
+    uint32_t* sums = alloc_limbs(2 * (half + 1));
+    uint32_t* sum_a = sums;
+    uint32_t* sum_b = &sums[half + 1];
+    sum_a[half] = limbs_add(sum_a, a, half, &a[half], na1);
+    sum_b[half] = limbs_add(sum_b, b, half, &b[half], nb1);
+    size_t middle_len = 2 * (half + 1);
+    uint32_t* middle = alloc_limbs(middle_len);
+    mul_limbs(middle, sum_a, half + 1, sum_b, half + 1);
+    limbs_sub(middle, middle, middle_len, r, 2 * half);
+    limbs_sub(middle, middle, middle_len, &r[2 * half], na1 + nb1);
+    /* The middle fits what is left of the product above `B^half`. */
+    while (middle_len > (na + nb - half)) middle_len--;
+    limbs_add(&r[half], &r[half], na + nb - half, middle, middle_len);
+    free(middle);
+    free(sums);
+}
+
+size_t bf_len_for_digits(unsigned int digits) {
+    /* log2(10) bits per digit, and two limbs to spare. */
+    const double bits = ceil(digits * 3.3219280948873623) + 64;
+    return (size_t)((bits + 31) / 32);
+}
+
+void bf_init(struct MC4_BigFloat* x, size_t len) {
+    *x = (struct MC4_BigFloat){
+        .kind = BF_ZERO,
+        .negative = false,
+        .exponent = 0,
+        .limbs = alloc_limbs(len),
+        .len = len,
+    };
+}
+
+void bf_free(struct MC4_BigFloat* x) {
+    free(x->limbs);
+    *x = (struct MC4_BigFloat){0};
+}
+
+static void set_special(struct MC4_BigFloat* r, enum BigFloatKind kind,
+                        bool negative) {
+    r->kind = kind;
+    r->negative = negative && (kind != BF_NAN);
+    r->exponent = 0;
+}
+
+/* Turns exponents out of range into infinity or 0. */
+static void check_range(struct MC4_BigFloat* r) {
+    if (r->kind != BF_FINITE) return;
+    if (r->exponent > BF_MAX_EXPONENT) {
+        set_special(r, BF_INF, r->negative);
+    } else if (r->exponent < -BF_MAX_EXPONENT) {
+        set_special(r, BF_ZERO, r->negative);
+    }
+}
+
+/**
+ * Limb `i` of the `n`-limb `w` shifted left by `shift` bits, where limbs
+ * outside of `w` are 0.
+ */
+static uint32_t shifted_limb(const uint32_t* w, size_t n, int shift,
+                             ptrdiff_t i) {
+    const uint32_t hi = ((i >= 0) && (i < (ptrdiff_t)n)) ? w[i] : 0;
+    if (shift == 0) return hi;
+    const uint32_t lo = ((i >= 1) && (i <= (ptrdiff_t)n)) ? w[i - 1] : 0;
+    return (hi << shift) | (lo >> (32 - shift));
+}
+
+/**
+ * Rounds the `n`-limb mantissa `w`, which doesn't need to be normalized, to
+ * the nearest number with the precision of `r`, so that `r` is
+ * `(w / 2^(32n)) * 2^exponent`. `w` mustn't be `r->limbs`.
+ */
+static void round_limbs(struct MC4_BigFloat* r, bool negative,
+                        int64_t exponent, const uint32_t* w, size_t n) {
+    while ((n > 0) && (w[n - 1] == 0)) {
+        n--;
+        exponent -= 32;
+    }
+    if (n == 0) {
+        set_special(r, BF_ZERO, false);
+        return;
+    }
+    const int shift = clz32(w[n - 1]);
+    const ptrdiff_t offset = (ptrdiff_t)n - (ptrdiff_t)r->len;
+    for (size_t i = 0; i < r->len; i++) {
+        r->limbs[i] = shifted_limb(w, n, shift, offset + (ptrdiff_t)i);
+    }
+    exponent -= shift;
+    if (shifted_limb(w, n, shift, offset - 1) & (UINT32_C(1) << 31)) {
+        uint64_t carry = 1;
+        for (size_t i = 0; (i < r->len) && (carry != 0); i++) {
+            carry += r->limbs[i];
+            r->limbs[i] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry != 0) {
+            r->limbs[r->len - 1] = UINT32_C(1) << 31;
+            exponent++;
+        }
+    }
+    r->kind = BF_FINITE;
+    r->negative = negative;
+    r->exponent = exponent;
+    check_range(r);
+}
+
+void bf_set(struct MC4_BigFloat* r, const struct MC4_BigFloat* x) {
+    if (r == x) return;
+    if (x->kind == BF_FINITE) {
+        round_limbs(r, x->negative, x->exponent, x->limbs, x->len);
+    } else {
+        set_special(r, x->kind, x->negative);
+    }
+}
+
+void bf_set_u64(struct MC4_BigFloat* r, uint64_t value) {
+    const uint32_t w[2] = {(uint32_t)value, (uint32_t)(value >> 32)};
+    round_limbs(r, false, 64, w, 2);
+}
+
+void bf_set_double(struct MC4_BigFloat* r, double value) {
+    if (isnan(value)) {
+        set_special(r, BF_NAN, false);
+        return;
+    }
+    if (isinf(value) || (value == 0)) {
+        set_special(r, isinf(value) ? BF_INF : BF_ZERO, signbit(value));
+        return;
+    }
+    int exponent;
+    const double mantissa = frexp(fabs(value), &exponent);
+    bf_set_u64(r, (uint64_t)ldexp(mantissa, 64));
+    r->exponent += exponent - 64;
+    r->negative = signbit(value);
+}
+
+/**
+ * Points `view` at `limb`, holding the small integer `value`, so it can be an
+ * operand without allocating.
+ */
+static void view_u32(struct MC4_BigFloat* view, uint32_t* limb,
+                     uint32_t value) {
+    *view = (struct MC4_BigFloat){.kind = BF_ZERO, .limbs = limb, .len = 1};
+    if (value == 0) return;
+    const int shift = clz32(value);
+    *limb = value << shift;
+    view->kind = BF_FINITE;
+    view->exponent = 32 - shift;
+}
+
+double bf_to_double(const struct MC4_BigFloat* x) {
+    const double sign = x->negative ? -1 : 1;
+    switch (x->kind) {
+    case BF_NAN: return NAN;
+    case BF_INF: return sign * INFINITY;
+    case BF_ZERO: return sign * 0.0;
+    case BF_FINITE: break;
+    }
+    if (x->exponent > 2000) return sign * INFINITY;
+    if (x->exponent < -2000) return sign * 0.0;
+    uint64_t top = (uint64_t)x->limbs[x->len - 1] << 32;
+    if (x->len > 1) top |= x->limbs[x->len - 2];
+    return sign * ldexp((double)top, (int)x->exponent - 64);
+}
+
+/**
+ * Compares the magnitudes of the finite `a` and `b`, returning a negative
+ * number, 0 or a positive number.
+ */
+static int cmp_abs(const struct MC4_BigFloat* a, const struct MC4_BigFloat* b) {
+    if (a->exponent != b->exponent) return (a->exponent < b->exponent) ? -1 : 1;
+    const size_t len = (a->len > b->len) ? a->len : b->len;
+    for (size_t i = 1; i <= len; i++) {
+        const uint32_t x = (i <= a->len) ? a->limbs[a->len - i] : 0;
+        const uint32_t y = (i <= b->len) ? b->limbs[b->len - i] : 0;
+        if (x != y) return (x < y) ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Adds `a` and `b`, with `b` negated if `b_negative` differs from its sign.
+ * The mantissas are lined up in a buffer a limb longer than any of the
+ * numbers, so the sum only loses bits of the smaller operand that are far
+ * below the precision of the result.
+ */
+static void add_signed(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+                       bool a_negative, const struct MC4_BigFloat* b,
+                       bool b_negative) {
+    if ((a->kind == BF_NAN) || (b->kind == BF_NAN)) {
+        set_special(r, BF_NAN, false);
+        return;
+    }
+    if (a->kind == BF_INF) {
+        const bool opposite = (b->kind == BF_INF) && (a_negative != b_negative);
+        set_special(r, opposite ? BF_NAN : BF_INF, a_negative);
+        return;
+    }
+    if ((b->kind == BF_INF) || (a->kind == BF_ZERO)) {
+        if ((b->kind == BF_ZERO)) {
+            set_special(r, BF_ZERO, a_negative && b_negative);
+            return;
+        }
+        bf_set(r, b);
+        r->negative = b_negative;
+        return;
+    }
+    if (b->kind == BF_ZERO) {
+        bf_set(r, a);
+        r->negative = a_negative;
+        return;
+    }
+
+    /* `x` has the larger exponent. */
+    const struct MC4_BigFloat* x = a;
+    const struct MC4_BigFloat* y = b;
+    bool x_negative = a_negative, y_negative = b_negative;
+    if (a->exponent < b->exponent) {
+        x = b, y = a;
+        x_negative = b_negative, y_negative = a_negative;
+    }
+    size_t n = (x->len > y->len) ? x->len : y->len;
+    if (r->len > n) n = r->len;
+    n++;
+    /* Both mantissas, with the top of `x` at limb `n - 1` and a limb above it
+    for the carry. */
+    uint32_t stack[2 * BF_STACK_LIMBS];
+    uint32_t* w = ((2 * (n + 1)) <= (2 * BF_STACK_LIMBS))
+                      ? stack
+                      : alloc_limbs(2 * (n + 1));
+    memset(w, 0, 2 * (n + 1) * sizeof(uint32_t));
+    uint32_t* v = &w[n + 1];
+    memcpy(&w[n - x->len], x->limbs, x->len * sizeof(uint32_t));
+    const uint64_t shift = (uint64_t)(x->exponent - y->exponent);
+    if (shift < (32 * (uint64_t)n)) {
+        /* Where bit 0 of limb `k` of `y` goes in `v`. */
+        const int64_t start = ((int64_t)(n - y->len) * 32) - (int64_t)shift;
+        for (size_t k = 0; k < y->len; k++) {
+            const int64_t pos = start + (32 * (int64_t)k);
+            if (pos <= -32) continue;
+            if (pos < 0) {
+                v[0] |= y->limbs[k] >> (-pos);
+                continue;
+            }
+            const int bit = (int)(pos % 32);
+            v[pos / 32] |= y->limbs[k] << bit;
+            if (bit > 0) v[(pos / 32) + 1] |= y->limbs[k] >> (32 - bit);
+        }
+    }
+    bool negative = x_negative;
+    if (x_negative == y_negative) {
+        limbs_add(w, w, n + 1, v, n + 1);
+    } else if (limbs_sub(w, w, n + 1, v, n + 1) != 0) {
+        limbs_negate(w, n + 1);
+        negative = !negative;
+    }
+    round_limbs(r, negative, x->exponent + 32, w, n + 1);
+    if (w != stack) free(w);
+}
+
+void bf_add(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+            const struct MC4_BigFloat* b) {
+    add_signed(r, a, a->negative, b, b->negative);
+}
+
+void bf_sub(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+            const struct MC4_BigFloat* b) {
+    add_signed(r, a, a->negative, b, !b->negative);
+}
+
+/**
+ * Skips the limbs of `x` below what a result of `keep` limbs needs, and the
+ * zero limbs at the bottom of the rest, which integers and short constants
+ * have plenty of. Returns the number of limbs left.
+ */
+static size_t significant_limbs(const struct MC4_BigFloat* x, size_t keep,
+                                const uint32_t** limbs) {
+    size_t len = x->len;
+    *limbs = x->limbs;
+    if (len > keep) {
+        *limbs += len - keep;
+        len = keep;
+    }
+    while ((*limbs)[0] == 0) {
+        (*limbs)++;
+        len--;
+    }
+    return len;
+}
+
+void bf_mul(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+            const struct MC4_BigFloat* b) {
+    const bool negative = a->negative != b->negative;
+    if ((a->kind == BF_NAN) || (b->kind == BF_NAN)) {
+        set_special(r, BF_NAN, false);
+        return;
+    }
+    if ((a->kind == BF_INF) || (b->kind == BF_INF)) {
+        const bool zero = (a->kind == BF_ZERO) || (b->kind == BF_ZERO);
+        set_special(r, zero ? BF_NAN : BF_INF, negative);
+        return;
+    }
+    if ((a->kind == BF_ZERO) || (b->kind == BF_ZERO)) {
+        set_special(r, BF_ZERO, negative);
+        return;
+    }
+    const uint32_t *x, *y;
+    const size_t nx = significant_limbs(a, r->len + 1, &x);
+    const size_t ny = significant_limbs(b, r->len + 1, &y);
+    uint32_t stack[BF_STACK_LIMBS];
+    uint32_t* product =
+        ((nx + ny) <= BF_STACK_LIMBS) ? stack : alloc_limbs(nx + ny);
+    mul_limbs(product, x, nx, y, ny);
+    round_limbs(r, negative, a->exponent + b->exponent, product, nx + ny);
+    if (product != stack) free(product);
+}
+
+/* Divides by a small integer with one pass of long division. */
+static void div_u32(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+                    uint32_t d) {
+    if (a->kind != BF_FINITE) {
+        bf_set(r, a);
+        return;
+    }
+    const size_t n = r->len + 2;
+    uint32_t stack[BF_STACK_LIMBS];
+    uint32_t* q = (n <= BF_STACK_LIMBS) ? stack : alloc_limbs(n);
+    memset(q, 0, n * sizeof(uint32_t));
+    const size_t len = (a->len < n) ? a->len : n;
+    memcpy(&q[n - len], &a->limbs[a->len - len], len * sizeof(uint32_t));
+    uint64_t rem = 0;
+    for (size_t i = n; i-- > 0;) {
+        const uint64_t current = (rem << 32) | q[i];
+        q[i] = (uint32_t)(current / d);
+        rem = current % d;
+    }
+    round_limbs(r, a->negative, a->exponent, q, n);
+    if (q != stack) free(q);
+}
+
+void bf_mul_2exp(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+                 int64_t power) {
+    bf_set(r, a);
+    if (r->kind != BF_FINITE) return;
+    if (power > (2 * BF_MAX_EXPONENT)) power = 2 * BF_MAX_EXPONENT;
+    if (power < (-2 * BF_MAX_EXPONENT)) power = -2 * BF_MAX_EXPONENT;
+    r->exponent += power;
+    check_range(r);
+}
+
+/**
+ * Writes the lengths Newton's iteration works at to `lengths`, ending with
+ * `len`. Every step about doubles the number of correct bits, so each length
+ * is a bit over half the next. Returns the number of lengths.
+ */
+static size_t newton_lengths(size_t len,
+                             size_t lengths[BF_MAX_NEWTON_STEPS]) {
+    size_t count = 0;
+    lengths[count++] = len;
+    while (len > 2) {
+        len = (len / 2) + 1;
+        lengths[count++] = len;
+    }
+    for (size_t i = 0; i < (count / 2); i++) {
+        const size_t swap = lengths[i];
+        lengths[i] = lengths[count - 1 - i];
+        lengths[count - 1 - i] = swap;
+    }
+    return count;
+}
+
+/* Moves `x` to a new length, keeping its value. */
+static void resize(struct MC4_BigFloat* x, size_t len) {
+    struct MC4_BigFloat resized;
+    bf_init(&resized, len);
+    bf_set(&resized, x);
+    bf_free(x);
+    *x = resized;
+}
+
+/* Writes `1 / m` to `r`, for `m` in [0.5, 1). */
+static void reciprocal(struct MC4_BigFloat* r, const struct MC4_BigFloat* m) {
+    uint32_t one_limb;
+    struct MC4_BigFloat one;
+    view_u32(&one, &one_limb, 1);
+    size_t lengths[BF_MAX_NEWTON_STEPS];
+    const size_t count = newton_lengths(r->len + 1, lengths);
+    struct MC4_BigFloat x, t;
+    bf_init(&x, lengths[0]);
+    bf_set_double(&x, 1 / bf_to_double(m));
+    for (size_t i = 0; i < count; i++) {
+        resize(&x, lengths[i]);
+        bf_init(&t, lengths[i]);
+        /* x + x(1 - mx) */
+        bf_mul(&t, m, &x);
+        bf_sub(&t, &one, &t);
+        bf_mul(&t, &x, &t);
+        bf_add(&x, &x, &t);
+        bf_free(&t);
+    }
+    bf_set(r, &x);
+    bf_free(&x);
+}
+
+void bf_div(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+            const struct MC4_BigFloat* b) {
+    const bool negative = a->negative != b->negative;
+    if ((a->kind == BF_NAN) || (b->kind == BF_NAN)) {
+        set_special(r, BF_NAN, false);
+        return;
+    }
+    if (a->kind == BF_INF) {
+        set_special(r, (b->kind == BF_INF) ? BF_NAN : BF_INF, negative);
+        return;
+    }
+    if (b->kind == BF_INF) {
+        set_special(r, BF_ZERO, negative);
+        return;
+    }
+    if (b->kind == BF_ZERO) {
+        set_special(r, (a->kind == BF_ZERO) ? BF_NAN : BF_INF, negative);
+        return;
+    }
+    if (a->kind == BF_ZERO) {
+        set_special(r, BF_ZERO, negative);
+        return;
+    }
+    /* The mantissa of `b`, in [0.5, 1), shares the limbs of `b`. */
+    struct MC4_BigFloat m = *b;
+    m.negative = false;
+    m.exponent = 0;
+    const int64_t b_exponent = b->exponent;
+    struct MC4_BigFloat inverse;
+    bf_init(&inverse, r->len + 1);
+    reciprocal(&inverse, &m);
+    bf_mul(r, a, &inverse);
+    r->negative = negative;
+    bf_mul_2exp(r, r, -b_exponent);
+    bf_free(&inverse);
+}
+
+void bf_sqrt(struct MC4_BigFloat* r, const struct MC4_BigFloat* x) {
+    if ((x->kind == BF_NAN) || (x->negative && (x->kind != BF_ZERO))) {
+        set_special(r, BF_NAN, false);
+        return;
+    }
+    if (x->kind != BF_FINITE) {
+        bf_set(r, x);
+        return;
+    }
+    /* x = m * 4^k, with m in [0.25, 1). */
+    const int64_t k = (x->exponent + (x->exponent & 1)) / 2;
+    struct MC4_BigFloat m = *x;
+    m.exponent = x->exponent - (2 * k);
+
+    uint32_t one_limb;
+    struct MC4_BigFloat one;
+    view_u32(&one, &one_limb, 1);
+    size_t lengths[BF_MAX_NEWTON_STEPS];
+    const size_t count = newton_lengths(r->len + 1, lengths);
+    struct MC4_BigFloat y, t;
+    bf_init(&y, lengths[0]);
+    bf_set_double(&y, 1 / sqrt(bf_to_double(&m)));
+    for (size_t i = 0; i < count; i++) {
+        resize(&y, lengths[i]);
+        bf_init(&t, lengths[i]);
+        /* y + y(1 - my^2)/2 */
+        bf_mul(&t, &y, &y);
+        bf_mul(&t, &m, &t);
+        bf_sub(&t, &one, &t);
+        bf_mul(&t, &y, &t);
+        bf_mul_2exp(&t, &t, -1);
+        bf_add(&y, &y, &t);
+        bf_free(&t);
+    }
+    /* sqrt(m) = m / sqrt(m) */
+    bf_mul(&y, &m, &y);
+    bf_mul_2exp(r, &y, k);
+    bf_free(&y);
+}
+
+/**
+ * Checks if adding `term` to `sum` can no longer change it at the precision
+ * of `sum`, which ends a series.
+ */
+static bool negligible(const struct MC4_BigFloat* term,
+                       const struct MC4_BigFloat* sum) {
+    if (term->kind == BF_ZERO) return true;
+    if (sum->kind != BF_FINITE) return false;
+    return term->exponent < (sum->exponent - (32 * (int64_t)sum->len) - 2);
+}
+
+/* Writes `atan(1/n)` to `r` from its series, which only divides by small
+integers. */
+static void atan_inverse(struct MC4_BigFloat* r, uint32_t n) {
+    struct MC4_BigFloat power, term;
+    bf_init(&power, r->len);
+    bf_init(&term, r->len);
+    bf_set_u64(&power, 1);
+    div_u32(&power, &power, n);
+    bf_set(r, &power);
+    for (uint32_t i = 3;; i += 2) {
+        div_u32(&power, &power, n * n);
+        div_u32(&term, &power, i);
+        if (negligible(&term, r)) break;
+        if ((i % 4) == 3) {
+            bf_sub(r, r, &term);
+        } else {
+            bf_add(r, r, &term);
+        }
+    }
+    bf_free(&term);
+    bf_free(&power);
+}
+
+/* Machin's formula, pi = 16 atan(1/5) - 4 atan(1/239). */
+static void compute_pi(struct MC4_BigFloat* r) {
+    struct MC4_BigFloat t;
+    bf_init(&t, r->len);
+    atan_inverse(r, 5);
+    bf_mul_2exp(r, r, 4);
+    atan_inverse(&t, 239);
+    bf_mul_2exp(&t, &t, 2);
+    bf_sub(r, r, &t);
+    bf_free(&t);
+}
+
+/* e = 1 + 1/1! + 1/2! + ... */
+static void compute_e(struct MC4_BigFloat* r) {
+    struct MC4_BigFloat term;
+    bf_init(&term, r->len);
+    bf_set_u64(&term, 1);
+    bf_set_u64(r, 1);
+    for (uint32_t i = 1;; i++) {
+        div_u32(&term, &term, i);
+        if (negligible(&term, r)) break;
+        bf_add(r, r, &term);
+    }
+    bf_free(&term);
+}
+
+/* ln(2) = 2 atanh(1/3) = 2 (1/3 + 1/(3 3^3) + 1/(5 3^5) + ...) */
+static void compute_ln2(struct MC4_BigFloat* r) {
+    struct MC4_BigFloat power, term;
+    bf_init(&power, r->len);
+    bf_init(&term, r->len);
+    bf_set_u64(&power, 1);
+    div_u32(&power, &power, 3);
+    bf_set(r, &power);
+    for (uint32_t i = 3;; i += 2) {
+        div_u32(&power, &power, 9);
+        div_u32(&term, &power, i);
+        if (negligible(&term, r)) break;
+        bf_add(r, r, &term);
+    }
+    bf_mul_2exp(r, r, 1);
+    bf_free(&term);
+    bf_free(&power);
+}
+
+static void compute_ln10(struct MC4_BigFloat* r) {
+    struct MC4_BigFloat ten;
+    bf_init(&ten, 1);
+    bf_set_u64(&ten, 10);
+    bf_log(r, &ten);
+    bf_free(&ten);
+}
+
+/* A constant, computed at the highest precision asked for so far. */
+struct ConstantCache {
+    pthread_mutex_t lock;
+    void (*compute)(struct MC4_BigFloat* r);
+    struct MC4_BigFloat value;
+};
+
+static struct ConstantCache pi_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .compute = compute_pi,
+};
+static struct ConstantCache e_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .compute = compute_e,
+};
+static struct ConstantCache ln2_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .compute = compute_ln2,
+};
+static struct ConstantCache ln10_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .compute = compute_ln10,
+};
+
+/**
+ * Writes the constant of `cache` to `r`, computing it first if it hasn't been
+ * computed with a limb more than `r` keeps yet.
+ */
+static void cached_constant(struct ConstantCache* cache,
+                            struct MC4_BigFloat* r) {
+    pthread_mutex_lock(&cache->lock);
+    if (cache->value.len < (r->len + 1)) {
+        bf_free(&cache->value);
+        bf_init(&cache->value, r->len + 1);
+        cache->compute(&cache->value);
+    }
+    bf_set(r, &cache->value);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void bf_pi(struct MC4_BigFloat* r) {
+    cached_constant(&pi_cache, r);
+}
+
+void bf_e(struct MC4_BigFloat* r) {
+    cached_constant(&e_cache, r);
+}
+
+/**
+ * Checks if the finite or zero `x` is an integer.
+ */
+static bool is_integer(const struct MC4_BigFloat* x) {
+    if (x->kind == BF_ZERO) return true;
+    if ((x->kind != BF_FINITE) || (x->exponent <= 0)) return false;
+    if (x->exponent >= (32 * (int64_t)x->len)) return true;
+    const size_t fraction_bits = (32 * x->len) - (size_t)x->exponent;
+    for (size_t i = 0; i < (fraction_bits / 32); i++) {
+        if (x->limbs[i] != 0) return false;
+    }
+    const uint32_t mask = (UINT32_C(1) << (fraction_bits % 32)) - 1;
+    return (x->limbs[fraction_bits / 32] & mask) == 0;
+}
+
+/* Bit `bit` (of value `2^bit`) of the integer `x`. */
+static unsigned int integer_bit(const struct MC4_BigFloat* x, int64_t bit) {
+    if (x->kind != BF_FINITE) return 0;
+    const int64_t pos = (32 * (int64_t)x->len) - x->exponent + bit;
+    if ((pos < 0) || (pos >= (32 * (int64_t)x->len))) return 0;
+    return (x->limbs[pos / 32] >> (pos % 32)) & 1;
+}
+
+/* The magnitude of the integer `x`, which must be below 2^64. */
+static uint64_t integer_to_u64(const struct MC4_BigFloat* x) {
+    if (x->kind != BF_FINITE) return 0;
+    uint64_t top = (uint64_t)x->limbs[x->len - 1] << 32;
+    if (x->len > 1) top |= x->limbs[x->len - 2];
+    return top >> (64 - x->exponent);
+}
+
+/* Rounds `x` to the nearest integer, with halfway cases away from 0. */
+static void round_integer(struct MC4_BigFloat* r,
+                          const struct MC4_BigFloat* x) {
+    if ((x->kind != BF_FINITE) || (x->exponent >= (32 * (int64_t)x->len))) {
+        bf_set(r, x);
+        return;
+    }
+    if (x->exponent < 0) {
+        set_special(r, BF_ZERO, false);
+        return;
+    }
+    /* |x| + 1/2 is exact a limb longer, and its integer part is the answer. */
+    uint32_t half_limb;
+    struct MC4_BigFloat half;
+    view_u32(&half, &half_limb, 1);
+    half.exponent = 0;
+    struct MC4_BigFloat t;
+    bf_init(&t, x->len + 1);
+    add_signed(&t, x, false, &half, false);
+    const int64_t fraction_bits = (32 * (int64_t)t.len) - t.exponent;
+    for (int64_t i = 0; i < (fraction_bits / 32); i++) t.limbs[i] = 0;
+    if (fraction_bits > 0) {
+        t.limbs[fraction_bits / 32] &=
+            ~((UINT32_C(1) << (fraction_bits % 32)) - 1);
+    }
+    t.negative = x->negative;
+    bf_set(r, &t);
+    bf_free(&t);
+}
+
+/* `a^n` by repeated squaring. */
+static void pow_u64(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+                    uint64_t n) {
+    struct MC4_BigFloat base, result;
+    bf_init(&base, r->len);
+    bf_init(&result, r->len);
+    bf_set(&base, a);
+    bf_set_u64(&result, 1);
+    while (n > 0) {
+        if (n & 1) bf_mul(&result, &result, &base);
+        n >>= 1;
+        if (n > 0) bf_mul(&base, &base, &base);
+    }
+    bf_set(r, &result);
+    bf_free(&result);
+    bf_free(&base);
+}
+
+/* Limbs for repeated squaring up to `n` to keep `len` limbs. */
+static size_t pow_len(size_t len, uint64_t n) {
+    size_t bits = 0;
+    while (n > 0) {
+        bits++;
+        n >>= 1;
+    }
+    return len + 1 + (bits / 32) + 1;
+}
+
+/* `10^power`, with enough precision to be right to the length of `r`. */
+static void power_of_ten(struct MC4_BigFloat* r, int64_t power) {
+    const uint64_t n = (power < 0) ? -(uint64_t)power : (uint64_t)power;
+    uint32_t ten_limb;
+    struct MC4_BigFloat ten, t;
+    view_u32(&ten, &ten_limb, 10);
+    bf_init(&t, pow_len(r->len, n));
+    pow_u64(&t, &ten, n);
+    if (power < 0) {
+        uint32_t one_limb;
+        struct MC4_BigFloat one;
+        view_u32(&one, &one_limb, 1);
+        bf_div(&t, &one, &t);
+    }
+    bf_set(r, &t);
+    bf_free(&t);
+}
+
+void bf_exp(struct MC4_BigFloat* r, const struct MC4_BigFloat* x) {
+    if (x->kind == BF_NAN) {
+        set_special(r, BF_NAN, false);
+        return;
+    }
+    if (x->kind == BF_ZERO) {
+        bf_set_u64(r, 1);
+        return;
+    }
+    if ((x->kind == BF_INF) || (x->exponent > 52)) {
+        set_special(r, x->negative ? BF_ZERO : BF_INF, false);
+        return;
+    }
+    /* x = k ln(2) + y with |y| <= ln(2)/2, and y is halved `halvings` times
+    so the series converges in few terms. Squaring the sum back loses a bit
+    each time, which the extra limbs make up for. */
+    const double k = nearbyint(bf_to_double(x) / log(2.0));
+    const unsigned int halvings = (unsigned int)sqrt(32.0 * r->len);
+    const size_t len = r->len + 4 + (halvings / 32);
+    struct MC4_BigFloat y, t, sum, term;
+    bf_init(&y, len);
+    bf_init(&t, len);
+    bf_init(&sum, len);
+    bf_init(&term, len);
+    cached_constant(&ln2_cache, &t);
+    bf_set_double(&y, k);
+    bf_mul(&t, &y, &t);
+    bf_sub(&y, x, &t);
+    bf_mul_2exp(&y, &y, -(int64_t)halvings);
+
+    bf_set_u64(&sum, 1);
+    bf_set_u64(&term, 1);
+    for (uint32_t i = 1;; i++) {
+        bf_mul(&term, &term, &y);
+        div_u32(&term, &term, i);
+        if (negligible(&term, &sum)) break;
+        bf_add(&sum, &sum, &term);
+    }
+    for (unsigned int i = 0; i < halvings; i++) bf_mul(&sum, &sum, &sum);
+    bf_mul_2exp(r, &sum, (int64_t)k);
+    bf_free(&term);
+    bf_free(&sum);
+    bf_free(&t);
+    bf_free(&y);
+}
+
+void bf_log(struct MC4_BigFloat* r, const struct MC4_BigFloat* x) {
+    if ((x->kind == BF_NAN) || (x->negative && (x->kind != BF_ZERO))) {
+        set_special(r, BF_NAN, false);
+        return;
+    }
+    if (x->kind != BF_FINITE) {
+        set_special(r, BF_INF, x->kind == BF_ZERO);
+        return;
+    }
+    struct MC4_BigFloat m = *x;
+    m.exponent = 0;
+    int64_t k = x->exponent;
+    if (m.limbs[m.len - 1] < BF_SQRT_HALF_LIMB) {
+        m.exponent = 1;
+        k--;
+    }
+    /* ln(m) = 2 atanh(u) = 2 (u + u^3/3 + u^5/5 + ...), u = (m - 1)/(m + 1).
+    `m - 1` is exact, so logarithms close to 0 keep their precision. */
+    const size_t len = r->len + 3;
+    uint32_t one_limb;
+    struct MC4_BigFloat one;
+    view_u32(&one, &one_limb, 1);
+    struct MC4_BigFloat u, u2, sum, term;
+    bf_init(&u, len);
+    bf_init(&u2, len);
+    bf_init(&sum, len);
+    bf_init(&term, len);
+    bf_sub(&u, &m, &one);
+    bf_add(&u2, &m, &one);
+    bf_div(&u, &u, &u2);
+    bf_mul(&u2, &u, &u);
+    bf_set(&sum, &u);
+    for (uint32_t i = 3; u.kind != BF_ZERO; i += 2) {
+        bf_mul(&u, &u, &u2);
+        div_u32(&term, &u, i);
+        if (negligible(&term, &sum)) break;
+        bf_add(&sum, &sum, &term);
+    }
+    bf_mul_2exp(&sum, &sum, 1);
+    if (k != 0) {
+        cached_constant(&ln2_cache, &term);
+        bf_set_double(&u, (double)k);
+        bf_mul(&term, &term, &u);
+        bf_add(&sum, &sum, &term);
+    }
+    bf_set(r, &sum);
+    bf_free(&term);
+    bf_free(&sum);
+    bf_free(&u2);
+    bf_free(&u);
+}
+
+void bf_log10(struct MC4_BigFloat* r, const struct MC4_BigFloat* x) {
+    struct MC4_BigFloat ln10;
+    bf_init(&ln10, r->len + 1);
+    cached_constant(&ln10_cache, &ln10);
+    bf_log(r, x);
+    bf_div(r, r, &ln10);
+    bf_free(&ln10);
+}
+
+void bf_pow(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+            const struct MC4_BigFloat* b) {
+    if (b->kind == BF_ZERO) {
+        bf_set_u64(r, 1);
+        return;
+    }
+    if ((a->kind == BF_NAN) || (b->kind == BF_NAN)) {
+        set_special(r, BF_NAN, false);
+        return;
+    }
+    const bool integer = is_integer(b);
+    if (integer && (b->exponent <= 63)) {
+        /* Integer powers by squaring, which keeps the sign of negative bases
+        and the exactness of small powers. */
+        const uint64_t n = integer_to_u64(b);
+        struct MC4_BigFloat t;
+        bf_init(&t, pow_len(r->len, n));
+        pow_u64(&t, a, n);
+        if (b->negative) {
+            uint32_t one_limb;
+            struct MC4_BigFloat one;
+            view_u32(&one, &one_limb, 1);
+            bf_div(&t, &one, &t);
+        }
+        bf_set(r, &t);
+        bf_free(&t);
+        return;
+    }
+    /* Odd integers this large only exist with a lot of precision. */
+    const bool negative =
+        a->negative && integer && (integer_bit(b, 0) != 0);
+    if (a->negative && !integer && (a->kind == BF_FINITE) &&
+        (b->kind == BF_FINITE)) {
+        set_special(r, BF_NAN, false);
+        return;
+    }
+    if (b->kind == BF_INF) {
+        uint32_t one_limb;
+        struct MC4_BigFloat one;
+        view_u32(&one, &one_limb, 1);
+        const int cmp = (a->kind == BF_FINITE) ? cmp_abs(a, &one)
+                        : (a->kind == BF_INF) ? 1
+                                                : -1;
+        if (cmp == 0) {
+            bf_set_u64(r, 1);
+        } else {
+            set_special(r, ((cmp > 0) != b->negative) ? BF_INF : BF_ZERO,
+                        false);
+        }
+        return;
+    }
+    if (a->kind != BF_FINITE) {
+        /* 0 or infinity to a finite power. */
+        const bool inf = (a->kind == BF_INF) != b->negative;
+        set_special(r, inf ? BF_INF : BF_ZERO, negative);
+        return;
+    }
+    /* exp(b ln|a|), where b ln|a| needs enough limbs to keep the precision of
+    its fraction. */
+    struct MC4_BigFloat t, magnitude = *a;
+    magnitude.negative = false;
+    bf_init(&t, r->len + 3);
+    bf_log(&t, &magnitude);
+    bf_mul(&t, &t, b);
+    bf_exp(r, &t);
+    r->negative = negative && (r->kind != BF_NAN);
+    bf_free(&t);
+}
+
+/* Negates `x`, except for 0, which stays positive. */
+static void negate(struct MC4_BigFloat* x) {
+    if ((x->kind == BF_FINITE) || (x->kind == BF_INF)) {
+        x->negative = !x->negative;
+    }
+}
+
+/* sin(y) = y - y^3/3! + y^5/5! - ... */
+static void sin_series(struct MC4_BigFloat* r, const struct MC4_BigFloat* y) {
+    struct MC4_BigFloat y2, term;
+    bf_init(&y2, r->len);
+    bf_init(&term, r->len);
+    bf_mul(&y2, y, y);
+    bf_set(&term, y);
+    bf_set(r, y);
+    for (uint32_t i = 2;; i += 2) {
+        bf_mul(&term, &term, &y2);
+        div_u32(&term, &term, i * (i + 1));
+        negate(&term);
+        if (negligible(&term, r)) break;
+        bf_add(r, r, &term);
+    }
+    bf_free(&term);
+    bf_free(&y2);
+}
+
+/* cos(y) = 1 - y^2/2! + y^4/4! - ... */
+static void cos_series(struct MC4_BigFloat* r, const struct MC4_BigFloat* y) {
+    struct MC4_BigFloat y2, term;
+    bf_init(&y2, r->len);
+    bf_init(&term, r->len);
+    bf_mul(&y2, y, y);
+    bf_set_u64(&term, 1);
+    bf_set_u64(r, 1);
+    for (uint32_t i = 1;; i += 2) {
+        bf_mul(&term, &term, &y2);
+        div_u32(&term, &term, i * (i + 1));
+        negate(&term);
+        if (negligible(&term, r)) break;
+        bf_add(r, r, &term);
+    }
+    bf_free(&term);
+    bf_free(&y2);
+}
+
+/**
+ * Writes `sin(x)` to `sin_r` and `cos(x)` to `cos_r`, either of which may be
+ * NULL. `x = q * (quarter turn) + y`, so the functions of `x` are the
+ * functions of `y` in the quadrant `q mod 4`. Reducing by 90 degrees is
+ * exact, so `sin(180)` is exactly 0 in degrees.
+ */
+static void sin_cos(struct MC4_BigFloat* sin_r, struct MC4_BigFloat* cos_r,
+                    const struct MC4_BigFloat* x, enum AngleMode angle_mode) {
+    if ((x->kind == BF_NAN) || (x->kind == BF_INF) ||
+        ((x->kind == BF_FINITE) && (x->exponent > BF_MAX_TRIG_EXPONENT))) {
+        if (sin_r != NULL) set_special(sin_r, BF_NAN, false);
+        if (cos_r != NULL) set_special(cos_r, BF_NAN, false);
+        return;
+    }
+    if (x->kind == BF_ZERO) {
+        if (sin_r != NULL) bf_set(sin_r, x);
+        if (cos_r != NULL) bf_set_u64(cos_r, 1);
+        return;
+    }
+    size_t len = (sin_r != NULL) ? sin_r->len : 0;
+    if ((cos_r != NULL) && (cos_r->len > len)) len = cos_r->len;
+    /* The integer part of `x / quarter` cancels, so `y` needs as many more
+    limbs as it has. */
+    len += 2;
+    if (x->exponent > 0) len += ((size_t)x->exponent / 32) + 1;
+
+    struct MC4_BigFloat quarter, q, y, s, c;
+    bf_init(&quarter, len);
+    bf_init(&q, len);
+    bf_init(&y, len);
+    bf_init(&s, len);
+    bf_init(&c, len);
+    if (angle_mode == ANGLE_MODE_DEG) {
+        bf_set_u64(&quarter, 90);
+    } else {
+        bf_pi(&quarter);
+        bf_mul_2exp(&quarter, &quarter, -1);
+    }
+    bf_div(&q, x, &quarter);
+    round_integer(&q, &q);
+    bf_mul(&y, &q, &quarter);
+    bf_sub(&y, x, &y);
+    if (angle_mode == ANGLE_MODE_DEG) {
+        bf_pi(&quarter);
+        bf_mul(&y, &y, &quarter);
+        div_u32(&y, &y, 180);
+    }
+    unsigned int quadrant = integer_bit(&q, 0) + (2 * integer_bit(&q, 1));
+    if (q.negative) quadrant = (4 - quadrant) % 4;
+
+    const bool odd = (quadrant % 2) != 0;
+    if (((sin_r != NULL) && !odd) || ((cos_r != NULL) && odd)) {
+        sin_series(&s, &y);
+    }
+    if (((sin_r != NULL) && odd) || ((cos_r != NULL) && !odd)) {
+        cos_series(&c, &y);
+    }
+    if (sin_r != NULL) {
+        /* sin y, cos y, -sin y, -cos y */
+        bf_set(sin_r, odd ? &c : &s);
+        if (quadrant >= 2) negate(sin_r);
+    }
+    if (cos_r != NULL) {
+        /* cos y, -sin y, -cos y, sin y */
+        bf_set(cos_r, odd ? &s : &c);
+        if ((quadrant == 1) || (quadrant == 2)) negate(cos_r);
+    }
+    bf_free(&c);
+    bf_free(&s);
+    bf_free(&y);
+    bf_free(&q);
+    bf_free(&quarter);
+}
+
+void bf_sin(struct MC4_BigFloat* r, const struct MC4_BigFloat* x,
+            enum AngleMode angle_mode) {
+    sin_cos(r, NULL, x, angle_mode);
+}
+
+void bf_cos(struct MC4_BigFloat* r, const struct MC4_BigFloat* x,
+            enum AngleMode angle_mode) {
+    sin_cos(NULL, r, x, angle_mode);
+}
+
+void bf_tan(struct MC4_BigFloat* r, const struct MC4_BigFloat* x,
+            enum AngleMode angle_mode) {
+    struct MC4_BigFloat s, c;
+    bf_init(&s, r->len + 1);
+    bf_init(&c, r->len + 1);
+    sin_cos(&s, &c, x, angle_mode);
+    bf_div(r, &s, &c);
+    bf_free(&c);
+    bf_free(&s);
+}
+
+void bf_atan(struct MC4_BigFloat* r, const struct MC4_BigFloat* x) {
+    if ((x->kind == BF_NAN) || (x->kind == BF_ZERO)) {
+        bf_set(r, x);
+        return;
+    }
+    const bool negative = x->negative;
+    if (x->kind == BF_INF) {
+        bf_pi(r);
+        bf_mul_2exp(r, r, -1);
+        r->negative = negative;
+        return;
+    }
+    const size_t len = r->len + 2;
+    uint32_t one_limb;
+    struct MC4_BigFloat one;
+    view_u32(&one, &one_limb, 1);
+    struct MC4_BigFloat y, t, sum, y2;
+    bf_init(&y, len);
+    bf_init(&t, len);
+    bf_init(&sum, len);
+    bf_init(&y2, len);
+    bf_set(&y, x);
+    y.negative = false;
+    /* atan(y) = pi/2 - atan(1/y) */
+    const bool inverted = cmp_abs(&y, &one) > 0;
+    if (inverted) bf_div(&y, &one, &y);
+    /* atan(y) = 2 atan(y / (1 + sqrt(1 + y^2))) */
+    for (int i = 0; i < BF_ATAN_HALVINGS; i++) {
+        bf_mul(&t, &y, &y);
+        bf_add(&t, &t, &one);
+        bf_sqrt(&t, &t);
+        bf_add(&t, &t, &one);
+        bf_div(&y, &y, &t);
+    }
+    /* atan(y) = y - y^3/3 + y^5/5 - ... */
+    bf_mul(&y2, &y, &y);
+    bf_set(&sum, &y);
+    for (uint32_t i = 3; y.kind != BF_ZERO; i += 2) {
+        bf_mul(&y, &y, &y2);
+        negate(&y);
+        div_u32(&t, &y, i);
+        if (negligible(&t, &sum)) break;
+        bf_add(&sum, &sum, &t);
+    }
+    bf_mul_2exp(&sum, &sum, BF_ATAN_HALVINGS);
+    if (inverted) {
+        bf_pi(&t);
+        bf_mul_2exp(&t, &t, -1);
+        bf_sub(&sum, &t, &sum);
+    }
+    bf_set(r, &sum);
+    r->negative = negative;
+    bf_free(&y2);
+    bf_free(&sum);
+    bf_free(&t);
+    bf_free(&y);
+}
+
+/* asin(x) = atan(x / sqrt((1 - x)(1 + x))) */
+void bf_asin(struct MC4_BigFloat* r, const struct MC4_BigFloat* x) {
+    uint32_t one_limb;
+    struct MC4_BigFloat one;
+    view_u32(&one, &one_limb, 1);
+    struct MC4_BigFloat t, u;
+    bf_init(&t, r->len + 2);
+    bf_init(&u, r->len + 2);
+    bf_sub(&t, &one, x);
+    bf_add(&u, &one, x);
+    bf_mul(&t, &t, &u);
+    bf_sqrt(&t, &t);
+    bf_div(&t, x, &t);
+    bf_atan(r, &t);
+    bf_free(&u);
+    bf_free(&t);
+}
+
+/* acos(x) = 2 atan(sqrt((1 - x) / (1 + x))) */
+void bf_acos(struct MC4_BigFloat* r, const struct MC4_BigFloat* x) {
+    uint32_t one_limb;
+    struct MC4_BigFloat one;
+    view_u32(&one, &one_limb, 1);
+    struct MC4_BigFloat t, u;
+    bf_init(&t, r->len + 2);
+    bf_init(&u, r->len + 2);
+    bf_sub(&t, &one, x);
+    bf_add(&u, &one, x);
+    bf_div(&t, &t, &u);
+    bf_sqrt(&t, &t);
+    bf_atan(r, &t);
+    bf_mul_2exp(r, r, 1);
+    bf_free(&u);
+    bf_free(&t);
+}
+
+static bool is_digit(char ch) {
+    return (unsigned char)(ch - '0') < 10;
+}
+
+/**
+ * Multiplies the `*len`-limb integer `m` by `mul` and adds `add`, growing
+ * `*len` if there is a carry. `m` must have room for it.
+ */
+static void mul_add_u32(uint32_t* m, size_t* len, uint32_t mul,
+                        uint32_t add) {
+    uint64_t carry = add;
+    for (size_t i = 0; i < *len; i++) {
+        carry += (uint64_t)m[i] * mul;
+        m[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    if (carry != 0) m[(*len)++] = (uint32_t)carry;
+}
+
+size_t bf_set_decimal(struct MC4_BigFloat* r, const char* str, size_t len) {
+    size_t pos = 0;
+    size_t num_digits = 0;
+    while ((pos < len) && (is_digit(str[pos]) || (str[pos] == '.'))) {
+        num_digits += is_digit(str[pos]);
+        pos++;
+    }
+    const size_t mantissa_end = pos;
+    /* An exponent only counts if it has digits. */
+    int64_t exp10 = 0;
+    if ((pos < len) && ((str[pos] == 'e') || (str[pos] == 'E'))) {
+        size_t exp_pos = pos + 1;
+        const bool exp_negative = (exp_pos < len) && (str[exp_pos] == '-');
+        if ((exp_pos < len) && ((str[exp_pos] == '+') || exp_negative)) {
+            exp_pos++;
+        }
+        if ((exp_pos < len) && is_digit(str[exp_pos])) {
+            while ((exp_pos < len) && is_digit(str[exp_pos])) {
+                if (exp10 < BF_MAX_EXPONENT) {
+                    exp10 = (exp10 * 10) + (str[exp_pos] - '0');
+                }
+                exp_pos++;
+            }
+            if (exp_negative) exp10 = -exp10;
+            pos = exp_pos;
+        }
+    }
+
+    /* The digits as an integer, gathered nine at a time. */
+    uint32_t* mantissa = alloc_limbs((num_digits / 9) + 2);
+    size_t mantissa_len = 0;
+    uint32_t chunk = 0, chunk_scale = 1;
+    for (size_t i = 0; i < mantissa_end; i++) {
+        if (str[i] == '.') {
+            exp10 -= (int64_t)(mantissa_end - i - 1);
+            continue;
+        }
+        chunk = (chunk * 10) + (uint32_t)(str[i] - '0');
+        chunk_scale *= 10;
+        if (chunk_scale == 1000000000) {
+            mul_add_u32(mantissa, &mantissa_len, chunk_scale, chunk);
+            chunk = 0, chunk_scale = 1;
+        }
+    }
+    mul_add_u32(mantissa, &mantissa_len, chunk_scale, chunk);
+
+    struct MC4_BigFloat t, scale;
+    bf_init(&t, r->len + 2);
+    round_limbs(&t, false, 32 * (int64_t)mantissa_len, mantissa,
+                mantissa_len);
+    if ((t.kind != BF_ZERO) && (exp10 != 0)) {
+        bf_init(&scale, r->len + 2);
+        power_of_ten(&scale, exp10);
+        bf_mul(&t, &t, &scale);
+        bf_free(&scale);
+    }
+    bf_set(r, &t);
+    bf_free(&t);
+    free(mantissa);
+    return pos;
+}
+
+/**
+ * Returns the decimal digits of the integer `x`, writing their count to
+ * `num_digits`. Free with `free()`.
+ */
+static char* integer_to_decimal(const struct MC4_BigFloat* x,
+                                size_t* num_digits) {
+    if ((x->kind != BF_FINITE) || (x->exponent <= 0)) {
+        char* zero = malloc(1);
+        if (zero == NULL) MLOG.panic("Out of memory.");
+        zero[0] = '0';
+        *num_digits = 1;
+        return zero;
+    }
+    /* The integer is the mantissa shifted right by its fraction bits. */
+    size_t len = ((size_t)x->exponent + 31) / 32;
+    uint32_t* limbs = alloc_limbs(len);
+    const int64_t fraction_bits = (32 * (int64_t)x->len) - x->exponent;
+    for (size_t i = 0; i < len; i++) {
+        const int64_t pos = fraction_bits + (32 * (int64_t)i);
+        const int64_t limb = (pos >= 0) ? (pos / 32) : -((31 - pos) / 32);
+        const int bit = (int)(pos - (32 * limb));
+        uint64_t pair = 0;
+        if ((limb >= 0) && (limb < (int64_t)x->len)) pair = x->limbs[limb];
+        if (((limb + 1) >= 0) && ((limb + 1) < (int64_t)x->len)) {
+            pair |= (uint64_t)x->limbs[limb + 1] << 32;
+        }
+        limbs[i] = (uint32_t)(pair >> bit);
+    }
+    /* Nine digits at a time from the bottom, by dividing by 10^9. */
+    char* digits = malloc((10 * len) + 9);
+    if (digits == NULL) MLOG.panic("Out of memory.");
+    size_t count = 0;
+    while ((len > 0) && (limbs[len - 1] == 0)) len--;
+    while (len > 0) {
+        uint64_t rem = 0;
+        for (size_t i = len; i-- > 0;) {
+            const uint64_t current = (rem << 32) | limbs[i];
+            limbs[i] = (uint32_t)(current / 1000000000);
+            rem = current % 1000000000;
+        }
+        while ((len > 0) && (limbs[len - 1] == 0)) len--;
+        for (int i = 0; i < 9; i++) {
+            digits[count++] = (char)('0' + (rem % 10));
+            rem /= 10;
+        }
+    }
+    while ((count > 1) && (digits[count - 1] == '0')) count--;
+    for (size_t i = 0; i < (count / 2); i++) {
+        const char swap = digits[i];
+        digits[i] = digits[count - 1 - i];
+        digits[count - 1 - i] = swap;
+    }
+    free(limbs);
+    *num_digits = count;
+    return digits;
+}
+
+/**
+ * Writes `num_digits` digits with the decimal point after the first
+ * `int_digits`, padding with zeros if there are fewer digits than that.
+ */
+static size_t write_point_notation(char* out, const char* digits,
+                                   size_t num_digits, int64_t int_digits) {
+    size_t len = 0;
+    if (int_digits <= 0) {
+        out[len++] = '0';
+        out[len++] = '.';
+        for (int64_t i = int_digits; i < 0; i++) out[len++] = '0';
+        memcpy(&out[len], digits, num_digits);
+        return len + num_digits;
+    }
+    if (num_digits <= (size_t)int_digits) {
+        memcpy(out, digits, num_digits);
+        len = num_digits;
+        for (size_t i = num_digits; i < (size_t)int_digits; i++) {
+            out[len++] = '0';
+        }
+        return len;
+    }
+    memcpy(out, digits, int_digits);
+    len = int_digits;
+    out[len++] = '.';
+    memcpy(&out[len], &digits[int_digits], num_digits - int_digits);
+    return len + (num_digits - int_digits);
+}
+
+char* bf_format(const struct MC4_BigFloat* x, unsigned int digits,
+                enum OutputMode mode) {
+    if (digits == 0) digits = 1;
+    /* Normal mode is plain for as many digits as are asked for, and at
+    least in the range of `MC4_format()`. */
+    const int64_t max_point = (digits > BF_FIXED_MAX_DECIMAL_POINT)
+                                  ? digits
+                                  : BF_FIXED_MAX_DECIMAL_POINT;
+    char* out = malloc(digits + max_point + 32);
+    if (out == NULL) MLOG.panic("Out of memory.");
+    size_t len = 0;
+    if (x->kind == BF_NAN) {
+        strcpy(out, "nan");
+        return out;
+    }
+    if (x->negative) out[len++] = '-';
+    if (x->kind != BF_FINITE) {
+        strcpy(&out[len], (x->kind == BF_INF) ? "inf" : "0");
+        return out;
+    }
+
+    /* |x| * 10^(digits - 1 - exp10), rounded to an integer, has `digits`
+    digits if `exp10` is the decimal exponent of `x`, which the binary
+    exponent nearly gives. Otherwise it is off by one. */
+    const double top = ldexp(x->limbs[x->len - 1], -32);
+    int64_t exp10 =
+        (int64_t)floor(((double)x->exponent + log2(top)) * log10(2.0));
+    struct MC4_BigFloat magnitude = *x, scaled, scale;
+    magnitude.negative = false;
+    bf_init(&scaled, bf_len_for_digits(digits) + 1);
+    bf_init(&scale, scaled.len);
+    char* digit_str = NULL;
+    size_t num_digits = 0;
+    int64_t power = 0;
+    for (int attempt = 0; attempt < 4; attempt++) {
+        power = (int64_t)digits - 1 - exp10;
+        power_of_ten(&scale, power);
+        bf_mul(&scaled, &magnitude, &scale);
+        round_integer(&scaled, &scaled);
+        free(digit_str);
+        digit_str = integer_to_decimal(&scaled, &num_digits);
+        if (num_digits == digits) break;
+        exp10 += (num_digits > digits) ? 1 : -1;
+    }
+    /* Position of the decimal point relative to the first digit. */
+    const int64_t point = (int64_t)num_digits - power;
+    if (num_digits > digits) num_digits = digits;
+    while ((num_digits > 1) && (digit_str[num_digits - 1] == '0')) {
+        num_digits--;
+    }
+
+    if ((mode == OUTPUT_MODE_NORMAL) &&
+        (point >= BF_FIXED_MIN_DECIMAL_POINT) && (point <= max_point)) {
+        len += write_point_notation(&out[len], digit_str, num_digits, point);
+    } else {
+        int64_t exp = point - 1;
+        int64_t int_digits = 1;
+        if (mode == OUTPUT_MODE_ENGINEERING) {
+            const int64_t remainder = ((exp % 3) + 3) % 3;
+            int_digits += remainder;
+            exp -= remainder;
+        }
+        len += write_point_notation(&out[len], digit_str, num_digits,
+                                    int_digits);
+        len += (size_t)sprintf(&out[len], "e%" PRId64, exp);
+    }
+    out[len] = '\0';
+    free(digit_str);
+    bf_free(&scale);
+    bf_free(&scaled);
+    return out;
+}
@@ -0,0 +1,146 @@
+#ifndef MCALCULATOR_VERSION_4_BIGFLOAT_H_
+#define MCALCULATOR_VERSION_4_BIGFLOAT_H_
+
+#include "../cli/cli_types.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum BigFloatKind {
+    BF_ZERO,
+    BF_FINITE,
+    BF_INF,
+    BF_NAN,
+};
+
+/**
+ * An arbitrary precision binary floating point number. A finite number is
+ * `(limbs / 2^(32 * len)) * 2^exponent`, where the limbs are normalized so
+ * the mantissa is in [0.5, 1).
+ *
+ * Every number has its own precision, `len` limbs of 32 bits, which is fixed
+ * by `bf_init()`. Operations round their result to the precision of the
+ * number they write to, which may also be an operand, and read operands of
+ * any precision.
+ */
+struct MC4_BigFloat {
+    enum BigFloatKind kind;
+    bool negative;
+    int64_t exponent;
+    /* Least significant limb first. The top bit of the last limb is set. */
+    uint32_t* limbs;
+    size_t len;
+};
+
+/**
+ * Returns the number of limbs which hold `digits` significant decimal digits,
+ * with a couple of limbs to spare so the digits are still right after a long
+ * evaluation.
+ */
+size_t bf_len_for_digits(unsigned int digits);
+
+/**
+ * Initializes `x` to 0 with a precision of `len` limbs. Free with `bf_free()`.
+ */
+void bf_init(struct MC4_BigFloat* x, size_t len);
+
+void bf_free(struct MC4_BigFloat* x);
+
+void bf_set(struct MC4_BigFloat* r, const struct MC4_BigFloat* x);
+
+void bf_set_u64(struct MC4_BigFloat* r, uint64_t value);
+
+/* Exact, including NaN and infinities. */
+void bf_set_double(struct MC4_BigFloat* r, double value);
+
+/**
+ * Reads the number literal at the start of `str` (as `parse_number()`),
+ * looking at no more than `len` characters, and returns the number of
+ * characters read. Every digit counts, so `0.1` is as close to 1/10 as the
+ * precision of `r` allows.
+ */
+size_t bf_set_decimal(struct MC4_BigFloat* r, const char* str, size_t len);
+
+double bf_to_double(const struct MC4_BigFloat* x);
+
+/**
+ * Returns `x` with `digits` significant decimal digits, with trailing zeros
+ * removed, and laid out the same as `MC4_format()` in `mode`. Free with
+ * `free()`.
+ */
+char* bf_format(const struct MC4_BigFloat* x, unsigned int digits,
+                enum OutputMode mode);
+
+void bf_add(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+            const struct MC4_BigFloat* b);
+void bf_sub(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+            const struct MC4_BigFloat* b);
+
+/**
+ * Multiplies the mantissas with schoolbook multiplication, or Karatsuba's
+ * method once they are long enough.
+ */
+void bf_mul(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+            const struct MC4_BigFloat* b);
+
+/**
+ * Multiplies `a` by the reciprocal of `b`, found with Newton's iteration
+ * `x + x(1 - bx)`, which doubles the precision it works at every step.
+ */
+void bf_div(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+            const struct MC4_BigFloat* b);
+
+/* `a * 2^power`, exactly unless it over- or underflows. */
+void bf_mul_2exp(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+                 int64_t power);
+
+/* Same as `pow()`, including for negative bases and integer exponents. */
+void bf_pow(struct MC4_BigFloat* r, const struct MC4_BigFloat* a,
+            const struct MC4_BigFloat* b);
+
+/* Newton's iteration for `1/sqrt(x)`, doubling the precision every step. */
+void bf_sqrt(struct MC4_BigFloat* r, const struct MC4_BigFloat* x);
+
+/**
+ * Reduces `x` to `x - k*ln(2)`, halves that until it is small, sums the Taylor
+ * series and squares the sum back, then multiplies by `2^k`.
+ */
+void bf_exp(struct MC4_BigFloat* r, const struct MC4_BigFloat* x);
+
+/**
+ * Splits `x` into `m * 2^k` with `m` in [sqrt(1/2), sqrt(2)), and sums the
+ * series of `2*atanh((m - 1)/(m + 1))` for `ln(m)`.
+ */
+void bf_log(struct MC4_BigFloat* r, const struct MC4_BigFloat* x);
+
+void bf_log10(struct MC4_BigFloat* r, const struct MC4_BigFloat* x);
+
+/**
+ * Trigonometric functions of `x` in radians or degrees. `x` is reduced by the
+ * nearest multiple of a quarter turn, with enough extra precision that large
+ * arguments are still right, and the Taylor series of sine or cosine is
+ * summed for the rest.
+ */
+void bf_sin(struct MC4_BigFloat* r, const struct MC4_BigFloat* x,
+            enum AngleMode angle_mode);
+void bf_cos(struct MC4_BigFloat* r, const struct MC4_BigFloat* x,
+            enum AngleMode angle_mode);
+void bf_tan(struct MC4_BigFloat* r, const struct MC4_BigFloat* x,
+            enum AngleMode angle_mode);
+
+/**
+ * Halves the angle with `x / (1 + sqrt(1 + x^2))` a few times and sums the
+ * Taylor series. `bf_asin()` and `bf_acos()` are written in terms of it.
+ */
+void bf_atan(struct MC4_BigFloat* r, const struct MC4_BigFloat* x);
+void bf_asin(struct MC4_BigFloat* r, const struct MC4_BigFloat* x);
+void bf_acos(struct MC4_BigFloat* r, const struct MC4_BigFloat* x);
+
+/**
+ * Constants, which are computed once at the highest precision asked for so
+ * far and cached: pi with Machin's formula, e with the series of 1/k!.
+ */
+void bf_pi(struct MC4_BigFloat* r);
+void bf_e(struct MC4_BigFloat* r);
+
+#endif
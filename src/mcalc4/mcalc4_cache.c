@@ -0,0 +1,378 @@
+#include "mcalc4_cache.h"
+#include "../../libs/mlogging.h"
+#include "mcalc4_types.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Marks the end of the LRU list and of bucket chains. */
+#define CACHE_NONE ((size_t)-1)
+
+struct CacheEntry {
+    uint64_t hash;
+    enum AngleMode angle_mode;
+    unsigned int num_vars;
+    /* `num_vars` variable values, in the order `find_variables()` returns
+    their names, followed by the normalized text. One allocation, reused when
+    the entry is evicted. */
+    unsigned char* data;
+    size_t data_capacity;
+    size_t text_len;
+    double value;
+
+    size_t lru_prev;
+    size_t lru_next;
+    size_t bucket_next;
+};
+
+struct MC4_Cache {
+    struct CacheEntry* entries;
+    size_t capacity;
+    size_t num_entries;
+    /* Heads of the bucket chains. `num_buckets` is a power of two. */
+    size_t* buckets;
+    size_t num_buckets;
+    /* Most and least recently used entries. */
+    size_t lru_head;
+    size_t lru_tail;
+    struct MC4_CacheStats stats;
+};
+
+/* Normalizing
+ *
+ * Whitespace only matters between two characters which would otherwise be
+ * read as one token (`s in` and `sin`, `2 3` and `23`, `1e +5` and `1e+5`).
+ * The normalized text drops all other whitespace and replaces the rest with a
+ * single space, so `2 * x` and `2*x` share a cache entry. */
+
+/* Normalized text is produced in chunks of this size, so hashing works on
+whole words without a buffer for the whole text. */
+#define NORMALIZE_CHUNK_SIZE 64
+
+/* Normalized texts up to this length are kept on the stack while looking
+them up, longer ones are normalized again to compare them. */
+#define KEY_TEXT_SIZE 512
+
+/* Expressions which read more distinct variables than this aren't cached. */
+#define KEY_MAX_VARS 64
+
+struct Normalizer {
+    const char* str;
+    size_t len;
+    size_t pos;
+    char prev;
+};
+
+static struct Normalizer new_normalizer(const char* str, size_t len) {
+    return (struct Normalizer){.str = str, .len = len, .pos = 0, .prev = '\0'};
+}
+
+/* Same as `isspace()` in the "C" locale, without the function call. */
+static bool is_space(char ch) {
+    return (ch == ' ') || ((ch >= '\t') && (ch <= '\r'));
+}
+
+static bool is_separator(char ch) {
+    return (ch == '+') || (ch == '-') || (ch == '*') || (ch == '/') ||
+           (ch == '^') || (ch == '(') || (ch == ')');
+}
+
+static bool space_is_significant(char prev, char next) {
+    if ((prev == '\0') || is_separator(prev)) return false;
+    if ((next == '+') || (next == '-')) return (prev == 'e') || (prev == 'E');
+    return !is_separator(next);
+}
+
+/**
+ * Writes the next `NORMALIZE_CHUNK_SIZE` (or fewer at the end) characters of
+ * the normalized text to `out`, returning how many were written.
+ */
+static size_t normalize_chunk(struct Normalizer* normalizer,
+                              char out[NORMALIZE_CHUNK_SIZE]) {
+    const char* str = normalizer->str;
+    const size_t len = normalizer->len;
+    size_t pos = normalizer->pos;
+    size_t num_written = 0;
+    while ((num_written < NORMALIZE_CHUNK_SIZE) && (pos < len)) {
+        const char ch = str[pos];
+        if (!is_space(ch)) {
+            out[num_written++] = ch;
+            normalizer->prev = ch;
+            pos++;
+            continue;
+        }
+        size_t next = pos + 1;
+        while ((next < len) && is_space(str[next])) next++;
+        if ((next < len) && space_is_significant(normalizer->prev, str[next])) {
+            out[num_written++] = ' ';
+            normalizer->prev = ' ';
+        }
+        pos = next;
+    }
+    normalizer->pos = pos;
+    return num_written;
+}
+
+static bool normalized_equals(const char* normalized, size_t normalized_len,
+                              const char* equ, size_t len) {
+    struct Normalizer normalizer = new_normalizer(equ, len);
+    char chunk[NORMALIZE_CHUNK_SIZE];
+    size_t chunk_len;
+    size_t compared = 0;
+    while ((chunk_len = normalize_chunk(&normalizer, chunk)) > 0) {
+        if (((compared + chunk_len) > normalized_len) ||
+            (memcmp(&normalized[compared], chunk, chunk_len) != 0)) {
+            return false;
+        }
+        compared += chunk_len;
+    }
+    return compared == normalized_len;
+}
+
+static uint64_t hash_mix(uint64_t hash, uint64_t bits) {
+    hash = (hash ^ bits) * UINT64_C(0x9E3779B97F4A7C15);
+    return hash ^ (hash >> 29);
+}
+
+/* Entries */
+
+static const double* entry_values(const struct CacheEntry* entry) {
+    return (const double*)entry->data;
+}
+
+static const char* entry_text(const struct CacheEntry* entry) {
+    return (const char*)&entry->data[entry->num_vars * sizeof(double)];
+}
+
+/* Everything a result is looked up by. */
+struct CacheKey {
+    uint64_t hash;
+    const char* equ;
+    size_t len;
+    enum AngleMode angle_mode;
+    unsigned int num_vars;
+    double values[KEY_MAX_VARS];
+    size_t text_len;
+    /* The normalized text, if it is at most `KEY_TEXT_SIZE` long. */
+    char text[KEY_TEXT_SIZE];
+};
+
+/**
+ * Normalizes and hashes `equ` and reads the variables it uses from `vars`.
+ * Returns false if a variable is undefined, which makes evaluating fail, or if
+ * there are too many variables to cache.
+ */
+static bool build_key(struct CacheKey* key, const char* equ,
+                      const struct MC4_VariableSet* vars,
+                      const struct MC4_Settings* settings) {
+    key->equ = equ;
+    key->len = strlen(equ);
+    key->angle_mode = settings->angle_mode;
+    key->text_len = 0;
+
+    uint64_t hash = 0;
+    struct Normalizer normalizer = new_normalizer(equ, key->len);
+    char chunk[NORMALIZE_CHUNK_SIZE + sizeof(uint64_t)];
+    size_t chunk_len;
+    while ((chunk_len = normalize_chunk(&normalizer, chunk)) > 0) {
+        if ((key->text_len + chunk_len) <= KEY_TEXT_SIZE) {
+            memcpy(&key->text[key->text_len], chunk, chunk_len);
+        }
+        /* Zero padding is told apart from text by mixing in the length. */
+        memset(&chunk[chunk_len], 0, sizeof(uint64_t));
+        for (size_t i = 0; i < chunk_len; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, &chunk[i], sizeof(word));
+            hash = hash_mix(hash, word);
+        }
+        key->text_len += chunk_len;
+    }
+    hash = hash_mix(hash, key->text_len);
+    hash = hash_mix(hash, key->angle_mode);
+
+    struct MC4_Name names[KEY_MAX_VARS];
+    key->num_vars = find_variables(equ, key->len, names, KEY_MAX_VARS);
+    if (key->num_vars > KEY_MAX_VARS) return false;
+    for (unsigned int i = 0; i < key->num_vars; i++) {
+        const int slot =
+            varset_find(vars, &equ[names[i].start], names[i].len);
+        if ((slot < 0) || !vars->exists[slot]) return false;
+        key->values[i] = vars->values[slot];
+        uint64_t bits;
+        memcpy(&bits, &key->values[i], sizeof(bits));
+        hash = hash_mix(hash, bits);
+    }
+    key->hash = hash;
+    return true;
+}
+
+/**
+ * Values are compared bitwise, so 0 and -0 are different keys.
+ */
+static bool entry_matches(const struct CacheEntry* entry,
+                          const struct CacheKey* key) {
+    if ((entry->hash != key->hash) || (entry->angle_mode != key->angle_mode) ||
+        (entry->num_vars != key->num_vars) ||
+        (entry->text_len != key->text_len) ||
+        (memcmp(entry_values(entry), key->values,
+                key->num_vars * sizeof(double)) != 0)) {
+        return false;
+    }
+    if (key->text_len <= KEY_TEXT_SIZE) {
+        return memcmp(entry_text(entry), key->text, key->text_len) == 0;
+    }
+    return normalized_equals(entry_text(entry), entry->text_len, key->equ,
+                             key->len);
+}
+
+static void lru_unlink(struct MC4_Cache* cache, size_t index) {
+    struct CacheEntry* entry = &cache->entries[index];
+    if (entry->lru_prev != CACHE_NONE) {
+        cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != CACHE_NONE) {
+        cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+}
+
+static void lru_push_front(struct MC4_Cache* cache, size_t index) {
+    struct CacheEntry* entry = &cache->entries[index];
+    entry->lru_prev = CACHE_NONE;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head != CACHE_NONE) {
+        cache->entries[cache->lru_head].lru_prev = index;
+    } else {
+        cache->lru_tail = index;
+    }
+    cache->lru_head = index;
+}
+
+static void bucket_unlink(struct MC4_Cache* cache, size_t index) {
+    size_t* link =
+        &cache->buckets[cache->entries[index].hash & (cache->num_buckets - 1)];
+    while (*link != index) link = &cache->entries[*link].bucket_next;
+    *link = cache->entries[index].bucket_next;
+}
+
+/**
+ * Returns an unused entry, evicting the least recently used one if the cache
+ * is full.
+ */
+static size_t take_entry(struct MC4_Cache* cache) {
+    if (cache->num_entries < cache->capacity) return cache->num_entries++;
+    const size_t index = cache->lru_tail;
+    lru_unlink(cache, index);
+    bucket_unlink(cache, index);
+    cache->stats.evictions++;
+    return index;
+}
+
+static void insert_entry(struct MC4_Cache* cache, const struct CacheKey* key,
+                         double value) {
+    const size_t index = take_entry(cache);
+    struct CacheEntry* entry = &cache->entries[index];
+    const size_t values_size = key->num_vars * sizeof(double);
+    const size_t data_size = values_size + key->text_len;
+    if (entry->data_capacity < data_size) {
+        free(entry->data);
+        entry->data = malloc(data_size);
+        if (entry->data == NULL) MLOG.panic("Out of memory.");
+        entry->data_capacity = data_size;
+    }
+    entry->hash = key->hash;
+    entry->angle_mode = key->angle_mode;
+    entry->num_vars = key->num_vars;
+    entry->text_len = key->text_len;
+    entry->value = value;
+    memcpy(entry->data, key->values, values_size);
+    char* text = (char*)&entry->data[values_size];
+    if (key->text_len <= KEY_TEXT_SIZE) {
+        memcpy(text, key->text, key->text_len);
+    } else {
+        struct Normalizer normalizer = new_normalizer(key->equ, key->len);
+        for (size_t i = 0; i < key->text_len;) {
+            i += normalize_chunk(&normalizer, &text[i]);
+        }
+    }
+
+    size_t* bucket = &cache->buckets[key->hash & (cache->num_buckets - 1)];
+    entry->bucket_next = *bucket;
+    *bucket = index;
+    lru_push_front(cache, index);
+}
+
+struct MC4_Cache* MC4_cache_new(size_t capacity) {
+    if (capacity == 0) capacity = 1;
+    size_t num_buckets = 16;
+    while (num_buckets < capacity) num_buckets *= 2;
+
+    struct MC4_Cache* cache = malloc(sizeof(struct MC4_Cache));
+    if (cache == NULL) MLOG.panic("Out of memory.");
+    *cache = (struct MC4_Cache){
+        .entries = calloc(capacity, sizeof(struct CacheEntry)),
+        .capacity = capacity,
+        .buckets = malloc(num_buckets * sizeof(size_t)),
+        .num_buckets = num_buckets,
+    };
+    if ((cache->entries == NULL) || (cache->buckets == NULL)) {
+        MLOG.panic("Out of memory.");
+    }
+    MC4_cache_clear(cache);
+    return cache;
+}
+
+struct MC4_Result MC4_evaluate_cached(struct MC4_Cache* cache, const char* equ,
+                                      const struct MC4_VariableSet* vars,
+                                      struct MC4_Settings* settings) {
+    struct CacheKey key;
+    if (!build_key(&key, equ, vars, settings)) {
+        /* Reading an undefined variable is an error, which isn't cached, and
+        so are expressions with too many variables. */
+        cache->stats.misses++;
+        return MC4_evaluate(equ, vars, settings);
+    }
+
+    size_t index = cache->buckets[key.hash & (cache->num_buckets - 1)];
+    while ((index != CACHE_NONE) &&
+           !entry_matches(&cache->entries[index], &key)) {
+        index = cache->entries[index].bucket_next;
+    }
+
+    if (index != CACHE_NONE) {
+        cache->stats.hits++;
+        lru_unlink(cache, index);
+        lru_push_front(cache, index);
+        struct MC4_Result result = new_result();
+        result.value = cache->entries[index].value;
+        return result;
+    }
+
+    cache->stats.misses++;
+    struct MC4_Result result = MC4_evaluate(equ, vars, settings);
+    if (!MC4_error_occured(&result)) insert_entry(cache, &key, result.value);
+    return result;
+}
+
+struct MC4_CacheStats MC4_cache_stats(const struct MC4_Cache* cache) {
+    return cache->stats;
+}
+
+void MC4_cache_clear(struct MC4_Cache* cache) {
+    for (size_t i = 0; i < cache->num_buckets; i++) {
+        cache->buckets[i] = CACHE_NONE;
+    }
+    cache->num_entries = 0;
+    cache->lru_head = cache->lru_tail = CACHE_NONE;
+}
+
+void MC4_cache_free(struct MC4_Cache* cache) {
+    for (size_t i = 0; i < cache->capacity; i++) free(cache->entries[i].data);
+    free(cache->entries);
+    free(cache->buckets);
+    free(cache);
+}
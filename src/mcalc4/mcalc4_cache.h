@@ -0,0 +1,47 @@
+#ifndef MCALCULATOR_VERSION_4_CACHE_H_
+#define MCALCULATOR_VERSION_4_CACHE_H_
+
+#include "mcalc4.h"
+#include <stddef.h>
+
+/**
+ * A bounded least-recently-used cache of evaluation results.
+ *
+ * Results are keyed by the expression text with insignificant whitespace
+ * removed, the values of the variables the expression reads, and the angle
+ * mode. Lookups hash the key in one pass over the text and don't allocate.
+ * Only successful evaluations are cached. A cache must not be used by several
+ * threads at once.
+ */
+struct MC4_Cache;
+
+struct MC4_CacheStats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+};
+
+/**
+ * Creates a cache which holds up to `capacity` results (at least 1).
+ */
+struct MC4_Cache* MC4_cache_new(size_t capacity);
+
+/**
+ * Same as `MC4_evaluate()`, but returns the cached result if `equ` was
+ * evaluated before with the same variable values and angle mode, without
+ * tokenizing or parsing.
+ */
+struct MC4_Result MC4_evaluate_cached(struct MC4_Cache* cache, const char* equ,
+                                      const struct MC4_VariableSet* vars,
+                                      struct MC4_Settings* settings);
+
+struct MC4_CacheStats MC4_cache_stats(const struct MC4_Cache* cache);
+
+/**
+ * Removes every result, keeping the capacity and the counters.
+ */
+void MC4_cache_clear(struct MC4_Cache* cache);
+
+void MC4_cache_free(struct MC4_Cache* cache);
+
+#endif
@@ -0,0 +1,206 @@
+#include "mcalc4_diff.h"
+#include "../../libs/mlogging.h"
+#include "mcalc4_stats.h"
+#include "mcalc4_types.h"
+#include "mcalc4_varset.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Expressions needing at most this many values and derivatives are
+differentiated without allocating. */
+#define DIFF_STACK_REGS 256
+
+/**
+ * Applies operator `op` to the values `a` and `b` and their derivatives
+ * `da` and `db`, writing the derivatives of the result to `d`.
+ */
+static double diff_op(char op, double a, double b, const double* da,
+                      const double* db, double* d, size_t num_slots) {
+    switch (op) {
+    case '+':
+        for (size_t j = 0; j < num_slots; j++) d[j] = da[j] + db[j];
+        return a + b;
+    case '-':
+        for (size_t j = 0; j < num_slots; j++) d[j] = da[j] - db[j];
+        return a - b;
+    case '*':
+        for (size_t j = 0; j < num_slots; j++) {
+            d[j] = (a * db[j]) + (b * da[j]);
+        }
+        return a * b;
+    case '/': {
+        const double value = a / b;
+        for (size_t j = 0; j < num_slots; j++) {
+            d[j] = (da[j] - (value * db[j])) / b;
+        }
+        return value;
+    }
+    default: {
+        const double value = pow(a, b);
+        /* Each term is only taken where it can change the result, so
+        constant exponents of negative bases and powers of 0 don't take
+        `log()` of their base. */
+        for (size_t j = 0; j < num_slots; j++) {
+            d[j] = 0;
+            if (da[j] != 0) d[j] += b * pow(a, b - 1) * da[j];
+            if ((db[j] != 0) && (value != 0)) d[j] += value * log(a) * db[j];
+        }
+        return value;
+    }
+    }
+}
+
+/**
+ * Applies function `func_type` to the value `a` and its derivatives `da`,
+ * writing the derivatives of the result to `d`.
+ */
+static double diff_func(enum FuncType func_type, enum AngleMode angle_mode,
+                        double a, const double* da, double* d,
+                        size_t num_slots) {
+    stats_count_func(func_type);
+    /* The conversion of `convert_angle_units()`, which is also the
+    derivative of the angle in radians (the chain rule for degrees). */
+    const double to_rad = (angle_mode == ANGLE_MODE_DEG) ? (M_PI / 180) : 1;
+    const double rad = a * to_rad;
+    double value, slope;
+    switch (func_type) {
+    case FN_SIN:
+        value = sin(rad);
+        slope = cos(rad) * to_rad;
+        break;
+    case FN_COS:
+        value = cos(rad);
+        slope = -sin(rad) * to_rad;
+        break;
+    case FN_TAN:
+        value = tan(rad);
+        slope = (1 + (value * value)) * to_rad;
+        break;
+    case FN_ASIN:
+        value = asin(a);
+        slope = 1 / sqrt(1 - (a * a));
+        break;
+    case FN_ACOS:
+        value = acos(a);
+        slope = -1 / sqrt(1 - (a * a));
+        break;
+    case FN_ATAN:
+        value = atan(a);
+        slope = 1 / (1 + (a * a));
+        break;
+    case FN_LOG_10:
+        value = log10(a);
+        slope = 1 / (a * log(10));
+        break;
+    case FN_LOG_E:
+        value = log(a);
+        slope = 1 / a;
+        break;
+    default:
+        value = sqrt(a);
+        slope = 1 / (2 * value);
+        break;
+    }
+    for (size_t j = 0; j < num_slots; j++) d[j] = slope * da[j];
+    return value;
+}
+
+double MC4_eval_compiled_gradient(const struct MC4_Compiled* expr,
+                                  const int* slots, size_t num_slots,
+                                  const struct MC4_VariableSet* vars,
+                                  double* gradient, MC4_ErrorCode* err) {
+    *err = MC4_ERR_NONE;
+    if (!compiled_vars_defined(expr, vars)) {
+        *err = MC4_ERR_VAR_NOT_FOUND;
+        return 0;
+    }
+
+    /* Node `i` has its value at `values[i]` and its derivatives at
+    `derivs[i * num_slots]`. */
+    const size_t num_regs = expr->num_nodes * (num_slots + 1);
+    double stack_regs[DIFF_STACK_REGS];
+    double* regs = stack_regs;
+    if (num_regs > DIFF_STACK_REGS) {
+        regs = malloc(num_regs * sizeof(double));
+        if (regs == NULL) MLOG.panic("Out of memory.");
+    }
+    double* values = regs;
+    double* derivs = &regs[expr->num_nodes];
+
+    for (unsigned int i = 0; i < expr->num_nodes; i++) {
+        const struct MC4_Node* node = &expr->nodes[i];
+        double* d = &derivs[i * num_slots];
+        switch (node->type) {
+        case NODE_NUMBER:
+            values[i] = node->value;
+            for (size_t j = 0; j < num_slots; j++) d[j] = 0;
+            break;
+        case NODE_VARIABLE:
+            values[i] = vars->values[node->slot];
+            for (size_t j = 0; j < num_slots; j++) {
+                d[j] = (slots[j] == node->slot) ? 1 : 0;
+            }
+            break;
+        case NODE_OPERATOR:
+            values[i] = diff_op(node->op, values[node->lhs],
+                                values[node->rhs],
+                                &derivs[node->lhs * num_slots],
+                                &derivs[node->rhs * num_slots], d, num_slots);
+            break;
+        case NODE_FUNCTION:
+            values[i] = diff_func(node->func_type, expr->angle_mode,
+                                  values[node->lhs],
+                                  &derivs[node->lhs * num_slots], d,
+                                  num_slots);
+            break;
+        }
+    }
+
+    const unsigned int last = expr->num_nodes - 1;
+    const double value = values[last];
+    if (num_slots > 0) {
+        memcpy(gradient, &derivs[last * num_slots],
+               num_slots * sizeof(double));
+    }
+    if (regs != stack_regs) free(regs);
+    return value;
+}
+
+MC4_ErrorCode MC4_gradient(const char* equ, const char* const* wrt,
+                           const double* at, size_t num_wrt,
+                           struct MC4_VariableSet* vars,
+                           const struct MC4_Settings* settings, double* value,
+                           double* gradient) {
+    /* The variables of `wrt` need slots even if the caller has no variable
+    set. */
+    struct MC4_VariableSet local_vars = new_varset();
+    if (vars == NULL) vars = &local_vars;
+    MC4_ErrorCode err;
+    struct MC4_Compiled* expr = MC4_compile(equ, vars, settings, &err);
+    if (err != MC4_ERR_NONE) {
+        free_varset(&local_vars);
+        return err;
+    }
+    int* slots = malloc((num_wrt + 1) * sizeof(int));
+    if (slots == NULL) MLOG.panic("Out of memory.");
+    for (size_t i = 0; i < num_wrt; i++) {
+        slots[i] = varset_intern(vars, wrt[i], strlen(wrt[i]));
+    }
+    /* The point is bound in a copy, so `vars` keeps its values. */
+    struct MC4_VariableSet point = varset_copy_values(vars);
+    if (at != NULL) {
+        for (size_t i = 0; i < num_wrt; i++) {
+            point.values[slots[i]] = at[i];
+            point.exists[slots[i]] = true;
+        }
+    }
+    *value = MC4_eval_compiled_gradient(expr, slots, num_wrt, &point,
+                                        gradient, &err);
+
+    free_varset_values(&point);
+    free(slots);
+    MC4_free_compiled(expr);
+    free_varset(&local_vars);
+    return err;
+}
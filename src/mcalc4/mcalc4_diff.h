@@ -0,0 +1,38 @@
+#ifndef MCALCULATOR_VERSION_4_DIFF_H_
+#define MCALCULATOR_VERSION_4_DIFF_H_
+
+#include "mcalc4.h"
+#include <stddef.h>
+
+/**
+ * Evaluates a compiled expression against `vars` (the same as
+ * `MC4_eval_compiled()`, with the same value) together with its partial
+ * derivatives with respect to variable set slots `slots`, writing the
+ * derivative with respect to `slots[i]` to `gradient[i]`.
+ *
+ * Derivatives are propagated forwards through the nodes alongside the values
+ * (dual numbers), so one pass gives exact derivatives up to rounding, instead
+ * of the estimates and extra evaluations of finite differences. Degree
+ * trigonometry includes the `pi/180` of the conversion. A slot `expr` doesn't
+ * read has a derivative of 0.
+ */
+double MC4_eval_compiled_gradient(const struct MC4_Compiled* expr,
+                                  const int* slots, size_t num_slots,
+                                  const struct MC4_VariableSet* vars,
+                                  double* gradient, MC4_ErrorCode* err);
+
+/**
+ * Evaluates `equ` and its gradient with respect to the variables named `wrt`
+ * at the point `at`, where the `i`th variable is `at[i]`, writing the value
+ * to `value` and the derivative with respect to `wrt[i]` to `gradient[i]`.
+ * If `at` is NULL, the variables keep their values in `vars`. Other variables
+ * are read from `vars`, which may be NULL, and gets the variables of `wrt`
+ * which are new, but keeps their values.
+ */
+MC4_ErrorCode MC4_gradient(const char* equ, const char* const* wrt,
+                           const double* at, size_t num_wrt,
+                           struct MC4_VariableSet* vars,
+                           const struct MC4_Settings* settings, double* value,
+                           double* gradient);
+
+#endif
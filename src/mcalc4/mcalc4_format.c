@@ -0,0 +1,390 @@
+/* Double to decimal conversion.
+ *
+ * Digits are generated with Grisu2 (Loitsch, "Printing Floating-Point Numbers
+ * Quickly and Accurately with Integers", 2010): the double and the boundaries
+ * of its rounding interval are scaled by a cached power of ten into a range
+ * where the integer and fractional parts fit 32 and 64 bits, and digits are
+ * generated until they identify a number inside the interval. The result
+ * always reads back as the same double, and is the shortest such number for
+ * all but a tiny fraction of inputs (where it's one digit longer). */
+#include "mcalc4_format.h"
+#include "mcalc4_stats.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Normal mode switches to scientific notation outside of [1e-6, 1e21). */
+#define FIXED_MIN_DECIMAL_POINT -5
+#define FIXED_MAX_DECIMAL_POINT 21
+
+/* Range of binary exponents which digit generation is designed for. */
+#define GRISU_ALPHA -60
+#define GRISU_GAMMA -32
+
+/* `f * 2^e`, not necessarily normalized. */
+struct DiyFp {
+    uint64_t f;
+    int e;
+};
+
+struct CachedPower {
+    uint64_t f;
+    int e;
+    int k;
+};
+
+#define CACHED_POWERS_MIN_DEC_EXP -300
+#define CACHED_POWERS_DEC_STEP 8
+
+/* Normalized approximations of 10^k for every 8th k in [-300, 324]. */
+static const struct CachedPower CACHED_POWERS[] = {
+    {UINT64_C(0xAB70FE17C79AC6CA), -1060, -300},
+    {UINT64_C(0xFF77B1FCBEBCDC4F), -1034, -292},
+    {UINT64_C(0xBE5691EF416BD60C), -1007, -284},
+    {UINT64_C(0x8DD01FAD907FFC3C), -980, -276},
+    {UINT64_C(0xD3515C2831559A83), -954, -268},
+    {UINT64_C(0x9D71AC8FADA6C9B5), -927, -260},
+    {UINT64_C(0xEA9C227723EE8BCB), -901, -252},
+    {UINT64_C(0xAECC49914078536D), -874, -244},
+    {UINT64_C(0x823C12795DB6CE57), -847, -236},
+    {UINT64_C(0xC21094364DFB5637), -821, -228},
+    {UINT64_C(0x9096EA6F3848984F), -794, -220},
+    {UINT64_C(0xD77485CB25823AC7), -768, -212},
+    {UINT64_C(0xA086CFCD97BF97F4), -741, -204},
+    {UINT64_C(0xEF340A98172AACE5), -715, -196},
+    {UINT64_C(0xB23867FB2A35B28E), -688, -188},
+    {UINT64_C(0x84C8D4DFD2C63F3B), -661, -180},
+    {UINT64_C(0xC5DD44271AD3CDBA), -635, -172},
+    {UINT64_C(0x936B9FCEBB25C996), -608, -164},
+    {UINT64_C(0xDBAC6C247D62A584), -582, -156},
+    {UINT64_C(0xA3AB66580D5FDAF6), -555, -148},
+    {UINT64_C(0xF3E2F893DEC3F126), -529, -140},
+    {UINT64_C(0xB5B5ADA8AAFF80B8), -502, -132},
+    {UINT64_C(0x87625F056C7C4A8B), -475, -124},
+    {UINT64_C(0xC9BCFF6034C13053), -449, -116},
+    {UINT64_C(0x964E858C91BA2655), -422, -108},
+    {UINT64_C(0xDFF9772470297EBD), -396, -100},
+    {UINT64_C(0xA6DFBD9FB8E5B88F), -369, -92},
+    {UINT64_C(0xF8A95FCF88747D94), -343, -84},
+    {UINT64_C(0xB94470938FA89BCF), -316, -76},
+    {UINT64_C(0x8A08F0F8BF0F156B), -289, -68},
+    {UINT64_C(0xCDB02555653131B6), -263, -60},
+    {UINT64_C(0x993FE2C6D07B7FAC), -236, -52},
+    {UINT64_C(0xE45C10C42A2B3B06), -210, -44},
+    {UINT64_C(0xAA242499697392D3), -183, -36},
+    {UINT64_C(0xFD87B5F28300CA0E), -157, -28},
+    {UINT64_C(0xBCE5086492111AEB), -130, -20},
+    {UINT64_C(0x8CBCCC096F5088CC), -103, -12},
+    {UINT64_C(0xD1B71758E219652C), -77, -4},
+    {UINT64_C(0x9C40000000000000), -50, 4},
+    {UINT64_C(0xE8D4A51000000000), -24, 12},
+    {UINT64_C(0xAD78EBC5AC620000), 3, 20},
+    {UINT64_C(0x813F3978F8940984), 30, 28},
+    {UINT64_C(0xC097CE7BC90715B3), 56, 36},
+    {UINT64_C(0x8F7E32CE7BEA5C70), 83, 44},
+    {UINT64_C(0xD5D238A4ABE98068), 109, 52},
+    {UINT64_C(0x9F4F2726179A2245), 136, 60},
+    {UINT64_C(0xED63A231D4C4FB27), 162, 68},
+    {UINT64_C(0xB0DE65388CC8ADA8), 189, 76},
+    {UINT64_C(0x83C7088E1AAB65DB), 216, 84},
+    {UINT64_C(0xC45D1DF942711D9A), 242, 92},
+    {UINT64_C(0x924D692CA61BE758), 269, 100},
+    {UINT64_C(0xDA01EE641A708DEA), 295, 108},
+    {UINT64_C(0xA26DA3999AEF774A), 322, 116},
+    {UINT64_C(0xF209787BB47D6B85), 348, 124},
+    {UINT64_C(0xB454E4A179DD1877), 375, 132},
+    {UINT64_C(0x865B86925B9BC5C2), 402, 140},
+    {UINT64_C(0xC83553C5C8965D3D), 428, 148},
+    {UINT64_C(0x952AB45CFA97A0B3), 455, 156},
+    {UINT64_C(0xDE469FBD99A05FE3), 481, 164},
+    {UINT64_C(0xA59BC234DB398C25), 508, 172},
+    {UINT64_C(0xF6C69A72A3989F5C), 534, 180},
+    {UINT64_C(0xB7DCBF5354E9BECE), 561, 188},
+    {UINT64_C(0x88FCF317F22241E2), 588, 196},
+    {UINT64_C(0xCC20CE9BD35C78A5), 614, 204},
+    {UINT64_C(0x98165AF37B2153DF), 641, 212},
+    {UINT64_C(0xE2A0B5DC971F303A), 667, 220},
+    {UINT64_C(0xA8D9D1535CE3B396), 694, 228},
+    {UINT64_C(0xFB9B7CD9A4A7443C), 720, 236},
+    {UINT64_C(0xBB764C4CA7A44410), 747, 244},
+    {UINT64_C(0x8BAB8EEFB6409C1A), 774, 252},
+    {UINT64_C(0xD01FEF10A657842C), 800, 260},
+    {UINT64_C(0x9B10A4E5E9913129), 827, 268},
+    {UINT64_C(0xE7109BFBA19C0C9D), 853, 276},
+    {UINT64_C(0xAC2820D9623BF429), 880, 284},
+    {UINT64_C(0x80444B5E7AA7CF85), 907, 292},
+    {UINT64_C(0xBF21E44003ACDD2D), 933, 300},
+    {UINT64_C(0x8E679C2F5E44FF8F), 960, 308},
+    {UINT64_C(0xD433179D9C8CB841), 986, 316},
+    {UINT64_C(0x9E19DB92B4E31BA9), 1013, 324},
+};
+
+static struct DiyFp diyfp_sub(struct DiyFp x, struct DiyFp y) {
+    return (struct DiyFp){x.f - y.f, x.e};
+}
+
+/**
+ * Returns `x * y`, rounded to the upper 64 bits of the product.
+ */
+static struct DiyFp diyfp_mul(struct DiyFp x, struct DiyFp y) {
+#ifdef __SIZEOF_INT128__
+    __extension__ typedef unsigned __int128 uint128;
+    const uint128 product = (uint128)x.f * y.f;
+    const uint64_t hi = (uint64_t)(product >> 64);
+    const uint64_t lo = (uint64_t)product;
+    return (struct DiyFp){hi + (lo >> 63), x.e + y.e + 64};
+#else
+    const uint64_t x_lo = (uint32_t)x.f, x_hi = x.f >> 32;
+    const uint64_t y_lo = (uint32_t)y.f, y_hi = y.f >> 32;
+    const uint64_t lo_lo = x_lo * y_lo;
+    const uint64_t hi_lo = x_hi * y_lo;
+    const uint64_t lo_hi = x_lo * y_hi;
+    const uint64_t hi_hi = x_hi * y_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + (uint32_t)lo_hi;
+    cross += UINT64_C(1) << 31; /* Round the low half. */
+    return (struct DiyFp){hi_hi + (hi_lo >> 32) + (lo_hi >> 32) + (cross >> 32),
+                          x.e + y.e + 64};
+#endif
+}
+
+static struct DiyFp diyfp_normalize(struct DiyFp x) {
+#if defined(__GNUC__) || defined(__clang__)
+    const int shift = __builtin_clzll(x.f);
+    return (struct DiyFp){x.f << shift, x.e - shift};
+#else
+    while ((x.f >> 63) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+#endif
+}
+
+/**
+ * Computes the normalized `value` and the boundaries `m_minus` and `m_plus`
+ * halfway to its neighbours, which share the binary exponent of `m_plus`.
+ * `value` must be finite and positive.
+ */
+static struct DiyFp compute_boundaries(double value, struct DiyFp* m_minus,
+                                       struct DiyFp* m_plus) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint64_t fraction = bits & ((UINT64_C(1) << 52) - 1);
+    const int biased_exp = (int)(bits >> 52);
+    const struct DiyFp v =
+        (biased_exp == 0)
+            ? (struct DiyFp){fraction, 1 - 1075}
+            : (struct DiyFp){fraction | (UINT64_C(1) << 52), biased_exp - 1075};
+
+    /* The gap below a power of two is half as big as the gap above it. */
+    const bool lower_is_closer = (fraction == 0) && (biased_exp > 1);
+    *m_plus = diyfp_normalize((struct DiyFp){(v.f << 1) + 1, v.e - 1});
+    const struct DiyFp lower = lower_is_closer
+                                   ? (struct DiyFp){(v.f << 2) - 1, v.e - 2}
+                                   : (struct DiyFp){(v.f << 1) - 1, v.e - 1};
+    *m_minus = (struct DiyFp){lower.f << (lower.e - m_plus->e), m_plus->e};
+    return diyfp_normalize(v);
+}
+
+/**
+ * Returns a cached power `c` such that multiplying a normalized number with
+ * binary exponent `e` by it gives an exponent in `[GRISU_ALPHA, GRISU_GAMMA]`.
+ */
+static const struct CachedPower* cached_power_for(int e) {
+    /* ceil((GRISU_ALPHA - e - 1) * log10(2)) */
+    const int f = GRISU_ALPHA - e - 1;
+    const int k = ((f * 78913) / (1 << 18)) + (f > 0);
+    const int index = (-CACHED_POWERS_MIN_DEC_EXP + k +
+                       (CACHED_POWERS_DEC_STEP - 1)) /
+                      CACHED_POWERS_DEC_STEP;
+    return &CACHED_POWERS[index];
+}
+
+/**
+ * Returns the largest power of ten `<= n` (or 1 for 0), and its number of
+ * digits in `num_digits`.
+ */
+static uint32_t largest_pow10(uint32_t n, int* num_digits) {
+    uint32_t pow10 = 1;
+    *num_digits = 1;
+    while ((n / pow10) >= 10) {
+        pow10 *= 10;
+        (*num_digits)++;
+    }
+    return pow10;
+}
+
+/**
+ * Moves the last digit towards `w` while the result stays inside the rounding
+ * interval and gets closer to `w`.
+ */
+static void round_last_digit(char* digits, int len, uint64_t dist,
+                             uint64_t delta, uint64_t rest, uint64_t ten_k) {
+    while ((rest < dist) && ((delta - rest) >= ten_k) &&
+           (((rest + ten_k) < dist) ||
+            ((dist - rest) > (rest + ten_k - dist)))) {
+        digits[len - 1]--;
+        rest += ten_k;
+    }
+}
+
+/**
+ * Writes the digits of a number in `[m_minus, m_plus]` which is close to `w`
+ * to `digits`, returning their count. The number is `digits * 10^exp10`.
+ */
+static int generate_digits(char* digits, int* exp10, struct DiyFp m_minus,
+                           struct DiyFp w, struct DiyFp m_plus) {
+    uint64_t delta = diyfp_sub(m_plus, m_minus).f;
+    uint64_t dist = diyfp_sub(m_plus, w).f;
+
+    /* Split m_plus into an integer part `p1` and a fraction `p2`. */
+    const int shift = -m_plus.e;
+    const uint64_t one = UINT64_C(1) << shift;
+    uint32_t p1 = (uint32_t)(m_plus.f >> shift);
+    uint64_t p2 = m_plus.f & (one - 1);
+
+    int len = 0;
+    int n;
+    uint32_t pow10 = largest_pow10(p1, &n);
+    while (n > 0) {
+        digits[len++] = (char)('0' + (p1 / pow10));
+        p1 %= pow10;
+        n--;
+        const uint64_t rest = ((uint64_t)p1 << shift) + p2;
+        if (rest <= delta) {
+            *exp10 += n;
+            round_last_digit(digits, len, dist, delta, rest,
+                             (uint64_t)pow10 << shift);
+            return len;
+        }
+        pow10 /= 10;
+    }
+
+    int m = 0;
+    do {
+        p2 *= 10;
+        digits[len++] = (char)('0' + (p2 >> shift));
+        p2 &= one - 1;
+        m++;
+        delta *= 10;
+        dist *= 10;
+    } while (p2 > delta);
+    *exp10 -= m;
+    round_last_digit(digits, len, dist, delta, p2, one);
+    return len;
+}
+
+/**
+ * Writes the shortest digits of the positive finite `value` to `digits`, so
+ * that `value` is `digits * 10^exp10`.
+ */
+static int grisu2(double value, char* digits, int* exp10) {
+    struct DiyFp m_minus, m_plus;
+    const struct DiyFp v = compute_boundaries(value, &m_minus, &m_plus);
+    const struct CachedPower* cached = cached_power_for(m_plus.e);
+    const struct DiyFp c = {cached->f, cached->e};
+
+    const struct DiyFp w = diyfp_mul(v, c);
+    struct DiyFp w_minus = diyfp_mul(m_minus, c);
+    struct DiyFp w_plus = diyfp_mul(m_plus, c);
+    /* Shrink the interval by one unit to account for rounding in `mul`. */
+    w_minus.f++;
+    w_plus.f--;
+
+    *exp10 = -cached->k;
+    return generate_digits(digits, exp10, w_minus, w, w_plus);
+}
+
+static size_t write_exponent(char* out, int exp) {
+    size_t len = 0;
+    out[len++] = 'e';
+    if (exp < 0) {
+        out[len++] = '-';
+        exp = -exp;
+    }
+    if (exp >= 100) out[len++] = (char)('0' + (exp / 100));
+    if (exp >= 10) out[len++] = (char)('0' + ((exp / 10) % 10));
+    out[len++] = (char)('0' + (exp % 10));
+    return len;
+}
+
+/**
+ * Writes `num_digits` digits with the decimal point after the first
+ * `int_digits`, padding with zeros if there are fewer digits than that.
+ */
+static size_t write_point_notation(char* out, const char* digits,
+                                   int num_digits, int int_digits) {
+    size_t len = 0;
+    if (int_digits <= 0) {
+        out[len++] = '0';
+        out[len++] = '.';
+        for (int i = int_digits; i < 0; i++) out[len++] = '0';
+        memcpy(&out[len], digits, num_digits);
+        return len + num_digits;
+    }
+    if (num_digits <= int_digits) {
+        memcpy(out, digits, num_digits);
+        len = num_digits;
+        for (int i = num_digits; i < int_digits; i++) out[len++] = '0';
+        return len;
+    }
+    memcpy(out, digits, int_digits);
+    len = int_digits;
+    out[len++] = '.';
+    memcpy(&out[len], &digits[int_digits], num_digits - int_digits);
+    return len + (num_digits - int_digits);
+}
+
+static size_t format_value(double value, enum OutputMode mode,
+                           char buffer[MC4_FORMAT_BUFFER_SIZE]) {
+    size_t len = 0;
+    if (isnan(value)) {
+        memcpy(buffer, "nan", 4);
+        return 3;
+    }
+    if (signbit(value)) {
+        buffer[len++] = '-';
+        value = -value;
+    }
+    if (isinf(value)) {
+        memcpy(&buffer[len], "inf", 4);
+        return len + 3;
+    }
+
+    char digits[18] = {'0'};
+    int num_digits = 1;
+    int exp10 = 0;
+    if (value != 0) num_digits = grisu2(value, digits, &exp10);
+    /* Position of the decimal point relative to the first digit. */
+    const int point = num_digits + exp10;
+
+    if ((mode == OUTPUT_MODE_NORMAL) &&
+        (((point >= FIXED_MIN_DECIMAL_POINT) &&
+          (point <= FIXED_MAX_DECIMAL_POINT)) ||
+         (value == 0))) {
+        len += write_point_notation(&buffer[len], digits, num_digits, point);
+        buffer[len] = '\0';
+        return len;
+    }
+
+    int exp = (value == 0) ? 0 : (point - 1);
+    int int_digits = 1;
+    if (mode == OUTPUT_MODE_ENGINEERING) {
+        const int remainder = ((exp % 3) + 3) % 3;
+        int_digits += remainder;
+        exp -= remainder;
+    }
+    len += write_point_notation(&buffer[len], digits, num_digits, int_digits);
+    len += write_exponent(&buffer[len], exp);
+    buffer[len] = '\0';
+    return len;
+}
+
+size_t MC4_format(double value, enum OutputMode mode,
+                  char buffer[MC4_FORMAT_BUFFER_SIZE]) {
+    const uint64_t start = stats_start();
+    const size_t len = format_value(value, mode, buffer);
+    stats_end(STATS_FORMAT, start);
+    return len;
+}
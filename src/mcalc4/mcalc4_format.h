@@ -0,0 +1,23 @@
+#ifndef MCALCULATOR_VERSION_4_FORMAT_H_
+#define MCALCULATOR_VERSION_4_FORMAT_H_
+
+#include "../cli/cli_types.h"
+#include <stddef.h>
+
+/* Large enough for any double in any output mode, including the '\0'. */
+#define MC4_FORMAT_BUFFER_SIZE 32
+
+/**
+ * Writes `value` to `buffer` with the fewest digits which read back as exactly
+ * `value`, and returns the length (excluding the '\0').
+ *
+ * `OUTPUT_MODE_NORMAL` uses plain notation for magnitudes in [1e-6, 1e21)
+ * (`0.1`, `1234.5`) and scientific notation otherwise. `OUTPUT_MODE_SCIENTIFIC`
+ * always writes one digit before the point (`1.2345e3`), and
+ * `OUTPUT_MODE_ENGINEERING` uses exponents which are multiples of 3
+ * (`12.345e3`). NaN and infinity are written as `nan`, `inf` and `-inf`.
+ */
+size_t MC4_format(double value, enum OutputMode mode,
+                  char buffer[MC4_FORMAT_BUFFER_SIZE]);
+
+#endif
@@ -0,0 +1,318 @@
+#include "mcalc4_formulas.h"
+#include "../../libs/mlogging.h"
+#include "mcalc4_types.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Formula {
+    /* NULL if the variable holds a plain value. */
+    struct MC4_Compiled* expr;
+    char* equ;
+    /* Variables whose formulas read this variable. */
+    unsigned int* dependents;
+    unsigned int num_dependents;
+    unsigned int dependents_capacity;
+};
+
+struct MC4_Formulas {
+    /* One per variable set slot, `capacity` long like the arrays below. */
+    struct Formula* formulas;
+    unsigned int capacity;
+    size_t num_evaluations;
+    /* Scratch space for walking the dependency graph. A slot has been visited
+    by the current walk if its mark is `generation`, so starting a walk
+    doesn't touch every slot. */
+    unsigned int* visit_marks;
+    unsigned int generation;
+    unsigned int* stack;
+    unsigned int* next_child;
+    unsigned int* order;
+};
+
+struct MC4_Formulas* MC4_formulas_new(void) {
+    struct MC4_Formulas* formulas = calloc(1, sizeof(struct MC4_Formulas));
+    if (formulas == NULL) MLOG.panic("Out of memory.");
+    return formulas;
+}
+
+/**
+ * Makes room for every slot of `vars`.
+ */
+static void reserve_slots(struct MC4_Formulas* formulas,
+                          const struct MC4_VariableSet* vars) {
+    if (vars->num_slots <= formulas->capacity) return;
+    unsigned int capacity = (formulas->capacity == 0) ? 32 : formulas->capacity;
+    while (capacity < vars->num_slots) capacity *= 2;
+    formulas->formulas =
+        realloc(formulas->formulas, capacity * sizeof(struct Formula));
+    formulas->visit_marks =
+        realloc(formulas->visit_marks, capacity * sizeof(unsigned int));
+    formulas->stack = realloc(formulas->stack, capacity * sizeof(unsigned int));
+    formulas->next_child =
+        realloc(formulas->next_child, capacity * sizeof(unsigned int));
+    formulas->order = realloc(formulas->order, capacity * sizeof(unsigned int));
+    if ((formulas->formulas == NULL) || (formulas->visit_marks == NULL) ||
+        (formulas->stack == NULL) || (formulas->next_child == NULL) ||
+        (formulas->order == NULL)) {
+        MLOG.panic("Out of memory.");
+    }
+    const unsigned int num_new = capacity - formulas->capacity;
+    memset(&formulas->formulas[formulas->capacity], 0,
+           num_new * sizeof(struct Formula));
+    memset(&formulas->visit_marks[formulas->capacity], 0,
+           num_new * sizeof(unsigned int));
+    formulas->capacity = capacity;
+}
+
+static bool is_visited(const struct MC4_Formulas* formulas,
+                       unsigned int slot) {
+    return formulas->visit_marks[slot] == formulas->generation;
+}
+
+/**
+ * Forgets which slots have been visited.
+ */
+static void start_walk(struct MC4_Formulas* formulas) {
+    if (++formulas->generation == 0) {
+        memset(formulas->visit_marks, 0,
+               formulas->capacity * sizeof(unsigned int));
+        formulas->generation = 1;
+    }
+}
+
+static void add_dependent(struct Formula* formula, unsigned int slot) {
+    if (formula->num_dependents == formula->dependents_capacity) {
+        formula->dependents_capacity =
+            (formula->dependents_capacity == 0)
+                ? 4
+                : (formula->dependents_capacity * 2);
+        formula->dependents =
+            realloc(formula->dependents,
+                    formula->dependents_capacity * sizeof(unsigned int));
+        if (formula->dependents == NULL) MLOG.panic("Out of memory.");
+    }
+    formula->dependents[formula->num_dependents++] = slot;
+}
+
+static void remove_dependent(struct Formula* formula, unsigned int slot) {
+    for (unsigned int i = 0; i < formula->num_dependents; i++) {
+        if (formula->dependents[i] == slot) {
+            formula->dependents[i] =
+                formula->dependents[--formula->num_dependents];
+            return;
+        }
+    }
+}
+
+/**
+ * Removes the formula of `slot`, keeping the formulas which depend on it.
+ */
+static void unbind(struct MC4_Formulas* formulas, unsigned int slot) {
+    struct Formula* formula = &formulas->formulas[slot];
+    if (formula->expr == NULL) return;
+    for (unsigned int i = 0; i < formula->expr->num_vars_read; i++) {
+        remove_dependent(&formulas->formulas[formula->expr->vars_read[i]],
+                         slot);
+    }
+    MC4_free_compiled(formula->expr);
+    free(formula->equ);
+    formula->expr = NULL;
+    formula->equ = NULL;
+}
+
+/**
+ * Appends `root` and every variable which depends on it and hasn't been
+ * visited yet to `formulas->order` in depth-first post-order, so everything
+ * comes before what it reads. Uses an explicit stack so long chains can't
+ * overflow the call stack.
+ */
+static unsigned int visit(struct MC4_Formulas* formulas, unsigned int root,
+                          unsigned int num_ordered) {
+    if (is_visited(formulas, root)) return num_ordered;
+    unsigned int depth = 0;
+    formulas->stack[depth] = root;
+    formulas->next_child[depth++] = 0;
+    formulas->visit_marks[root] = formulas->generation;
+    while (depth > 0) {
+        const unsigned int slot = formulas->stack[depth - 1];
+        const struct Formula* formula = &formulas->formulas[slot];
+        if (formulas->next_child[depth - 1] < formula->num_dependents) {
+            const unsigned int child =
+                formula->dependents[formulas->next_child[depth - 1]++];
+            if (!is_visited(formulas, child)) {
+                formulas->visit_marks[child] = formulas->generation;
+                formulas->stack[depth] = child;
+                formulas->next_child[depth++] = 0;
+            }
+        } else {
+            formulas->order[num_ordered++] = slot;
+            depth--;
+        }
+    }
+    return num_ordered;
+}
+
+static void reverse_order(struct MC4_Formulas* formulas,
+                          unsigned int num_ordered) {
+    for (unsigned int i = 0; i < (num_ordered / 2); i++) {
+        const unsigned int tmp = formulas->order[i];
+        formulas->order[i] = formulas->order[num_ordered - 1 - i];
+        formulas->order[num_ordered - 1 - i] = tmp;
+    }
+}
+
+/**
+ * Writes `root` and every variable which depends on it to `formulas->order`,
+ * each one after everything it reads, and returns their number. Marks them as
+ * visited.
+ */
+static unsigned int topological_order(struct MC4_Formulas* formulas,
+                                      unsigned int root) {
+    start_walk(formulas);
+    const unsigned int num_ordered = visit(formulas, root, 0);
+    reverse_order(formulas, num_ordered);
+    return num_ordered;
+}
+
+/**
+ * Evaluates the formula of `slot`. A formula which can't be evaluated leaves
+ * its variable undefined, so everything which reads it fails too.
+ */
+static MC4_ErrorCode evaluate(struct MC4_Formulas* formulas,
+                              struct MC4_VariableSet* vars,
+                              unsigned int slot) {
+    MC4_ErrorCode err = MC4_ERR_NONE;
+    const double value =
+        MC4_eval_compiled(formulas->formulas[slot].expr, vars, &err);
+    formulas->num_evaluations++;
+    vars->exists[slot] = (err == MC4_ERR_NONE);
+    vars->values[slot] = (err == MC4_ERR_NONE) ? value : 0;
+    return err;
+}
+
+/**
+ * Evaluates the first `num_ordered` formulas of `formulas->order`, skipping
+ * plain values. Returns the error of `root`'s formula.
+ */
+static MC4_ErrorCode evaluate_in_order(struct MC4_Formulas* formulas,
+                                       struct MC4_VariableSet* vars,
+                                       unsigned int num_ordered,
+                                       unsigned int root) {
+    MC4_ErrorCode root_err = MC4_ERR_NONE;
+    for (unsigned int i = 0; i < num_ordered; i++) {
+        const unsigned int slot = formulas->order[i];
+        if (formulas->formulas[slot].expr == NULL) continue;
+        const MC4_ErrorCode err = evaluate(formulas, vars, slot);
+        if (slot == root) root_err = err;
+    }
+    return root_err;
+}
+
+/**
+ * Evaluates every formula which depends on `root`, and `root` itself if it
+ * has a formula. Returns the error of `root`'s formula.
+ */
+static MC4_ErrorCode propagate(struct MC4_Formulas* formulas,
+                               struct MC4_VariableSet* vars,
+                               unsigned int root) {
+    const unsigned int num_ordered = topological_order(formulas, root);
+    return evaluate_in_order(formulas, vars, num_ordered, root);
+}
+
+MC4_ErrorCode MC4_formulas_bind(struct MC4_Formulas* formulas,
+                                struct MC4_VariableSet* vars,
+                                const char* name, const char* equ,
+                                const struct MC4_Settings* settings) {
+    const unsigned int slot = varset_intern(vars, name, strlen(name));
+    MC4_ErrorCode err = MC4_ERR_NONE;
+    struct MC4_Compiled* expr = MC4_compile(equ, vars, settings, &err);
+    if (expr == NULL) return err;
+    reserve_slots(formulas, vars);
+
+    /* `equ` closes a cycle if it reads `name` or anything depending on it.
+    Either error is found before the old binding is removed, so a failed
+    bind leaves `name` as it was. */
+    topological_order(formulas, slot);
+    for (unsigned int i = 0; i < expr->num_vars_read; i++) {
+        if (is_visited(formulas, expr->vars_read[i])) {
+            MC4_free_compiled(expr);
+            return MC4_ERR_CYCLE;
+        }
+    }
+    for (unsigned int i = 0; i < expr->num_vars_read; i++) {
+        if (!vars->exists[expr->vars_read[i]]) {
+            MC4_free_compiled(expr);
+            return MC4_ERR_VAR_NOT_FOUND;
+        }
+    }
+
+    const size_t equ_len = strlen(equ);
+    char* equ_copy = malloc(equ_len + 1);
+    if (equ_copy == NULL) MLOG.panic("Out of memory.");
+    memcpy(equ_copy, equ, equ_len + 1);
+
+    unbind(formulas, slot);
+    struct Formula* formula = &formulas->formulas[slot];
+    formula->expr = expr;
+    formula->equ = equ_copy;
+    for (unsigned int i = 0; i < expr->num_vars_read; i++) {
+        add_dependent(&formulas->formulas[expr->vars_read[i]], slot);
+    }
+    return propagate(formulas, vars, slot);
+}
+
+void MC4_formulas_assign(struct MC4_Formulas* formulas,
+                         struct MC4_VariableSet* vars, const char* name,
+                         double value) {
+    const unsigned int slot = varset_intern(vars, name, strlen(name));
+    reserve_slots(formulas, vars);
+    unbind(formulas, slot);
+    vars->exists[slot] = true;
+    vars->values[slot] = value;
+    propagate(formulas, vars, slot);
+}
+
+void MC4_formulas_recompute_all(struct MC4_Formulas* formulas,
+                                struct MC4_VariableSet* vars,
+                                const struct MC4_Settings* settings) {
+    for (unsigned int slot = 0; slot < formulas->capacity; slot++) {
+        struct Formula* formula = &formulas->formulas[slot];
+        if (formula->expr == NULL) continue;
+        /* The text compiled before, and its names are already in `vars`, so
+        only the angle mode can change. */
+        MC4_ErrorCode err = MC4_ERR_NONE;
+        struct MC4_Compiled* expr =
+            MC4_compile(formula->equ, vars, settings, &err);
+        if (expr == NULL) continue;
+        MC4_free_compiled(formula->expr);
+        formula->expr = expr;
+    }
+
+    start_walk(formulas);
+    unsigned int num_ordered = 0;
+    for (unsigned int slot = 0; slot < formulas->capacity; slot++) {
+        num_ordered = visit(formulas, slot, num_ordered);
+    }
+    reverse_order(formulas, num_ordered);
+    evaluate_in_order(formulas, vars, num_ordered, formulas->capacity);
+}
+
+size_t MC4_formulas_num_evaluations(const struct MC4_Formulas* formulas) {
+    return formulas->num_evaluations;
+}
+
+void MC4_formulas_free(struct MC4_Formulas* formulas) {
+    for (unsigned int slot = 0; slot < formulas->capacity; slot++) {
+        struct Formula* formula = &formulas->formulas[slot];
+        MC4_free_compiled(formula->expr);
+        free(formula->equ);
+        free(formula->dependents);
+    }
+    free(formulas->formulas);
+    free(formulas->visit_marks);
+    free(formulas->stack);
+    free(formulas->next_child);
+    free(formulas->order);
+    free(formulas);
+}
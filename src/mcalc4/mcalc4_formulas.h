@@ -0,0 +1,54 @@
+#ifndef MCALCULATOR_VERSION_4_FORMULAS_H_
+#define MCALCULATOR_VERSION_4_FORMULAS_H_
+
+#include "mcalc4.h"
+#include <stddef.h>
+
+/**
+ * Variables which are bound to formulas, like the cells of a spreadsheet.
+ *
+ * Every formula is compiled once and records the variables it reads. When a
+ * variable changes, only the formulas which depend on it (directly or through
+ * other formulas) are evaluated again, in dependency order. Values live in an
+ * ordinary `MC4_VariableSet`, which must be the same one in every call.
+ */
+struct MC4_Formulas;
+
+struct MC4_Formulas* MC4_formulas_new(void);
+
+/**
+ * Binds `name` to `equ`, then evaluates it and every formula which depends on
+ * `name`. Returns `MC4_ERR_CYCLE` without changing anything if `equ` would read
+ * `name` itself, directly or through other formulas, `MC4_ERR_VAR_NOT_FOUND`
+ * without changing anything if `equ` reads an undefined variable, or the
+ * compile error if `equ` is invalid.
+ */
+MC4_ErrorCode MC4_formulas_bind(struct MC4_Formulas* formulas,
+                                struct MC4_VariableSet* vars,
+                                const char* name, const char* equ,
+                                const struct MC4_Settings* settings);
+
+/**
+ * Sets `name` to `value`, removing its formula if it had one, and evaluates
+ * every formula which depends on `name`.
+ */
+void MC4_formulas_assign(struct MC4_Formulas* formulas,
+                         struct MC4_VariableSet* vars, const char* name,
+                         double value);
+
+/**
+ * Compiles every formula again with `settings` and evaluates all of them, for
+ * when the angle mode changes.
+ */
+void MC4_formulas_recompute_all(struct MC4_Formulas* formulas,
+                                struct MC4_VariableSet* vars,
+                                const struct MC4_Settings* settings);
+
+/**
+ * Returns how many formula evaluations have been done so far.
+ */
+size_t MC4_formulas_num_evaluations(const struct MC4_Formulas* formulas);
+
+void MC4_formulas_free(struct MC4_Formulas* formulas);
+
+#endif
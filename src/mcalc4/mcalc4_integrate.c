@@ -0,0 +1,193 @@
+#include "mcalc4_integrate.h"
+#include "../../libs/mlogging.h"
+#include "mcalc4_jit.h"
+#include "mcalc4_pool.h"
+#include "mcalc4_types.h"
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+/* Pieces the range is split into if one interval isn't enough. It doesn't
+depend on the number of threads, so neither does the result, and is enough
+for threads to steal the pieces of a thread stuck on a hard part. */
+#define INTEGRATE_NUM_PIECES 64
+/* Intervals are halved at most this many times. */
+#define INTEGRATE_MAX_DEPTH 40
+/* Intervals one piece may evaluate before the rest are accepted as they are. */
+#define INTEGRATE_MAX_INTERVALS (1 << 14)
+
+/* Abscissae and weights of the 15 point Kronrod rule, and the weights of the
+7 point Gauss rule which uses every other abscissa (QUADPACK's `qk15`). */
+static const double KRONROD_X[8] = {
+    0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245, 0.000000000000000000000000000000000,
+};
+static const double KRONROD_W[8] = {
+    0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649, 0.209482141084727828012999174891714,
+};
+static const double GAUSS_W[4] = {
+    0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975, 0.417959183673469387755102040816327,
+};
+
+/**
+ * Applies the Kronrod rule to `[a, b]`, writing the difference from the Gauss
+ * rule to `error`. As in QUADPACK, the difference is never less than the
+ * rounding error of the sum, `50 * DBL_EPSILON` times the integral of `|f|`,
+ * which is written to `roundoff`.
+ */
+static double gauss_kronrod(struct MC4_JitBinding* f, double a, double b,
+                            double* error, double* roundoff) {
+    const double center = 0.5 * (a + b);
+    const double half = 0.5 * (b - a);
+    const double f_center = MC4_jit_eval_at(f, center);
+    double kronrod = f_center * KRONROD_W[7];
+    double gauss = f_center * GAUSS_W[3];
+    double kronrod_abs = fabs(f_center) * KRONROD_W[7];
+    for (int i = 0; i < 7; i++) {
+        const double dx = half * KRONROD_X[i];
+        const double lower = MC4_jit_eval_at(f, center - dx);
+        const double upper = MC4_jit_eval_at(f, center + dx);
+        kronrod += KRONROD_W[i] * (lower + upper);
+        kronrod_abs += KRONROD_W[i] * (fabs(lower) + fabs(upper));
+        if ((i % 2) == 1) gauss += GAUSS_W[i / 2] * (lower + upper);
+    }
+    *roundoff = 50 * DBL_EPSILON * fabs(kronrod_abs * half);
+    *error = fmax(fabs((kronrod - gauss) * half), *roundoff);
+    return kronrod * half;
+}
+
+/* The error `MC4_integrate()` aims for, given the integral is about
+`value`. */
+static double integral_tol(double abs_tol, double rel_tol, double value) {
+    return fmax(abs_tol, rel_tol * fabs(value));
+}
+
+struct Interval {
+    double a;
+    double b;
+    int depth;
+};
+
+struct IntegrateJob {
+    const struct MC4_Jit* jit;
+    const struct MC4_VariableSet* vars;
+    int slot;
+    double from;
+    double to;
+    /* Allowed error per unit of the range. */
+    double tol_density;
+    size_t num_pieces;
+    struct MC4_Integral* pieces;
+};
+
+/**
+ * Integrates piece `index` of the range, halving intervals depth first, so at
+ * most one interval per level is waiting at any time.
+ */
+static void integrate_task(void* ctx, size_t index) {
+    struct IntegrateJob* job = ctx;
+    struct MC4_JitBinding f = MC4_jit_bind(job->jit, job->vars, job->slot);
+    const double width = (job->to - job->from) / job->num_pieces;
+    struct Interval stack[INTEGRATE_MAX_DEPTH + 1];
+    stack[0] = (struct Interval){
+        .a = job->from + (index * width),
+        .b = job->from + ((index + 1) * width),
+    };
+    if ((index + 1) == job->num_pieces) stack[0].b = job->to;
+    int num_waiting = 1;
+    size_t num_intervals = 0;
+    struct MC4_Integral piece = {0};
+    while (num_waiting > 0) {
+        const struct Interval interval = stack[--num_waiting];
+        double error, roundoff;
+        const double value =
+            gauss_kronrod(&f, interval.a, interval.b, &error, &roundoff);
+        num_intervals++;
+        const bool within_tol =
+            error <= (job->tol_density * fabs(interval.b - interval.a));
+        /* Halving doesn't help once the value isn't finite, or once the error
+        is all rounding, which halves with the interval. */
+        if (within_tol || !isfinite(value) || (error <= roundoff) ||
+            (interval.depth == INTEGRATE_MAX_DEPTH) ||
+            (num_intervals >= INTEGRATE_MAX_INTERVALS)) {
+            piece.value += value;
+            piece.error += error;
+            continue;
+        }
+        const double middle = 0.5 * (interval.a + interval.b);
+        stack[num_waiting++] = (struct Interval){
+            middle, interval.b, interval.depth + 1};
+        stack[num_waiting++] = (struct Interval){
+            interval.a, middle, interval.depth + 1};
+    }
+    piece.num_evals = f.num_evals;
+    job->pieces[index] = piece;
+    MC4_jit_unbind(&f);
+}
+
+MC4_ErrorCode MC4_integrate(const char* equ, const char* var, double from,
+                            double to, double abs_tol, double rel_tol,
+                            struct MC4_VariableSet* vars,
+                            const struct MC4_Settings* settings,
+                            unsigned int num_threads,
+                            struct MC4_Integral* result) {
+    *result = (struct MC4_Integral){.converged = true};
+    struct MC4_JitFunction fn;
+    const MC4_ErrorCode err =
+        MC4_jit_function_compile(&fn, equ, var, vars, settings);
+    if (err != MC4_ERR_NONE) return err;
+    if (from == to) {
+        MC4_jit_function_free(&fn);
+        return MC4_ERR_NONE;
+    }
+    struct MC4_JitBinding f = MC4_jit_bind(fn.jit, fn.vars, fn.slot);
+    /* Smooth integrands are done with one rule, without starting threads. */
+    double roundoff;
+    result->value = gauss_kronrod(&f, from, to, &result->error, &roundoff);
+    result->num_evals = f.num_evals;
+    MC4_jit_unbind(&f);
+    /* The pieces share the tolerance for the integral this rule estimates, so
+    it doesn't depend on which thread finishes first. */
+    const double tol = integral_tol(abs_tol, rel_tol, result->value);
+    if ((result->error <= tol) && isfinite(result->value)) {
+        MC4_jit_function_free(&fn);
+        return MC4_ERR_NONE;
+    }
+    struct IntegrateJob job = {
+        .jit = fn.jit,
+        .vars = fn.vars,
+        .slot = fn.slot,
+        .from = from,
+        .to = to,
+        .tol_density = tol / fabs(to - from),
+        .num_pieces = INTEGRATE_NUM_PIECES,
+    };
+
+    struct MC4_ThreadPool* pool = pool_new(num_threads);
+    job.pieces = malloc(job.num_pieces * sizeof(struct MC4_Integral));
+    if (job.pieces == NULL) MLOG.panic("Out of memory.");
+    pool_run(pool, job.num_pieces, integrate_task, &job);
+    *result = (struct MC4_Integral){.num_evals = result->num_evals};
+
+    /* Summed in order, so the result doesn't depend on which thread
+    integrated which piece. */
+    for (size_t i = 0; i < job.num_pieces; i++) {
+        result->value += job.pieces[i].value;
+        result->error += job.pieces[i].error;
+        result->num_evals += job.pieces[i].num_evals;
+    }
+    result->converged =
+        isfinite(result->value) &&
+        (result->error <= integral_tol(abs_tol, rel_tol, result->value));
+
+    free(job.pieces);
+    pool_free(pool);
+    MC4_jit_function_free(&fn);
+    return MC4_ERR_NONE;
+}
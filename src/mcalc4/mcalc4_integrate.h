@@ -0,0 +1,46 @@
+#ifndef MCALCULATOR_VERSION_4_INTEGRATE_H_
+#define MCALCULATOR_VERSION_4_INTEGRATE_H_
+
+#include "mcalc4.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Absolute and relative tolerances `integrate` uses unless it is given
+them. */
+#define MC4_INTEGRATE_DEFAULT_ABS_TOL 1e-10
+#define MC4_INTEGRATE_DEFAULT_REL_TOL 1e-10
+
+struct MC4_Integral {
+    double value;
+    /* Estimated absolute error of `value`, which is never less than the
+    rounding error of summing the integrand. */
+    double error;
+    /* Number of times the integrand was evaluated. */
+    size_t num_evals;
+    /* False if `error` isn't within the tolerance, usually because the
+    integrand is singular or isn't finite. */
+    bool converged;
+};
+
+/**
+ * Integrates `equ` over the variable `var` from `from` to `to`, which must be
+ * finite (`to` may be less than `from`), to an error of about
+ * `max(abs_tol, rel_tol * |integral|)` as in QUADPACK.
+ *
+ * `equ` is compiled once and translated with `MC4_jit_compile()`, and
+ * integrated with adaptive 15 point Gauss-Kronrod quadrature: an interval is
+ * halved until the difference between its Kronrod and Gauss estimates is
+ * within its share of the tolerance, or is no more than the rounding error of
+ * the rule, which halving can't reduce. If one rule over the whole range
+ * isn't enough, the range is split into pieces which are integrated on
+ * `num_threads` threads (0 uses one per CPU). Other variables are read from
+ * `vars`, which may be NULL, and gets `var` if it is new but keeps its value.
+ */
+MC4_ErrorCode MC4_integrate(const char* equ, const char* var, double from,
+                            double to, double abs_tol, double rel_tol,
+                            struct MC4_VariableSet* vars,
+                            const struct MC4_Settings* settings,
+                            unsigned int num_threads,
+                            struct MC4_Integral* result);
+
+#endif
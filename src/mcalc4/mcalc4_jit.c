@@ -0,0 +1,346 @@
+#define _DEFAULT_SOURCE
+#include "mcalc4_jit.h"
+#include "../../libs/mlogging.h"
+#include "mcalc4_stats.h"
+#include "mcalc4_types.h"
+#include "mcalc4_varset.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define HAS_X86_64_JIT 1
+#include <sys/mman.h>
+#endif
+
+typedef double (*NativeFn)(const double* values);
+
+struct MC4_Jit {
+    const struct MC4_Compiled* expr;
+    /* NULL if `expr` is interpreted. */
+    NativeFn native;
+    void* code;
+    size_t code_size;
+    /* Calls of every function per evaluation, which native code makes
+    without counting them. */
+    unsigned int num_func_calls[NUM_FUNC_TYPES];
+};
+
+#ifdef HAS_X86_64_JIT
+
+/* Every node is emitted in at most this many bytes. */
+#define MAX_NODE_BYTES 64
+/* Larger expressions would need too big a stack frame, and are interpreted. */
+#define MAX_NATIVE_NODES 8192
+
+/* SSE2 opcodes, after the 0xF2 prefix and 0x0F escape. */
+enum SseOpcode {
+    SSE_LOAD = 0x10,
+    SSE_STORE = 0x11,
+    SSE_ADD = 0x58,
+    SSE_MUL = 0x59,
+    SSE_SUB = 0x5C,
+    SSE_DIV = 0x5E,
+};
+
+/* Base registers of memory operands: node results are in the stack frame,
+variables are at `rbx`, which holds the `values` argument. */
+enum Base {
+    BASE_FRAME = 4, /* rsp */
+    BASE_VALUES = 3, /* rbx */
+};
+
+struct Emitter {
+    unsigned char* code;
+    size_t len;
+};
+
+static void emit(struct Emitter* out, const unsigned char* bytes, size_t len) {
+    memcpy(&out->code[out->len], bytes, len);
+    out->len += len;
+}
+
+static void emit_u32(struct Emitter* out, uint32_t value) {
+    emit(out, (const unsigned char*)&value, sizeof(value));
+}
+
+static void emit_u64(struct Emitter* out, uint64_t value) {
+    emit(out, (const unsigned char*)&value, sizeof(value));
+}
+
+/**
+ * Emits the ModRM (and SIB) bytes and displacement of `[base + disp]`, with
+ * `reg` in the reg field.
+ */
+static void emit_mem(struct Emitter* out, int reg, enum Base base,
+                     uint32_t disp) {
+    const unsigned char modrm = 0x80 | (reg << 3) | base;
+    emit(out, &modrm, 1);
+    if (base == BASE_FRAME) emit(out, (const unsigned char[]){0x24}, 1);
+    emit_u32(out, disp);
+}
+
+/**
+ * Emits `op xmm<reg>, [base + disp]` (or the store, `[base + disp], xmm<reg>`).
+ */
+static void emit_sse(struct Emitter* out, enum SseOpcode op, int reg,
+                     enum Base base, uint32_t disp) {
+    emit(out, (const unsigned char[]){0xF2, 0x0F, op}, 3);
+    emit_mem(out, reg, base, disp);
+}
+
+/**
+ * Emits `mov rax, imm64`.
+ */
+static void emit_mov_rax(struct Emitter* out, uint64_t imm) {
+    emit(out, (const unsigned char[]){0x48, 0xB8}, 2);
+    emit_u64(out, imm);
+}
+
+/**
+ * Emits a call of the function at `address`, with the arguments in `xmm0` and
+ * `xmm1`.
+ */
+static void emit_call(struct Emitter* out, uintptr_t address) {
+    emit_mov_rax(out, address);
+    emit(out, (const unsigned char[]){0xFF, 0xD0}, 2); /* call rax */
+}
+
+static uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static uintptr_t libm_func(enum FuncType func_type) {
+    switch (func_type) {
+    case FN_SIN: return (uintptr_t)sin;
+    case FN_COS: return (uintptr_t)cos;
+    case FN_TAN: return (uintptr_t)tan;
+    case FN_ASIN: return (uintptr_t)asin;
+    case FN_ACOS: return (uintptr_t)acos;
+    case FN_ATAN: return (uintptr_t)atan;
+    case FN_LOG_10: return (uintptr_t)log10;
+    case FN_LOG_E: return (uintptr_t)log;
+    case FN_SQRT: return (uintptr_t)sqrt;
+    }
+    return 0;
+}
+
+static enum SseOpcode op_opcode(char op) {
+    switch (op) {
+    case '+': return SSE_ADD;
+    case '-': return SSE_SUB;
+    case '*': return SSE_MUL;
+    default: return SSE_DIV;
+    }
+}
+
+/**
+ * Loads the result of node `index` into `xmm0`, unless it is already there.
+ */
+static void emit_load_xmm0(struct Emitter* out, unsigned int index,
+                           unsigned int in_xmm0) {
+    if (index != in_xmm0) emit_sse(out, SSE_LOAD, 0, BASE_FRAME, index * 8);
+}
+
+/**
+ * Writes the code of `expr` to `out`. `xmm0` is tracked so an operand which
+ * was computed by the previous node isn't loaded again.
+ */
+static void emit_expr(struct Emitter* out, const struct MC4_Compiled* expr,
+                      uint32_t frame_size) {
+    /* push rbx; mov rbx, rdi; sub rsp, frame_size */
+    emit(out, (const unsigned char[]){0x53, 0x48, 0x89, 0xFB, 0x48, 0x81, 0xEC},
+         7);
+    emit_u32(out, frame_size);
+
+    /* No node has this index. */
+    unsigned int in_xmm0 = expr->num_nodes;
+    for (unsigned int i = 0; i < expr->num_nodes; i++) {
+        const struct MC4_Node* node = &expr->nodes[i];
+        switch (node->type) {
+        case NODE_NUMBER:
+            emit_mov_rax(out, double_bits(node->value));
+            /* mov [rsp + disp], rax */
+            emit(out, (const unsigned char[]){0x48, 0x89}, 2);
+            emit_mem(out, 0, BASE_FRAME, i * 8);
+            continue;
+        case NODE_VARIABLE:
+            emit_sse(out, SSE_LOAD, 0, BASE_VALUES, node->slot * 8);
+            break;
+        case NODE_OPERATOR:
+            if (node->op == '^') {
+                emit_sse(out, SSE_LOAD, 1, BASE_FRAME, node->rhs * 8);
+                emit_load_xmm0(out, node->lhs, in_xmm0);
+                emit_call(out, (uintptr_t)pow);
+            } else {
+                emit_load_xmm0(out, node->lhs, in_xmm0);
+                emit_sse(out, op_opcode(node->op), 0, BASE_FRAME,
+                         node->rhs * 8);
+            }
+            break;
+        case NODE_FUNCTION:
+            emit_load_xmm0(out, node->lhs, in_xmm0);
+            if ((expr->angle_mode == ANGLE_MODE_DEG) &&
+                ((node->func_type == FN_SIN) || (node->func_type == FN_COS) ||
+                 (node->func_type == FN_TAN))) {
+                /* Same conversion as `convert_angle_units()`. */
+                emit_mov_rax(out, double_bits(M_PI / 180));
+                /* movq xmm1, rax; mulsd xmm0, xmm1 */
+                emit(out,
+                     (const unsigned char[]){0x66, 0x48, 0x0F, 0x6E, 0xC8, 0xF2,
+                                             0x0F, 0x59, 0xC1},
+                     9);
+            }
+            emit_call(out, libm_func(node->func_type));
+            break;
+        }
+        emit_sse(out, SSE_STORE, 0, BASE_FRAME, i * 8);
+        in_xmm0 = i;
+    }
+
+    emit_load_xmm0(out, expr->num_nodes - 1, in_xmm0);
+    /* add rsp, frame_size; pop rbx; ret */
+    emit(out, (const unsigned char[]){0x48, 0x81, 0xC4}, 3);
+    emit_u32(out, frame_size);
+    emit(out, (const unsigned char[]){0x5B, 0xC3}, 2);
+}
+
+/**
+ * Checks that every displacement `emit_expr()` uses fits in 32 bits.
+ */
+static bool can_emit(const struct MC4_Compiled* expr) {
+    if ((expr->num_nodes == 0) || (expr->num_nodes > MAX_NATIVE_NODES)) {
+        return false;
+    }
+    for (unsigned int i = 0; i < expr->num_nodes; i++) {
+        if ((expr->nodes[i].type == NODE_VARIABLE) &&
+            ((unsigned int)expr->nodes[i].slot > (INT32_MAX / 8))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void compile_native(struct MC4_Jit* jit) {
+    const struct MC4_Compiled* expr = jit->expr;
+    if (!can_emit(expr)) return;
+    const size_t max_size = (expr->num_nodes + 2) * MAX_NODE_BYTES;
+    void* code = mmap(NULL, max_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) return;
+
+    /* On entry `rsp` is 8 bytes past a 16 byte boundary, and `push rbx`
+    realigns it, so calls stay aligned if the frame is a multiple of 16. */
+    const uint32_t frame_size = ((expr->num_nodes * 8) + 15) & ~15u;
+    struct Emitter out = {.code = code, .len = 0};
+    emit_expr(&out, expr, frame_size);
+    if (mprotect(code, max_size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, max_size);
+        return;
+    }
+    jit->code = code;
+    jit->code_size = max_size;
+    /* ISO C has no conversion from object to function pointers. */
+    memcpy(&jit->native, &code, sizeof(code));
+}
+
+#endif
+
+struct MC4_Jit* MC4_jit_compile(const struct MC4_Compiled* expr) {
+    struct MC4_Jit* jit = malloc(sizeof(struct MC4_Jit));
+    if (jit == NULL) MLOG.panic("Out of memory.");
+    *jit = (struct MC4_Jit){.expr = expr};
+    for (unsigned int i = 0; i < expr->num_nodes; i++) {
+        if (expr->nodes[i].type == NODE_FUNCTION) {
+            jit->num_func_calls[expr->nodes[i].func_type]++;
+        }
+    }
+#ifdef HAS_X86_64_JIT
+    compile_native(jit);
+#endif
+    return jit;
+}
+
+bool MC4_jit_is_native(const struct MC4_Jit* jit) {
+    return jit->native != NULL;
+}
+
+double MC4_jit_eval(const struct MC4_Jit* jit,
+                    const struct MC4_VariableSet* vars, MC4_ErrorCode* err) {
+    if (jit->native == NULL) return MC4_eval_compiled(jit->expr, vars, err);
+    if (!compiled_vars_defined(jit->expr, vars)) {
+        *err = MC4_ERR_VAR_NOT_FOUND;
+        return 0;
+    }
+    *err = MC4_ERR_NONE;
+    if (stats_on()) {
+        for (int i = 0; i < NUM_FUNC_TYPES; i++) {
+            stats_count_funcs(i, jit->num_func_calls[i]);
+        }
+    }
+    return jit->native((vars != NULL) ? vars->values : NULL);
+}
+
+void MC4_jit_free(struct MC4_Jit* jit) {
+    if (jit == NULL) return;
+#ifdef HAS_X86_64_JIT
+    if (jit->code != NULL) munmap(jit->code, jit->code_size);
+#endif
+    free(jit);
+}
+
+struct MC4_JitBinding MC4_jit_bind(const struct MC4_Jit* jit,
+                                   const struct MC4_VariableSet* vars,
+                                   int slot) {
+    struct MC4_JitBinding binding = {
+        .jit = jit,
+        .vars = varset_copy_values(vars),
+        .slot = slot,
+    };
+    binding.vars.exists[slot] = true;
+    return binding;
+}
+
+double MC4_jit_eval_at(struct MC4_JitBinding* binding, double x) {
+    MC4_ErrorCode err;
+    binding->vars.values[binding->slot] = x;
+    binding->num_evals++;
+    return MC4_jit_eval(binding->jit, &binding->vars, &err);
+}
+
+void MC4_jit_unbind(struct MC4_JitBinding* binding) {
+    free_varset_values(&binding->vars);
+}
+
+MC4_ErrorCode MC4_jit_function_compile(struct MC4_JitFunction* fn,
+                                       const char* equ, const char* var,
+                                       struct MC4_VariableSet* vars,
+                                       const struct MC4_Settings* settings) {
+    *fn = (struct MC4_JitFunction){.local_vars = new_varset(), .vars = vars};
+    if (fn->vars == NULL) fn->vars = &fn->local_vars;
+    MC4_ErrorCode err;
+    fn->expr = MC4_compile(equ, fn->vars, settings, &err);
+    if (err != MC4_ERR_NONE) {
+        free_varset(&fn->local_vars);
+        return err;
+    }
+    fn->slot = varset_intern(fn->vars, var, strlen(var));
+    fn->jit = MC4_jit_compile(fn->expr);
+    struct MC4_JitBinding f = MC4_jit_bind(fn->jit, fn->vars, fn->slot);
+    const bool defined = compiled_vars_defined(fn->expr, &f.vars);
+    MC4_jit_unbind(&f);
+    if (!defined) {
+        MC4_jit_function_free(fn);
+        return MC4_ERR_VAR_NOT_FOUND;
+    }
+    return MC4_ERR_NONE;
+}
+
+void MC4_jit_function_free(struct MC4_JitFunction* fn) {
+    MC4_jit_free(fn->jit);
+    MC4_free_compiled(fn->expr);
+    free_varset(&fn->local_vars);
+}
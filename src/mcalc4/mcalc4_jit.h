@@ -0,0 +1,97 @@
+#ifndef MCALCULATOR_VERSION_4_JIT_H_
+#define MCALCULATOR_VERSION_4_JIT_H_
+
+#include "mcalc4.h"
+#include "mcalc4_types.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A compiled expression translated to native code, for expressions which are
+ * evaluated many times against changing variables.
+ *
+ * Every node becomes a few SSE2 instructions with no dispatch: variables are
+ * loaded straight from their slots, operators are single instructions, and
+ * `^` and functions call the same libm functions as `MC4_eval_compiled()`, so
+ * results are identical to the bit. Intermediate values live in the native
+ * stack frame, so one JIT may be called from several threads at once.
+ *
+ * Native code is only generated on x86-64 Linux. Elsewhere, or if the code
+ * can't be mapped, evaluating falls back to `MC4_eval_compiled()`.
+ */
+struct MC4_Jit;
+
+/**
+ * Translates `expr`, which must outlive the returned JIT. Never returns NULL.
+ */
+struct MC4_Jit* MC4_jit_compile(const struct MC4_Compiled* expr);
+
+/**
+ * Checks if `jit` runs native code rather than the interpreter.
+ */
+bool MC4_jit_is_native(const struct MC4_Jit* jit);
+
+/**
+ * Same as `MC4_eval_compiled()` for the expression `jit` was made from.
+ */
+double MC4_jit_eval(const struct MC4_Jit* jit,
+                    const struct MC4_VariableSet* vars, MC4_ErrorCode* err);
+
+void MC4_jit_free(struct MC4_Jit* jit);
+
+/**
+ * A JIT with its own copy of the values of a variable set, in which one
+ * variable is defined and set by the caller. Lets one thread evaluate an
+ * expression at many points without touching the set, for integrating and
+ * solving.
+ */
+struct MC4_JitBinding {
+    const struct MC4_Jit* jit;
+    struct MC4_VariableSet vars;
+    int slot;
+    /* Number of `MC4_jit_eval_at()` calls. */
+    size_t num_evals;
+};
+
+/**
+ * Binds variable set slot `slot` of a copy of `vars`. Free with
+ * `MC4_jit_unbind()`.
+ */
+struct MC4_JitBinding MC4_jit_bind(const struct MC4_Jit* jit,
+                                   const struct MC4_VariableSet* vars,
+                                   int slot);
+
+/**
+ * Evaluates the JIT with the bound variable set to `x`. The other variables
+ * must be defined, which `compiled_vars_defined()` can check on `vars`.
+ */
+double MC4_jit_eval_at(struct MC4_JitBinding* binding, double x);
+
+void MC4_jit_unbind(struct MC4_JitBinding* binding);
+
+/**
+ * An expression compiled to a JIT as a function of one variable, for
+ * integrating and solving.
+ */
+struct MC4_JitFunction {
+    /* `var` needs a slot even if the caller has no variable set. */
+    struct MC4_VariableSet local_vars;
+    struct MC4_VariableSet* vars;
+    struct MC4_Compiled* expr;
+    struct MC4_Jit* jit;
+    int slot;
+};
+
+/**
+ * Compiles `equ` as a function of `var`, with the other variables taken from
+ * `vars`, which may be NULL. Returns `MC4_ERR_VAR_NOT_FOUND` if any of them is
+ * undefined, and only needs `MC4_jit_function_free()` on success.
+ */
+MC4_ErrorCode MC4_jit_function_compile(struct MC4_JitFunction* fn,
+                                       const char* equ, const char* var,
+                                       struct MC4_VariableSet* vars,
+                                       const struct MC4_Settings* settings);
+
+void MC4_jit_function_free(struct MC4_JitFunction* fn);
+
+#endif
@@ -0,0 +1,283 @@
+/* Decimal to double conversion.
+ *
+ * Literals are split into a 64-bit decimal mantissa `w` and a power of ten
+ * `q`, and converted with, in order:
+ *
+ * 1. Clinger's fast path: if `w` and `10^q` are both exact doubles, one
+ *    multiplication or division is correctly rounded.
+ * 2. The Eisel-Lemire algorithm: `w` is multiplied by a 128-bit approximation
+ *    of `5^q` from `POW5_TABLE`, which is always enough to round correctly for
+ *    mantissas of up to 19 digits (Mushtak and Lemire, "Fast Number Parsing
+ *    Without Fallback", 2023).
+ * 3. `strtod()`, for subnormal results, and for literals with more than 19
+ *    significant digits where rounding `w` and `w + 1` disagree. */
+#include "mcalc4_number.h"
+#include "../../libs/mlogging.h"
+#include "mcalc4_number_table.h"
+#include "mcalc4_types.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Literals up to this length are copied to the stack for `strtod()`. */
+#define SLOW_PATH_BUFFER_SIZE 128
+
+/* Mantissas at or above this have 19 digits, the most that always fit. */
+#define MIN_19_DIGIT_MANTISSA UINT64_C(1000000000000000000)
+
+static const double EXACT_POWERS_OF_TEN[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static bool is_digit(char ch) {
+    return (unsigned char)(ch - '0') < 10;
+}
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define HAS_SWAR_DIGITS 1
+
+static uint64_t load_eight_chars(const char* str) {
+    uint64_t chunk;
+    memcpy(&chunk, str, sizeof(chunk));
+    return chunk;
+}
+
+/**
+ * Checks if all eight characters in `chunk` are digits.
+ */
+static bool is_eight_digits(uint64_t chunk) {
+    return (((chunk & UINT64_C(0xF0F0F0F0F0F0F0F0)) |
+             (((chunk + UINT64_C(0x0606060606060606)) &
+               UINT64_C(0xF0F0F0F0F0F0F0F0)) >>
+              4)) == UINT64_C(0x3333333333333333));
+}
+
+/**
+ * Converts eight digit characters to their value with three multiplications
+ * instead of eight.
+ */
+static uint64_t parse_eight_digits(uint64_t chunk) {
+    const uint64_t mask = UINT64_C(0x000000FF000000FF);
+    const uint64_t mul1 = UINT64_C(0x000F424000000064); /* 100 + 10^6 << 32 */
+    const uint64_t mul2 = UINT64_C(0x0000271000000001); /* 1 + 10^4 << 32 */
+    chunk -= UINT64_C(0x3030303030303030);
+    chunk = (chunk * 10) + (chunk >> 8);
+    return (((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32;
+}
+#endif
+
+/**
+ * Accumulates the digits starting at `str[*pos]` into `mantissa`, which wraps
+ * around for more than 19 digits.
+ */
+static uint64_t read_digits(const char* str, size_t len, size_t* pos,
+                            uint64_t mantissa) {
+#ifdef HAS_SWAR_DIGITS
+    while (((*pos) + 8) <= len) {
+        const uint64_t chunk = load_eight_chars(&str[*pos]);
+        if (!is_eight_digits(chunk)) break;
+        mantissa = (mantissa * 100000000) + parse_eight_digits(chunk);
+        *pos += 8;
+    }
+#endif
+    while (((*pos) < len) && is_digit(str[*pos])) {
+        mantissa = (mantissa * 10) + (str[*pos] - '0');
+        (*pos)++;
+    }
+    return mantissa;
+}
+
+static int count_leading_zeros(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#else
+    int count = 0;
+    while ((x & (UINT64_C(1) << 63)) == 0) {
+        x <<= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+/**
+ * Returns the high 64 bits of `a * b`, writing the low 64 bits to `lo`.
+ */
+static uint64_t multiply_128(uint64_t a, uint64_t b, uint64_t* lo) {
+#ifdef __SIZEOF_INT128__
+    __extension__ typedef unsigned __int128 uint128;
+    const uint128 product = (uint128)a * b;
+    *lo = (uint64_t)product;
+    return (uint64_t)(product >> 64);
+#else
+    const uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    const uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    const uint64_t lo_lo = a_lo * b_lo;
+    const uint64_t hi_lo = a_hi * b_lo;
+    const uint64_t lo_hi = a_lo * b_hi;
+    const uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    *lo = (cross << 32) | (uint32_t)lo_lo;
+    return (a_hi * b_hi) + (hi_lo >> 32) + (cross >> 32);
+#endif
+}
+
+static bool clinger_fast_path(uint64_t w, int64_t q, double* result) {
+    if ((w > (UINT64_C(1) << 53)) || (q < -22) || (q > 22)) return false;
+    const double value = (double)w;
+    *result = (q < 0) ? (value / EXACT_POWERS_OF_TEN[-q])
+                      : (value * EXACT_POWERS_OF_TEN[q]);
+    return true;
+}
+
+/**
+ * Rounds `w * 10^q` to the nearest double. Returns false if the result is
+ * subnormal, which is left to `strtod()`.
+ */
+static bool eisel_lemire(uint64_t w, int64_t q, double* result) {
+    if ((w == 0) || (q < POW5_TABLE_MIN_EXP)) {
+        *result = 0;
+        return true;
+    }
+    if (q > POW5_TABLE_MAX_EXP) {
+        *result = INFINITY;
+        return true;
+    }
+
+    const int lz = count_leading_zeros(w);
+    w <<= lz;
+    const uint64_t* pow5 = POW5_TABLE[q - POW5_TABLE_MIN_EXP];
+    uint64_t lo;
+    uint64_t hi = multiply_128(w, pow5[0], &lo);
+    /* The low 9 bits are only used for rounding. If they are all ones, a carry
+    from the next 64 bits of 5^q could still change the result. */
+    if ((hi & 0x1FF) == 0x1FF) {
+        uint64_t lo_lo;
+        const uint64_t lo_hi = multiply_128(w, pow5[1], &lo_lo);
+        lo += lo_hi;
+        if (lo_hi > lo) hi++;
+    }
+
+    const int upper_bit = hi >> 63;
+    const int shift = upper_bit + 9;
+    uint64_t mantissa = hi >> shift;
+    /* floor(log2(10^q)) + 63, plus the exponent bias. */
+    int64_t power2 =
+        ((((152170 + 65536) * q) >> 16) + 63) + upper_bit - lz + 1023;
+    if (power2 <= 0) return false;
+
+    /* Exactly halfway between two doubles: round to even. This can only
+    happen for small powers of ten. */
+    if ((lo <= 1) && (q >= -4) && (q <= 23) && ((mantissa & 3) == 1) &&
+        ((mantissa << shift) == hi)) {
+        mantissa &= ~UINT64_C(1);
+    }
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (UINT64_C(2) << 52)) {
+        mantissa = UINT64_C(1) << 52;
+        power2++;
+    }
+    mantissa &= ~(UINT64_C(1) << 52);
+    if (power2 >= 0x7FF) {
+        *result = INFINITY;
+        return true;
+    }
+
+    const uint64_t bits = mantissa | ((uint64_t)power2 << 52);
+    memcpy(result, &bits, sizeof(bits));
+    return true;
+}
+
+static double parse_number_slow(const char* str, size_t len) {
+    char buffer[SLOW_PATH_BUFFER_SIZE];
+    char* copy = buffer;
+    if (len >= SLOW_PATH_BUFFER_SIZE) {
+        copy = malloc(len + 1);
+        if (copy == NULL) MLOG.panic("Out of memory.");
+    }
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    const double value = strtod(copy, NULL);
+    if (copy != buffer) free(copy);
+    return value;
+}
+
+size_t parse_number(const char* str, size_t len, double* value,
+                    MC4_ErrorCode* err) {
+    size_t pos = 0;
+    uint64_t w = read_digits(str, len, &pos, 0);
+    const size_t int_end = pos;
+    size_t frac_start = pos;
+    size_t frac_end = pos;
+    if ((pos < len) && (str[pos] == '.')) {
+        pos++;
+        frac_start = pos;
+        w = read_digits(str, len, &pos, w);
+        frac_end = pos;
+    }
+
+    int64_t exp_number = 0;
+    if ((pos < len) && ((str[pos] == 'e') || (str[pos] == 'E'))) {
+        size_t exp_pos = pos + 1;
+        bool negative = false;
+        if ((exp_pos < len) &&
+            ((str[exp_pos] == '+') || (str[exp_pos] == '-'))) {
+            negative = (str[exp_pos] == '-');
+            exp_pos++;
+        }
+        if ((exp_pos < len) && is_digit(str[exp_pos])) {
+            while ((exp_pos < len) && is_digit(str[exp_pos])) {
+                /* Anything this big is already 0 or infinity. */
+                if (exp_number < 0x10000000) {
+                    exp_number = (exp_number * 10) + (str[exp_pos] - '0');
+                }
+                exp_pos++;
+            }
+            if (negative) exp_number = -exp_number;
+            pos = exp_pos;
+        }
+    }
+    if ((pos < len) && (str[pos] == '.')) {
+        *err = MC4_ERR_NUM_FMT_ERR;
+        return pos;
+    }
+
+    int64_t q = exp_number - (int64_t)(frac_end - frac_start);
+    size_t num_digits = int_end + (frac_end - frac_start);
+    for (size_t i = 0; (i < pos) && ((str[i] == '0') || (str[i] == '.'));
+         i++) {
+        if (str[i] == '0') num_digits--;
+    }
+
+    /* Keep the first 19 significant digits, and remember that the literal is
+    somewhere between `w` and `w + 1` times `10^q`. */
+    const bool truncated = (num_digits > 19);
+    if (truncated) {
+        w = 0;
+        size_t i = 0;
+        while ((w < MIN_19_DIGIT_MANTISSA) && (i < int_end)) {
+            w = (w * 10) + (str[i++] - '0');
+        }
+        if (w >= MIN_19_DIGIT_MANTISSA) {
+            q = exp_number + (int64_t)(int_end - i);
+        } else {
+            i = frac_start;
+            while ((w < MIN_19_DIGIT_MANTISSA) && (i < frac_end)) {
+                w = (w * 10) + (str[i++] - '0');
+            }
+            q = exp_number - (int64_t)(i - frac_start);
+        }
+    }
+
+    if (!truncated && clinger_fast_path(w, q, value)) return pos;
+    double upper;
+    if (eisel_lemire(w, q, value) &&
+        (!truncated || (eisel_lemire(w + 1, q, &upper) && (upper == *value)))) {
+        return pos;
+    }
+    *value = parse_number_slow(str, pos);
+    return pos;
+}
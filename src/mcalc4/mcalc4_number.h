@@ -0,0 +1,21 @@
+#ifndef MCALCULATOR_VERSION_4_NUMBER_H_
+#define MCALCULATOR_VERSION_4_NUMBER_H_
+
+#include "mcalc4_types.h"
+#include <stddef.h>
+
+/**
+ * Parses the number literal at the start of `str`, looking at no more than
+ * `len` characters (`str` doesn't need to be null-terminated). The literal is
+ * digits with an optional fraction (`1.5`, `2.`) and an optional exponent
+ * (`6.02e23`, `1E-9`). An `e` or `E` which isn't followed by exponent digits
+ * is not part of the literal.
+ *
+ * The result is correctly rounded, exactly like `strtod()`. Returns the number
+ * of characters read. A literal followed by another '.' writes
+ * `MC4_ERR_NUM_FMT_ERR` to `err`.
+ */
+size_t parse_number(const char* str, size_t len, double* value,
+                    MC4_ErrorCode* err);
+
+#endif
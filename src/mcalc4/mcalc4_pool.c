@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mcalc4_pool.h"
+#include "../../libs/mlogging.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Each queue sits on its own cache line so that workers popping from their own
+queues don't invalidate each other's lines. */
+struct WorkerQueue {
+    _Alignas(64) pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+    struct MC4_ThreadPool* pool;
+    unsigned int id;
+};
+
+struct MC4_ThreadPool {
+    unsigned int num_workers;
+    /* `num_workers - 1` threads. Worker 0 is the caller of `pool_run()`. */
+    pthread_t* threads;
+    struct WorkerQueue* queues;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    /* Incremented by every `pool_run()` so sleeping workers can tell a new
+    loop from a spurious wakeup. */
+    unsigned long generation;
+    unsigned int num_busy;
+    bool shutting_down;
+
+    MC4_PoolTask task;
+    void* ctx;
+};
+
+static bool queue_pop(struct WorkerQueue* queue, size_t* index) {
+    pthread_mutex_lock(&queue->lock);
+    const bool found = queue->begin < queue->end;
+    if (found) *index = queue->begin++;
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+/**
+ * Moves the back half of the first non-empty queue after `thief` into `thief`.
+ * Returns false if every queue is empty.
+ */
+static bool queue_steal(struct WorkerQueue* thief) {
+    struct MC4_ThreadPool* pool = thief->pool;
+    for (unsigned int i = 1; i < pool->num_workers; i++) {
+        struct WorkerQueue* victim =
+            &pool->queues[(thief->id + i) % pool->num_workers];
+        size_t begin = 0, end = 0;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->begin < victim->end) {
+            end = victim->end;
+            begin = end - ((end - victim->begin + 1) / 2);
+            victim->end = begin;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (begin < end) {
+            pthread_mutex_lock(&thief->lock);
+            thief->begin = begin;
+            thief->end = end;
+            pthread_mutex_unlock(&thief->lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_worker(struct WorkerQueue* queue) {
+    struct MC4_ThreadPool* pool = queue->pool;
+    size_t index;
+    do {
+        while (queue_pop(queue, &index)) pool->task(pool->ctx, index);
+    } while (queue_steal(queue));
+}
+
+static void* worker_main(void* arg) {
+    struct WorkerQueue* queue = arg;
+    struct MC4_ThreadPool* pool = queue->pool;
+    unsigned long seen_generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->shutting_down && (pool->generation == seen_generation)) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutting_down) break;
+        seen_generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_worker(queue);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->num_busy == 0) pthread_cond_signal(&pool->work_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+struct MC4_ThreadPool* pool_new(unsigned int num_threads) {
+    if (num_threads == 0) {
+        const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (num_cpus > 0) ? num_cpus : 1;
+    }
+    if (num_threads > MC4_MAX_THREADS) num_threads = MC4_MAX_THREADS;
+
+    struct MC4_ThreadPool* pool = malloc(sizeof(struct MC4_ThreadPool));
+    if (pool == NULL) MLOG.panic("Out of memory.");
+    *pool = (struct MC4_ThreadPool){
+        .num_workers = num_threads,
+        .threads = malloc(num_threads * sizeof(pthread_t)),
+        .queues = aligned_alloc(_Alignof(struct WorkerQueue),
+                                num_threads * sizeof(struct WorkerQueue)),
+    };
+    if ((pool->threads == NULL) || (pool->queues == NULL)) {
+        MLOG.panic("Out of memory.");
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    for (unsigned int i = 0; i < num_threads; i++) {
+        struct WorkerQueue* queue = &pool->queues[i];
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->begin = queue->end = 0;
+        queue->pool = pool;
+        queue->id = i;
+    }
+    for (unsigned int i = 1; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main,
+                           &pool->queues[i]) != 0) {
+            MLOG.panic("Failed to create worker thread.");
+        }
+    }
+    return pool;
+}
+
+void pool_run(struct MC4_ThreadPool* pool, size_t num_tasks, MC4_PoolTask task,
+              void* ctx) {
+    if (num_tasks == 0) return;
+    const unsigned int num_workers = pool->num_workers;
+
+    /* Start from an even split; stealing fixes up uneven task costs. */
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->ctx = ctx;
+    for (unsigned int i = 0; i < num_workers; i++) {
+        struct WorkerQueue* queue = &pool->queues[i];
+        pthread_mutex_lock(&queue->lock);
+        queue->begin = (num_tasks * i) / num_workers;
+        queue->end = (num_tasks * (i + 1)) / num_workers;
+        pthread_mutex_unlock(&queue->lock);
+    }
+    pool->num_busy = num_workers - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_worker(&pool->queues[0]);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->num_busy > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+unsigned int pool_num_threads(const struct MC4_ThreadPool* pool) {
+    return pool->num_workers;
+}
+
+void pool_free(struct MC4_ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutting_down = true;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned int i = 1; i < pool->num_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (unsigned int i = 0; i < pool->num_workers; i++) {
+        pthread_mutex_destroy(&pool->queues[i].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->threads);
+    free(pool->queues);
+    free(pool);
+}
@@ -0,0 +1,40 @@
+#ifndef MCALCULATOR_VERSION_4_POOL_H_
+#define MCALCULATOR_VERSION_4_POOL_H_
+
+#include <stddef.h>
+
+/* Most workers a pool has. Larger requests are clamped to it. */
+#define MC4_MAX_THREADS 256
+
+/**
+ * A fixed set of worker threads which run loops of independent tasks.
+ *
+ * Every worker owns a range of task indices. Workers take tasks from the
+ * front of their own range, and a worker whose range is empty steals the back
+ * half of another worker's range, so cheap and expensive tasks even out
+ * across workers without any up-front cost estimate.
+ */
+struct MC4_ThreadPool;
+
+typedef void (*MC4_PoolTask)(void* ctx, size_t index);
+
+/**
+ * Creates a pool with `num_threads` workers (including the thread which calls
+ * `pool_run()`), at most `MC4_MAX_THREADS`. 0 uses one worker per online
+ * CPU.
+ */
+struct MC4_ThreadPool* pool_new(unsigned int num_threads);
+
+/**
+ * Calls `task(ctx, i)` exactly once for every `i` in `[0, num_tasks)` and
+ * returns when all of them have finished. The calling thread works too.
+ * Calls must not be nested or made from several threads at once.
+ */
+void pool_run(struct MC4_ThreadPool* pool, size_t num_tasks, MC4_PoolTask task,
+              void* ctx);
+
+unsigned int pool_num_threads(const struct MC4_ThreadPool* pool);
+
+void pool_free(struct MC4_ThreadPool* pool);
+
+#endif
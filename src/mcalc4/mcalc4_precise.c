@@ -0,0 +1,148 @@
+/* Arbitrary precision evaluation.
+ *
+ * The expression is compiled with `compile_tokens_unfolded()`, by the same
+ * grammar as every other evaluation, so errors are found at the same places.
+ * Its nodes are then evaluated with `MC4_BigFloat`s instead of doubles:
+ * nothing is folded at the precision of a double, and every literal is read
+ * again from the text at the position its node records. Every intermediate
+ * value has the same precision, the digits asked for and a couple of limbs to
+ * spare. */
+#include "mcalc4_precise.h"
+#include "mcalc4_bigfloat.h"
+#include "mcalc4_stats.h"
+#include "mcalc4_types.h"
+
+/**
+ * Applies the function `func_type` to `x`, writing the result to `r`.
+ */
+static void apply_func(enum FuncType func_type, struct MC4_BigFloat* r,
+                       const struct MC4_BigFloat* x,
+                       enum AngleMode angle_mode) {
+    stats_count_func(func_type);
+    switch (func_type) {
+    case FN_SIN: bf_sin(r, x, angle_mode); break;
+    case FN_COS: bf_cos(r, x, angle_mode); break;
+    case FN_TAN: bf_tan(r, x, angle_mode); break;
+    case FN_ASIN: bf_asin(r, x); break;
+    case FN_ACOS: bf_acos(r, x); break;
+    case FN_ATAN: bf_atan(r, x); break;
+    case FN_LOG_10: bf_log10(r, x); break;
+    case FN_LOG_E: bf_log(r, x); break;
+    case FN_SQRT: bf_sqrt(r, x); break;
+    }
+}
+
+/**
+ * Applies the operator `op` to `a` and `b`, writing the result to `r`.
+ */
+static void apply_op(char op, struct MC4_BigFloat* r,
+                     const struct MC4_BigFloat* a,
+                     const struct MC4_BigFloat* b) {
+    switch (op) {
+    case '+': bf_add(r, a, b); break;
+    case '-': bf_sub(r, a, b); break;
+    case '*': bf_mul(r, a, b); break;
+    case '/': bf_div(r, a, b); break;
+    default: bf_pow(r, a, b); break;
+    }
+}
+
+/**
+ * Reads the literal or constant at `pos` of `equ` again, since the double of
+ * its node has lost the digits past the precision of a double.
+ */
+static void read_number(const char* equ, size_t len, unsigned int pos,
+                        struct MC4_BigFloat* r) {
+    enum ConstType const_type = CONST_NONE;
+    match_constant(&equ[pos], len - pos, &const_type);
+    switch (const_type) {
+    case CONST_PI: bf_pi(r); break;
+    case CONST_E: bf_e(r); break;
+    case CONST_NONE: bf_set_decimal(r, &equ[pos], len - pos); break;
+    }
+}
+
+/**
+ * Evaluates the nodes of `expr`, which was compiled from the first `len`
+ * characters of `equ` without folding, writing the result to `r`. Every node
+ * has a register of the precision of `r`. Without subexpression elimination,
+ * every node but the last is the operand of exactly one other node, so its
+ * register is freed once that node is evaluated, and only as many are live
+ * as the expression is deep.
+ */
+static void eval_precise(const struct MC4_Compiled* expr, const char* equ,
+                         size_t len, const struct MC4_VariableSet* vars,
+                         struct MC4_BigFloat* r) {
+    struct MC4_BigFloat* regs =
+        malloc(expr->num_nodes * sizeof(struct MC4_BigFloat));
+    if (regs == NULL) MLOG.panic("Out of memory.");
+    for (unsigned int i = 0; i < expr->num_nodes; i++) {
+        const struct MC4_Node* node = &expr->nodes[i];
+        bf_init(&regs[i], r->len);
+        switch (node->type) {
+        case NODE_NUMBER: read_number(equ, len, node->pos, &regs[i]); break;
+        case NODE_VARIABLE:
+            bf_set_double(&regs[i], vars->values[node->slot]);
+            break;
+        case NODE_OPERATOR:
+            apply_op(node->op, &regs[i], &regs[node->lhs], &regs[node->rhs]);
+            bf_free(&regs[node->lhs]);
+            bf_free(&regs[node->rhs]);
+            break;
+        case NODE_FUNCTION:
+            apply_func(node->func_type, &regs[i], &regs[node->lhs],
+                       expr->angle_mode);
+            bf_free(&regs[node->lhs]);
+            break;
+        }
+    }
+    bf_set(r, &regs[expr->num_nodes - 1]);
+    bf_free(&regs[expr->num_nodes - 1]);
+    free(regs);
+}
+
+struct MC4_Result MC4_evaluate_precise(const char* equ,
+                                       const struct MC4_VariableSet* vars,
+                                       const struct MC4_Settings* settings,
+                                       char** text) {
+    return MC4_evaluate_precise_n(equ, strlen(equ), vars, settings, text);
+}
+
+struct MC4_Result MC4_evaluate_precise_n(const char* equ, size_t len,
+                                         const struct MC4_VariableSet* vars,
+                                         const struct MC4_Settings* settings,
+                                         char** text) {
+    struct MC4_Result result = new_result();
+    MC4_ErrorCode* err = &result.err_code;
+    *text = NULL;
+    uint64_t start = stats_start();
+    struct TokensList tokens_list = tokenize_n(equ, len, err);
+    stats_end(STATS_TOKENIZE, start);
+    if ((*err) != MC4_ERR_NONE) {
+        result.err_pos = tokens_list.starts[tokens_list.len];
+        return result;
+    }
+
+    unsigned int digits = settings->precision;
+    if (digits == 0) digits = MC4_DEFAULT_PRECISION;
+    if (digits > MC4_MAX_PRECISION) digits = MC4_MAX_PRECISION;
+    start = stats_start();
+    struct MC4_Compiled* expr = compile_tokens_unfolded(
+        &tokens_list, equ, vars, settings->angle_mode, err, &result.err_pos);
+    if (expr == NULL) {
+        stats_end(STATS_PARSE, start);
+        return result;
+    }
+    struct MC4_BigFloat value;
+    bf_init(&value, bf_len_for_digits(digits));
+    eval_precise(expr, equ, len, vars, &value);
+    stats_end(STATS_PARSE, start);
+    MC4_free_compiled(expr);
+
+    result.value = bf_to_double(&value);
+    start = stats_start();
+    *text = bf_format(&value, digits, settings->output_mode);
+    stats_end(STATS_FORMAT, start);
+    bf_free(&value);
+    return result;
+}
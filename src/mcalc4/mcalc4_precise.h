@@ -0,0 +1,41 @@
+#ifndef MCALCULATOR_VERSION_4_PRECISE_H_
+#define MCALCULATOR_VERSION_4_PRECISE_H_
+
+#include "mcalc4.h"
+#include <stddef.h>
+
+/* Most significant digits `MC4_evaluate_precise()` evaluates with. */
+#define MC4_MAX_PRECISION 10000
+
+/* Digits used if the settings don't ask for arbitrary precision, which are
+enough to tell doubles apart. */
+#define MC4_DEFAULT_PRECISION 17
+
+/**
+ * Evaluates `equ` the same as `MC4_evaluate()`, but with `MC4_BigFloat`s of
+ * `settings->precision` significant digits (at most `MC4_MAX_PRECISION`)
+ * instead of doubles, so `1/3` has as many 3s as are asked for.
+ *
+ * Literals are read with all of their digits, and `pi` and `e` are computed
+ * to the precision and cached for later evaluations. Variables are stored as
+ * doubles, so they only have the precision of a double.
+ *
+ * Writes the result, formatted with that many digits in the output mode of
+ * `settings`, to `text`, which must be freed with `free()`, or NULL if there
+ * was an error. `value` of the result is `text` rounded to a double.
+ */
+struct MC4_Result MC4_evaluate_precise(const char* equ,
+                                       const struct MC4_VariableSet* vars,
+                                       const struct MC4_Settings* settings,
+                                       char** text);
+
+/**
+ * Same as `MC4_evaluate_precise()`, but only reads the first `len`
+ * characters of `equ`, which doesn't need to be null-terminated.
+ */
+struct MC4_Result MC4_evaluate_precise_n(const char* equ, size_t len,
+                                         const struct MC4_VariableSet* vars,
+                                         const struct MC4_Settings* settings,
+                                         char** text);
+
+#endif
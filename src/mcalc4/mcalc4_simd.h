@@ -0,0 +1,41 @@
+#ifndef MCALCULATOR_VERSION_4_SIMD_H_
+#define MCALCULATOR_VERSION_4_SIMD_H_
+
+#include "mcalc4_types.h"
+#include <stddef.h>
+
+enum SimdIsa {
+    SIMD_ISA_SCALAR,
+    SIMD_ISA_SSE2,
+    SIMD_ISA_AVX2,
+    SIMD_ISA_AVX512,
+};
+
+/**
+ * Returns the best instruction set supported by the CPU.
+ */
+enum SimdIsa simd_detect_isa(void);
+
+/**
+ * Overrides the instruction set used by the kernels. Instruction sets which
+ * the CPU doesn't support fall back to the best supported one. Returns the
+ * instruction set which will actually be used.
+ */
+enum SimdIsa simd_set_isa(enum SimdIsa isa);
+
+const char* simd_isa_to_str(enum SimdIsa isa);
+
+/**
+ * Applies the binary operator `op` element-wise over `len` values.
+ */
+void simd_apply_op(char op, const double* lhs, const double* rhs, double* out,
+                   size_t len);
+
+/**
+ * Applies `func_type` element-wise over `len` values. Arguments of trig
+ * functions are multiplied by `to_rad` first.
+ */
+void simd_apply_func(enum FuncType func_type, const double* in, double* out,
+                     size_t len, double to_rad);
+
+#endif
@@ -0,0 +1,398 @@
+/* Vectorized math kernels.
+ *
+ * This file is a template: `mcalc4_simd.c` includes it once per instruction
+ * set with the following macros defined.
+ *
+ *   VEC_ISA    - suffix appended to every name (e.g. `avx2`).
+ *   VEC_WIDTH  - number of doubles per vector.
+ *   VEC_ATTR   - function attribute enabling the instruction set.
+ *   VEC_SQRT   - vector square root intrinsic for the instruction set.
+ *
+ * Every kernel computes the common case with branch-free vector code and then
+ * recomputes the lanes it can't handle accurately (NaN, infinity, subnormals,
+ * huge trig arguments, ...) with scalar libm, so edge cases behave exactly like
+ * the scalar evaluator. */
+
+#define vd VN(vd)
+#define vi VN(vi)
+#define vdu VN(vdu)
+
+typedef double vd __attribute__((vector_size(VEC_WIDTH * 8)));
+typedef int64_t vi __attribute__((vector_size(VEC_WIDTH * 8)));
+/* Same as `vd`, but may be loaded from and stored to any `double*`. */
+typedef double vdu
+    __attribute__((vector_size(VEC_WIDTH * 8), aligned(8), may_alias));
+
+#define SPLAT(c) ((vd){0} + (c))
+#define LOAD(ptr) ((vd)(*(const vdu*)(ptr)))
+#define STORE(ptr, v) (*(vdu*)(ptr) = (v))
+
+static VEC_ATTR vd VN(blend)(vi mask, vd a, vd b) {
+    return (vd)(((vi)a & mask) | ((vi)b & ~mask));
+}
+
+static VEC_ATTR vd VN(abs)(vd x) {
+    return (vd)((vi)x & ABS_MASK);
+}
+
+static VEC_ATTR bool VN(any)(vi mask) {
+    for (int j = 0; j < VEC_WIDTH; j++) {
+        if (mask[j]) return true;
+    }
+    return false;
+}
+
+/**
+ * exp(x + tail) for |x| <= 708 and |tail| much smaller than |x|.
+ */
+static VEC_ATTR vd VN(exp_core)(vd x, vd tail) {
+    const vd t = (x * LOG2E) + SHIFTER;
+    const vd k = t - SHIFTER;
+    const vi ki = (vi)t - SHIFTER_BITS;
+    const vd hi = x - (k * LN2_HI);
+    const vd lo = (k * LN2_LO) - tail;
+    const vd r = hi - lo;
+    const vd z = r * r;
+    vd p = SPLAT(EXP_POLY[0]);
+    for (size_t n = 1; n < ARR_SIZE(EXP_POLY); n++) {
+        p = (p * z) + EXP_POLY[n];
+    }
+    const vd c = r - (z * p);
+    const vd y = 1 - ((lo - ((r * c) / (2 - c))) - hi);
+    return y * (vd)((ki + 1023) << 52);
+}
+
+/**
+ * Splits positive normal `x` into `2^e * (1 + f)` with `1 + f` in
+ * [sqrt(2)/2, sqrt(2)), so that `log(x) = e*ln(2) + f - hfsq + sr`.
+ */
+static VEC_ATTR void VN(log_parts)(vd x, vd* e, vd* f, vd* hfsq, vd* sr) {
+    const vi bits = (vi)x;
+    vi exponent = (bits >> 52) - 1023;
+    vd m = (vd)((bits & MANTISSA_MASK) | ONE_BITS);
+    const vi big = (vi)(m > M_SQRT2);
+    m = VN(blend)(big, m * 0.5, m);
+    exponent -= big;
+    *e = (vd)(exponent + SHIFTER_BITS) - SHIFTER;
+    *f = m - 1;
+    const vd s = *f / (*f + 2);
+    const vd z = s * s;
+    vd r = SPLAT(LOG_TAYLOR[0]);
+    for (size_t n = 1; n < ARR_SIZE(LOG_TAYLOR); n++) {
+        r = (r * z) + LOG_TAYLOR[n];
+    }
+    r *= z;
+    *hfsq = (*f * *f) * 0.5;
+    *sr = s * (*hfsq + r);
+}
+
+static VEC_ATTR vi VN(log_special)(vd x) {
+    return ~((vi)(x >= DBL_MIN) & (vi)(x <= DBL_MAX));
+}
+
+static VEC_ATTR vd VN(log)(vd x) {
+    vd e, f, hfsq, sr;
+    VN(log_parts)(x, &e, &f, &hfsq, &sr);
+    return (e * LN2_HI) - ((hfsq - (sr + (e * LN2_LO))) - f);
+}
+
+static VEC_ATTR vd VN(log10)(vd x) {
+    vd e, f, hfsq, sr;
+    VN(log_parts)(x, &e, &f, &hfsq, &sr);
+    return (e * LOG10_2_HI) + ((e * LOG10_2_LO) + (IVLN10 * (f - (hfsq - sr))));
+}
+
+/**
+ * Evaluates sin(r + r_lo) and cos(r + r_lo) for |r| <= pi/4.
+ */
+static VEC_ATTR void VN(sincos_core)(vd r, vd r_lo, vd* sin_r, vd* cos_r) {
+    const vd z = r * r;
+    vd ps = SPLAT(SIN_POLY[0]);
+    for (size_t n = 1; n < ARR_SIZE(SIN_POLY); n++) {
+        ps = (ps * z) + SIN_POLY[n];
+    }
+    const vd v = z * r;
+    *sin_r = r - (((z * ((r_lo * 0.5) - (v * ps))) - r_lo) - (v * SIN_S1));
+    vd pc = SPLAT(COS_POLY[0]);
+    for (size_t n = 1; n < ARR_SIZE(COS_POLY); n++) {
+        pc = (pc * z) + COS_POLY[n];
+    }
+    const vd hz = z * 0.5;
+    const vd w = 1 - hz;
+    *cos_r = w + (((1 - w) - hz) + ((z * (z * pc)) - (r * r_lo)));
+}
+
+/**
+ * Reduces `x` to `r + r_lo` in [-pi/4, pi/4] with `x = r + r_lo + q*pi/2`.
+ */
+static VEC_ATTR vd VN(reduce_pio2)(vd x, vd* r_lo, vi* q) {
+    const vd t = (x * M_2_PI) + SHIFTER;
+    const vd k = t - SHIFTER;
+    *q = (vi)t - SHIFTER_BITS;
+    const vd r1 = (x - (k * PIO2_1)) - (k * PIO2_2);
+    const vd w = k * PIO2_3;
+    const vd r = r1 - w;
+    *r_lo = (r1 - r) - w;
+    return r;
+}
+
+static VEC_ATTR vi VN(trig_special)(vd x) {
+    return ~(vi)(VN(abs)(x) <= TRIG_MAX_ARG);
+}
+
+/**
+ * sin(x) if `shift` is 0, or cos(x) if `shift` is 1.
+ */
+static VEC_ATTR vd VN(sin_shifted)(vd x, int64_t shift) {
+    vi q;
+    vd r_lo, sin_r, cos_r;
+    const vd r = VN(reduce_pio2)(x, &r_lo, &q);
+    VN(sincos_core)(r, r_lo, &sin_r, &cos_r);
+    q += shift;
+    const vd value = VN(blend)(-(q & 1), cos_r, sin_r);
+    return (vd)((vi)value ^ ((vi)((q & 2) != 0) & SIGN_MASK));
+}
+
+static VEC_ATTR vd VN(tan)(vd x) {
+    vi q;
+    vd r_lo, sin_r, cos_r;
+    const vd r = VN(reduce_pio2)(x, &r_lo, &q);
+    VN(sincos_core)(r, r_lo, &sin_r, &cos_r);
+    return VN(blend)(-(q & 1), -cos_r / sin_r, sin_r / cos_r);
+}
+
+static VEC_ATTR vd VN(atan)(vd x) {
+    const vi sign = (vi)x & SIGN_MASK;
+    const vd ax = VN(abs)(x);
+    const vi big = (vi)(ax > ATAN_T3P8);
+    const vi mid = (vi)(ax > 0.66) & ~big;
+    const vd xr = VN(blend)(big, -1 / ax,
+                            VN(blend)(mid, (ax - 1) / (ax + 1), ax));
+    const vd base = VN(blend)(big, SPLAT(M_PI_2),
+                              VN(blend)(mid, SPLAT(M_PI_4), SPLAT(0)));
+    const vd more = VN(blend)(big, SPLAT(ATAN_MOREBITS),
+                              VN(blend)(mid, SPLAT(ATAN_MOREBITS * 0.5),
+                                        SPLAT(0)));
+    const vd z = xr * xr;
+    vd p = SPLAT(ATAN_P[0]);
+    for (size_t n = 1; n < ARR_SIZE(ATAN_P); n++) {
+        p = (p * z) + ATAN_P[n];
+    }
+    vd q = z + ATAN_Q[0];
+    for (size_t n = 1; n < ARR_SIZE(ATAN_Q); n++) {
+        q = (q * z) + ATAN_Q[n];
+    }
+    const vd y = base + (((xr * ((z * p) / q)) + xr) + more);
+    return (vd)((vi)y | sign);
+}
+
+static VEC_ATTR vd VN(asin)(vd x) {
+    return VN(atan)(x / (vd)VEC_SQRT((1 - x) * (1 + x)));
+}
+
+static VEC_ATTR vd VN(acos)(vd x) {
+    return VN(atan)((vd)VEC_SQRT((1 - x) / (1 + x))) * 2;
+}
+
+/**
+ * Dekker's exact product: `a * b = *hi + *lo`.
+ */
+static VEC_ATTR void VN(two_prod)(vd a, vd b, vd* hi, vd* lo) {
+    const vd ca = a * DEKKER_SPLIT;
+    const vd ah = ca - (ca - a);
+    const vd al = a - ah;
+    const vd cb = b * DEKKER_SPLIT;
+    const vd bh = cb - (cb - b);
+    const vd bl = b - bh;
+    *hi = a * b;
+    *lo = ((((ah * bh) - *hi) + (ah * bl)) + (al * bh)) + (al * bl);
+}
+
+/**
+ * Error-free sum: `a + b = *sum + *err`.
+ */
+static VEC_ATTR void VN(two_sum)(vd a, vd b, vd* sum, vd* err) {
+    *sum = a + b;
+    const vd bb = *sum - a;
+    *err = (a - (*sum - bb)) + (b - bb);
+}
+
+/**
+ * log(x) = `*log_hi + *log_lo` for positive normal `x`, accurate to about
+ * 2^-70 so that exp(y * log(x)) stays within an ULP for every finite result.
+ */
+static VEC_ATTR void VN(log_double_double)(vd x, vd* log_hi, vd* log_lo) {
+    const vi bits = (vi)x;
+    const vd k = (vd)(((bits >> 52) - 1023) + SHIFTER_BITS) - SHIFTER;
+    const vi index = (bits >> (52 - POW_TABLE_BITS)) &
+                     ((1 << POW_TABLE_BITS) - 1);
+    const vd m = (vd)((bits & MANTISSA_MASK) | ONE_BITS);
+    vd invc, logc_hi, logc_lo;
+    for (int j = 0; j < VEC_WIDTH; j++) {
+        const struct PowLogEntry* entry = &POW_LOG_TABLE[index[j]];
+        invc[j] = entry->invc;
+        logc_hi[j] = entry->logc_hi;
+        logc_lo[j] = entry->logc_lo;
+    }
+    /* r = m*invc - 1 = r_hi + r_lo exactly. */
+    vd prod, r_lo;
+    VN(two_prod)(m, invc, &prod, &r_lo);
+    const vd r = prod - 1;
+    /* log(1 + r) = r - r^2/2 + r^3 * poly(r) */
+    const vd half_sq = (r * r) * -0.5;
+    vd poly = SPLAT(LOG1P_TAYLOR[0]);
+    for (size_t n = 1; n < ARR_SIZE(LOG1P_TAYLOR); n++) {
+        poly = (poly * r) + LOG1P_TAYLOR[n];
+    }
+    vd h1, e1, h2, e2, h3, e3;
+    VN(two_sum)(k * LN2_HI, logc_hi, &h1, &e1);
+    VN(two_sum)(h1, r, &h2, &e2);
+    VN(two_sum)(h2, half_sq, &h3, &e3);
+    const vd lo = ((e1 + e2) + e3) + (k * LN2_LO) + logc_lo +
+                  (r_lo * (1 - r)) + ((r * r) * (r * poly));
+    *log_hi = h3 + lo;
+    *log_lo = lo - (*log_hi - h3);
+}
+
+/**
+ * pow(x, y), writing the lanes which must be computed by libm to `special`.
+ * `y` in {-2, -1, 0, 1, 2} is handled exactly for every `x`, otherwise
+ * `x^y = exp(y * log(x))` with log(x) carried in double-double precision.
+ */
+static VEC_ATTR vd VN(pow)(vd x, vd y, vi* special) {
+    vd log_hi, log_lo;
+    VN(log_double_double)(x, &log_hi, &log_lo);
+    /* y * log(x) = t_hi + t_lo */
+    vd p, p_err;
+    VN(two_prod)(y, log_hi, &p, &p_err);
+    const vd p_tail = p_err + (y * log_lo);
+    const vd t_hi = p + p_tail;
+    const vd t_lo = p_tail - (t_hi - p);
+    const vd t_safe = VN(blend)((vi)(VN(abs)(t_hi) <= EXP_MAX_ARG), t_hi,
+                                SPLAT(0));
+    vd value = VN(exp_core)(t_safe, t_lo);
+
+    *special = VN(log_special)(x) | ~(vi)(VN(abs)(y) <= DBL_MAX) |
+               ~(vi)(VN(abs)(t_hi) <= EXP_MAX_ARG);
+
+    const vd sq = x * x;
+    const vi y_zero = (vi)(y == 0);
+    const vi y_one = (vi)(y == 1);
+    const vi y_two = (vi)(y == 2);
+    const vi y_neg_one = (vi)(y == -1);
+    const vi y_neg_two = (vi)(y == -2);
+    value = VN(blend)(y_zero, SPLAT(1), value);
+    value = VN(blend)(y_one, x, value);
+    value = VN(blend)(y_two, sq, value);
+    value = VN(blend)(y_neg_one, 1 / x, value);
+    value = VN(blend)(y_neg_two, 1 / sq, value);
+    const vi small_int = y_zero | y_one | y_two | y_neg_one | y_neg_two;
+    /* 1 / x^2 loses precision when x^2 is subnormal. */
+    const vi sq_subnormal = (vi)(sq < DBL_MIN) & (vi)(sq != 0);
+    *special = (*special & ~small_int) | (y_neg_two & sq_subnormal);
+    return value;
+}
+
+static VEC_ATTR void VN(apply_op)(char op, const double* lhs,
+                                  const double* rhs, double* out, size_t len) {
+    size_t i = 0;
+    switch (op) {
+    case '+':
+        for (; (i + VEC_WIDTH) <= len; i += VEC_WIDTH) {
+            STORE(&out[i], LOAD(&lhs[i]) + LOAD(&rhs[i]));
+        }
+        break;
+    case '-':
+        for (; (i + VEC_WIDTH) <= len; i += VEC_WIDTH) {
+            STORE(&out[i], LOAD(&lhs[i]) - LOAD(&rhs[i]));
+        }
+        break;
+    case '*':
+        for (; (i + VEC_WIDTH) <= len; i += VEC_WIDTH) {
+            STORE(&out[i], LOAD(&lhs[i]) * LOAD(&rhs[i]));
+        }
+        break;
+    case '/':
+        for (; (i + VEC_WIDTH) <= len; i += VEC_WIDTH) {
+            STORE(&out[i], LOAD(&lhs[i]) / LOAD(&rhs[i]));
+        }
+        break;
+    case '^':
+        for (; (i + VEC_WIDTH) <= len; i += VEC_WIDTH) {
+            const vd x = LOAD(&lhs[i]);
+            const vd y = LOAD(&rhs[i]);
+            vi special;
+            STORE(&out[i], VN(pow)(x, y, &special));
+            if (VN(any)(special)) {
+                for (int j = 0; j < VEC_WIDTH; j++) {
+                    if (special[j]) out[i + j] = pow(x[j], y[j]);
+                }
+            }
+        }
+        break;
+    }
+    scalar_apply_op(op, &lhs[i], &rhs[i], &out[i], len - i);
+}
+
+/* Applies `vec_fn` to a block, falling back to `scalar_fn` for the lanes
+`special_fn` flags and for the tail. */
+#define APPLY_UNARY(vec_fn, special_fn, scalar_fn)                             \
+    do {                                                                       \
+        for (; (i + VEC_WIDTH) <= len; i += VEC_WIDTH) {                       \
+            const vd x = LOAD(&in[i]) * scale;                                  \
+            const vi special = special_fn(x);                                  \
+            STORE(&out[i], vec_fn(x));                                         \
+            if (VN(any)(special)) {                                            \
+                for (int j = 0; j < VEC_WIDTH; j++) {                          \
+                    if (special[j]) out[i + j] = scalar_fn(x[j]);              \
+                }                                                              \
+            }                                                                  \
+        }                                                                      \
+    } while (0)
+
+static VEC_ATTR vi VN(no_special)(vd x) {
+    (void)x;
+    return (vi){0};
+}
+
+static VEC_ATTR vd VN(sin)(vd x) {
+    return VN(sin_shifted)(x, 0);
+}
+
+static VEC_ATTR vd VN(cos)(vd x) {
+    return VN(sin_shifted)(x, 1);
+}
+
+static VEC_ATTR vd VN(sqrt)(vd x) {
+    return (vd)VEC_SQRT(x);
+}
+
+static VEC_ATTR void VN(apply_func)(enum FuncType func_type, const double* in,
+                                    double* out, size_t len, double to_rad) {
+    /* Only trig functions take angles. */
+    const double scale =
+        ((func_type == FN_SIN) || (func_type == FN_COS) || (func_type == FN_TAN))
+            ? to_rad
+            : 1;
+    size_t i = 0;
+    switch (func_type) {
+    case FN_SIN: APPLY_UNARY(VN(sin), VN(trig_special), sin); break;
+    case FN_COS: APPLY_UNARY(VN(cos), VN(trig_special), cos); break;
+    case FN_TAN: APPLY_UNARY(VN(tan), VN(trig_special), tan); break;
+    case FN_ASIN: APPLY_UNARY(VN(asin), VN(no_special), asin); break;
+    case FN_ACOS: APPLY_UNARY(VN(acos), VN(no_special), acos); break;
+    case FN_ATAN: APPLY_UNARY(VN(atan), VN(no_special), atan); break;
+    case FN_LOG_10: APPLY_UNARY(VN(log10), VN(log_special), log10); break;
+    case FN_LOG_E: APPLY_UNARY(VN(log), VN(log_special), log); break;
+    case FN_SQRT: APPLY_UNARY(VN(sqrt), VN(no_special), sqrt); break;
+    }
+    scalar_apply_func(func_type, &in[i], &out[i], len - i, to_rad);
+}
+
+#undef APPLY_UNARY
+#undef SPLAT
+#undef LOAD
+#undef STORE
+#undef vd
+#undef vi
+#undef vdu
@@ -0,0 +1,427 @@
+#include "mcalc4_solve.h"
+#include "../../libs/mlogging.h"
+#include "mcalc4_diff.h"
+#include "mcalc4_jit.h"
+#include "mcalc4_pool.h"
+#include "mcalc4_types.h"
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Pieces a range is split into, each scanned by one task. It doesn't depend
+on the number of threads, so neither do the roots found. */
+#define SOLVE_NUM_PIECES 64
+/* Brent's method and the search for a dip halve the bracket at least every
+few steps, so they only run out of steps if the equation isn't a function of
+the variable. */
+#define SOLVE_MAX_STEPS 200
+/* How close to 0, relative to the values around it, the bottom of a dip must
+be to be a root where the equation touches 0: sqrt(DBL_EPSILON), which
+allows for the rounding of the equation near a double root. */
+#define SOLVE_TOUCH_TOL 1.4901161193847656e-8
+/* How many times steeper than its values explain the slopes at the ends of an
+interval must be for it to be too long to scan. */
+#define SOLVE_MAX_SLOPE_RATIO 8
+
+static bool opposite_signs(double a, double b) {
+    return ((a < 0) && (b > 0)) || ((a > 0) && (b < 0));
+}
+
+/* A point of the equation, with its derivative. */
+struct Sample {
+    double x;
+    double value;
+    double slope;
+};
+
+/**
+ * Evaluates the equation and its derivative at `x` with
+ * `MC4_eval_compiled_gradient()`, counted as one evaluation of `f`.
+ */
+static struct Sample sample_at(struct MC4_JitBinding* f,
+                               const struct MC4_Compiled* expr, double x) {
+    struct Sample sample = {.x = x};
+    MC4_ErrorCode err;
+    f->vars.values[f->slot] = x;
+    f->num_evals++;
+    sample.value = MC4_eval_compiled_gradient(expr, &f->slot, 1, &f->vars,
+                                              &sample.slope, &err);
+    return sample;
+}
+
+/**
+ * True if `|f|` falls from `a` into `[a, b]` and rises out of it to `b`
+ * without `f` changing sign, so it has a minimum in between which may touch
+ * or cross 0.
+ */
+static bool dips_between(const struct Sample* a, const struct Sample* b) {
+    return (a->value != 0) && (b->value != 0) &&
+           !opposite_signs(a->value, b->value) &&
+           ((a->value * a->slope) < 0) && ((b->value * b->slope) >= 0);
+}
+
+/**
+ * True if the slopes at both ends of `[a, b]` are far steeper than the change
+ * and size of the values explain, which happens when the equation turns
+ * around several times in between, so the interval is too long to tell where
+ * its roots are.
+ */
+static bool too_long(const struct Sample* a, const struct Sample* b) {
+    const double explained = fabs(b->value - a->value) +
+                             fmax(fabs(a->value), fabs(b->value));
+    return (fmin(fabs(a->slope), fabs(b->slope)) * (b->x - a->x)) >
+           (SOLVE_MAX_SLOPE_RATIO * explained);
+}
+
+/**
+ * Finds the root of `f` in `[a, b]`, where `fa` and `fb` have opposite signs,
+ * with Brent's method (`zeroin`), to within rounding. `c` is the end of the
+ * bracket opposite `b`, the best guess so far. Returns false if the bracket
+ * closes on a pole rather than a root.
+ */
+static bool brent(struct MC4_JitBinding* f, double a, double b, double fa,
+                  double fb, double* root) {
+    const double bracket_max = fmax(fabs(fa), fabs(fb));
+    double c = a, fc = fa;
+    double d = b - a, e = d;
+    for (int step = 0; step < SOLVE_MAX_STEPS; step++) {
+        if (fabs(fc) < fabs(fb)) {
+            a = b, fa = fb;
+            b = c, fb = fc;
+            c = a, fc = fa;
+        }
+        const double tol = (2 * DBL_EPSILON * fabs(b)) + DBL_MIN;
+        const double middle = 0.5 * (c - b);
+        if ((fabs(middle) <= tol) || (fb == 0)) {
+            *root = b;
+            return fabs(fb) <= bracket_max;
+        }
+        if ((fabs(e) >= tol) && (fabs(fa) > fabs(fb))) {
+            /* Secant step if there are two points, inverse quadratic if
+            there are three. */
+            const double s = fb / fa;
+            double p, q;
+            if (a == c) {
+                p = 2 * middle * s;
+                q = 1 - s;
+            } else {
+                const double qa = fa / fc, r = fb / fc;
+                p = s * ((2 * middle * qa * (qa - r)) - ((b - a) * (r - 1)));
+                q = (qa - 1) * (r - 1) * (s - 1);
+            }
+            if (p > 0) q = -q;
+            p = fabs(p);
+            if (((2 * p) < ((3 * middle * q) - fabs(tol * q))) &&
+                (p < fabs(0.5 * e * q))) {
+                e = d;
+                d = p / q;
+            } else {
+                d = middle;
+                e = d;
+            }
+        } else {
+            d = middle;
+            e = d;
+        }
+        a = b, fa = fb;
+        b += (fabs(d) > tol) ? d : copysign(tol, middle);
+        fb = MC4_jit_eval_at(f, b);
+        if (!opposite_signs(fb, fc) && (fb != 0)) {
+            c = a, fc = fa;
+            d = b - a, e = d;
+        }
+    }
+    return false;
+}
+
+/**
+ * Searches `[lo, hi]`, where `dips_between(lo, hi)`, for the bottom of the
+ * dip with Newton's method kept inside the bracket: a Newton step is taken if
+ * it lands inside and the previous step halved the bracket, and otherwise the
+ * bracket is halved. The bracket keeps the side the slope falls towards.
+ * Newton steps home in on a root where `f` touches 0 (at half the distance
+ * per step for a double root), and halving finds the bottom if it doesn't.
+ *
+ * If `f` crosses 0 on the way, the roots on either side are found with
+ * Brent's method. Otherwise the bottom is a root if it is within
+ * `SOLVE_TOUCH_TOL` of 0 relative to the ends. Writes the roots to `roots` in
+ * increasing order and returns how many there are.
+ */
+static size_t solve_dip(struct MC4_JitBinding* f,
+                        const struct MC4_Compiled* expr, struct Sample lo,
+                        struct Sample hi, double roots[2]) {
+    const double scale = fmax(fabs(lo.value), fabs(hi.value));
+    struct Sample best = (fabs(lo.value) <= fabs(hi.value)) ? lo : hi;
+    struct Sample current = best;
+    double last_width = INFINITY;
+    for (int step = 0; step < SOLVE_MAX_STEPS; step++) {
+        const double width = hi.x - lo.x;
+        double next = current.x - (current.value / current.slope);
+        if (!((next > lo.x) && (next < hi.x)) || (width > (0.5 * last_width))) {
+            next = lo.x + (0.5 * width);
+        }
+        /* The bracket is down to neighbouring doubles. */
+        if ((next <= lo.x) || (next >= hi.x)) break;
+        last_width = width;
+        current = sample_at(f, expr, next);
+        if (current.value == 0) {
+            roots[0] = current.x;
+            return 1;
+        }
+        if (opposite_signs(current.value, lo.value)) {
+            size_t num_roots = 0;
+            if (brent(f, lo.x, current.x, lo.value, current.value,
+                      &roots[num_roots])) {
+                num_roots++;
+            }
+            if (brent(f, current.x, hi.x, current.value, hi.value,
+                      &roots[num_roots])) {
+                num_roots++;
+            }
+            return num_roots;
+        }
+        if (fabs(current.value) < fabs(best.value)) best = current;
+        if ((current.value * current.slope) < 0) {
+            lo = current;
+        } else {
+            hi = current;
+        }
+    }
+    if (fabs(best.value) <= (SOLVE_TOUCH_TOL * scale)) {
+        roots[0] = best.x;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Finds the roots strictly inside `[a, b]`: one if `f` changes sign, and if it
+ * dips towards 0 in between, one where it touches 0 or two where it crosses
+ * 0 and back. Writes them to `roots` in increasing order and returns how many
+ * there are.
+ */
+static size_t solve_between(struct MC4_JitBinding* f,
+                            const struct MC4_Compiled* expr,
+                            const struct Sample* a, const struct Sample* b,
+                            double roots[2]) {
+    if (opposite_signs(a->value, b->value)) {
+        return brent(f, a->x, b->x, a->value, b->value, &roots[0]) ? 1 : 0;
+    }
+    if (dips_between(a, b)) return solve_dip(f, expr, *a, *b, roots);
+    return 0;
+}
+
+MC4_ErrorCode MC4_solve(const char* equ, const char* var, double guess,
+                        struct MC4_VariableSet* vars,
+                        const struct MC4_Settings* settings,
+                        struct MC4_Solution* solution) {
+    *solution = (struct MC4_Solution){0};
+    struct MC4_JitFunction eq;
+    const MC4_ErrorCode err =
+        MC4_jit_function_compile(&eq, equ, var, vars, settings);
+    if (err != MC4_ERR_NONE) return err;
+    struct MC4_JitBinding f = MC4_jit_bind(eq.jit, eq.vars, eq.slot);
+
+    /* The last point checked on each side, to look for a root between it
+    and the next. */
+    struct Sample left = sample_at(&f, eq.expr, guess);
+    struct Sample right = left;
+    double root = guess;
+    bool found = (left.value == 0);
+    for (double step = 0.01 * fmax(fabs(guess), 1);
+         !found && isfinite(guess + step) && isfinite(guess - step);
+         step *= 2) {
+        double roots[2];
+        const struct Sample next_right = sample_at(&f, eq.expr, guess + step);
+        if (next_right.value == 0) {
+            root = next_right.x;
+            found = true;
+        } else if (solve_between(&f, eq.expr, &right, &next_right, roots) >
+                   0) {
+            /* The nearer of two roots is the lower one. */
+            root = roots[0];
+            found = true;
+        }
+        right = next_right;
+        if (found) break;
+
+        const struct Sample next_left = sample_at(&f, eq.expr, guess - step);
+        size_t num_roots;
+        if (next_left.value == 0) {
+            root = next_left.x;
+            found = true;
+        } else if ((num_roots = solve_between(&f, eq.expr, &next_left, &left,
+                                              roots)) > 0) {
+            /* The nearer of two roots is the higher one. */
+            root = roots[num_roots - 1];
+            found = true;
+        }
+        left = next_left;
+    }
+
+    if (found) {
+        solution->roots = malloc(sizeof(double));
+        if (solution->roots == NULL) MLOG.panic("Out of memory.");
+        solution->roots[0] = root;
+        solution->num_roots = 1;
+    }
+    solution->complete = true;
+    solution->num_evals = f.num_evals;
+    MC4_jit_unbind(&f);
+    MC4_jit_function_free(&eq);
+    return MC4_ERR_NONE;
+}
+
+struct SolvePiece {
+    double* roots;
+    size_t num_roots;
+    size_t capacity;
+    size_t num_evals;
+    /* Whether some interval was too long to scan (see `too_long()`). */
+    bool too_coarse;
+};
+
+struct SolveJob {
+    const struct MC4_JitFunction* eq;
+    double from;
+    double to;
+    size_t num_intervals;
+    size_t intervals_per_piece;
+    struct SolvePiece* pieces;
+};
+
+static void piece_add_root(struct SolvePiece* piece, double root) {
+    if (piece->num_roots == piece->capacity) {
+        piece->capacity = (piece->capacity == 0) ? 4 : (piece->capacity * 2);
+        piece->roots =
+            realloc(piece->roots, piece->capacity * sizeof(double));
+        if (piece->roots == NULL) MLOG.panic("Out of memory.");
+    }
+    piece->roots[piece->num_roots++] = root;
+}
+
+/**
+ * Returns the start of interval `index` of the range, computed rather than
+ * added up so the pieces meet exactly.
+ */
+static double interval_start(const struct SolveJob* job, size_t index) {
+    if (index == job->num_intervals) return job->to;
+    return job->from + ((job->to - job->from) *
+                        ((double)index / job->num_intervals));
+}
+
+/**
+ * Solves every interval of piece `index` in which the equation changes sign
+ * or dips towards 0. A root exactly at the start of an interval belongs to
+ * that interval.
+ */
+static void solve_task(void* ctx, size_t index) {
+    struct SolveJob* job = ctx;
+    const struct MC4_Compiled* expr = job->eq->expr;
+    struct MC4_JitBinding f =
+        MC4_jit_bind(job->eq->jit, job->eq->vars, job->eq->slot);
+    struct SolvePiece* piece = &job->pieces[index];
+    const size_t first = index * job->intervals_per_piece;
+    const size_t end = first + job->intervals_per_piece;
+    struct Sample a = sample_at(&f, expr, interval_start(job, first));
+    for (size_t i = first; i < end; i++) {
+        const struct Sample b = sample_at(&f, expr, interval_start(job, i + 1));
+        if (a.value == 0) {
+            /* An interval narrower than a double is empty, and its root is
+            added by the next interval starting at the same point. */
+            if (a.x < b.x) piece_add_root(piece, a.x);
+        } else {
+            double roots[2];
+            const size_t num_roots = solve_between(&f, expr, &a, &b, roots);
+            for (size_t j = 0; j < num_roots; j++) {
+                piece_add_root(piece, roots[j]);
+            }
+        }
+        if (too_long(&a, &b)) piece->too_coarse = true;
+        a = b;
+    }
+    /* The end of the range doesn't start an interval. */
+    if (((index + 1) == SOLVE_NUM_PIECES) && (a.value == 0)) {
+        piece_add_root(piece, a.x);
+    }
+    piece->num_evals = f.num_evals;
+    MC4_jit_unbind(&f);
+}
+
+MC4_ErrorCode MC4_solve_range(const char* equ, const char* var, double from,
+                              double to, size_t num_intervals,
+                              struct MC4_VariableSet* vars,
+                              const struct MC4_Settings* settings,
+                              unsigned int num_threads,
+                              struct MC4_Solution* solution) {
+    *solution = (struct MC4_Solution){.complete = true};
+    struct MC4_JitFunction eq;
+    const MC4_ErrorCode err =
+        MC4_jit_function_compile(&eq, equ, var, vars, settings);
+    if (err != MC4_ERR_NONE) return err;
+    if (from == to) {
+        /* A range of one point has no intervals to scan. */
+        struct MC4_JitBinding f = MC4_jit_bind(eq.jit, eq.vars, eq.slot);
+        if (MC4_jit_eval_at(&f, from) == 0) {
+            solution->roots = malloc(sizeof(double));
+            if (solution->roots == NULL) MLOG.panic("Out of memory.");
+            solution->roots[0] = from;
+            solution->num_roots = 1;
+        }
+        solution->num_evals = f.num_evals;
+        MC4_jit_unbind(&f);
+        MC4_jit_function_free(&eq);
+        return MC4_ERR_NONE;
+    }
+    if (num_intervals == 0) num_intervals = MC4_SOLVE_DEFAULT_INTERVALS;
+    if (num_intervals > MC4_SOLVE_MAX_INTERVALS) {
+        num_intervals = MC4_SOLVE_MAX_INTERVALS;
+    }
+    /* Every piece has the same number of intervals. */
+    const size_t intervals_per_piece =
+        (num_intervals + SOLVE_NUM_PIECES - 1) / SOLVE_NUM_PIECES;
+    struct SolveJob job = {
+        .eq = &eq,
+        .from = fmin(from, to),
+        .to = fmax(from, to),
+        .num_intervals = intervals_per_piece * SOLVE_NUM_PIECES,
+        .intervals_per_piece = intervals_per_piece,
+        .pieces = calloc(SOLVE_NUM_PIECES, sizeof(struct SolvePiece)),
+    };
+    if (job.pieces == NULL) MLOG.panic("Out of memory.");
+    struct MC4_ThreadPool* pool = pool_new(num_threads);
+    pool_run(pool, SOLVE_NUM_PIECES, solve_task, &job);
+
+    /* Pieces are in order, as are the roots in each. */
+    for (size_t i = 0; i < SOLVE_NUM_PIECES; i++) {
+        solution->num_roots += job.pieces[i].num_roots;
+        solution->num_evals += job.pieces[i].num_evals;
+        if (job.pieces[i].too_coarse) solution->complete = false;
+    }
+    if (solution->num_roots > 0) {
+        solution->roots = malloc(solution->num_roots * sizeof(double));
+        if (solution->roots == NULL) MLOG.panic("Out of memory.");
+    }
+    size_t num_roots = 0;
+    for (size_t i = 0; i < SOLVE_NUM_PIECES; i++) {
+        const struct SolvePiece* piece = &job.pieces[i];
+        if (piece->num_roots > 0) {
+            memcpy(&solution->roots[num_roots], piece->roots,
+                   piece->num_roots * sizeof(double));
+        }
+        num_roots += piece->num_roots;
+        free(piece->roots);
+    }
+
+    free(job.pieces);
+    pool_free(pool);
+    MC4_jit_function_free(&eq);
+    return MC4_ERR_NONE;
+}
+
+void MC4_free_solution(struct MC4_Solution* solution) {
+    free(solution->roots);
+    *solution = (struct MC4_Solution){0};
+}
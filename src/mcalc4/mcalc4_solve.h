@@ -0,0 +1,72 @@
+#ifndef MCALCULATOR_VERSION_4_SOLVE_H_
+#define MCALCULATOR_VERSION_4_SOLVE_H_
+
+#include "mcalc4.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Intervals `MC4_solve_range()` scans when asked for 0. */
+#define MC4_SOLVE_DEFAULT_INTERVALS 4096
+/* Most intervals `MC4_solve_range()` scans. */
+#define MC4_SOLVE_MAX_INTERVALS (1 << 24)
+
+struct MC4_Solution {
+    /* Roots in increasing order. Free with `MC4_free_solution()`. */
+    double* roots;
+    size_t num_roots;
+    /* Number of times the equation was evaluated. */
+    size_t num_evals;
+    /* False if some interval of `MC4_solve_range()` was too long for how
+    often `equ` turns around, so roots may be missing. */
+    bool complete;
+};
+
+/**
+ * Finds a root of `equ`, a value of the variable `var` at which `equ` is 0,
+ * near `guess`.
+ *
+ * `equ` is compiled once and translated with `MC4_jit_compile()`. Steps which
+ * double in length are taken both ways from `guess`, with the slope of `equ`
+ * at each from `MC4_eval_compiled_gradient()`, until a root is bracketed:
+ *
+ * - If `equ` changes sign between two steps, the root is found with Brent's
+ *   method, which takes inverse quadratic and secant steps but falls back to
+ *   halving the bracket when they don't shrink it fast enough.
+ * - If `|equ|` falls after one step and rises before the next, the bottom of
+ *   the dip is found with Newton steps, kept inside the bracket by halving it
+ *   when they leave it or don't shrink it fast enough. It is a root where
+ *   `equ` touches 0, such as `(x-1)^2`, if it is 0 to within about
+ *   `sqrt(DBL_EPSILON)` of the values around it, and if `equ` crosses 0 on
+ *   the way the nearer root is found with Brent's method.
+ *
+ * Finds no root if neither happens before the steps overflow, or if `equ`
+ * only changes sign across a pole. Other variables are read from `vars`,
+ * which may be NULL, and gets `var` if it is new but keeps its value.
+ */
+MC4_ErrorCode MC4_solve(const char* equ, const char* var, double guess,
+                        struct MC4_VariableSet* vars,
+                        const struct MC4_Settings* settings,
+                        struct MC4_Solution* solution);
+
+/**
+ * Finds every root of `equ` in `[from, to]`, the same as `MC4_solve()`.
+ *
+ * The range is split into `num_intervals` short intervals (0 for
+ * `MC4_SOLVE_DEFAULT_INTERVALS`, rounded up to a multiple of 64 and at most
+ * `MC4_SOLVE_MAX_INTERVALS`), which are scanned for sign changes and dips and
+ * solved on `num_threads` threads (0 uses one per CPU). An interval in which
+ * `equ` turns around twice or more may hide roots, which shows in slopes at
+ * its ends far steeper than its values explain: `complete` is false if any
+ * interval looks like that, and more intervals should be scanned. If `from`
+ * equals `to`, only that point is checked.
+ */
+MC4_ErrorCode MC4_solve_range(const char* equ, const char* var, double from,
+                              double to, size_t num_intervals,
+                              struct MC4_VariableSet* vars,
+                              const struct MC4_Settings* settings,
+                              unsigned int num_threads,
+                              struct MC4_Solution* solution);
+
+void MC4_free_solution(struct MC4_Solution* solution);
+
+#endif
@@ -0,0 +1,61 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mcalc4_stats.h"
+#include <time.h>
+
+atomic_bool mc4_stats_on;
+_Atomic uint64_t mc4_stats_func_calls[NUM_FUNC_TYPES];
+
+static _Atomic uint64_t phase_calls[NUM_STATS_PHASES];
+static _Atomic uint64_t phase_ns[NUM_STATS_PHASES];
+
+uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+void MC4_stats_enable(bool enabled) {
+    atomic_store(&mc4_stats_on, enabled);
+}
+
+bool MC4_stats_enabled(void) {
+    return atomic_load(&mc4_stats_on);
+}
+
+struct MC4_Stats MC4_stats_get(void) {
+    struct MC4_Stats stats;
+    for (int i = 0; i < NUM_STATS_PHASES; i++) {
+        stats.num_calls[i] = atomic_load(&phase_calls[i]);
+        stats.ns[i] = atomic_load(&phase_ns[i]);
+    }
+    for (int i = 0; i < NUM_FUNC_TYPES; i++) {
+        stats.num_func_calls[i] = atomic_load(&mc4_stats_func_calls[i]);
+    }
+    return stats;
+}
+
+void MC4_stats_reset(void) {
+    for (int i = 0; i < NUM_STATS_PHASES; i++) {
+        atomic_store(&phase_calls[i], 0);
+        atomic_store(&phase_ns[i], 0);
+    }
+    for (int i = 0; i < NUM_FUNC_TYPES; i++) {
+        atomic_store(&mc4_stats_func_calls[i], 0);
+    }
+}
+
+const char* MC4_stats_phase_name(enum MC4_StatsPhase phase) {
+    switch (phase) {
+    case STATS_TOKENIZE: return "tokenize";
+    case STATS_PARSE: return "parse/eval";
+    case STATS_FORMAT: return "format";
+    case NUM_STATS_PHASES: break;
+    }
+    return "unknown";
+}
+
+void stats_record(enum MC4_StatsPhase phase, uint64_t start) {
+    const uint64_t elapsed = stats_now_ns() - start;
+    atomic_fetch_add_explicit(&phase_calls[phase], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&phase_ns[phase], elapsed, memory_order_relaxed);
+}
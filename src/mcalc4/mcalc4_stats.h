@@ -0,0 +1,92 @@
+#ifndef MCALCULATOR_VERSION_4_STATS_H_
+#define MCALCULATOR_VERSION_4_STATS_H_
+
+#include "mcalc4_types.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Phases of evaluating an expression which are counted and timed. */
+enum MC4_StatsPhase {
+    STATS_TOKENIZE,
+    /* Parsing and evaluating, which happen together. */
+    STATS_PARSE,
+    STATS_FORMAT,
+    NUM_STATS_PHASES,
+};
+
+#define NUM_FUNC_TYPES (FN_SQRT + 1)
+
+/**
+ * Counters for every thread since the last `MC4_stats_reset()`. Nothing is
+ * counted while stats are disabled, which is the default.
+ */
+struct MC4_Stats {
+    uint64_t num_calls[NUM_STATS_PHASES];
+    uint64_t ns[NUM_STATS_PHASES];
+    /* libm calls made while evaluating or folding, by `enum FuncType`. */
+    uint64_t num_func_calls[NUM_FUNC_TYPES];
+};
+
+void MC4_stats_enable(bool enabled);
+
+bool MC4_stats_enabled(void);
+
+struct MC4_Stats MC4_stats_get(void);
+
+void MC4_stats_reset(void);
+
+const char* MC4_stats_phase_name(enum MC4_StatsPhase phase);
+
+/* Instrumentation
+ *
+ * Instrumented code checks `stats_on()` first, which is a single relaxed load,
+ * so disabled stats cost one predictable branch per phase. The checks are
+ * inline, and only enabled stats call into mcalc4_stats.c. Counters are
+ * relaxed atomics, since `MC4_evaluate_many()` evaluates on several threads.
+ *
+ * Functions are counted per call by the interpreters, per block of values by
+ * `MC4_evaluate_batch()`, and per evaluation by native JIT code, which calls
+ * libm without counting. */
+
+extern atomic_bool mc4_stats_on;
+extern _Atomic uint64_t mc4_stats_func_calls[NUM_FUNC_TYPES];
+
+static inline bool stats_on(void) {
+    return atomic_load_explicit(&mc4_stats_on, memory_order_relaxed);
+}
+
+uint64_t stats_now_ns(void);
+
+void stats_record(enum MC4_StatsPhase phase, uint64_t start);
+
+/**
+ * Returns the time to pass to `stats_end()`, or 0 if stats are disabled.
+ */
+static inline uint64_t stats_start(void) {
+    return stats_on() ? stats_now_ns() : 0;
+}
+
+/**
+ * Counts a call of `phase` which began at `start` (from `stats_start()`).
+ * Does nothing if `start` is 0, so a phase which was running when stats were
+ * enabled isn't counted.
+ */
+static inline void stats_end(enum MC4_StatsPhase phase, uint64_t start) {
+    if (start != 0) stats_record(phase, start);
+}
+
+/* Counts `count` calls of `func_type`. */
+static inline void stats_count_funcs(enum FuncType func_type,
+                                     uint64_t count) {
+    if (stats_on()) {
+        atomic_fetch_add_explicit(&mc4_stats_func_calls[func_type], count,
+                                  memory_order_relaxed);
+    }
+}
+
+static inline void stats_count_func(enum FuncType func_type) {
+    stats_count_funcs(func_type, 1);
+}
+
+#endif
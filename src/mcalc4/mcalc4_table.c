@@ -0,0 +1,154 @@
+#include "mcalc4_table.h"
+#include "../../libs/mlogging.h"
+#include "mcalc4_format.h"
+#include "mcalc4_pool.h"
+#include "mcalc4_types.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Rows evaluated and formatted by one task. */
+#define TABLE_BLOCK_ROWS 4096
+/* Blocks formatted before they are written, per thread. More blocks per
+thread let fast threads steal from slow ones; fewer use less memory. */
+#define TABLE_BLOCKS_PER_THREAD 4
+/* Longest line: two values, a comma and a newline, which overwrite the '\0'
+`MC4_format()` writes. */
+#define TABLE_LINE_SIZE (2 * MC4_FORMAT_BUFFER_SIZE)
+
+size_t MC4_range_len(const struct MC4_Range* range) {
+    if (!isfinite(range->from) || !isfinite(range->to) ||
+        !isfinite(range->step) || (range->step == 0)) {
+        return 0;
+    }
+    const double steps = (range->to - range->from) / range->step;
+    /* Steps such as 0.1 aren't exact, so `to` may be a hair more than a
+    whole number of steps away. */
+    const double count = floor(steps + ((fabs(steps) + 1) * 1e-9)) + 1;
+    if (!(count >= 1) || (count >= (double)SIZE_MAX)) return 0;
+    return (size_t)count;
+}
+
+struct TableBlock {
+    double* xs;
+    double* values;
+    char* text;
+    size_t len;
+};
+
+struct TableJob {
+    const struct MC4_Compiled* expr;
+    const struct MC4_VariableSet* vars;
+    const struct MC4_Range* range;
+    enum OutputMode output_mode;
+    size_t num_rows;
+    /* Index of the block which `blocks[0]` holds. */
+    size_t first_block;
+    struct TableBlock* blocks;
+};
+
+static void table_task(void* ctx, size_t index) {
+    struct TableJob* job = ctx;
+    struct TableBlock* block = &job->blocks[index];
+    const size_t start = (job->first_block + index) * TABLE_BLOCK_ROWS;
+    const size_t num_rows = ((job->num_rows - start) < TABLE_BLOCK_ROWS)
+                                ? (job->num_rows - start)
+                                : TABLE_BLOCK_ROWS;
+    /* Multiplying rather than adding up steps keeps rounding errors from
+    piling up over long ranges. */
+    for (size_t i = 0; i < num_rows; i++) {
+        block->xs[i] =
+            job->range->from + ((double)(start + i) * job->range->step);
+    }
+    const struct MC4_Column column = {
+        .name = job->range->name,
+        .values = block->xs,
+    };
+    MC4_eval_compiled_batch(job->expr, &column, 1, num_rows, job->vars,
+                            block->values);
+
+    size_t len = 0;
+    for (size_t i = 0; i < num_rows; i++) {
+        len += MC4_format(block->xs[i], job->output_mode, &block->text[len]);
+        block->text[len++] = ',';
+        len +=
+            MC4_format(block->values[i], job->output_mode, &block->text[len]);
+        block->text[len++] = '\n';
+    }
+    block->len = len;
+}
+
+MC4_ErrorCode MC4_tabulate(const char* equ, const struct MC4_Range* range,
+                           struct MC4_VariableSet* vars,
+                           const struct MC4_Settings* settings, FILE* out,
+                           unsigned int num_threads) {
+    /* The range's variable needs a slot even if the caller has no variable
+    set. */
+    struct MC4_VariableSet local_vars = new_varset();
+    if (vars == NULL) vars = &local_vars;
+    MC4_ErrorCode err;
+    struct MC4_Compiled* expr = MC4_compile(equ, vars, settings, &err);
+    if (err != MC4_ERR_NONE) {
+        free_varset(&local_vars);
+        return err;
+    }
+    /* Finds undefined variables before anything is written. */
+    const struct MC4_Column first = {.name = range->name,
+                                     .values = &range->from};
+    double first_value;
+    err = MC4_eval_compiled_batch(expr, &first, 1, 1, vars, &first_value);
+    const size_t num_rows = MC4_range_len(range);
+    if ((err != MC4_ERR_NONE) || (num_rows == 0)) {
+        MC4_free_compiled(expr);
+        free_varset(&local_vars);
+        return err;
+    }
+
+    const size_t num_blocks =
+        (num_rows + TABLE_BLOCK_ROWS - 1) / TABLE_BLOCK_ROWS;
+    struct MC4_ThreadPool* pool = pool_new(num_threads);
+    size_t wave_size = pool_num_threads(pool) * TABLE_BLOCKS_PER_THREAD;
+    if (wave_size > num_blocks) wave_size = num_blocks;
+    struct TableBlock* blocks = malloc(wave_size * sizeof(struct TableBlock));
+    if (blocks == NULL) MLOG.panic("Out of memory.");
+    for (size_t i = 0; i < wave_size; i++) {
+        blocks[i].xs = malloc(TABLE_BLOCK_ROWS * sizeof(double));
+        blocks[i].values = malloc(TABLE_BLOCK_ROWS * sizeof(double));
+        blocks[i].text = malloc((TABLE_BLOCK_ROWS * TABLE_LINE_SIZE) + 1);
+        if ((blocks[i].xs == NULL) || (blocks[i].values == NULL) ||
+            (blocks[i].text == NULL)) {
+            MLOG.panic("Out of memory.");
+        }
+    }
+
+    struct TableJob job = {
+        .expr = expr,
+        .vars = vars,
+        .range = range,
+        .output_mode = (settings != NULL) ? settings->output_mode
+                                          : settings_default().output_mode,
+        .num_rows = num_rows,
+        .blocks = blocks,
+    };
+    while (job.first_block < num_blocks) {
+        const size_t num_tasks = ((num_blocks - job.first_block) < wave_size)
+                                     ? (num_blocks - job.first_block)
+                                     : wave_size;
+        pool_run(pool, num_tasks, table_task, &job);
+        for (size_t i = 0; i < num_tasks; i++) {
+            fwrite(blocks[i].text, 1, blocks[i].len, out);
+        }
+        job.first_block += num_tasks;
+    }
+
+    for (size_t i = 0; i < wave_size; i++) {
+        free(blocks[i].xs);
+        free(blocks[i].values);
+        free(blocks[i].text);
+    }
+    free(blocks);
+    pool_free(pool);
+    MC4_free_compiled(expr);
+    free_varset(&local_vars);
+    return MC4_ERR_NONE;
+}
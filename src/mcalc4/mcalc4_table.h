@@ -0,0 +1,41 @@
+#ifndef MCALCULATOR_VERSION_4_TABLE_H_
+#define MCALCULATOR_VERSION_4_TABLE_H_
+
+#include "mcalc4.h"
+#include <stddef.h>
+#include <stdio.h>
+
+/* Values of the variable `name`: `from`, `from + step`, `from + 2*step`, ...
+up to `to`. `step` is negative if `to` is less than `from`. */
+struct MC4_Range {
+    const char* name;
+    double from;
+    double to;
+    double step;
+};
+
+/**
+ * Returns the number of values in `range`, or 0 if `step` is 0 or goes away
+ * from `to`, or if any bound isn't finite. `to` is included if it is within
+ * rounding of a step.
+ */
+size_t MC4_range_len(const struct MC4_Range* range);
+
+/**
+ * Writes a `x,value` line for every value `x` of `range`, where `value` is
+ * `equ` with the range's variable bound to `x`, to `out`.
+ *
+ * `equ` is compiled once, and blocks of rows are evaluated (the same as
+ * `MC4_evaluate_batch()`) and formatted with `MC4_format()` in the output mode
+ * of `settings` on `num_threads` threads (0 uses one per CPU). Blocks are
+ * written in order as large buffered writes. Other variables are read from
+ * `vars`, which may be NULL, and gets the range's variable if it is new but
+ * keeps its value. Nothing is written if `equ` is invalid or reads an
+ * undefined variable.
+ */
+MC4_ErrorCode MC4_tabulate(const char* equ, const struct MC4_Range* range,
+                           struct MC4_VariableSet* vars,
+                           const struct MC4_Settings* settings, FILE* out,
+                           unsigned int num_threads);
+
+#endif
@@ -1,11 +1,10 @@
 #ifndef MCALCULATOR_VERSION_4_UTILS_H_
 #define MCALCULATOR_VERSION_4_UTILS_H_
 
+#include "../cli/cli_types.h"
+#include <stdbool.h>
 #include <stddef.h>
-
-#define MAX_TOKENS 1000
-#define MC4_VARSET_SIZE 52
-#define MC4_VARSET_HALF_SIZE (MC4_VARSET_SIZE / 2)
+#include <stdint.h>
 
 enum TokenType {
     TYPE_EMPTY,
@@ -21,6 +20,8 @@ enum TokenType {
 enum ConstType {
     CONST_PI,
     CONST_E,
+    /* A keyword which isn't a constant. */
+    CONST_NONE,
 };
 
 enum FuncType {
@@ -35,6 +36,23 @@ enum FuncType {
     FN_SQRT
 };
 
+/* A name in the text of an expression. */
+struct MC4_Name {
+    unsigned int start;
+    unsigned int len;
+};
+
+union TokenValue {
+    /* Used for storing type of operator for `OPERATOR`. */
+    char op;
+    /* Used for storing the value of a `NUMBER`. */
+    double value;
+    /* Used for storing the type of a `FUNCTION`. */
+    enum FuncType func_type;
+    /* Used for storing where the name of a `VARIABLE` is. */
+    struct MC4_Name name;
+};
+
 struct Token {
     /* Stores the type of token. Metadata for token is stored in attached
     union. */
@@ -47,31 +65,157 @@ struct Token {
         double value;
         /* Used for storing the type of a `FUNCTION`. */
         enum FuncType func_type;
-        /* Used for storing the identifier of a `VARIABLE`. */
-        char symbol;
+        /* Used for storing where the name of a `VARIABLE` is. */
+        struct MC4_Name name;
     };
 };
 
+/* Tokens are stored as two parallel arrays (one byte of type and eight bytes
+of value per token) in the calling thread's arena, so they stay valid until the
+thread tokenizes again. Use `tokens_get()` to read a whole `Token`. */
 struct TokensList {
-    /* List of tokens, capacity is is `MAX_TOKENS` */
-    struct Token tokens[MAX_TOKENS];
-    /* Current index of tokens array */
-    unsigned int tkns_pos;
+    /* `len` token types followed by a `TYPE_EMPTY` terminator. */
+    unsigned char* types;
+    union TokenValue* values;
+    /* Where each token starts in the text. The terminator "starts" where
+    tokenizing stopped: the end of the text, or the character it failed on. */
+    unsigned int* starts;
+    unsigned int len;
 };
 
 typedef enum {
     MC4_ERR_NONE,
-    MC4_ERR_MAX_TOKENS,
     MC4_ERR_UNEXPECTED_TOKEN,
     MC4_ERR_NUM_FMT_ERR,
     MC4_ERR_VAR_NOT_FOUND,
+    MC4_ERR_CYCLE,
 } MC4_ErrorCode;
 
+enum NodeType {
+    NODE_NUMBER,
+    NODE_VARIABLE,
+    NODE_OPERATOR,
+    NODE_FUNCTION,
+};
+
+struct MC4_Node {
+    /* Stores the type of node. Metadata for node is stored in attached
+    union. */
+    enum NodeType type;
+
+    union {
+        /* Used for storing the value of a `NUMBER`. */
+        double value;
+        /* Used for storing the variable set slot of a `VARIABLE`. */
+        int slot;
+        /* Used for storing the type of operator for `OPERATOR`. */
+        char op;
+        /* Used for storing the type of a `FUNCTION`. */
+        enum FuncType func_type;
+    };
+
+    /* Indices of the operand nodes. `FUNCTION` only uses `lhs`. Operands
+    always come before the node that uses them. */
+    unsigned int lhs;
+    unsigned int rhs;
+    /* Where the literal or constant of a `NUMBER` starts in the text, so it
+    can be read again at a higher precision. Not meaningful once folded. */
+    unsigned int pos;
+};
+
+typedef struct MC4_Compiled {
+    /* Nodes in evaluation order, the last node is the result. */
+    struct MC4_Node* nodes;
+    unsigned int num_nodes;
+    unsigned int capacity;
+    /* Every distinct variable set slot read by the expression. */
+    int* vars_read;
+    unsigned int num_vars_read;
+    /* Angle mode of every trigonometric function, folded or not. */
+    enum AngleMode angle_mode;
+    /* Number of repeated subexpression nodes removed when compiling. */
+    unsigned int num_eliminated;
+} MC4_Compiled;
+
+struct MC4_Column {
+    /* Name of the variable which is bound to the column. */
+    const char* name;
+    /* One value per row. */
+    const double* values;
+};
+
+/**
+ * A symbol table of named variables. Every name gets a slot the first time it
+ * is interned, and slots are never removed (a variable can only become
+ * undefined), so compiled expressions refer to variables by slot. A zeroed set
+ * is empty, see `new_varset()` and `free_varset()`.
+ */
 struct MC4_VariableSet {
-    double values_hashmap[MC4_VARSET_SIZE];
-    bool exists_hashmap[MC4_VARSET_SIZE];
+    /* Value of every slot, only meaningful where `exists` is set. */
+    double* values;
+    bool* exists;
+    /* Hash of every slot's name, and where it starts in `names`. */
+    uint64_t* hashes;
+    size_t* name_offsets;
+    unsigned int num_slots;
+    unsigned int slots_capacity;
+    /* Every slot's name, null-terminated, back to back. */
+    char* names;
+    size_t names_len;
+    size_t names_capacity;
+    /* Open addressing table of slot + 1, 0 is an empty bucket. The size is a
+    power of two and at least twice `num_slots`. */
+    unsigned int* table;
+    unsigned int table_size;
 };
 
 struct TokensList tokenize(const char* equ, MC4_ErrorCode* err);
+struct TokensList tokenize_n(const char* equ, size_t len, MC4_ErrorCode* err);
+
+/**
+ * Writes where every distinct variable name in the first `len` characters of
+ * `equ` first appears to `names`, in order of appearance, and returns how many
+ * there are, or `max_names + 1` if there are more than `max_names`. Doesn't
+ * tokenize or allocate.
+ */
+unsigned int find_variables(const char* equ, size_t len,
+                            struct MC4_Name* names, unsigned int max_names);
+
+/**
+ * Checks if the `len` characters at `name` are a function or constant.
+ */
+bool is_keyword(const char* name, size_t len);
+
+/**
+ * Checks if the name at `name`, which ends at the first character which isn't
+ * a letter or digit or after `len` characters, is a constant, writing which to
+ * `const_type`.
+ */
+bool match_constant(const char* name, size_t len, enum ConstType* const_type);
+
+/**
+ * Compiles tokens which `tokenize_n()` made from `equ` without folding
+ * constants or eliminating repeated subexpressions, so every literal and
+ * constant has a `NUMBER` node of its own which records where it is in `equ`.
+ * Variables are resolved to slots of `vars` (which may be NULL if there are
+ * none) and must be defined, as when evaluating. Returns NULL and writes the
+ * error and where it was found to `err` and `err_pos` if the expression is
+ * invalid. Free with `MC4_free_compiled()`.
+ */
+struct MC4_Compiled* compile_tokens_unfolded(
+    struct TokensList* list, const char* equ,
+    const struct MC4_VariableSet* vars, enum AngleMode angle_mode,
+    MC4_ErrorCode* err, unsigned int* err_pos);
+
+/**
+ * Checks that every variable `expr` reads is defined in `vars`.
+ */
+bool compiled_vars_defined(const struct MC4_Compiled* expr,
+                           const struct MC4_VariableSet* vars);
+
+/**
+ * Returns the name `func_type` is written as, such as "arcsin".
+ */
+const char* func_type_to_str(enum FuncType func_type);
 
 #endif
@@ -0,0 +1,159 @@
+#include "mcalc4_varset.h"
+#include "../../libs/mlogging.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* FNV-1a. */
+static uint64_t hash_name(const char* name, size_t len) {
+    uint64_t hash = UINT64_C(0xCBF29CE484222325);
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * UINT64_C(0x100000001B3);
+    }
+    return hash;
+}
+
+/**
+ * Returns the bucket of `name`: either the one holding its slot, or the empty
+ * one where it would be inserted.
+ */
+static unsigned int find_bucket(const struct MC4_VariableSet* vars,
+                                const char* name, size_t len,
+                                uint64_t hash) {
+    const unsigned int mask = vars->table_size - 1;
+    unsigned int bucket = hash & mask;
+    while (vars->table[bucket] != 0) {
+        const unsigned int slot = vars->table[bucket] - 1;
+        if (vars->hashes[slot] == hash) {
+            const char* slot_name = &vars->names[vars->name_offsets[slot]];
+            if ((strncmp(slot_name, name, len) == 0) &&
+                (slot_name[len] == '\0')) {
+                return bucket;
+            }
+        }
+        bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+}
+
+int varset_find(const struct MC4_VariableSet* vars, const char* name,
+                size_t len) {
+    if ((vars == NULL) || (vars->table_size == 0)) return -1;
+    const unsigned int bucket =
+        find_bucket(vars, name, len, hash_name(name, len));
+    return (int)vars->table[bucket] - 1;
+}
+
+static void grow_table(struct MC4_VariableSet* vars) {
+    const unsigned int table_size =
+        (vars->table_size == 0) ? 64 : (vars->table_size * 2);
+    free(vars->table);
+    vars->table = calloc(table_size, sizeof(unsigned int));
+    if (vars->table == NULL) MLOG.panic("Out of memory.");
+    vars->table_size = table_size;
+    for (unsigned int slot = 0; slot < vars->num_slots; slot++) {
+        unsigned int bucket = vars->hashes[slot] & (table_size - 1);
+        while (vars->table[bucket] != 0) {
+            bucket = (bucket + 1) & (table_size - 1);
+        }
+        vars->table[bucket] = slot + 1;
+    }
+}
+
+static void grow_slots(struct MC4_VariableSet* vars) {
+    const unsigned int capacity =
+        (vars->slots_capacity == 0) ? 32 : (vars->slots_capacity * 2);
+    vars->values = realloc(vars->values, capacity * sizeof(double));
+    vars->exists = realloc(vars->exists, capacity * sizeof(bool));
+    vars->hashes = realloc(vars->hashes, capacity * sizeof(uint64_t));
+    vars->name_offsets =
+        realloc(vars->name_offsets, capacity * sizeof(size_t));
+    if ((vars->values == NULL) || (vars->exists == NULL) ||
+        (vars->hashes == NULL) || (vars->name_offsets == NULL)) {
+        MLOG.panic("Out of memory.");
+    }
+    vars->slots_capacity = capacity;
+}
+
+static size_t add_name(struct MC4_VariableSet* vars, const char* name,
+                       size_t len) {
+    if ((vars->names_len + len + 1) > vars->names_capacity) {
+        size_t capacity =
+            (vars->names_capacity == 0) ? 256 : vars->names_capacity;
+        while ((vars->names_len + len + 1) > capacity) capacity *= 2;
+        vars->names = realloc(vars->names, capacity);
+        if (vars->names == NULL) MLOG.panic("Out of memory.");
+        vars->names_capacity = capacity;
+    }
+    const size_t offset = vars->names_len;
+    memcpy(&vars->names[offset], name, len);
+    vars->names[offset + len] = '\0';
+    vars->names_len += len + 1;
+    return offset;
+}
+
+int varset_intern(struct MC4_VariableSet* vars, const char* name, size_t len) {
+    if ((vars->num_slots * 2) >= vars->table_size) grow_table(vars);
+    const uint64_t hash = hash_name(name, len);
+    const unsigned int bucket = find_bucket(vars, name, len, hash);
+    if (vars->table[bucket] != 0) return vars->table[bucket] - 1;
+
+    if (vars->num_slots == vars->slots_capacity) grow_slots(vars);
+    const unsigned int slot = vars->num_slots++;
+    vars->values[slot] = 0;
+    vars->exists[slot] = false;
+    vars->hashes[slot] = hash;
+    vars->name_offsets[slot] = add_name(vars, name, len);
+    vars->table[bucket] = slot + 1;
+    return slot;
+}
+
+const char* varset_name(const struct MC4_VariableSet* vars, int slot) {
+    return &vars->names[vars->name_offsets[slot]];
+}
+
+struct MC4_VariableSet varset_copy_values(const struct MC4_VariableSet* vars) {
+    struct MC4_VariableSet copy = {.num_slots = vars->num_slots};
+    /* At least one slot, so `malloc(0)` never returns NULL. */
+    const size_t num_slots = (vars->num_slots > 0) ? vars->num_slots : 1;
+    copy.values = malloc(num_slots * sizeof(double));
+    copy.exists = malloc(num_slots * sizeof(bool));
+    if ((copy.values == NULL) || (copy.exists == NULL)) {
+        MLOG.panic("Out of memory.");
+    }
+    if (vars->num_slots > 0) {
+        memcpy(copy.values, vars->values, vars->num_slots * sizeof(double));
+        memcpy(copy.exists, vars->exists, vars->num_slots * sizeof(bool));
+    }
+    return copy;
+}
+
+void free_varset_values(struct MC4_VariableSet* copy) {
+    free(copy->values);
+    free(copy->exists);
+    *copy = new_varset();
+}
+
+void set_var(struct MC4_VariableSet* vars, const char* name, double value) {
+    const int slot = varset_intern(vars, name, strlen(name));
+    vars->exists[slot] = true;
+    vars->values[slot] = value;
+}
+
+bool get_var(const struct MC4_VariableSet* vars, const char* name,
+             double* value) {
+    const int slot = varset_find(vars, name, strlen(name));
+    if ((slot < 0) || !vars->exists[slot]) return false;
+    *value = vars->values[slot];
+    return true;
+}
+
+void free_varset(struct MC4_VariableSet* vars) {
+    free(vars->values);
+    free(vars->exists);
+    free(vars->hashes);
+    free(vars->name_offsets);
+    free(vars->names);
+    free(vars->table);
+    *vars = new_varset();
+}
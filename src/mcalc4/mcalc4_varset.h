@@ -0,0 +1,47 @@
+#ifndef MCALCULATOR_VERSION_4_VARSET_H_
+#define MCALCULATOR_VERSION_4_VARSET_H_
+
+#include "mcalc4_types.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+static struct MC4_VariableSet new_varset() {
+    return (struct MC4_VariableSet){0};
+}
+
+void free_varset(struct MC4_VariableSet* vars);
+
+/**
+ * Returns the slot of the `len` characters at `name`, or -1 if the name has
+ * never been interned. `vars` may be NULL.
+ */
+int varset_find(const struct MC4_VariableSet* vars, const char* name,
+                size_t len);
+
+/**
+ * Returns the slot of the `len` characters at `name`, adding an undefined
+ * variable with that name if there is none.
+ */
+int varset_intern(struct MC4_VariableSet* vars, const char* name, size_t len);
+
+const char* varset_name(const struct MC4_VariableSet* vars, int slot);
+
+/**
+ * Returns a set with its own copy of the values of `vars`, so that a thread
+ * can bind variables of a compiled expression without touching `vars`. Names
+ * aren't copied, so it can only be used for evaluating compiled expressions.
+ * Free with `free_varset_values()`.
+ */
+struct MC4_VariableSet varset_copy_values(const struct MC4_VariableSet* vars);
+
+void free_varset_values(struct MC4_VariableSet* copy);
+
+void set_var(struct MC4_VariableSet* vars, const char* name, double value);
+
+/**
+ * Writes the value of `name` to `value`. Returns false if it is undefined.
+ */
+bool get_var(const struct MC4_VariableSet* vars, const char* name,
+             double* value);
+
+#endif
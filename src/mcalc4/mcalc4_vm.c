@@ -0,0 +1,308 @@
+#include "mcalc4_vm.h"
+#include "../../libs/mlogging.h"
+#include "mcalc4_stats.h"
+#include "mcalc4_types.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HAS_COMPUTED_GOTO 1
+#endif
+
+/* Expressions with at most this many registers are evaluated without
+allocating. */
+#define VM_STACK_REGS 64
+
+enum Opcode {
+    /* Returns `a`. */
+    OP_END,
+    /* Loads variable set slot `a`. */
+    OP_LOAD,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_POW,
+    /* Converts degrees in `a` to radians, as `convert_angle_units()`. */
+    OP_TO_RAD,
+    OP_SIN,
+    OP_COS,
+    OP_TAN,
+    OP_ASIN,
+    OP_ACOS,
+    OP_ATAN,
+    OP_LOG_10,
+    OP_LOG_E,
+    OP_SQRT,
+    NUM_OPCODES,
+};
+
+/* `dst = a op b`, where all three are registers, except for `OP_LOAD`. */
+struct Instr {
+    uint32_t op;
+    uint32_t dst;
+    uint32_t a;
+    uint32_t b;
+};
+
+struct MC4_Bytecode {
+    const struct MC4_Compiled* expr;
+    struct Instr* code;
+    /* Copied to the first registers before running. */
+    double* consts;
+    unsigned int num_consts;
+    unsigned int num_regs;
+};
+
+static enum Opcode op_opcode(char op) {
+    switch (op) {
+    case '+': return OP_ADD;
+    case '-': return OP_SUB;
+    case '*': return OP_MUL;
+    case '/': return OP_DIV;
+    default: return OP_POW;
+    }
+}
+
+static enum Opcode func_opcode(enum FuncType func_type) {
+    switch (func_type) {
+    case FN_SIN: return OP_SIN;
+    case FN_COS: return OP_COS;
+    case FN_TAN: return OP_TAN;
+    case FN_ASIN: return OP_ASIN;
+    case FN_ACOS: return OP_ACOS;
+    case FN_ATAN: return OP_ATAN;
+    case FN_LOG_10: return OP_LOG_10;
+    case FN_LOG_E: return OP_LOG_E;
+    case FN_SQRT: return OP_SQRT;
+    }
+    return OP_SQRT;
+}
+
+/* Register allocation
+ *
+ * Nodes are visited in order, and every value gets a register when it is
+ * computed and gives it back when its last reader is computed. A reader may
+ * write its result to the register of its own operand, since operands are read
+ * before the result is written. */
+
+struct RegAlloc {
+    /* Registers which are free to reuse. */
+    uint32_t* free;
+    unsigned int num_free;
+    unsigned int num_regs;
+};
+
+static uint32_t alloc_reg(struct RegAlloc* alloc) {
+    if (alloc->num_free > 0) return alloc->free[--alloc->num_free];
+    return alloc->num_regs++;
+}
+
+/**
+ * Frees the register of node `index` if `reader` is its last reader.
+ */
+static void release_operand(struct RegAlloc* alloc,
+                            const struct MC4_Compiled* expr,
+                            const unsigned int* last_use, const uint32_t* regs,
+                            unsigned int index, unsigned int reader) {
+    if ((expr->nodes[index].type != NODE_NUMBER) &&
+        (last_use[index] == reader)) {
+        alloc->free[alloc->num_free++] = regs[index];
+    }
+}
+
+static void translate(struct MC4_Bytecode* bc) {
+    const struct MC4_Compiled* expr = bc->expr;
+    const unsigned int num_nodes = expr->num_nodes;
+    unsigned int* last_use = malloc(num_nodes * sizeof(unsigned int));
+    uint32_t* regs = malloc(num_nodes * sizeof(uint32_t));
+    struct RegAlloc alloc = {.free = malloc(num_nodes * sizeof(uint32_t))};
+    /* At most a conversion and an operation per node, and `OP_END`. */
+    bc->code = malloc(((num_nodes * 2) + 1) * sizeof(struct Instr));
+    bc->consts = malloc(num_nodes * sizeof(double));
+    if ((last_use == NULL) || (regs == NULL) || (alloc.free == NULL) ||
+        (bc->code == NULL) || (bc->consts == NULL)) {
+        MLOG.panic("Out of memory.");
+    }
+
+    for (unsigned int i = 0; i < num_nodes; i++) {
+        const struct MC4_Node* node = &expr->nodes[i];
+        last_use[i] = i;
+        if ((node->type == NODE_OPERATOR) || (node->type == NODE_FUNCTION)) {
+            last_use[node->lhs] = i;
+        }
+        if (node->type == NODE_OPERATOR) last_use[node->rhs] = i;
+        if (node->type == NODE_NUMBER) {
+            regs[i] = bc->num_consts;
+            bc->consts[bc->num_consts++] = node->value;
+        }
+    }
+    /* The result is read by `OP_END`. */
+    last_use[num_nodes - 1] = num_nodes;
+    alloc.num_regs = bc->num_consts;
+
+    struct Instr* code = bc->code;
+    for (unsigned int i = 0; i < num_nodes; i++) {
+        const struct MC4_Node* node = &expr->nodes[i];
+        switch (node->type) {
+        case NODE_NUMBER: continue;
+        case NODE_VARIABLE:
+            regs[i] = alloc_reg(&alloc);
+            *code++ = (struct Instr){OP_LOAD, regs[i], node->slot, 0};
+            break;
+        case NODE_OPERATOR:
+            release_operand(&alloc, expr, last_use, regs, node->lhs, i);
+            if (node->rhs != node->lhs) {
+                release_operand(&alloc, expr, last_use, regs, node->rhs, i);
+            }
+            regs[i] = alloc_reg(&alloc);
+            *code++ = (struct Instr){op_opcode(node->op), regs[i],
+                                     regs[node->lhs], regs[node->rhs]};
+            break;
+        case NODE_FUNCTION: {
+            release_operand(&alloc, expr, last_use, regs, node->lhs, i);
+            regs[i] = alloc_reg(&alloc);
+            uint32_t arg = regs[node->lhs];
+            if ((expr->angle_mode == ANGLE_MODE_DEG) &&
+                ((node->func_type == FN_SIN) || (node->func_type == FN_COS) ||
+                 (node->func_type == FN_TAN))) {
+                *code++ = (struct Instr){OP_TO_RAD, regs[i], arg, 0};
+                arg = regs[i];
+            }
+            *code++ =
+                (struct Instr){func_opcode(node->func_type), regs[i], arg, 0};
+            break;
+        }
+        }
+        /* Nothing reads it. */
+        if (last_use[i] == i) alloc.free[alloc.num_free++] = regs[i];
+    }
+    *code = (struct Instr){OP_END, 0, regs[num_nodes - 1], 0};
+    bc->num_regs = alloc.num_regs;
+
+    free(alloc.free);
+    free(regs);
+    free(last_use);
+}
+
+struct MC4_Bytecode* MC4_bytecode_compile(const struct MC4_Compiled* expr) {
+    struct MC4_Bytecode* bc = malloc(sizeof(struct MC4_Bytecode));
+    if (bc == NULL) MLOG.panic("Out of memory.");
+    *bc = (struct MC4_Bytecode){.expr = expr};
+    translate(bc);
+    return bc;
+}
+
+unsigned int MC4_bytecode_num_regs(const struct MC4_Bytecode* bc) {
+    return bc->num_regs;
+}
+
+/* Computed gotos and `goto *` are GNU extensions. */
+#ifdef HAS_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define VM_START() DISPATCH();
+#define DISPATCH() goto* targets[ip->op]
+#define TARGET(op) target_##op:
+#else
+#define VM_START() for (;;) switch (ip->op)
+#define DISPATCH() continue
+#define TARGET(op) case op:
+#endif
+
+#define BINARY(op, expr)                                                       \
+    TARGET(op) {                                                               \
+        const double a = regs[ip->a], b = regs[ip->b];                         \
+        regs[ip->dst] = (expr);                                                \
+        ip++;                                                                  \
+        DISPATCH();                                                            \
+    }
+
+#define UNARY(op, func_type, func)                                             \
+    TARGET(op) {                                                               \
+        stats_count_func(func_type);                                           \
+        regs[ip->dst] = func(regs[ip->a]);                                     \
+        ip++;                                                                  \
+        DISPATCH();                                                            \
+    }
+
+static double run(const struct Instr* ip, double* regs, const double* values) {
+#ifdef HAS_COMPUTED_GOTO
+    static const void* const targets[NUM_OPCODES] = {
+        [OP_END] = &&target_OP_END,       [OP_LOAD] = &&target_OP_LOAD,
+        [OP_ADD] = &&target_OP_ADD,       [OP_SUB] = &&target_OP_SUB,
+        [OP_MUL] = &&target_OP_MUL,       [OP_DIV] = &&target_OP_DIV,
+        [OP_POW] = &&target_OP_POW,       [OP_TO_RAD] = &&target_OP_TO_RAD,
+        [OP_SIN] = &&target_OP_SIN,       [OP_COS] = &&target_OP_COS,
+        [OP_TAN] = &&target_OP_TAN,       [OP_ASIN] = &&target_OP_ASIN,
+        [OP_ACOS] = &&target_OP_ACOS,     [OP_ATAN] = &&target_OP_ATAN,
+        [OP_LOG_10] = &&target_OP_LOG_10, [OP_LOG_E] = &&target_OP_LOG_E,
+        [OP_SQRT] = &&target_OP_SQRT,
+    };
+#endif
+    VM_START() {
+        TARGET(OP_END) return regs[ip->a];
+        TARGET(OP_LOAD) {
+            regs[ip->dst] = values[ip->a];
+            ip++;
+            DISPATCH();
+        }
+        BINARY(OP_ADD, a + b)
+        BINARY(OP_SUB, a - b)
+        BINARY(OP_MUL, a * b)
+        BINARY(OP_DIV, a / b)
+        BINARY(OP_POW, pow(a, b))
+        TARGET(OP_TO_RAD) {
+            regs[ip->dst] = regs[ip->a] * (M_PI / 180);
+            ip++;
+            DISPATCH();
+        }
+        UNARY(OP_SIN, FN_SIN, sin)
+        UNARY(OP_COS, FN_COS, cos)
+        UNARY(OP_TAN, FN_TAN, tan)
+        UNARY(OP_ASIN, FN_ASIN, asin)
+        UNARY(OP_ACOS, FN_ACOS, acos)
+        UNARY(OP_ATAN, FN_ATAN, atan)
+        UNARY(OP_LOG_10, FN_LOG_10, log10)
+        UNARY(OP_LOG_E, FN_LOG_E, log)
+        UNARY(OP_SQRT, FN_SQRT, sqrt)
+    }
+#ifndef HAS_COMPUTED_GOTO
+    return 0;
+#endif
+}
+
+#ifdef HAS_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+double MC4_bytecode_eval(const struct MC4_Bytecode* bc,
+                         const struct MC4_VariableSet* vars,
+                         MC4_ErrorCode* err) {
+    *err = MC4_ERR_NONE;
+    if (!compiled_vars_defined(bc->expr, vars)) {
+        *err = MC4_ERR_VAR_NOT_FOUND;
+        return 0;
+    }
+
+    double stack_regs[VM_STACK_REGS];
+    double* regs = stack_regs;
+    if (bc->num_regs > VM_STACK_REGS) {
+        regs = malloc(bc->num_regs * sizeof(double));
+        if (regs == NULL) MLOG.panic("Out of memory.");
+    }
+    memcpy(regs, bc->consts, bc->num_consts * sizeof(double));
+    const double value =
+        run(bc->code, regs, (vars != NULL) ? vars->values : NULL);
+    if (regs != stack_regs) free(regs);
+    return value;
+}
+
+void MC4_bytecode_free(struct MC4_Bytecode* bc) {
+    if (bc == NULL) return;
+    free(bc->consts);
+    free(bc->code);
+    free(bc);
+}
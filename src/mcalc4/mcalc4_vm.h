@@ -0,0 +1,42 @@
+#ifndef MCALCULATOR_VERSION_4_VM_H_
+#define MCALCULATOR_VERSION_4_VM_H_
+
+#include "mcalc4.h"
+#include <stdbool.h>
+
+/**
+ * A compiled expression translated to register-based bytecode, the portable
+ * alternative to `MC4_Jit`.
+ *
+ * Every instruction names its destination and operand registers, and has an
+ * opcode per operator and function, so evaluating is one loop over a flat
+ * array with no recursion and no calls besides libm. Constants are loaded into
+ * their registers all at once, and registers are reused once the value they
+ * hold is last read, so most expressions fit in a small register file on the
+ * stack. Instructions are dispatched with computed gotos on GCC and Clang, and
+ * with a `switch` elsewhere.
+ *
+ * Results are identical to `MC4_eval_compiled()` to the bit.
+ */
+struct MC4_Bytecode;
+
+/**
+ * Translates `expr`, which must outlive the returned bytecode.
+ */
+struct MC4_Bytecode* MC4_bytecode_compile(const struct MC4_Compiled* expr);
+
+/**
+ * Returns the number of registers evaluating `bc` uses, constants included.
+ */
+unsigned int MC4_bytecode_num_regs(const struct MC4_Bytecode* bc);
+
+/**
+ * Same as `MC4_eval_compiled()` for the expression `bc` was made from.
+ */
+double MC4_bytecode_eval(const struct MC4_Bytecode* bc,
+                         const struct MC4_VariableSet* vars,
+                         MC4_ErrorCode* err);
+
+void MC4_bytecode_free(struct MC4_Bytecode* bc);
+
+#endif
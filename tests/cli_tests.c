@@ -1,2 +1,83 @@
-void bar() {
+#define _POSIX_C_SOURCE 200809L
+#include "../libs/mlogging.h"
+#include "../src/cli/cli.h"
+#include "tests.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Runs `input` through `start_batch()` and returns everything it printed.
+ * Free with `free()`.
+ */
+static char* run_batch(const char* input) {
+    char in_path[] = "/tmp/mcalc4-batch-in-XXXXXX";
+    const int in_fd = mkstemp(in_path);
+    if ((in_fd == -1) ||
+        (write(in_fd, input, strlen(input)) != (ssize_t)strlen(input))) {
+        MLOG.panic("Can't write the batch input.");
+    }
+    close(in_fd);
+
+    /* `start_batch()` writes to stdout, so fd 1 is pointed at a file while it
+    runs. */
+    FILE* out = tmpfile();
+    fflush(stdout);
+    const int stdout_fd = dup(STDOUT_FILENO);
+    dup2(fileno(out), STDOUT_FILENO);
+    start_batch(in_path);
+    fflush(stdout);
+    dup2(stdout_fd, STDOUT_FILENO);
+    close(stdout_fd);
+    unlink(in_path);
+
+    const long len = ftell(out);
+    char* text = malloc(len + 1);
+    if (text == NULL) MLOG.panic("Out of memory.");
+    rewind(out);
+    text[fread(text, 1, len, out)] = '\0';
+    fclose(out);
+    return text;
+}
+
+static void run_cli_test(const char* name, const char* input,
+                         const char* expected) {
+    char* output = run_batch(input);
+    const bool passed = (strcmp(output, expected) == 0);
+    if (!passed) MLOG.logf("Expected:\n%sFound:\n%s", expected, output);
+    MLOG.test(name, passed);
+    free(output);
+}
+
+void test_cli(void) {
+    MLOG.log("CLI Test Suite");
+    run_cli_test("let then evaluate", "let x = 3\nx^2\n", "ok\n9\n");
+    /* A failed `let` prints the error, not `ok`, and the variable keeps its
+    value. */
+    run_cli_test("let with a syntax error", "let z = 5\nlet z = 1 +\nz\n",
+                 "ok\nSyntax Error: Unexpected token.\n5\n");
+    run_cli_test("let with an undefined variable", "let z = w\nz\n",
+                 "Syntax Error: Variable not found.\n"
+                 "Syntax Error: Variable not found at character 1.\n");
+    run_cli_test("let binding a cycle", "let z = 2\nlet z := z + 1\nz\n",
+                 "ok\nSyntax Error: Circular variable reference.\n2\n");
+    run_cli_test("let binding an undefined variable",
+                 "let z = 5\nlet z := q + 1\nz\n",
+                 "ok\nSyntax Error: Variable not found.\n5\n");
+    /* The note about missing roots is on the line of the roots, so the next
+    answer is on the next line. */
+    char* output = run_batch("solve sin(x) for x in 0..1e6\n1+1\n");
+    const char* note = "; roots may be missing, try a smaller `step`)\n2\n";
+    const size_t len = strlen(output);
+    MLOG.test("solve with too few intervals prints one line",
+              (len >= strlen(note)) &&
+                  (strcmp(&output[len - strlen(note)], note) == 0) &&
+                  (strchr(output, '\n') == &output[len - 3]));
+    free(output);
+    run_cli_test("diff with a variable twice", "diff x wrt x,x at 1,2\n",
+                 "Syntax Error: Each variable may only be given once.\n");
+    run_cli_test("diff with two variables", "diff x*y wrt x,y at 2,3\n",
+                 "d/dx = 3, d/dy = 2\n");
 }
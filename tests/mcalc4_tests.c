@@ -1,7 +1,24 @@
 #include "../src/mcalc4/mcalc4.h"
+#include "../src/mcalc4/mcalc4_cache.h"
+#include "../src/mcalc4/mcalc4_diff.h"
+#include "../src/mcalc4/mcalc4_format.h"
+#include "../src/mcalc4/mcalc4_formulas.h"
+#include "../src/mcalc4/mcalc4_integrate.h"
+#include "../src/mcalc4/mcalc4_jit.h"
+#include "../src/mcalc4/mcalc4_precise.h"
+#include "../src/mcalc4/mcalc4_solve.h"
+#include "../src/mcalc4/mcalc4_table.h"
+#include "../src/mcalc4/mcalc4_vm.h"
+#include "../src/mcalc4/mcalc4_number.h"
+#include "../src/mcalc4/mcalc4_pool.h"
+#include "../src/mcalc4/mcalc4_stats.h"
 #include "../src/mcalc4/mcalc4_types.h"
 #include <float.h>
 #include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define ARR_SIZE(arr) ((sizeof(arr)) / (sizeof(arr[0])))
 
@@ -28,6 +45,7 @@ const char* functype_to_str(enum FuncType type) {
     case FN_ATAN: return "ATAN";
     case FN_LOG_10: return "LOG_10";
     case FN_LOG_E: return "LOG_E";
+    case FN_SQRT: return "SQRT";
     }
     return NULL;
 }
@@ -55,7 +73,8 @@ const char* token_to_str(void* ptr) {
         snprintf(buffer, 100, "%s(%s)", type,
                  functype_to_str(token->func_type));
     } else if (token->type == TYPE_VARIABLE) {
-        snprintf(buffer, 100, "%s(%c)", type, token->symbol);
+        snprintf(buffer, 100, "%s(%u:%u)", type, token->name.start,
+                 token->name.len);
     } else {
         snprintf(buffer, 100, "%s", type);
     }
@@ -79,19 +98,29 @@ bool tokens_equal(struct Token a, struct Token b) {
     case TYPE_FUNCTION:
         return (b.type == TYPE_FUNCTION) && (a.func_type == b.func_type);
     case TYPE_VARIABLE:
-        return (b.type == TYPE_VARIABLE) && (a.symbol == b.symbol);
+        return (b.type == TYPE_VARIABLE) &&
+               (a.name.start == b.name.start) && (a.name.len == b.name.len);
     default: return false;
     }
 }
 
-bool tokens_arr_equal(struct Token a[], struct Token b[], const int len) {
-    for (int i = 0; i < len; i++) {
-        if (!tokens_equal(a[i], b[i])) {
+bool tokens_list_equal(const struct TokensList* list, struct Token expected[],
+                       const unsigned int len) {
+    if (list->len != len) return false;
+    for (unsigned int i = 0; i < len; i++) {
+        if (!tokens_equal(tokens_get(list, i), expected[i])) {
             return false;
         }
     }
+    /* The list is terminated by an empty token. */
+    return tokens_get(list, len).type == TYPE_EMPTY;
+}
 
-    return true;
+static void print_tokens(const struct TokensList* list) {
+    for (unsigned int i = 0; i < list->len; i++) {
+        struct Token token = tokens_get(list, i);
+        MLOG.log(token_to_str(&token));
+    }
 }
 
 static void test_tokenization_one(void) {
@@ -100,10 +129,9 @@ static void test_tokenization_one(void) {
                            (struct Token){.type = TYPE_NUMBER, .value = 4}};
     struct TokensList result = tokenize("2+4", NULL);
     int passed = MLOG.test(
-        "2 + 4", tokens_arr_equal(result.tokens, test, ARR_SIZE(test)));
+        "2 + 4", tokens_list_equal(&result, test, ARR_SIZE(test)));
     if (!passed) {
-        MLOG.array_custom(&result, result.tkns_pos, sizeof(struct Token),
-                          &token_to_str);
+        print_tokens(&result);
     }
 }
 
@@ -117,10 +145,9 @@ static void test_tokenization_two(void) {
                            (struct Token){.type = TYPE_NUMBER, .value = 6}};
     struct TokensList result = tokenize("(2+4)*6", NULL);
     int passed = MLOG.test(
-        "(2+4)*6", tokens_arr_equal(result.tokens, test, ARR_SIZE(test)));
+        "(2+4)*6", tokens_list_equal(&result, test, ARR_SIZE(test)));
     if (!passed) {
-        MLOG.array_custom(&result, result.tkns_pos, sizeof(struct Token),
-                          &token_to_str);
+        print_tokens(&result);
     }
 }
 
@@ -138,10 +165,9 @@ static void test_tokenization_three(void) {
     };
     struct TokensList result = tokenize("(2*4/6)^8", NULL);
     int passed = MLOG.test(
-        "(2*4/6)^8", tokens_arr_equal(result.tokens, test, ARR_SIZE(test)));
+        "(2*4/6)^8", tokens_list_equal(&result, test, ARR_SIZE(test)));
     if (!passed) {
-        MLOG.array_custom(&result, result.tkns_pos, sizeof(struct Token),
-                          &token_to_str);
+        print_tokens(&result);
     }
 }
 
@@ -163,10 +189,9 @@ static void test_tokenization_four(void) {
     struct TokensList result = tokenize("cos(arctan(sin(pi/2)))", NULL);
     int passed =
         MLOG.test("cos(arctan(sin(pi/2)))",
-                  tokens_arr_equal(result.tokens, test, ARR_SIZE(test)));
+                  tokens_list_equal(&result, test, ARR_SIZE(test)));
     if (!passed) {
-        MLOG.array_custom(&result, result.tkns_pos, sizeof(struct Token),
-                          &token_to_str);
+        print_tokens(&result);
     }
 }
 
@@ -187,10 +212,9 @@ static void test_tokenization_five(void) {
     struct TokensList result = tokenize("ln(e^2)+log(10)", NULL);
     int passed =
         MLOG.test("ln(e^2)+log(10)",
-                  tokens_arr_equal(result.tokens, test, ARR_SIZE(test)));
+                  tokens_list_equal(&result, test, ARR_SIZE(test)));
     if (!passed) {
-        MLOG.array_custom(&result, result.tkns_pos, sizeof(struct Token),
-                          &token_to_str);
+        print_tokens(&result);
     }
 }
 
@@ -198,28 +222,73 @@ static void test_tokenization_six(void) {
     struct Token test[] = {
         (struct Token){.type = TYPE_NUMBER, .value = 2},
         (struct Token){.type = TYPE_OPERATOR, .op = '*'},
-        (struct Token){.type = TYPE_VARIABLE, .symbol = 'x'},
+        (struct Token){.type = TYPE_VARIABLE, .name = {2, 1}},
         (struct Token){.type = TYPE_OPERATOR, .op = '+'},
         (struct Token){.type = TYPE_NUMBER, .value = 5},
         (struct Token){.type = TYPE_OPERATOR, .op = '*'},
-        (struct Token){.type = TYPE_VARIABLE, .symbol = 'y'},
+        (struct Token){.type = TYPE_VARIABLE, .name = {8, 1}},
         (struct Token){.type = TYPE_OPERATOR, .op = '+'},
         (struct Token){.type = TYPE_NUMBER, .value = 3},
         (struct Token){.type = TYPE_OPERATOR, .op = '*'},
-        (struct Token){.type = TYPE_VARIABLE, .symbol = 'z'},
+        (struct Token){.type = TYPE_VARIABLE, .name = {16, 1}},
         (struct Token){.type = TYPE_OPERATOR, .op = '^'},
         (struct Token){.type = TYPE_NUMBER, .value = 2},
     };
     struct TokensList result = tokenize("2*x + 5*y + 3 * z^2", NULL);
     int passed =
         MLOG.test("2*x + 5*y + 3* z^2",
-                  tokens_arr_equal(result.tokens, test, ARR_SIZE(test)));
+                  tokens_list_equal(&result, test, ARR_SIZE(test)));
+    if (!passed) {
+        print_tokens(&result);
+    }
+}
+
+/* Names are letters, digits and underscores, and only whole names are
+keywords. */
+static void test_tokenization_seven(void) {
+    struct Token test[] = {
+        (struct Token){.type = TYPE_VARIABLE, .name = {0, 7}},
+        (struct Token){.type = TYPE_OPERATOR, .op = '-'},
+        (struct Token){.type = TYPE_VARIABLE, .name = {10, 3}},
+        (struct Token){.type = TYPE_OPERATOR, .op = '*'},
+        (struct Token){.type = TYPE_FUNCTION, .func_type = FN_SIN},
+        (struct Token){.type = TYPE_VARIABLE, .name = {18, 4}},
+        (struct Token){.type = TYPE_OPERATOR, .op = '+'},
+        (struct Token){.type = TYPE_NUMBER, .value = 2},
+        (struct Token){.type = TYPE_NUMBER, .value = M_PI},
+    };
+    struct TokensList result = tokenize("arcsinx - exp*sin x_10 + 2pi", NULL);
+    int passed =
+        MLOG.test("arcsinx - exp*sin x_10 + 2pi",
+                  tokens_list_equal(&result, test, ARR_SIZE(test)));
     if (!passed) {
-        MLOG.array_custom(&result, result.tkns_pos, sizeof(struct Token),
-                          &token_to_str);
+        print_tokens(&result);
     }
 }
 
+static void test_tokenization_errors(void) {
+    MC4_ErrorCode err = MC4_ERR_NONE;
+    tokenize("1.2.3", &err);
+    MLOG.test("1.2.3 (number format)", err == MC4_ERR_NUM_FMT_ERR);
+    err = MC4_ERR_NONE;
+    struct TokensList result = tokenize("1 # 2", &err);
+    MLOG.test("1 # 2 (unexpected character)",
+              (err == MC4_ERR_UNEXPECTED_TOKEN) && (result.len == 1) &&
+                  (result.starts[result.len] == 2));
+    /* `tokenize_n()` used to loop forever on characters it didn't classify,
+    and must stop at `len` in text which isn't null-terminated. */
+    const char unterminated[] = {'1', ' ', '#', ' ', '2', '#'};
+    err = MC4_ERR_NONE;
+    result = tokenize_n(unterminated, 5, &err);
+    MLOG.test("tokenize_n 1 # 2 (unexpected character)",
+              (err == MC4_ERR_UNEXPECTED_TOKEN) && (result.len == 1) &&
+                  (result.starts[result.len] == 2));
+    err = MC4_ERR_NONE;
+    result = tokenize_n(&unterminated[4], 1, &err);
+    MLOG.test("tokenize_n stops before the #",
+              (err == MC4_ERR_NONE) && (result.len == 1));
+}
+
 void test_tokenization(void) {
     MLOG.log("Tokenization Test Suite");
     test_tokenization_one();
@@ -228,6 +297,8 @@ void test_tokenization(void) {
     test_tokenization_four();
     test_tokenization_five();
     test_tokenization_six();
+    test_tokenization_seven();
+    test_tokenization_errors();
 }
 
 static void run_parse_test(const char* equ, double expected,
@@ -241,15 +312,1585 @@ static void run_parse_test(const char* equ, double expected,
     }
 }
 
+/* Longer than the old 1000-token limit. */
+static void test_parsing_long(void) {
+    enum { NUM_TERMS = 3000 };
+    static char equ[NUM_TERMS * 2];
+    for (int i = 0; i < NUM_TERMS; i++) {
+        equ[i * 2] = '1';
+        equ[(i * 2) + 1] = '+';
+    }
+    equ[(NUM_TERMS * 2) - 1] = '\0';
+    struct MC4_Settings settings = settings_default();
+    struct MC4_Result result = MC4_evaluate(equ, NULL, &settings);
+    MLOG.test("1+1+...+1 (3000 terms)", (result.err_code == MC4_ERR_NONE) &&
+                                            (result.value == NUM_TERMS));
+}
+
+static void run_parse_error_test(const char* equ, MC4_ErrorCode expected,
+                                 unsigned int expected_pos,
+                                 const struct MC4_VariableSet* vars) {
+    struct MC4_Settings settings = settings_default();
+    struct MC4_Result result = MC4_evaluate(equ, vars, &settings);
+    int passed = MLOG.test(equ, (result.err_code == expected) &&
+                                    (result.err_pos == expected_pos));
+    if (!passed) {
+        MLOG.logf("Expected: %s at %u | Found: %s at %u",
+                  _MC4_ErrorCode_to_str(expected), expected_pos,
+                  MC4_get_error_str(&result), result.err_pos);
+    }
+}
+
+/* The valid and invalid expressions of the parsing tests, which the
+arbitrary precision tests also compare against. `with_vars` evaluates them with
+the set of `new_parse_vars()`, and otherwise without variables. */
+static const struct {
+    const char* equ;
+    double expected;
+    bool with_vars;
+} PARSE_TESTS[] = {
+    {"2+4", 6, false},
+    {"(2*4/6)^8", 9.98872123151958, false},
+    {"cos(arctan(sin(pi/2)))", 0.7071067811865476, false},
+    {"ln(e^2) + log(10)", 3, false},
+    {"2*x + 5*y + 3 * z^2", 67, true},
+};
+
+static const struct {
+    const char* equ;
+    MC4_ErrorCode expected;
+    unsigned int expected_pos;
+    bool with_vars;
+} PARSE_ERROR_TESTS[] = {
+    {"x + yy * 2", MC4_ERR_VAR_NOT_FOUND, 4, true},
+    {"2 + * 3", MC4_ERR_UNEXPECTED_TOKEN, 4, true},
+    {"(x + 1", MC4_ERR_UNEXPECTED_TOKEN, 6, true},
+    {"2 + 1.2.3", MC4_ERR_NUM_FMT_ERR, 7, true},
+    {"2 # 3", MC4_ERR_UNEXPECTED_TOKEN, 2, true},
+    {"x", MC4_ERR_VAR_NOT_FOUND, 0, false},
+    {"1 +", MC4_ERR_UNEXPECTED_TOKEN, 3, true},
+    {"w*2", MC4_ERR_VAR_NOT_FOUND, 0, true},
+    {"sin", MC4_ERR_UNEXPECTED_TOKEN, 3, true},
+    {")", MC4_ERR_UNEXPECTED_TOKEN, 0, true},
+    {"", MC4_ERR_UNEXPECTED_TOKEN, 0, true},
+};
+
+static struct MC4_VariableSet new_parse_vars(void) {
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "x", 2);
+    set_var(&vars, "y", 3);
+    set_var(&vars, "z", 4);
+    return vars;
+}
+
+static void test_parsing_errors(void) {
+    struct MC4_VariableSet vars = new_parse_vars();
+    for (size_t i = 0; i < ARR_SIZE(PARSE_ERROR_TESTS); i++) {
+        run_parse_error_test(PARSE_ERROR_TESTS[i].equ,
+                             PARSE_ERROR_TESTS[i].expected,
+                             PARSE_ERROR_TESTS[i].expected_pos,
+                             PARSE_ERROR_TESTS[i].with_vars ? &vars : NULL);
+    }
+    /* The result is only the value and the error, however many variables
+    there are. */
+    MLOG.test("result doesn't hold variables",
+              sizeof(struct MC4_Result) <= (2 * sizeof(double)));
+    free_varset(&vars);
+}
+
 void test_parsing(void) {
     MLOG.log("Parsing Test Suite");
-    run_parse_test("2+4", 6, NULL);
-    run_parse_test("(2*4/6)^8", 9.98872123151958, NULL);
-    run_parse_test("cos(arctan(sin(pi/2)))", 0.7071067811865476, NULL);
-    run_parse_test("ln(e^2) + log(10)", 3, NULL);
-    struct MC4_VariableSet vars = new_varset();
-    set_var(&vars, 'x', 2);
-    set_var(&vars, 'y', 3);
-    set_var(&vars, 'z', 4);
-    run_parse_test("2*x + 5*y + 3 * z^2", 67, &vars);
+    struct MC4_VariableSet vars = new_parse_vars();
+    for (size_t i = 0; i < ARR_SIZE(PARSE_TESTS); i++) {
+        run_parse_test(PARSE_TESTS[i].equ, PARSE_TESTS[i].expected,
+                       PARSE_TESTS[i].with_vars ? &vars : NULL);
+    }
+    free_varset(&vars);
+    test_parsing_long();
+    test_parsing_errors();
+}
+
+static void run_compile_test(const char* equ, struct MC4_VariableSet* vars) {
+    struct MC4_Settings settings = settings_default();
+    struct MC4_Result expected = MC4_evaluate(equ, vars, &settings);
+    MC4_ErrorCode err;
+    struct MC4_Compiled* expr = MC4_compile(equ, vars, &settings, &err);
+    double value = MC4_eval_compiled(expr, vars, &err);
+    int passed = MLOG.test(equ, (err == MC4_ERR_NONE) &&
+                                    doubles_mostly_equal(value, expected.value));
+    if (!passed) {
+        MLOG.logf("Expected value: %lf | Found value: %lf", expected.value,
+                  value);
+    }
+    MC4_free_compiled(expr);
+}
+
+static void test_compiling_reuse(void) {
+    MC4_ErrorCode err;
+    struct MC4_VariableSet vars = new_varset();
+    struct MC4_Compiled* expr =
+        MC4_compile("x^2 + 2*x + 1", &vars, NULL, &err);
+    bool passed = (err == MC4_ERR_NONE);
+    for (int x = -5; x <= 5; x++) {
+        set_var(&vars, "x", x);
+        double value = MC4_eval_compiled(expr, &vars, &err);
+        passed = passed && (err == MC4_ERR_NONE) &&
+                 doubles_mostly_equal(value, (x + 1) * (x + 1));
+    }
+    MLOG.test("x^2 + 2*x + 1 (reused)", passed);
+    MC4_free_compiled(expr);
+    free_varset(&vars);
+}
+
+static void test_compiling_errors(void) {
+    MC4_ErrorCode err;
+    MLOG.test("(2+", (MC4_compile("(2+", NULL, NULL, &err) == NULL) &&
+                         (err == MC4_ERR_UNEXPECTED_TOKEN));
+    struct MC4_VariableSet vars = new_varset();
+    struct MC4_Compiled* expr = MC4_compile("2*y", &vars, NULL, &err);
+    MC4_eval_compiled(expr, &vars, &err);
+    MLOG.test("2*y (undefined)", err == MC4_ERR_VAR_NOT_FOUND);
+    MC4_free_compiled(expr);
+    MLOG.test("2*y (no variable set)",
+              (MC4_compile("2*y", NULL, NULL, &err) == NULL) &&
+                  (err == MC4_ERR_VAR_NOT_FOUND));
+    free_varset(&vars);
+}
+
+static void run_folding_test(const char* equ, enum AngleMode angle_mode,
+                             unsigned int expected_nodes) {
+    struct MC4_Settings settings = settings_default();
+    settings.angle_mode = angle_mode;
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "x", 0.5);
+    struct MC4_Result expected = MC4_evaluate(equ, &vars, &settings);
+    MC4_ErrorCode err;
+    struct MC4_Compiled* expr = MC4_compile(equ, &vars, &settings, &err);
+    const double value = MC4_eval_compiled(expr, &vars, &err);
+    int passed = MLOG.test(equ, (err == MC4_ERR_NONE) &&
+                                    (expr->num_nodes == expected_nodes) &&
+                                    (value == expected.value));
+    if (!passed) {
+        MLOG.logf("Expected %u nodes, found %u | Expected value: %.17g | "
+                  "Found value: %.17g",
+                  expected_nodes, expr->num_nodes, expected.value, value);
+    }
+    MC4_free_compiled(expr);
+    free_varset(&vars);
+}
+
+static void test_compiling_folding(void) {
+    run_folding_test("sin(pi/4)*2^10", ANGLE_MODE_RAD, 1);
+    run_folding_test("sin(pi/4)*2^10", ANGLE_MODE_DEG, 1);
+    run_folding_test("cos(180) + x", ANGLE_MODE_DEG, 3);
+    /* x, pi/180, *, 2*3, + */
+    run_folding_test("x * (pi/180) + 2*3", ANGLE_MODE_RAD, 5);
+    /* Left associative, so `x*2*3` is `(x*2)*3` and nothing is folded. */
+    run_folding_test("x*2*3", ANGLE_MODE_RAD, 5);
+    run_folding_test("sqrt(2)^x", ANGLE_MODE_RAD, 3);
+}
+
+static void run_cse_test(const char* equ, unsigned int expected_nodes,
+                         unsigned int expected_eliminated) {
+    struct MC4_Settings settings = settings_default();
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "x", 0.5);
+    set_var(&vars, "y", 3);
+    set_var(&vars, "t", 1.25);
+    struct MC4_Result expected = MC4_evaluate(equ, &vars, &settings);
+    MC4_ErrorCode err;
+    struct MC4_Compiled* expr = MC4_compile(equ, &vars, &settings, &err);
+    const double value = MC4_eval_compiled(expr, &vars, &err);
+    int passed = MLOG.test(equ, (err == MC4_ERR_NONE) &&
+                                    (expr->num_nodes == expected_nodes) &&
+                                    (expr->num_eliminated ==
+                                     expected_eliminated) &&
+                                    (value == expected.value));
+    if (!passed) {
+        MLOG.logf("Expected %u nodes (%u removed), found %u (%u removed)",
+                  expected_nodes, expected_eliminated, expr->num_nodes,
+                  expr->num_eliminated);
+    }
+    MC4_free_compiled(expr);
+    free_varset(&vars);
+}
+
+static void test_compiling_cse(void) {
+    /* x, 2, ^, y, ^, +, sqrt, *, + */
+    run_cse_test("sqrt(x^2+y^2) + sqrt(x^2+y^2)*2", 9, 10);
+    /* t, sin, *, + */
+    run_cse_test("sin(t)*sin(t) + sin(t)*sin(t)", 4, 7);
+    /* x, y, *, - */
+    run_cse_test("x*y - y*x", 4, 3);
+    /* Not commutative: x, y, /, /, - */
+    run_cse_test("x/y - y/x", 5, 2);
+    run_cse_test("2*x + 5*y", 7, 0);
+}
+
+void test_compiling(void) {
+    MLOG.log("Compiling Test Suite");
+    run_compile_test("2+4", NULL);
+    run_compile_test("(2*4/6)^8", NULL);
+    run_compile_test("cos(arctan(sin(pi/2)))", NULL);
+    run_compile_test("ln(e^2) + log(10)", NULL);
+    run_compile_test("2^3^2 - sqrt 16 * 2", NULL);
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "x", 2);
+    set_var(&vars, "y", 3);
+    set_var(&vars, "z", 4);
+    run_compile_test("2*x + 5*y + 3 * z^2", &vars);
+    free_varset(&vars);
+    test_compiling_reuse();
+    test_compiling_errors();
+    test_compiling_folding();
+    test_compiling_cse();
+}
+
+static void run_batch_test(const char* equ) {
+    enum { NUM_ROWS = 1000 };
+    static double xs[NUM_ROWS], ys[NUM_ROWS], results[NUM_ROWS];
+    for (int i = 0; i < NUM_ROWS; i++) {
+        xs[i] = i * 0.01;
+        ys[i] = NUM_ROWS - i;
+    }
+    const struct MC4_Column columns[] = {{.name = "x", .values = xs},
+                                         {.name = "y", .values = ys}};
+    struct MC4_Settings settings = settings_default();
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "z", 4);
+    MC4_ErrorCode err = MC4_evaluate_batch(equ, columns, ARR_SIZE(columns),
+                                           NUM_ROWS, &vars, &settings, results);
+    bool passed = (err == MC4_ERR_NONE);
+    for (int i = 0; passed && (i < NUM_ROWS); i++) {
+        set_var(&vars, "x", xs[i]);
+        set_var(&vars, "y", ys[i]);
+        struct MC4_Result expected = MC4_evaluate(equ, &vars, &settings);
+        /* Batch evaluation uses SIMD kernels, which are a few ULP away from
+        libm, and the subtraction in the last expression cancels digits. */
+        passed = fabs(results[i] - expected.value) <=
+                 (1e-12 * fmax(1, fabs(expected.value)));
+    }
+    MLOG.test(equ, passed);
+    free_varset(&vars);
+}
+
+void test_batch(void) {
+    MLOG.log("Batch Test Suite");
+    run_batch_test("x");
+    run_batch_test("2*x + y/z");
+    run_batch_test("sqrt(x^2 + y^2) * sin(x) - ln(y)");
+    MC4_ErrorCode err =
+        MC4_evaluate_batch("x + w", NULL, 0, 0, NULL, NULL, NULL);
+    MLOG.test("x + w (undefined)", err == MC4_ERR_VAR_NOT_FOUND);
+}
+
+static void count_visit(void* ctx, size_t index) {
+    int* visits = ctx;
+    /* Make the tasks uneven so that workers have to steal. */
+    volatile double x = 0;
+    for (size_t i = 0; i < (index % 97) * 100; i++) x += sin(i);
+    visits[index]++;
+}
+
+static void test_pool(unsigned int num_threads) {
+    enum { NUM_TASKS = 5000 };
+    static int visits[NUM_TASKS];
+    struct MC4_ThreadPool* pool = pool_new(num_threads);
+    bool passed = true;
+    /* The pool is reused, and a run may have fewer tasks than workers. */
+    const size_t runs[] = {NUM_TASKS, 3, NUM_TASKS};
+    for (size_t r = 0; r < ARR_SIZE(runs); r++) {
+        for (int i = 0; i < NUM_TASKS; i++) visits[i] = 0;
+        pool_run(pool, runs[r], count_visit, visits);
+        for (size_t i = 0; i < NUM_TASKS; i++) {
+            passed = passed && (visits[i] == (i < runs[r]));
+        }
+    }
+    pool_free(pool);
+    MLOG.test("pool visits every task once", passed);
+}
+
+static void test_evaluate_many_order(unsigned int num_threads) {
+    const char* equs[] = {"1", "sin(cos(tan(0.5)))^2 + ln(3)", "(1 + 2",
+                          "x + 1", "2^10", "log(1000) * sqrt(16)"};
+    enum { NUM_EQUS = 600 };
+    const char* many[NUM_EQUS];
+    static MC4_Result results[NUM_EQUS];
+    for (int i = 0; i < NUM_EQUS; i++) many[i] = equs[i % ARR_SIZE(equs)];
+
+    struct MC4_Settings settings = settings_default();
+    MC4_evaluate_many(many, NUM_EQUS, NULL, &settings, results, num_threads);
+    bool passed = true;
+    for (int i = 0; i < NUM_EQUS; i++) {
+        struct MC4_Result expected = MC4_evaluate(many[i], NULL, &settings);
+        passed = passed && (results[i].err_code == expected.err_code) &&
+                 (results[i].value == expected.value);
+    }
+    MLOG.test("evaluate_many keeps input order", passed);
+}
+
+void test_many(void) {
+    MLOG.log("Parallel Evaluation Test Suite");
+    test_pool(1);
+    test_pool(4);
+    struct MC4_ThreadPool* pool = pool_new(MC4_MAX_THREADS * 4);
+    MLOG.test("pool is clamped to MC4_MAX_THREADS",
+              pool_num_threads(pool) == MC4_MAX_THREADS);
+    pool_free(pool);
+    test_evaluate_many_order(1);
+    test_evaluate_many_order(4);
+    test_evaluate_many_order(0);
+}
+
+static bool number_matches_strtod(const char* literal) {
+    double value;
+    MC4_ErrorCode err = MC4_ERR_NONE;
+    const size_t len = parse_number(literal, strlen(literal), &value, &err);
+    char* end;
+    const double expected = strtod(literal, &end);
+    return (err == MC4_ERR_NONE) && (len == (size_t)(end - literal)) &&
+           (memcmp(&value, &expected, sizeof(double)) == 0);
+}
+
+static void test_numbers_hard_cases(void) {
+    const char* literals[] = {
+        "0",
+        "0.1",
+        "123.456",
+        "9007199254740993",
+        "1e23",
+        "6.02E23",
+        "1e-9",
+        "2.2250738585072014e-308",
+        "2.2250738585072011e-308",
+        "4.9406564584124654e-324",
+        "2.4703282292062328e-324",
+        "1.7976931348623157e308",
+        "1.7976931348623159e308",
+        "1e-400",
+        "1e400",
+        "3.14159265358979323846264338327950288",
+        "1234567890123456789012345678901234567890",
+        "0.000000000000000000000000000000000000001234567890123456789012",
+        /* Exactly halfway between 1 and the next double, and just above. */
+        "1.00000000000000011102230246251565404236316680908203125",
+        "1.00000000000000011102230246251565404236316680908203126",
+        "9007199254740993.0000000000000000000001",
+        "7.2057594037927933e16",
+    };
+    bool passed = true;
+    for (size_t i = 0; i < ARR_SIZE(literals); i++) {
+        if (!number_matches_strtod(literals[i])) {
+            MLOG.logf("Mismatch for %s", literals[i]);
+            passed = false;
+        }
+    }
+    MLOG.test("hard literals match strtod", passed);
+}
+
+static void test_numbers_random(void) {
+    uint64_t state = 0x2545F4914F6CDD1Du;
+    char literal[64];
+    bool passed = true;
+    for (int i = 0; passed && (i < 200000); i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        double value;
+        uint64_t bits = state & 0x7FEFFFFFFFFFFFFFu;
+        memcpy(&value, &bits, sizeof(double));
+        snprintf(literal, sizeof(literal), "%.*g", (int)(state % 19) + 1,
+                 value);
+        passed = number_matches_strtod(literal);
+        if (!passed) MLOG.logf("Mismatch for %s", literal);
+    }
+    MLOG.test("random literals match strtod", passed);
+}
+
+static void test_numbers_in_expressions(void) {
+    run_parse_test("6.02E23 / 2", 3.01e23, NULL);
+    run_parse_test("1e-9 * 1e9", 1, NULL);
+    run_parse_test("2.5e+2 + 1.", 251, NULL);
+    struct Token exponent_less[] = {
+        (struct Token){.type = TYPE_NUMBER, .value = 2},
+        (struct Token){.type = TYPE_NUMBER, .value = M_E},
+        (struct Token){.type = TYPE_OPERATOR, .op = '-'},
+        (struct Token){.type = TYPE_VARIABLE, .name = {3, 1}},
+    };
+    struct TokensList result = tokenize("2e-x", NULL);
+    MLOG.test("2e-x (no exponent digits)",
+              tokens_list_equal(&result, exponent_less,
+                                ARR_SIZE(exponent_less)));
+    MC4_ErrorCode err = MC4_ERR_NONE;
+    tokenize("1e5.3", &err);
+    MLOG.test("1e5.3 (number format)", err == MC4_ERR_NUM_FMT_ERR);
+}
+
+void test_numbers(void) {
+    MLOG.log("Number Parsing Test Suite");
+    test_numbers_hard_cases();
+    test_numbers_random();
+    test_numbers_in_expressions();
+}
+
+static void run_format_test(double value, enum OutputMode mode,
+                            const char* expected) {
+    char buffer[MC4_FORMAT_BUFFER_SIZE];
+    const size_t len = MC4_format(value, mode, buffer);
+    const bool passed =
+        (strcmp(buffer, expected) == 0) && (len == strlen(expected));
+    if (!passed) MLOG.logf("Got %s", buffer);
+    MLOG.test(expected, passed);
+}
+
+static void test_format_modes(void) {
+    run_format_test(0, OUTPUT_MODE_NORMAL, "0");
+    run_format_test(-0.0, OUTPUT_MODE_NORMAL, "-0");
+    run_format_test(-1, OUTPUT_MODE_NORMAL, "-1");
+    run_format_test(0.1, OUTPUT_MODE_NORMAL, "0.1");
+    run_format_test(1.0 / 3, OUTPUT_MODE_NORMAL, "0.3333333333333333");
+    run_format_test(123456.789, OUTPUT_MODE_NORMAL, "123456.789");
+    run_format_test(1e20, OUTPUT_MODE_NORMAL, "100000000000000000000");
+    run_format_test(1e21, OUTPUT_MODE_NORMAL, "1e21");
+    run_format_test(0.000001, OUTPUT_MODE_NORMAL, "0.000001");
+    run_format_test(1.5e-7, OUTPUT_MODE_NORMAL, "1.5e-7");
+    run_format_test(NAN, OUTPUT_MODE_NORMAL, "nan");
+    run_format_test(-INFINITY, OUTPUT_MODE_NORMAL, "-inf");
+    run_format_test(0, OUTPUT_MODE_SCIENTIFIC, "0e0");
+    run_format_test(-12.5, OUTPUT_MODE_SCIENTIFIC, "-1.25e1");
+    run_format_test(0.000123, OUTPUT_MODE_SCIENTIFIC, "1.23e-4");
+    run_format_test(DBL_MAX, OUTPUT_MODE_SCIENTIFIC,
+                    "1.7976931348623157e308");
+    run_format_test(5e-324, OUTPUT_MODE_SCIENTIFIC, "5e-324");
+    run_format_test(123456.789, OUTPUT_MODE_ENGINEERING, "123.456789e3");
+    run_format_test(0.1, OUTPUT_MODE_ENGINEERING, "100e-3");
+    run_format_test(1234567, OUTPUT_MODE_ENGINEERING, "1.234567e6");
+    run_format_test(-0.00002, OUTPUT_MODE_ENGINEERING, "-20e-6");
+}
+
+static void test_format_round_trip(void) {
+    uint64_t state = 0x2545F4914F6CDD1Du;
+    char buffer[MC4_FORMAT_BUFFER_SIZE];
+    bool passed = true;
+    for (int i = 0; passed && (i < 200000); i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        double value;
+        uint64_t bits = state & 0x7FEFFFFFFFFFFFFFu;
+        memcpy(&value, &bits, sizeof(double));
+        for (int mode = OUTPUT_MODE_NORMAL; mode <= OUTPUT_MODE_ENGINEERING;
+             mode++) {
+            const size_t len = MC4_format(value, mode, buffer);
+            double parsed;
+            MC4_ErrorCode err = MC4_ERR_NONE;
+            parse_number(buffer, len, &parsed, &err);
+            if ((err != MC4_ERR_NONE) || (parsed != value)) {
+                MLOG.logf("%s doesn't read back as %.17g", buffer, value);
+                passed = false;
+            }
+        }
+    }
+    MLOG.test("random doubles round trip", passed);
+}
+
+void test_format(void) {
+    MLOG.log("Number Formatting Test Suite");
+    test_format_modes();
+    test_format_round_trip();
+}
+
+static bool cache_stats_equal(const struct MC4_Cache* cache, size_t hits,
+                              size_t misses, size_t evictions) {
+    const struct MC4_CacheStats stats = MC4_cache_stats(cache);
+    if ((stats.hits != hits) || (stats.misses != misses) ||
+        (stats.evictions != evictions)) {
+        MLOG.logf("Hits: %zu | Misses: %zu | Evictions: %zu", stats.hits,
+                  stats.misses, stats.evictions);
+        return false;
+    }
+    return true;
+}
+
+static void test_cache_keys(void) {
+    struct MC4_Cache* cache = MC4_cache_new(16);
+    struct MC4_Settings settings = settings_default();
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "x", 2);
+    set_var(&vars, "y", 5);
+
+    MC4_Result first =
+        MC4_evaluate_cached(cache, "3 * x + 1", &vars, &settings);
+    MC4_Result again = MC4_evaluate_cached(cache, "3*x+1 ", &vars, &settings);
+    MLOG.test("same text up to whitespace hits",
+              (first.value == 7) && (again.value == 7) &&
+                  (again.err_code == MC4_ERR_NONE) &&
+                  cache_stats_equal(cache, 1, 1, 0));
+
+    set_var(&vars, "y", 6);
+    MC4_evaluate_cached(cache, "3*x+1", &vars, &settings);
+    MLOG.test("unread variable changed hits",
+              cache_stats_equal(cache, 2, 1, 0));
+
+    set_var(&vars, "x", 3);
+    MC4_Result changed = MC4_evaluate_cached(cache, "3*x+1", &vars, &settings);
+    MLOG.test("read variable changed misses",
+              (changed.value == 10) && cache_stats_equal(cache, 2, 2, 0));
+
+    MC4_Result rad = MC4_evaluate_cached(cache, "cos(180)", &vars, &settings);
+    settings.angle_mode = ANGLE_MODE_DEG;
+    MC4_Result deg = MC4_evaluate_cached(cache, "cos(180)", &vars, &settings);
+    MLOG.test("angle mode changed misses",
+              (rad.value != deg.value) && (deg.value == -1) &&
+                  cache_stats_equal(cache, 2, 4, 0));
+
+    /* Significant whitespace: `s in` is three variables, `2 3` is just 2. */
+    set_var(&vars, "s", 1);
+    set_var(&vars, "i", 1);
+    set_var(&vars, "n", 0);
+    MC4_evaluate_cached(cache, "sin(0)+1", &vars, &settings);
+    MC4_Result spaced =
+        MC4_evaluate_cached(cache, "s in(0)+1", &vars, &settings);
+    MC4_evaluate_cached(cache, "23", &vars, &settings);
+    MC4_Result split = MC4_evaluate_cached(cache, "2 3", &vars, &settings);
+    MLOG.test("significant whitespace misses",
+              (spaced.value == 1) && (split.value == 2) &&
+                  cache_stats_equal(cache, 2, 8, 0));
+
+    MC4_Result undefined = MC4_evaluate_cached(cache, "z", &vars, &settings);
+    MC4_evaluate_cached(cache, "z", &vars, &settings);
+    MLOG.test("errors aren't cached",
+              (undefined.err_code == MC4_ERR_VAR_NOT_FOUND) &&
+                  cache_stats_equal(cache, 2, 10, 0));
+    MC4_cache_free(cache);
+    free_varset(&vars);
+}
+
+static void test_cache_eviction(void) {
+    struct MC4_Cache* cache = MC4_cache_new(2);
+    struct MC4_Settings settings = settings_default();
+    MC4_evaluate_cached(cache, "1", NULL, &settings);
+    MC4_evaluate_cached(cache, "2", NULL, &settings);
+    MC4_evaluate_cached(cache, "1", NULL, &settings);
+    /* Evicts "2", the least recently used. */
+    MC4_evaluate_cached(cache, "3", NULL, &settings);
+    MC4_evaluate_cached(cache, "1", NULL, &settings);
+    MC4_Result evicted = MC4_evaluate_cached(cache, "2", NULL, &settings);
+    MLOG.test("least recently used is evicted",
+              (evicted.value == 2) && cache_stats_equal(cache, 2, 4, 2));
+    MC4_cache_clear(cache);
+    MC4_evaluate_cached(cache, "1", NULL, &settings);
+    MLOG.test("clear", cache_stats_equal(cache, 2, 5, 2));
+    MC4_cache_free(cache);
+}
+
+static void test_cache_long_text(void) {
+    /* Longer than the text kept on the stack for lookups. */
+    enum { NUM_TERMS = 400 };
+    static char spaced[NUM_TERMS * 4], compact[NUM_TERMS * 2];
+    spaced[0] = compact[0] = '\0';
+    for (int i = 0; i < NUM_TERMS; i++) {
+        strcat(spaced, (i == 0) ? "x" : " + x");
+        strcat(compact, (i == 0) ? "x" : "+x");
+    }
+    struct MC4_Cache* cache = MC4_cache_new(4);
+    struct MC4_Settings settings = settings_default();
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "x", 0.5);
+    MC4_evaluate_cached(cache, spaced, &vars, &settings);
+    MC4_Result result = MC4_evaluate_cached(cache, compact, &vars, &settings);
+    /* Same prefix, but only the first `NUM_TERMS / 2 + 1` terms. */
+    compact[NUM_TERMS + 1] = '\0';
+    MC4_Result prefix = MC4_evaluate_cached(cache, compact, &vars, &settings);
+    const double prefix_expected = ((NUM_TERMS / 2) + 1) * 0.5;
+    MLOG.test("long expression", (result.value == (NUM_TERMS * 0.5)) &&
+                                     (prefix.value == prefix_expected) &&
+                                     cache_stats_equal(cache, 1, 2, 0));
+    MC4_cache_free(cache);
+    free_varset(&vars);
+}
+
+static void test_find_variables(void) {
+    const char* equ = "2e-x + pix + 1e5*E - sin(x) * x2";
+    struct MC4_Name names[4];
+    const unsigned int num_names =
+        find_variables(equ, strlen(equ), names, ARR_SIZE(names));
+    MLOG.test(equ, (num_names == 4) && (names[0].start == 3) &&
+                       (names[1].start == 7) && (names[2].start == 17) &&
+                       (names[3].start == 30) && (names[3].len == 2));
+    MLOG.test("too many names",
+              find_variables(equ, strlen(equ), names, 3) == 4);
+}
+
+void test_cache(void) {
+    MLOG.log("Result Cache Test Suite");
+    test_find_variables();
+    test_cache_keys();
+    test_cache_long_text();
+    test_cache_eviction();
+}
+
+static double var_value(const struct MC4_VariableSet* vars,
+                        const char* name) {
+    double value = 0;
+    get_var(vars, name, &value);
+    return value;
+}
+
+static bool var_exists(const struct MC4_VariableSet* vars, const char* name) {
+    double value;
+    return get_var(vars, name, &value);
+}
+
+static void test_formulas_chain(void) {
+    struct MC4_Formulas* formulas = MC4_formulas_new();
+    struct MC4_VariableSet vars = new_varset();
+    MC4_formulas_assign(formulas, &vars, "a", 2);
+    MC4_formulas_bind(formulas, &vars, "b", "a*3", NULL);
+    MC4_formulas_bind(formulas, &vars, "c", "b+1", NULL);
+    MLOG.test("chain is evaluated when bound",
+              (var_value(&vars, "b") == 6) && (var_value(&vars, "c") == 7));
+    MC4_formulas_assign(formulas, &vars, "a", 10);
+    MLOG.test("chain follows its input",
+              (var_value(&vars, "b") == 30) && (var_value(&vars, "c") == 31));
+    /* Replacing a formula with a value stops it from following `a`. */
+    MC4_formulas_assign(formulas, &vars, "b", 1);
+    MC4_formulas_assign(formulas, &vars, "a", 5);
+    MLOG.test("assigning removes the formula",
+              (var_value(&vars, "b") == 1) && (var_value(&vars, "c") == 2));
+    MC4_formulas_free(formulas);
+    free_varset(&vars);
+}
+
+static void test_formulas_diamond(void) {
+    struct MC4_Formulas* formulas = MC4_formulas_new();
+    struct MC4_VariableSet vars = new_varset();
+    MC4_formulas_assign(formulas, &vars, "a", 1);
+    MC4_formulas_bind(formulas, &vars, "b", "a+1", NULL);
+    MC4_formulas_bind(formulas, &vars, "c", "a+2", NULL);
+    MC4_formulas_bind(formulas, &vars, "d", "b*c", NULL);
+    MC4_formulas_assign(formulas, &vars, "x", 0);
+    MC4_formulas_bind(formulas, &vars, "y", "x+1", NULL);
+
+    const size_t before = MC4_formulas_num_evaluations(formulas);
+    MC4_formulas_assign(formulas, &vars, "a", 4);
+    /* `d` is evaluated once, after both `b` and `c`; `y` is untouched. */
+    MLOG.test("diamond is evaluated in order, once per formula",
+              (var_value(&vars, "d") == 30) &&
+                  ((MC4_formulas_num_evaluations(formulas) - before) == 3));
+    MC4_formulas_free(formulas);
+    free_varset(&vars);
+}
+
+static void test_formulas_cycles(void) {
+    struct MC4_Formulas* formulas = MC4_formulas_new();
+    struct MC4_VariableSet vars = new_varset();
+    MC4_formulas_assign(formulas, &vars, "a", 1);
+    MC4_formulas_bind(formulas, &vars, "b", "a+1", NULL);
+    MC4_formulas_bind(formulas, &vars, "c", "b+1", NULL);
+    MLOG.test("self reference is rejected",
+              MC4_formulas_bind(formulas, &vars, "x", "x+1", NULL) ==
+                  MC4_ERR_CYCLE);
+    MLOG.test("indirect cycle is rejected",
+              MC4_formulas_bind(formulas, &vars, "a", "c*2", NULL) ==
+                  MC4_ERR_CYCLE);
+    MC4_formulas_assign(formulas, &vars, "a", 2);
+    MLOG.test("rejected formula isn't bound", var_value(&vars, "c") == 4);
+    MC4_formulas_free(formulas);
+    free_varset(&vars);
+}
+
+static void test_formulas_undefined(void) {
+    struct MC4_Formulas* formulas = MC4_formulas_new();
+    struct MC4_VariableSet vars = new_varset();
+    MC4_ErrorCode err = MC4_formulas_bind(formulas, &vars, "b", "a*2", NULL);
+    MLOG.test("formula of an undefined variable is rejected",
+              (err == MC4_ERR_VAR_NOT_FOUND) && !var_exists(&vars, "b"));
+    MC4_formulas_assign(formulas, &vars, "b", 5);
+    err = MC4_formulas_bind(formulas, &vars, "b", "a*2", NULL);
+    MLOG.test("rejected formula keeps the old value",
+              (err == MC4_ERR_VAR_NOT_FOUND) && (var_value(&vars, "b") == 5));
+    MC4_formulas_assign(formulas, &vars, "a", 3);
+    MLOG.test("rejected formula doesn't follow its variables",
+              var_value(&vars, "b") == 5);
+    MC4_formulas_free(formulas);
+    free_varset(&vars);
+}
+
+static void test_formulas_recompute_all(void) {
+    struct MC4_Formulas* formulas = MC4_formulas_new();
+    struct MC4_VariableSet vars = new_varset();
+    struct MC4_Settings settings = settings_default();
+    settings.angle_mode = ANGLE_MODE_DEG;
+    MC4_formulas_assign(formulas, &vars, "a", 90);
+    MC4_formulas_bind(formulas, &vars, "s", "sin(a)", &settings);
+    MC4_formulas_bind(formulas, &vars, "t", "s*2", &settings);
+    settings.angle_mode = ANGLE_MODE_RAD;
+    MC4_formulas_recompute_all(formulas, &vars, &settings);
+    MLOG.test("angle mode change", var_value(&vars, "t") == (sin(90) * 2));
+    MC4_formulas_free(formulas);
+    free_varset(&vars);
+}
+
+void test_formulas(void) {
+    MLOG.log("Formula Variables Test Suite");
+    test_formulas_chain();
+    test_formulas_diamond();
+    test_formulas_cycles();
+    test_formulas_undefined();
+    test_formulas_recompute_all();
+}
+
+static void test_variables_many(void) {
+    struct MC4_VariableSet vars = new_varset();
+    char name[16];
+    const int num_names = 200000;
+    for (int i = 0; i < num_names; i++) {
+        snprintf(name, sizeof(name), "v%d", i);
+        set_var(&vars, name, i);
+    }
+    bool all_found = (vars.num_slots == (unsigned int)num_names);
+    for (int i = 0; (i < num_names) && all_found; i++) {
+        snprintf(name, sizeof(name), "v%d", i);
+        double value;
+        all_found = get_var(&vars, name, &value) && (value == i);
+    }
+    MLOG.test("200000 names", all_found);
+    double value;
+    MLOG.test("undefined name", !get_var(&vars, "v200000", &value));
+    set_var(&vars, "v7", -1);
+    MLOG.test("reassign", get_var(&vars, "v7", &value) && (value == -1) &&
+                              (vars.num_slots == (unsigned int)num_names));
+    free_varset(&vars);
+}
+
+static void test_variables_long_names(void) {
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "inlet_temp_2", 30);
+    set_var(&vars, "k_1", 2);
+    set_var(&vars, "_", 1);
+    MC4_ErrorCode err = MC4_ERR_NONE;
+    struct MC4_Compiled* expr =
+        MC4_compile("inlet_temp_2 * k_1 + inlet_temp_2 - _", &vars, NULL, &err);
+    MLOG.test("inlet_temp_2 * k_1 + inlet_temp_2 - _",
+              (expr != NULL) && (MC4_eval_compiled(expr, &vars, &err) == 89));
+    set_var(&vars, "inlet_temp_2", 10);
+    MLOG.test("after reassign",
+              (expr != NULL) && (MC4_eval_compiled(expr, &vars, &err) == 29));
+    MC4_free_compiled(expr);
+
+    struct MC4_Settings settings = settings_default();
+    struct MC4_Result result =
+        MC4_evaluate("k_1^inlet_temp_2", &vars, &settings);
+    MLOG.test("k_1^inlet_temp_2", (result.err_code == MC4_ERR_NONE) &&
+                                      (result.value == 1024));
+    result = MC4_evaluate("k_2 + 1", &vars, &settings);
+    MLOG.test("k_2 (undefined)", result.err_code == MC4_ERR_VAR_NOT_FOUND);
+    free_varset(&vars);
+}
+
+void test_variables(void) {
+    MLOG.log("Variables Test Suite");
+    test_variables_many();
+    test_variables_long_names();
+}
+
+void test_stats(void) {
+    MLOG.log("Stats Test Suite");
+    struct MC4_Settings settings = settings_default();
+    char buffer[MC4_FORMAT_BUFFER_SIZE];
+    MC4_stats_reset();
+    MC4_stats_enable(true);
+    struct MC4_Result result =
+        MC4_evaluate("sin(1) + sin(2) * sqrt(4)", NULL, &settings);
+    MC4_format(result.value, settings.output_mode, buffer);
+    MC4_evaluate("2 # 3", NULL, &settings);
+    struct MC4_Stats stats = MC4_stats_get();
+    MLOG.test("phases are counted", (stats.num_calls[STATS_TOKENIZE] == 2) &&
+                                        (stats.num_calls[STATS_PARSE] == 1) &&
+                                        (stats.num_calls[STATS_FORMAT] == 1));
+    MLOG.test("functions are counted",
+              (stats.num_func_calls[FN_SIN] == 2) &&
+                  (stats.num_func_calls[FN_SQRT] == 1) &&
+                  (stats.num_func_calls[FN_COS] == 0));
+
+    /* Batches count every row, and native code every evaluation. */
+    MC4_stats_reset();
+    static double xs[100], results[100];
+    for (int i = 0; i < 100; i++) xs[i] = i;
+    const struct MC4_Column column = {.name = "x", .values = xs};
+    MC4_evaluate_batch("sin(x) + cos(sin(x))", &column, 1, 100, NULL,
+                       &settings, results);
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "x", 2);
+    MC4_ErrorCode err;
+    struct MC4_Compiled* expr = MC4_compile("sqrt(x)", &vars, &settings, &err);
+    struct MC4_Jit* jit = MC4_jit_compile(expr);
+    for (int i = 0; i < 3; i++) MC4_jit_eval(jit, &vars, &err);
+    stats = MC4_stats_get();
+    /* The two `sin(x)` are the same node. */
+    MLOG.test("batch and JIT functions are counted",
+              (stats.num_func_calls[FN_SIN] == 100) &&
+                  (stats.num_func_calls[FN_COS] == 100) &&
+                  (stats.num_func_calls[FN_SQRT] == 3));
+    MC4_jit_free(jit);
+    MC4_free_compiled(expr);
+    free_varset(&vars);
+
+    MC4_stats_enable(false);
+    MC4_evaluate("cos(1)", NULL, &settings);
+    const struct MC4_Stats disabled = MC4_stats_get();
+    MLOG.test("nothing is counted while disabled",
+              (disabled.num_calls[STATS_TOKENIZE] ==
+               stats.num_calls[STATS_TOKENIZE]) &&
+                  (disabled.num_func_calls[FN_COS] == 100));
+    MC4_stats_reset();
+    stats = MC4_stats_get();
+    MLOG.test("reset", (stats.num_calls[STATS_TOKENIZE] == 0) &&
+                           (stats.ns[STATS_PARSE] == 0) &&
+                           (stats.num_func_calls[FN_SIN] == 0));
+}
+
+/* A way of evaluating compiled expressions which must agree exactly with
+`MC4_eval_compiled()`. */
+struct Backend {
+    void* (*compile)(const struct MC4_Compiled* expr);
+    double (*eval)(const void* code, const struct MC4_VariableSet* vars,
+                   MC4_ErrorCode* err);
+    void (*free)(void* code);
+    /* NULL if the backend has no registers. */
+    unsigned int (*num_regs)(const void* code);
+};
+
+static void* jit_compile(const struct MC4_Compiled* expr) {
+    return MC4_jit_compile(expr);
+}
+
+static double jit_eval(const void* code, const struct MC4_VariableSet* vars,
+                       MC4_ErrorCode* err) {
+    return MC4_jit_eval(code, vars, err);
+}
+
+static void jit_free(void* code) {
+    MC4_jit_free(code);
+}
+
+static void* bytecode_compile(const struct MC4_Compiled* expr) {
+    return MC4_bytecode_compile(expr);
+}
+
+static double bytecode_eval(const void* code,
+                            const struct MC4_VariableSet* vars,
+                            MC4_ErrorCode* err) {
+    return MC4_bytecode_eval(code, vars, err);
+}
+
+static void bytecode_free(void* code) {
+    MC4_bytecode_free(code);
+}
+
+static unsigned int bytecode_num_regs(const void* code) {
+    return MC4_bytecode_num_regs(code);
+}
+
+static const struct Backend JIT_BACKEND = {
+    .compile = jit_compile,
+    .eval = jit_eval,
+    .free = jit_free,
+    .num_regs = NULL,
+};
+
+static const struct Backend BYTECODE_BACKEND = {
+    .compile = bytecode_compile,
+    .eval = bytecode_eval,
+    .free = bytecode_free,
+    .num_regs = bytecode_num_regs,
+};
+
+/**
+ * Checks that `backend` gives exactly the interpreter's result for `equ` at a
+ * few values of `x` and `y`, and uses at most `max_regs` registers if it has
+ * any.
+ */
+static void run_backend_test(const struct Backend* backend, const char* name,
+                             const char* equ, enum AngleMode angle_mode,
+                             unsigned int max_regs) {
+    struct MC4_VariableSet vars = new_varset();
+    struct MC4_Settings settings = settings_default();
+    settings.angle_mode = angle_mode;
+    MC4_ErrorCode err;
+    struct MC4_Compiled* expr = MC4_compile(equ, &vars, &settings, &err);
+    void* code = backend->compile(expr);
+    bool passed = (backend->num_regs == NULL) ||
+                  (backend->num_regs(code) <= max_regs);
+    for (int i = 0; (i < 8) && passed; i++) {
+        set_var(&vars, "x", (i * 0.37) - 1);
+        set_var(&vars, "y", (i * 1.5) + 0.25);
+        MC4_ErrorCode backend_err;
+        const double expected = MC4_eval_compiled(expr, &vars, &err);
+        const double value = backend->eval(code, &vars, &backend_err);
+        passed = (backend_err == err) &&
+                 (memcmp(&value, &expected, sizeof(double)) == 0);
+    }
+    MLOG.test(name, passed);
+    backend->free(code);
+    MC4_free_compiled(expr);
+    free_varset(&vars);
+}
+
+/**
+ * Runs every backend test of the corpus, including variables which are
+ * defined only after compiling.
+ */
+static void run_backend_tests(const struct Backend* backend) {
+    const struct {
+        const char* name;
+        const char* equ;
+        enum AngleMode angle_mode;
+        /* Registers the bytecode needs at most. */
+        unsigned int max_regs;
+    } corpus[] = {
+        {"constant", "2 * 3 + 1", ANGLE_MODE_RAD, 1},
+        {"variable", "x", ANGLE_MODE_RAD, 1},
+        {"operators", "x + y - x*y / 3", ANGLE_MODE_RAD, 4},
+        {"powers", "x^2 + y^x - 2^0.5", ANGLE_MODE_RAD, 5},
+        {"functions", "sin(x) + cos(y)*tan(x) - arctan(y)", ANGLE_MODE_RAD, 4},
+        {"degrees", "sin(x*90) + cos(y) + tan(45) + arcsin(x)", ANGLE_MODE_DEG,
+         5},
+        {"logarithms", "arccos(x) + ln(y) - log(y) + sqrt(y)", ANGLE_MODE_RAD,
+         4},
+        {"shared subexpressions", "sqrt(x^2+y^2) * sqrt(x^2+y^2) - (x^2+y^2)",
+         ANGLE_MODE_RAD, 5},
+        {"nested", "(((x + 1) * (y - 2)) / ((x - 3) * (y + 4))) ^ (x/y)",
+         ANGLE_MODE_RAD, 10},
+        {"division by zero", "x / 0 + y", ANGLE_MODE_RAD, 4},
+    };
+    for (size_t i = 0; i < ARR_SIZE(corpus); i++) {
+        run_backend_test(backend, corpus[i].name, corpus[i].equ,
+                         corpus[i].angle_mode, corpus[i].max_regs);
+    }
+
+    /* Registers are reused along a long chain, and constants get their own. */
+    char equ[2048] = "x";
+    for (int i = 1; i <= 100; i++) {
+        sprintf(&equ[strlen(equ)], " + x*%d", i);
+    }
+    run_backend_test(backend, "long chain", equ, ANGLE_MODE_RAD, 100 + 4);
+
+    /* More registers than fit on the stack. */
+    strcpy(equ, "1");
+    for (int i = 2; i <= 100; i++) {
+        sprintf(&equ[strlen(equ)], " + (y + %d) * x", i);
+    }
+    run_backend_test(backend, "many registers", equ, ANGLE_MODE_RAD, 100 + 5);
+
+    struct MC4_VariableSet vars = new_varset();
+    MC4_ErrorCode err;
+    struct MC4_Compiled* expr = MC4_compile("x + z", &vars, NULL, &err);
+    void* code = backend->compile(expr);
+    set_var(&vars, "x", 1);
+    backend->eval(code, &vars, &err);
+    MLOG.test("x + z (undefined)", err == MC4_ERR_VAR_NOT_FOUND);
+    set_var(&vars, "z", 2);
+    MLOG.test("x + z (defined later)",
+              (backend->eval(code, &vars, &err) == 3) && (err == MC4_ERR_NONE));
+    backend->free(code);
+    MC4_free_compiled(expr);
+    free_varset(&vars);
+}
+
+void test_jit(void) {
+    MLOG.log("JIT Test Suite");
+#if defined(__x86_64__) && defined(__linux__)
+    MC4_ErrorCode two_err;
+    struct MC4_Compiled* two = MC4_compile("2", NULL, NULL, &two_err);
+    struct MC4_Jit* native = MC4_jit_compile(two);
+    MLOG.test("native code on x86-64",
+              MC4_jit_is_native(native) &&
+                  (MC4_jit_eval(native, NULL, &two_err) == 2));
+    MC4_jit_free(native);
+    MC4_free_compiled(two);
+#endif
+    run_backend_tests(&JIT_BACKEND);
+}
+
+void test_bytecode(void) {
+    MLOG.log("Bytecode Test Suite");
+    run_backend_tests(&BYTECODE_BACKEND);
+}
+
+static void run_range_len_test(const char* name, double from, double to,
+                               double step, size_t expected) {
+    const struct MC4_Range range = {"x", from, to, step};
+    MLOG.test(name, MC4_range_len(&range) == expected);
+}
+
+/**
+ * Reads the whole of `file` into a new string.
+ */
+static char* read_table(FILE* file, size_t* len) {
+    *len = ftell(file);
+    rewind(file);
+    char* text = malloc((*len) + 1);
+    text[fread(text, 1, *len, file)] = '\0';
+    return text;
+}
+
+void test_table(void) {
+    MLOG.log("Table Test Suite");
+    run_range_len_test("range 0 to 1 step 0.25", 0, 1, 0.25, 5);
+    run_range_len_test("range 0 to 1 step 0.1", 0, 1, 0.1, 11);
+    run_range_len_test("range 0 to 0.3 step 0.1", 0, 0.3, 0.1, 4);
+    run_range_len_test("range 0 to 0.99 step 0.5", 0, 0.99, 0.5, 2);
+    run_range_len_test("range 1 to 0 step -0.5", 1, 0, -0.5, 3);
+    run_range_len_test("range 2 to 2 step 1", 2, 2, 1, 1);
+    run_range_len_test("range 1 to 0 step 1", 1, 0, 1, 0);
+    run_range_len_test("range 0 to 1 step 0", 0, 1, 0, 0);
+    run_range_len_test("range 0 to inf step 1", 0, INFINITY, 1, 0);
+    run_range_len_test("range 0 to 1 step nan", 0, 1, NAN, 0);
+
+    struct MC4_VariableSet vars = new_varset();
+    struct MC4_Settings settings = settings_default();
+    set_var(&vars, "a", 1);
+    set_var(&vars, "x", 7);
+    /* More rows than fit in a block, on several threads. */
+    const struct MC4_Range range = {"x", 0, 5000, 0.5};
+    FILE* file = tmpfile();
+    MC4_ErrorCode err =
+        MC4_tabulate("2*x + a", &range, &vars, &settings, file, 4);
+    size_t len;
+    char* text = read_table(file, &len);
+    bool in_order = (err == MC4_ERR_NONE);
+    const char* line = text;
+    size_t num_lines = 0;
+    for (; in_order && (*line != '\0'); num_lines++) {
+        char expected[64];
+        const double x = num_lines * 0.5;
+        sprintf(expected, "%.15g,%.15g\n", x, (2 * x) + 1);
+        in_order = (strncmp(line, expected, strlen(expected)) == 0);
+        line += strlen(expected);
+    }
+    MLOG.test("2*x + a for x from 0 to 5000 step 0.5",
+              in_order && (num_lines == 10001));
+    double x;
+    MLOG.test("x keeps its value", get_var(&vars, "x", &x) && (x == 7));
+    free(text);
+    fclose(file);
+
+    file = tmpfile();
+    err = MC4_tabulate("x + b", &range, &vars, &settings, file, 0);
+    MLOG.test("x + b (undefined)",
+              (err == MC4_ERR_VAR_NOT_FOUND) && (ftell(file) == 0));
+    fclose(file);
+
+    file = tmpfile();
+    settings.output_mode = OUTPUT_MODE_SCIENTIFIC;
+    settings.angle_mode = ANGLE_MODE_DEG;
+    const struct MC4_Range degrees = {"t", 0, 90, 30};
+    err = MC4_tabulate("sin(t)", &degrees, NULL, &settings, file, 0);
+    text = read_table(file, &len);
+    MLOG.test("sin(t) for t from 0 to 90 step 30",
+              (err == MC4_ERR_NONE) &&
+                  (strcmp(text, "0e0,0e0\n3e1,4.9999999999999994e-1\n"
+                                "6e1,8.660254037844386e-1\n9e1,1e0\n") == 0));
+    free(text);
+    fclose(file);
+    free_varset(&vars);
+}
+
+/* Most numbers a `Command` writes. */
+#define COMMAND_MAX_OUT 512
+
+/**
+ * A command which runs an equation of x, such as `MC4_integrate()`, for the
+ * checks every command must pass the same way.
+ */
+struct Command {
+    /* Runs `equ` on `num_threads` threads, writing the numbers it found to
+    `out`, at most `COMMAND_MAX_OUT`, and how many to `num_out`. */
+    MC4_ErrorCode (*run)(const char* equ, struct MC4_VariableSet* vars,
+                         unsigned int num_threads, double* out,
+                         size_t* num_out);
+    /* An equation of x and a whose results may depend on how the work is
+    split between threads, or NULL if the command is single threaded. */
+    const char* threaded_equ;
+};
+
+/**
+ * Checks that `command` gives the same results on 1 and 4 threads, keeps the
+ * value of x, and reports undefined variables and invalid equations.
+ */
+static void run_command_tests(const struct Command* command) {
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "a", 3);
+    set_var(&vars, "x", 100);
+    double one[COMMAND_MAX_OUT], four[COMMAND_MAX_OUT];
+    size_t num_one, num_four;
+    MC4_ErrorCode err;
+    if (command->threaded_equ != NULL) {
+        err = command->run(command->threaded_equ, &vars, 1, one, &num_one);
+        if (err == MC4_ERR_NONE) {
+            err = command->run(command->threaded_equ, &vars, 4, four,
+                               &num_four);
+        }
+        MLOG.test("same result on 1 and 4 threads",
+                  (err == MC4_ERR_NONE) && (num_one > 0) &&
+                      (num_one == num_four) &&
+                      (memcmp(one, four, num_one * sizeof(double)) == 0));
+    } else {
+        err = command->run("a*x", &vars, 1, one, &num_one);
+        MLOG.test("a*x", (err == MC4_ERR_NONE) && (num_one > 0));
+    }
+    double x;
+    MLOG.test("x keeps its value", get_var(&vars, "x", &x) && (x == 100));
+    err = command->run("x + b", &vars, 0, one, &num_one);
+    MLOG.test("x + b (undefined)", err == MC4_ERR_VAR_NOT_FOUND);
+    err = command->run("x +", &vars, 0, one, &num_one);
+    MLOG.test("x + (invalid)", err == MC4_ERR_UNEXPECTED_TOKEN);
+    free_varset(&vars);
+}
+
+/* Writes the integral from 0 to 1000, its error and the evaluations. */
+static MC4_ErrorCode run_integrate(const char* equ,
+                                   struct MC4_VariableSet* vars,
+                                   unsigned int num_threads, double* out,
+                                   size_t* num_out) {
+    struct MC4_Settings settings = settings_default();
+    struct MC4_Integral integral;
+    const MC4_ErrorCode err = MC4_integrate(equ, "x", 0, 1000, 1e-10, 0, vars,
+                                            &settings, num_threads, &integral);
+    out[0] = integral.value;
+    out[1] = integral.error;
+    out[2] = integral.num_evals;
+    *num_out = 3;
+    return err;
+}
+
+static const struct Command INTEGRATE_COMMAND = {
+    .run = run_integrate,
+    .threaded_equ = "a*sin(x)^2",
+};
+
+static void run_integrate_test(const char* equ, double from, double to,
+                               double expected, struct MC4_VariableSet* vars) {
+    struct MC4_Settings settings = settings_default();
+    struct MC4_Integral integral;
+    const MC4_ErrorCode err = MC4_integrate(
+        equ, "x", from, to, MC4_INTEGRATE_DEFAULT_ABS_TOL,
+        MC4_INTEGRATE_DEFAULT_REL_TOL, vars, &settings, 0, &integral);
+    const double tol = fmax(MC4_INTEGRATE_DEFAULT_ABS_TOL,
+                            MC4_INTEGRATE_DEFAULT_REL_TOL * fabs(expected));
+    char name[128];
+    sprintf(name, "integral of %s from %g to %g", equ, from, to);
+    /* The estimated error is within the tolerance, and is really as large as
+    the error. */
+    MLOG.test(name, (err == MC4_ERR_NONE) && integral.converged &&
+                        (fabs(integral.value - expected) <= integral.error) &&
+                        (integral.error <= tol) && (integral.num_evals > 0));
+}
+
+void test_integrate(void) {
+    MLOG.log("Integrate Test Suite");
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "a", 3);
+    set_var(&vars, "x", 100);
+    run_integrate_test("x^2", 0, 1, 1.0 / 3, &vars);
+    run_integrate_test("sin(x)", 0, M_PI, 2, &vars);
+    run_integrate_test("a*x", 1, 0, -1.5, &vars);
+    run_integrate_test("1/x", 1, M_E, 1, &vars);
+    /* Not smooth at 0, so the range is split. */
+    run_integrate_test("sqrt(x)", 0, 1, 2.0 / 3, &vars);
+    run_integrate_test("sin(x)^2", 0, 1000, 500 - (sin(2000) / 4), &vars);
+    run_integrate_test("1", 0, 2, 2, NULL);
+    /* Large integrals are within a relative tolerance, and their error is at
+    least the rounding error of summing them. */
+    run_integrate_test("e^x", 0, 50, expm1(50), &vars);
+    run_integrate_test("x^10", 0, 100, 1e22 / 11, &vars);
+    run_integrate_test("1000000*sin(x)", 0, 10, 1e6 * (1 - cos(10)), &vars);
+    run_command_tests(&INTEGRATE_COMMAND);
+
+    struct MC4_Settings settings = settings_default();
+    /* 1e-10 is below the rounding error of the integral, which halving
+    can't reduce, so intervals aren't halved for it. */
+    struct MC4_Integral integral;
+    MC4_integrate("1000000*sin(x)", "x", 0, 10, 1e-10, 0, &vars, &settings, 0,
+                  &integral);
+    MLOG.test("1000000*sin(x) to an absolute 1e-10 (rounding error)",
+              !integral.converged && (integral.num_evals < 2000) &&
+                  (fabs(integral.value - (1e6 * (1 - cos(10)))) <=
+                   integral.error));
+    MC4_ErrorCode err = MC4_integrate("1/x", "x", 0, 1, 1e-10, 1e-10, &vars,
+                                      &settings, 0, &integral);
+    MLOG.test("1/x from 0 to 1 (diverges)",
+              (err == MC4_ERR_NONE) && !integral.converged);
+    err = MC4_integrate("x", "x", 2, 2, 1e-10, 1e-10, &vars, &settings, 0,
+                        &integral);
+    MLOG.test("empty range", (err == MC4_ERR_NONE) && (integral.value == 0) &&
+                                 (integral.num_evals == 0));
+    free_varset(&vars);
+}
+
+static bool roots_near(const struct MC4_Solution* solution,
+                       const double* expected, size_t num_expected) {
+    if (solution->num_roots != num_expected) return false;
+    for (size_t i = 0; i < num_expected; i++) {
+        if (fabs(solution->roots[i] - expected[i]) >
+            (4 * DBL_EPSILON * fmax(fabs(expected[i]), 1))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void run_solve_test(const char* equ, double guess, double expected,
+                           struct MC4_VariableSet* vars) {
+    struct MC4_Settings settings = settings_default();
+    struct MC4_Solution solution;
+    const MC4_ErrorCode err =
+        MC4_solve(equ, "x", guess, vars, &settings, &solution);
+    char name[128];
+    sprintf(name, "solve %s = 0 from %g", equ, guess);
+    MLOG.test(name, (err == MC4_ERR_NONE) &&
+                        roots_near(&solution, &expected, 1) &&
+                        (solution.num_evals > 0));
+    MC4_free_solution(&solution);
+}
+
+static void run_solve_range_test(const char* equ, double from, double to,
+                                 const double* expected, size_t num_expected,
+                                 struct MC4_VariableSet* vars) {
+    struct MC4_Settings settings = settings_default();
+    struct MC4_Solution solution;
+    const MC4_ErrorCode err = MC4_solve_range(equ, "x", from, to, 0, vars,
+                                              &settings, 0, &solution);
+    char name[128];
+    sprintf(name, "solve %s = 0 in %.15g..%.15g", equ, from, to);
+    MLOG.test(name, (err == MC4_ERR_NONE) && solution.complete &&
+                        roots_near(&solution, expected, num_expected));
+    MC4_free_solution(&solution);
+}
+
+/* Writes every root in 0..30, at most `COMMAND_MAX_OUT`. */
+static MC4_ErrorCode run_solve(const char* equ, struct MC4_VariableSet* vars,
+                               unsigned int num_threads, double* out,
+                               size_t* num_out) {
+    struct MC4_Settings settings = settings_default();
+    struct MC4_Solution solution;
+    const MC4_ErrorCode err = MC4_solve_range(equ, "x", 0, 30, 0, vars,
+                                              &settings, num_threads,
+                                              &solution);
+    if (err != MC4_ERR_NONE) return err;
+    *num_out = (solution.num_roots < COMMAND_MAX_OUT) ? solution.num_roots
+                                                      : COMMAND_MAX_OUT;
+    if (*num_out > 0) memcpy(out, solution.roots, *num_out * sizeof(double));
+    MC4_free_solution(&solution);
+    return err;
+}
+
+static const struct Command SOLVE_COMMAND = {
+    .run = run_solve,
+    .threaded_equ = "sin(x*x)",
+};
+
+void test_solve(void) {
+    MLOG.log("Solve Test Suite");
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "a", 3);
+    set_var(&vars, "x", 100);
+    run_solve_test("x^2-2", 0, sqrt(2), &vars);
+    run_solve_test("x^3-a", 0, cbrt(3), &vars);
+    run_solve_test("cos(x)-x", 0, 0.7390851332151607, &vars);
+    run_solve_test("ln(x)-1", 0, M_E, &vars);
+    run_solve_test("x-100000", 0, 100000, &vars);
+    run_solve_test("x*x", 0, 0, NULL);
+
+    const double sqrt_2[2] = {-sqrt(2), sqrt(2)};
+    run_solve_range_test("x^2-2", -5, 5, sqrt_2, 2, &vars);
+    run_solve_range_test("x^2-2", 5, -5, sqrt_2, 2, &vars);
+    /* 0 is the start of an interval. */
+    const double sin_roots[4] = {0, M_PI, 2 * M_PI, 3 * M_PI};
+    run_solve_range_test("sin(x)", 0, 10, sin_roots, 4, &vars);
+    /* Sign changes across poles aren't roots. */
+    run_solve_range_test("1/x", -1, 1, NULL, 0, &vars);
+    const double tan_roots[1] = {M_PI};
+    run_solve_range_test("tan(x)", 1, 5, tan_roots, 1, &vars);
+    run_solve_range_test("x^2+1", -10, 10, NULL, 0, &vars);
+
+    /* Roots at which the equation touches 0 without changing sign. */
+    run_solve_test("(x-1)^2", 0, 1, NULL);
+    run_solve_test("(x-2)^4", 0, 2, NULL);
+    const double double_roots[3] = {0, M_PI, 2 * M_PI};
+    run_solve_range_test("sin(x)^2", -1, 7, double_roots, 3, &vars);
+    const double one_root[1] = {1};
+    run_solve_range_test("(x-1)^2", -3.3, 4.1, one_root, 1, &vars);
+    run_solve_range_test("(x-1)^2+1e-6", -3.3, 4.1, NULL, 0, &vars);
+    /* A pair of roots closer together than an interval. */
+    const double close_roots[2] = {1 - 1e-6, 1 + 1e-6};
+    run_solve_range_test("(x-1)^2-1e-12", -3.3, 4.1, close_roots, 2, &vars);
+
+    /* A range of one point has that point as its only root, and a range
+    narrower than the intervals still finds each root once. */
+    const double zero[1] = {0};
+    run_solve_range_test("x", 0, 0, zero, 1, &vars);
+    run_solve_range_test("x-1", 1, 1, one_root, 1, &vars);
+    run_solve_range_test("x-2", 1, 1, NULL, 0, &vars);
+    run_solve_range_test("x-1", 1, 1 + 1e-13, one_root, 1, &vars);
+
+    run_command_tests(&SOLVE_COMMAND);
+
+    struct MC4_Settings settings = settings_default();
+    /* sin(x) has about 318000 roots in 0..1e6, far more than the default
+    intervals can tell apart. */
+    struct MC4_Solution solution;
+    MC4_solve_range("sin(x)", "x", 0, 1e6, 0, &vars, &settings, 0, &solution);
+    MLOG.test("too few intervals for sin(x) in 0..1e6",
+              !solution.complete && (solution.num_roots < 318309));
+    MC4_free_solution(&solution);
+    MC4_solve_range("sin(x)", "x", 0, 1e6, 1000000, &vars, &settings, 0,
+                    &solution);
+    MLOG.test("enough intervals for sin(x) in 0..1e6",
+              solution.complete && (solution.num_roots == 318310) &&
+                  (fabs(solution.roots[318309] - (318309 * M_PI)) < 1e-9));
+    MC4_free_solution(&solution);
+
+    MC4_ErrorCode err = MC4_solve("x^2+1", "x", 0, &vars, &settings,
+                                  &solution);
+    MLOG.test("x^2+1 (no roots)",
+              (err == MC4_ERR_NONE) && (solution.num_roots == 0));
+    MC4_free_solution(&solution);
+    err = MC4_solve("x + b", "x", 0, &vars, &settings, &solution);
+    MLOG.test("x + b from a guess (undefined)", err == MC4_ERR_VAR_NOT_FOUND);
+    free_varset(&vars);
+}
+
+/* True if `a` and `b` are both NaN, or within 4 epsilon of each other, which
+includes being the same infinity. */
+static bool diff_near(double a, double b) {
+    if (isnan(a) || isnan(b)) return isnan(a) && isnan(b);
+    return (a == b) || (fabs(a - b) <= (4 * DBL_EPSILON * fmax(fabs(b), 1)));
+}
+
+/**
+ * Checks the derivative of `equ` with respect to x at `at` in `angle_mode`,
+ * and that the value is the same as evaluating `equ`.
+ */
+static void run_diff_test(const char* equ, double at,
+                          enum AngleMode angle_mode, double expected) {
+    struct MC4_Settings settings = settings_default();
+    settings.angle_mode = angle_mode;
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "x", at);
+    const char* wrt[1] = {"x"};
+    double value, gradient[1];
+    const MC4_ErrorCode err =
+        MC4_gradient(equ, wrt, NULL, 1, &vars, &settings, &value, gradient);
+    MC4_Result result = MC4_evaluate(equ, &vars, &settings);
+    char name[128];
+    sprintf(name, "d/dx %s at %g", equ, at);
+    MLOG.test(name, (err == MC4_ERR_NONE) &&
+                        diff_near(value, result.value) &&
+                        diff_near(gradient[0], expected));
+    free_varset(&vars);
+}
+
+/* Writes the value and derivative at x = 2. */
+static MC4_ErrorCode run_diff(const char* equ, struct MC4_VariableSet* vars,
+                              unsigned int num_threads, double* out,
+                              size_t* num_out) {
+    (void)num_threads;
+    struct MC4_Settings settings = settings_default();
+    const char* wrt[1] = {"x"};
+    const double at[1] = {2};
+    *num_out = 2;
+    return MC4_gradient(equ, wrt, at, 1, vars, &settings, &out[0], &out[1]);
+}
+
+static const struct Command DIFF_COMMAND = {
+    .run = run_diff,
+    .threaded_equ = NULL,
+};
+
+void test_diff(void) {
+    MLOG.log("Diff Test Suite");
+    run_diff_test("x^2", 3, ANGLE_MODE_RAD, 6);
+    run_diff_test("x*x*x", 2, ANGLE_MODE_RAD, 12);
+    run_diff_test("1/x", 2, ANGLE_MODE_RAD, -0.25);
+    run_diff_test("x^x", 2, ANGLE_MODE_RAD, 4 * (1 + log(2)));
+    run_diff_test("2^x", 3, ANGLE_MODE_RAD, 8 * log(2));
+    /* The derivative of a constant exponent doesn't take log() of a
+    negative base. */
+    run_diff_test("(x-3)^2", 1, ANGLE_MODE_RAD, -4);
+    run_diff_test("sin(x)", 1, ANGLE_MODE_RAD, cos(1));
+    run_diff_test("cos(x)", 1, ANGLE_MODE_RAD, -sin(1));
+    run_diff_test("tan(x)", 1, ANGLE_MODE_RAD, 1 / (cos(1) * cos(1)));
+    run_diff_test("sin(x)", 60, ANGLE_MODE_DEG, 0.5 * (M_PI / 180));
+    run_diff_test("tan(x)", 45, ANGLE_MODE_DEG, 2 * (M_PI / 180));
+    run_diff_test("arcsin(x)", 0.5, ANGLE_MODE_DEG, 1 / sqrt(0.75));
+    run_diff_test("arccos(x)", 0.5, ANGLE_MODE_RAD, -1 / sqrt(0.75));
+    run_diff_test("arctan(x)", 2, ANGLE_MODE_RAD, 0.2);
+    run_diff_test("log(x)", 2, ANGLE_MODE_RAD, 1 / (2 * log(10)));
+    run_diff_test("ln(x)", 2, ANGLE_MODE_RAD, 0.5);
+    run_diff_test("sqrt(x)", 4, ANGLE_MODE_RAD, 0.25);
+    run_diff_test("sin(x^2)*ln(x)", 2, ANGLE_MODE_RAD,
+                  (4 * cos(4) * log(2)) + (sin(4) / 2));
+    run_diff_test("7", 2, ANGLE_MODE_RAD, 0);
+    /* Where the derivative doesn't exist, it is infinite if the slope is,
+    and NaN at a corner or outside the domain, never a finite number. */
+    run_diff_test("sqrt(x)", 0, ANGLE_MODE_RAD, INFINITY);
+    run_diff_test("x^0.5", 0, ANGLE_MODE_RAD, INFINITY);
+    run_diff_test("arcsin(x)", 1, ANGLE_MODE_RAD, INFINITY);
+    run_diff_test("ln(x)", 0, ANGLE_MODE_RAD, INFINITY);
+    run_diff_test("1/x", 0, ANGLE_MODE_RAD, -INFINITY);
+    run_diff_test("sqrt(x^2)", 0, ANGLE_MODE_RAD, NAN);
+    run_diff_test("sqrt(x)", -1, ANGLE_MODE_RAD, NAN);
+
+    struct MC4_Settings settings = settings_default();
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "x", 100);
+    set_var(&vars, "a", 3);
+    const char* wrt[3] = {"x", "y", "z"};
+    const double at[3] = {2, 5, 1};
+    double value, gradient[3];
+    MC4_ErrorCode err = MC4_gradient("a*x^2*y", wrt, at, 3, &vars, &settings,
+                                     &value, gradient);
+    MLOG.test("gradient of a*x^2*y",
+              (err == MC4_ERR_NONE) && (value == 60) && (gradient[0] == 60) &&
+                  (gradient[1] == 12) && (gradient[2] == 0));
+    err = MC4_gradient("x*y", wrt, at, 2, NULL, &settings, &value, gradient);
+    MLOG.test("gradient without a variable set",
+              (err == MC4_ERR_NONE) && (gradient[0] == 5) &&
+                  (gradient[1] == 2));
+
+    /* More nodes than fit on the stack. */
+    char equ[1024] = "x";
+    for (int i = 0; i < 100; i++) strcat(equ, "+x*y");
+    err = MC4_gradient(equ, wrt, at, 3, &vars, &settings, &value, gradient);
+    MLOG.test("gradient of a long expression",
+              (err == MC4_ERR_NONE) && (gradient[0] == 501) &&
+                  (gradient[1] == 200));
+
+    err = MC4_gradient("y", wrt, NULL, 2, &vars, &settings, &value, gradient);
+    MLOG.test("y without a point (undefined)", err == MC4_ERR_VAR_NOT_FOUND);
+    free_varset(&vars);
+    run_command_tests(&DIFF_COMMAND);
+}
+
+/**
+ * Checks that `equ` evaluated with `digits` digits in `angle_mode` and
+ * `output_mode` prints as `expected`.
+ */
+static void run_precise_test(const char* equ, unsigned int digits,
+                             enum AngleMode angle_mode,
+                             enum OutputMode output_mode,
+                             const char* expected) {
+    struct MC4_Settings settings = settings_default();
+    settings.angle_mode = angle_mode;
+    settings.output_mode = output_mode;
+    settings.precision = digits;
+    char* text;
+    const MC4_Result result =
+        MC4_evaluate_precise(equ, NULL, &settings, &text);
+    char name[128];
+    sprintf(name, "%s with %u digits", equ, digits);
+    MLOG.test(name, (result.err_code == MC4_ERR_NONE) &&
+                        (strcmp(text, expected) == 0));
+    free(text);
+}
+
+/**
+ * Checks that `equ` has the same error at the same position with
+ * `MC4_evaluate_precise()` as with `MC4_evaluate()`, or if it is valid, the
+ * same value to within the rounding of the doubles.
+ */
+static void run_precise_corpus_test(const char* equ,
+                                    const struct MC4_VariableSet* vars) {
+    struct MC4_Settings settings = settings_default();
+    settings.precision = 30;
+    char* text;
+    const MC4_Result result = MC4_evaluate_precise(equ, vars, &settings, &text);
+    const MC4_Result expected = MC4_evaluate(equ, vars, &settings);
+    char name[128];
+    sprintf(name, "%s (%s)", equ,
+            (expected.err_code == MC4_ERR_NONE) ? "valid" : "invalid");
+    MLOG.test(name, (result.err_code == expected.err_code) &&
+                        (result.err_pos == expected.err_pos) &&
+                        ((expected.err_code == MC4_ERR_NONE)
+                             ? (fabs(result.value - expected.value) <=
+                                (4 * DBL_EPSILON *
+                                 fmax(fabs(expected.value), 1)))
+                             : (text == NULL)));
+    free(text);
+}
+
+void test_precise(void) {
+    MLOG.log("Arbitrary Precision Test Suite");
+    const enum AngleMode RAD = ANGLE_MODE_RAD;
+    const enum OutputMode NORMAL = OUTPUT_MODE_NORMAL;
+    /* Digits from Python's `decimal`, and Machin's formula in integers. */
+    run_precise_test("pi", 100, RAD, NORMAL,
+                     "3.14159265358979323846264338327950288419716939937510"
+                     "5820974944592307816406286208998628034825342117068");
+    run_precise_test("e", 100, RAD, NORMAL,
+                     "2.71828182845904523536028747135266249775724709369995"
+                     "9574966967627724076630353547594571382178525166427");
+    run_precise_test("sqrt(2)", 100, RAD, NORMAL,
+                     "1.41421356237309504880168872420969807856967187537694"
+                     "8073176679737990732478462107038850387534327641573");
+    run_precise_test("ln(2)", 100, RAD, NORMAL,
+                     "0.69314718055994530941723212145817656807550013436025"
+                     "52541206800094933936219696947156058633269964186875");
+    run_precise_test("1/3", 40, RAD, NORMAL,
+                     "0.3333333333333333333333333333333333333333");
+    run_precise_test("0.1*3", 30, RAD, NORMAL, "0.3");
+    run_precise_test("10^30+1", 40, RAD, NORMAL,
+                     "1000000000000000000000000000001");
+    run_precise_test("2^0.5-sqrt(2)", 50, RAD, NORMAL, "0");
+    run_precise_test("0-2/3", 5, RAD, NORMAL, "-0.66667");
+    run_precise_test("sin(30)", 60, ANGLE_MODE_DEG, NORMAL, "0.5");
+    run_precise_test("sin(180)", 60, ANGLE_MODE_DEG, NORMAL, "0");
+    run_precise_test("arctan(1)*4-pi", 60, RAD, NORMAL, "0");
+    run_precise_test("12345", 10, RAD, OUTPUT_MODE_SCIENTIFIC, "1.2345e4");
+    run_precise_test("1/1024", 10, RAD, OUTPUT_MODE_ENGINEERING,
+                     "976.5625e-6");
+    run_precise_test("1/0", 20, RAD, NORMAL, "inf");
+    run_precise_test("0/0", 20, RAD, NORMAL, "nan");
+    run_precise_test("ln(0)", 20, RAD, NORMAL, "-inf");
+    /* Long enough for Karatsuba multiplication. */
+    run_precise_test("sqrt(2)*sqrt(2)", 1000, RAD, NORMAL, "2");
+    run_precise_test("e^ln(7)", 1000, RAD, NORMAL, "7");
+    run_precise_test("(1/7)*7", 1000, RAD, NORMAL, "1");
+    run_precise_test("sin(pi/6)*2", 1000, RAD, NORMAL, "1");
+    run_precise_test("log(10^300)", 1000, RAD, NORMAL, "300");
+
+    struct MC4_Settings settings = settings_default();
+    settings.precision = 30;
+    struct MC4_VariableSet vars = new_varset();
+    set_var(&vars, "x", 0.5);
+    char* text;
+    MC4_Result result = MC4_evaluate_precise("x*3", &vars, &settings, &text);
+    MLOG.test("x*3 reads x", (result.err_code == MC4_ERR_NONE) &&
+                                 (strcmp(text, "1.5") == 0) &&
+                                 (result.value == 1.5));
+    free(text);
+    result = MC4_evaluate_precise("1/3", &vars, &settings, &text);
+    MLOG.test("1/3 as a double", result.value == (1.0 / 3));
+    free(text);
+    const char* invalid[] = {"1 +", "y*2", "(1", "2 $ 3", "1..2"};
+    for (size_t i = 0; i < ARR_SIZE(invalid); i++) {
+        run_precise_corpus_test(invalid[i], &vars);
+    }
+    free_varset(&vars);
+
+    /* Every expression of the parsing tests. */
+    vars = new_parse_vars();
+    for (size_t i = 0; i < ARR_SIZE(PARSE_TESTS); i++) {
+        run_precise_corpus_test(PARSE_TESTS[i].equ,
+                                PARSE_TESTS[i].with_vars ? &vars : NULL);
+    }
+    for (size_t i = 0; i < ARR_SIZE(PARSE_ERROR_TESTS); i++) {
+        run_precise_corpus_test(PARSE_ERROR_TESTS[i].equ,
+                                PARSE_ERROR_TESTS[i].with_vars ? &vars
+                                                               : NULL);
+    }
+    free_varset(&vars);
 }
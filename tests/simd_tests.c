@@ -0,0 +1,152 @@
+#include "../libs/mlogging.h"
+#include "../src/mcalc4/mcalc4_simd.h"
+#include "../src/mcalc4/mcalc4_types.h"
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_SAMPLES 100000
+#define ARR_SIZE(arr) ((sizeof(arr)) / (sizeof(arr[0])))
+
+static double inputs[NUM_SAMPLES];
+static double exponents[NUM_SAMPLES];
+static double outputs[NUM_SAMPLES];
+
+/**
+ * Distance between `a` and `b` in units in the last place. NaNs are only equal
+ * to other NaNs.
+ */
+static int64_t ulps_between(double a, double b) {
+    if (isnan(a) || isnan(b)) return (isnan(a) && isnan(b)) ? 0 : INT64_MAX;
+    int64_t ia, ib;
+    memcpy(&ia, &a, sizeof(double));
+    memcpy(&ib, &b, sizeof(double));
+    if (ia < 0) ia = INT64_MIN - ia;
+    if (ib < 0) ib = INT64_MIN - ib;
+    return (ia > ib) ? (ia - ib) : (ib - ia);
+}
+
+static double random_between(double low, double high) {
+    return low + ((high - low) * (rand() / (double)RAND_MAX));
+}
+
+static void fill_inputs(double low, double high, bool log_scale) {
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        inputs[i] = log_scale ? exp(random_between(log(low), log(high)))
+                              : random_between(low, high);
+    }
+}
+
+static void check_func(enum SimdIsa isa, enum FuncType func_type,
+                       double (*libm_fn)(double), const char* name,
+                       int64_t max_ulps) {
+    simd_apply_func(func_type, inputs, outputs, NUM_SAMPLES, 1);
+    int64_t worst = 0;
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        const int64_t ulps = ulps_between(outputs[i], libm_fn(inputs[i]));
+        if (ulps > worst) worst = ulps;
+    }
+    char tag[100];
+    snprintf(tag, sizeof(tag), "%s %s <= %ld ULP", simd_isa_to_str(isa), name,
+             (long)max_ulps);
+    if (!MLOG.test(tag, worst <= max_ulps)) {
+        MLOG.logf("Worst error: %ld ULP", (long)worst);
+    }
+}
+
+static void check_pow(enum SimdIsa isa, const char* name, int64_t max_ulps) {
+    simd_apply_op('^', inputs, exponents, outputs, NUM_SAMPLES);
+    int64_t worst = 0;
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        const int64_t ulps =
+            ulps_between(outputs[i], pow(inputs[i], exponents[i]));
+        if (ulps > worst) worst = ulps;
+    }
+    char tag[100];
+    snprintf(tag, sizeof(tag), "%s pow %s <= %ld ULP", simd_isa_to_str(isa),
+             name, (long)max_ulps);
+    if (!MLOG.test(tag, worst <= max_ulps)) {
+        MLOG.logf("Worst error: %ld ULP", (long)worst);
+    }
+}
+
+static void check_special_values(enum SimdIsa isa) {
+    const double specials[] = {0.0,      -0.0,      1.0,      -1.0,
+                               INFINITY, -INFINITY, NAN,      1e-310,
+                               -1e-310,  1e300,     -1e300,   DBL_MAX,
+                               2.0,      -2.0,      0.5,      1e6};
+    const int num_specials = ARR_SIZE(specials);
+    const struct {
+        enum FuncType type;
+        double (*fn)(double);
+    } funcs[] = {{FN_SIN, sin},   {FN_COS, cos},      {FN_TAN, tan},
+                 {FN_ASIN, asin}, {FN_ACOS, acos},    {FN_ATAN, atan},
+                 {FN_LOG_E, log}, {FN_LOG_10, log10}, {FN_SQRT, sqrt}};
+    bool passed = true;
+    for (size_t f = 0; f < ARR_SIZE(funcs); f++) {
+        simd_apply_func(funcs[f].type, specials, outputs, num_specials, 1);
+        for (int i = 0; i < num_specials; i++) {
+            passed = passed &&
+                     (ulps_between(outputs[i], funcs[f].fn(specials[i])) <= 2);
+        }
+    }
+    double xs[ARR_SIZE(specials) * ARR_SIZE(specials)];
+    double ys[ARR_SIZE(specials) * ARR_SIZE(specials)];
+    int len = 0;
+    for (int i = 0; i < num_specials; i++) {
+        for (int j = 0; j < num_specials; j++) {
+            xs[len] = specials[i];
+            ys[len] = specials[j];
+            len++;
+        }
+    }
+    simd_apply_op('^', xs, ys, outputs, len);
+    for (int i = 0; i < len; i++) {
+        passed = passed && (ulps_between(outputs[i], pow(xs[i], ys[i])) <= 2);
+    }
+    char tag[100];
+    snprintf(tag, sizeof(tag), "%s special values", simd_isa_to_str(isa));
+    MLOG.test(tag, passed);
+}
+
+static void test_simd_isa(enum SimdIsa isa) {
+    srand(4);
+    fill_inputs(-1e5, 1e5, false);
+    check_func(isa, FN_SIN, sin, "sin", 1);
+    check_func(isa, FN_COS, cos, "cos", 1);
+    check_func(isa, FN_TAN, tan, "tan", 3);
+    fill_inputs(-1, 1, false);
+    check_func(isa, FN_ASIN, asin, "asin", 2);
+    check_func(isa, FN_ACOS, acos, "acos", 2);
+    fill_inputs(-100, 100, false);
+    check_func(isa, FN_ATAN, atan, "atan", 1);
+    fill_inputs(1e-300, 1e300, true);
+    check_func(isa, FN_LOG_E, log, "log", 1);
+    check_func(isa, FN_LOG_10, log10, "log10", 2);
+    check_func(isa, FN_SQRT, sqrt, "sqrt", 0);
+    fill_inputs(0.5, 2, false);
+    check_func(isa, FN_LOG_E, log, "log near 1", 1);
+    fill_inputs(1e-10, 1e10, true);
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        exponents[i] = random_between(-30, 30);
+    }
+    check_pow(isa, "general", 1);
+    fill_inputs(-1e100, 1e100, false);
+    for (int i = 0; i < NUM_SAMPLES; i++) {
+        exponents[i] = (rand() % 5) - 2;
+    }
+    check_pow(isa, "small integer exponents", 1);
+    check_special_values(isa);
+}
+
+void test_simd(void) {
+    MLOG.log("SIMD Test Suite");
+    const enum SimdIsa best = simd_detect_isa();
+    for (int isa = SIMD_ISA_SCALAR; isa <= (int)best; isa++) {
+        simd_set_isa(isa);
+        test_simd_isa(isa);
+    }
+    simd_set_isa(best);
+}
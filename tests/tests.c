@@ -3,4 +3,22 @@
 int main(void) {
     test_tokenization();
     test_parsing();
+    test_numbers();
+    test_format();
+    test_compiling();
+    test_batch();
+    test_many();
+    test_cache();
+    test_formulas();
+    test_variables();
+    test_stats();
+    test_jit();
+    test_bytecode();
+    test_table();
+    test_integrate();
+    test_solve();
+    test_diff();
+    test_precise();
+    test_cli();
+    test_simd();
 }
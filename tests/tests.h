@@ -3,5 +3,23 @@
 
 extern void test_tokenization(void);
 extern void test_parsing(void);
+extern void test_numbers(void);
+extern void test_format(void);
+extern void test_compiling(void);
+extern void test_batch(void);
+extern void test_many(void);
+extern void test_cache(void);
+extern void test_formulas(void);
+extern void test_variables(void);
+extern void test_stats(void);
+extern void test_jit(void);
+extern void test_bytecode(void);
+extern void test_table(void);
+extern void test_integrate(void);
+extern void test_solve(void);
+extern void test_diff(void);
+extern void test_precise(void);
+extern void test_cli(void);
+extern void test_simd(void);
 
 #endif